@@ -0,0 +1,211 @@
+/*	File: bench.c
+ *
+ * 	Purpose:	Benchmark suite for the histogram equalization kernels.  Times the
+ *				histogram, the LUT apply and the full pipeline (histogram, cumulative
+ *				sum, mapping, apply) on synthetic images, and checks every output
+ *				against a plain scalar reference by checksum.
+ *
+ *	Compile:	gcc -O2 -Wall -o bench bench.c
+ *	Run:		./bench [--sizes 256,1024,4096,8192] [--kernels histogram,lut,pipeline]
+ *					[--format text|csv|json] [--trials N] [--warmup N]
+ *
+ *	Notes:
+ *		1.	Sizes are image edges: 1024 means a 1024x1024 image.  Any edge from
+ *			256 to 32768 is accepted; 32768 needs about 2 GiB of memory.
+ *		2.	The kernel variant comes from dispatch.h (KERNEL_ISA=sse2|avx2|avx512).
+ *		3.	Harness settings are described in bench.h.
+ *
+ *	Author: Evelyn Evans
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kernels.h"
+#include "bench.h"
+
+#define MAX_SIZES 16
+
+const int nof_gray_shades = 256;
+
+struct image_case {
+	const unsigned char * in;
+	unsigned char * out;
+	long n;
+	int histogram[KERNELS_GRAY_SHADES];
+	unsigned char lut[KERNELS_GRAY_SHADES];
+};
+
+void make_synthetic_image(unsigned char * image, int edge, unsigned seed);
+void reference_histogram(const unsigned char * in, long n, int * histogram);
+void reference_apply(const unsigned char * in, unsigned char * out, long n, const unsigned char * lut);
+void build_lut(const int * histogram, long n, unsigned char * lut);
+void time_histogram(void * arg);
+void time_lut(void * arg);
+void time_pipeline(void * arg);
+int parse_sizes(const char * list, int * sizes);
+
+int main(int argc, char *argv[])
+{
+	struct bench_config config = Bench_default_config();
+	struct bench_report report;
+	int sizes[MAX_SIZES] = {256, 1024, 4096, 8192}, nof_sizes = 4;
+	const char * kernels = "histogram,lut,pipeline";
+	int failures = 0;
+
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "--sizes") == 0 && a + 1 < argc) {
+			nof_sizes = parse_sizes(argv[++a], sizes);
+		} else if (strcmp(argv[a], "--kernels") == 0 && a + 1 < argc) {
+			kernels = argv[++a];
+		} else if (strcmp(argv[a], "--format") == 0 && a + 1 < argc) {
+			config.format = Bench_parse_format(argv[++a]);
+		} else if (strcmp(argv[a], "--trials") == 0 && a + 1 < argc) {
+			config.trials = atoi(argv[++a]);
+		} else if (strcmp(argv[a], "--warmup") == 0 && a + 1 < argc) {
+			config.warmup = atoi(argv[++a]);
+		} else {
+			fprintf(stderr, "usage: %s [--sizes 256,1024,...] [--kernels histogram,lut,pipeline] "
+					"[--format text|csv|json] [--trials N] [--warmup N]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nof_sizes <= 0 || config.trials < 1 || config.trials > BENCH_MAX_TRIALS) {
+		fprintf(stderr, "bench: sizes must be edges from 256 to 32768, trials from 1 to %d\n", BENCH_MAX_TRIALS);
+		return 1;
+	}
+
+	if (config.format == BENCH_TEXT)
+		printf("kernel variant: %s\n", Isa_names[Isa_selected()]);
+	Bench_begin(&report, stdout, config.format);
+
+	for (int s = 0; s < nof_sizes; s++) {
+		long n = (long)sizes[s] * sizes[s];
+		struct image_case c;
+		struct bench_stats stats;
+		unsigned char * image = malloc(n), * out = malloc(n), * expect = malloc(n);
+		int expect_histogram[KERNELS_GRAY_SHADES];
+		char params[64];
+		int ok;
+
+		if (image == NULL || out == NULL || expect == NULL) {
+			fprintf(stderr, "bench: not enough memory for %dx%d\n", sizes[s], sizes[s]);
+			return 1;
+		}
+		snprintf(params, sizeof(params), "%dx%d/%s", sizes[s], sizes[s], Isa_names[Isa_selected()]);
+		make_synthetic_image(image, sizes[s], 12345u + s);
+
+		/* reference results */
+		memset(expect_histogram, 0, sizeof(expect_histogram));
+		reference_histogram(image, n, expect_histogram);
+		c.in = image;
+		c.out = out;
+		c.n = n;
+		build_lut(expect_histogram, n, c.lut);
+
+		if (strstr(kernels, "histogram") != NULL) {
+			Bench_run(time_histogram, &c, &config, &stats);
+			time_histogram(&c);
+			ok = memcmp(c.histogram, expect_histogram, sizeof(expect_histogram)) == 0;
+			Bench_record(&report, "histogram", params, n, &stats, Bench_checksum(c.histogram, sizeof(c.histogram)), ok);
+			failures += !ok;
+		}
+
+		if (strstr(kernels, "lut") != NULL) {
+			reference_apply(image, expect, n, c.lut);
+			Bench_run(time_lut, &c, &config, &stats);
+			memset(out, 0, n);
+			time_lut(&c);
+			ok = memcmp(out, expect, n) == 0;
+			Bench_record(&report, "lut", params, n, &stats, Bench_checksum(out, n), ok);
+			failures += !ok;
+		}
+
+		if (strstr(kernels, "pipeline") != NULL) {
+			reference_apply(image, expect, n, c.lut);	/* c.lut was built from the reference histogram */
+			Bench_run(time_pipeline, &c, &config, &stats);
+			memset(out, 0, n);
+			time_pipeline(&c);
+			ok = memcmp(out, expect, n) == 0;
+			Bench_record(&report, "pipeline", params, n, &stats, Bench_checksum(out, n), ok);
+			failures += !ok;
+		}
+
+		free(image);
+		free(out);
+		free(expect);
+	}
+
+	Bench_end(&report);
+	return failures != 0;
+}
+
+/* A low-contrast test card: diagonal gradient squeezed into 64..191 plus noise */
+void make_synthetic_image(unsigned char * image, int edge, unsigned seed) {
+	for (long y = 0; y < edge; y++) {
+		for (long x = 0; x < edge; x++) {
+			seed = seed * 1103515245u + 12345u;
+			image[y * edge + x] = 64 + (((x + y) * 127 / (2 * edge - 1) + (seed >> 28)) & 127);
+		}
+	}
+}
+
+void reference_histogram(const unsigned char * in, long n, int * histogram) {
+	for (long i = 0; i < n; i++) {
+		histogram[in[i]]++;
+	}
+}
+
+void reference_apply(const unsigned char * in, unsigned char * out, long n, const unsigned char * lut) {
+	for (long i = 0; i < n; i++) {
+		out[i] = lut[in[i]];
+	}
+}
+
+/* The mapping par-3.c uses: cumulative histogram scaled to 256 levels */
+void build_lut(const int * histogram, long n, unsigned char * lut) {
+	float Dm = nof_gray_shades, area = n;
+	long sum = 0;
+
+	for (int k = 0; k < nof_gray_shades; k++) {
+		sum += histogram[k];
+		lut[k] = (unsigned char)((Dm/area) * sum);
+	}
+}
+
+void time_histogram(void * arg) {
+	struct image_case * c = arg;
+
+	memset(c->histogram, 0, sizeof(c->histogram));
+	Kernel_histogram(c->in, c->n, c->histogram);
+}
+
+void time_lut(void * arg) {
+	struct image_case * c = arg;
+
+	Kernel_apply_lut(c->in, c->out, c->n, c->lut);
+}
+
+void time_pipeline(void * arg) {
+	struct image_case * c = arg;
+	unsigned char lut[KERNELS_GRAY_SHADES];
+
+	memset(c->histogram, 0, sizeof(c->histogram));
+	Kernel_histogram(c->in, c->n, c->histogram);
+	build_lut(c->histogram, c->n, lut);
+	Kernel_apply_lut(c->in, c->out, c->n, lut);
+}
+
+/* Parse "256,1024,..." into sizes[], returning the count or -1 */
+int parse_sizes(const char * list, int * sizes) {
+	int n = 0;
+	char * end;
+
+	while (*list != '\0' && n < MAX_SIZES) {
+		long edge = strtol(list, &end, 10);
+		if (end == list || edge < 256 || edge > 32768)
+			return -1;
+		sizes[n++] = (int)edge;
+		list = (*end == ',') ? end + 1 : end;
+	}
+	return n;
+}
@@ -0,0 +1,268 @@
+/* File:     bench.h
+ *
+ * Purpose:  A small benchmark harness: run a kernel a few times to warm
+ *           up, then time repeated trials and report min / median / p95,
+ *           with an optional output checksum, as text, CSV or JSON.
+ *
+ *           Kernels that finish in microseconds are repeated inside each
+ *           trial so that a trial lasts at least BENCH_MIN_TRIAL seconds;
+ *           the reported times are always per call.
+ *
+ * Note:     The defaults can be changed from the environment:
+ *              BENCH_WARMUP   warmup calls (default 3)
+ *              BENCH_TRIALS   timed trials (default 15)
+ *              BENCH_FORMAT   text, csv or json (default text)
+ *           The MPI helper Bench_run_mpi is only available when mpi.h is
+ *           included before this file.
+ *
+ * Example:
+ *    struct bench_config config = Bench_default_config();
+ *    struct bench_stats stats;
+ *    struct bench_report report;
+ *    . . .
+ *    Bench_run(kernel, &args, &config, &stats);
+ *    Bench_begin(&report, stdout, config.format);
+ *    Bench_record(&report, "histogram", "512x512", 512*512, &stats, checksum, 1);
+ *    Bench_end(&report);
+ */
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MIN_TRIAL 1e-3	/* seconds */
+#define BENCH_MAX_TRIALS 1000
+
+enum bench_format { BENCH_TEXT, BENCH_CSV, BENCH_JSON };
+
+struct bench_config {
+	int warmup;
+	int trials;
+	enum bench_format format;
+};
+
+struct bench_stats {
+	int trials;			/* timed trials */
+	long reps;			/* calls per trial */
+	double min, median, p95, mean, max;	/* seconds per call */
+};
+
+struct bench_report {
+	FILE * out;
+	enum bench_format format;
+	int records;
+};
+
+typedef void (*bench_kernel)(void * arg);
+
+/* Monotonic wall clock in seconds */
+static inline double Bench_now(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static inline enum bench_format Bench_parse_format(const char * name) {
+	if (name != NULL && strcmp(name, "csv") == 0)
+		return BENCH_CSV;
+	if (name != NULL && strcmp(name, "json") == 0)
+		return BENCH_JSON;
+	return BENCH_TEXT;
+}
+
+/* Harness settings from BENCH_WARMUP, BENCH_TRIALS and BENCH_FORMAT */
+static inline struct bench_config Bench_default_config(void) {
+	struct bench_config config = {3, 15, BENCH_TEXT};
+	const char * value;
+
+	if ((value = getenv("BENCH_WARMUP")) != NULL)
+		config.warmup = atoi(value);
+	if ((value = getenv("BENCH_TRIALS")) != NULL)
+		config.trials = atoi(value);
+	config.format = Bench_parse_format(getenv("BENCH_FORMAT"));
+
+	if (config.warmup < 0)
+		config.warmup = 0;
+	if (config.trials < 1)
+		config.trials = 1;
+	if (config.trials > BENCH_MAX_TRIALS)
+		config.trials = BENCH_MAX_TRIALS;
+	return config;
+}
+
+static inline int Bench_compare_double(const void * a, const void * b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/*------------------------------------------------------------------
+ * Function:	Bench_summarize
+ * Purpose:		Compute min, median, p95, mean and max of n samples
+ * 				(seconds per call).  The samples are sorted in place.
+ */
+static inline void Bench_summarize(double * samples, int n, long reps, struct bench_stats * stats) {
+	double sum = 0;
+
+	qsort(samples, n, sizeof(double), Bench_compare_double);
+	for (int i = 0; i < n; i++)
+		sum += samples[i];
+
+	stats->trials = n;
+	stats->reps = reps;
+	stats->min = samples[0];
+	stats->max = samples[n-1];
+	stats->mean = sum / n;
+	stats->median = (n % 2) ? samples[n/2] : 0.5 * (samples[n/2 - 1] + samples[n/2]);
+	stats->p95 = samples[(int)(0.95 * (n - 1) + 0.5)];
+}
+
+/* Calls per trial so that a trial lasts at least BENCH_MIN_TRIAL */
+static inline long Bench_calibrate(bench_kernel kernel, void * arg) {
+	long reps = 1;
+	double elapsed;
+
+	for (;;) {
+		double start = Bench_now();
+		for (long r = 0; r < reps; r++)
+			kernel(arg);
+		elapsed = Bench_now() - start;
+		if (elapsed >= BENCH_MIN_TRIAL || reps >= (1L << 30))
+			return reps;
+		reps = (elapsed <= 0) ? reps * 16 : (long)(reps * 1.2 * BENCH_MIN_TRIAL / elapsed) + 1;
+	}
+}
+
+/*------------------------------------------------------------------
+ * Function:	Bench_run
+ * Purpose:		Warm up, calibrate and time a kernel
+ * Input args:	kernel, arg:	the code to time, called as kernel(arg)
+ * 				config:			warmup and trial counts
+ * Output args:	stats:			per-call timings
+ */
+static inline void Bench_run(bench_kernel kernel, void * arg, const struct bench_config * config,
+		struct bench_stats * stats) {
+	double samples[BENCH_MAX_TRIALS];
+	long reps;
+
+	for (int w = 0; w < config->warmup; w++)
+		kernel(arg);
+	reps = Bench_calibrate(kernel, arg);
+
+	for (int t = 0; t < config->trials; t++) {
+		double start = Bench_now();
+		for (long r = 0; r < reps; r++)
+			kernel(arg);
+		samples[t] = (Bench_now() - start) / reps;
+	}
+	Bench_summarize(samples, config->trials, reps, stats);
+}
+
+#ifdef MPI_VERSION
+/*------------------------------------------------------------------
+ * Function:	Bench_run_mpi
+ * Purpose:		Time a kernel that every rank of comm runs together.
+ * 				Each trial starts at a barrier and its time is the
+ * 				slowest rank's, as with the MPI_MAX reduction the
+ * 				programs used before.
+ * Output args:	stats:	valid on rank 0 of comm only
+ * Note:		Collective over comm.  No calibration: one call per
+ * 				trial, since a call already includes communication.
+ */
+static inline void Bench_run_mpi(bench_kernel kernel, void * arg, const struct bench_config * config,
+		MPI_Comm comm, struct bench_stats * stats) {
+	double samples[BENCH_MAX_TRIALS], local, slowest;
+	int my_rank;
+
+	MPI_Comm_rank(comm, &my_rank);
+	for (int w = 0; w < config->warmup; w++)
+		kernel(arg);
+
+	for (int t = 0; t < config->trials; t++) {
+		double start;
+
+		MPI_Barrier(comm);
+		start = MPI_Wtime();
+		kernel(arg);
+		local = MPI_Wtime() - start;
+		MPI_Reduce(&local, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+		samples[t] = slowest;
+	}
+	if (my_rank == 0)
+		Bench_summarize(samples, config->trials, 1, stats);
+}
+#endif
+
+/* FNV-1a hash of a buffer, used to compare kernel output with a reference */
+static inline uint64_t Bench_checksum(const void * data, size_t n) {
+	const unsigned char * p = data;
+	uint64_t h = 1469598103934665603ULL;
+
+	for (size_t i = 0; i < n; i++) {
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/*---------------------------------------------------------------- reports */
+
+static inline void Bench_begin(struct bench_report * report, FILE * out, enum bench_format format) {
+	report->out = out;
+	report->format = format;
+	report->records = 0;
+
+	if (format == BENCH_CSV)
+		fprintf(out, "kernel,params,items,trials,reps,min_s,median_s,p95_s,mean_s,max_s,items_per_s,checksum,check\n");
+	else if (format == BENCH_JSON)
+		fprintf(out, "[");
+	else
+		fprintf(out, "%-12s %-16s %6s %12s %12s %12s %14s  %s\n",
+				"kernel", "params", "trials", "min", "median", "p95", "items/s", "check");
+}
+
+/*------------------------------------------------------------------
+ * Function:	Bench_record
+ * Purpose:		Print one result row
+ * Input args:	kernel:		kernel name
+ * 				params:		free-form parameters (size, variant, ...)
+ * 				items:		work items per call (pixels, terms)
+ * 				checksum:	output checksum
+ * 				check:		1 = matches the reference, 0 = mismatch,
+ * 							-1 = not checked
+ */
+static inline void Bench_record(struct bench_report * report, const char * kernel, const char * params,
+		double items, const struct bench_stats * stats, uint64_t checksum, int check) {
+	const char * verdict = check > 0 ? "ok" : (check == 0 ? "MISMATCH" : "unchecked");
+	double rate = stats->median > 0 ? items / stats->median : 0;
+
+	if (report->format == BENCH_CSV) {
+		fprintf(report->out, "%s,%s,%.0f,%d,%ld,%.9e,%.9e,%.9e,%.9e,%.9e,%.6e,%016llx,%s\n",
+				kernel, params, items, stats->trials, stats->reps, stats->min, stats->median,
+				stats->p95, stats->mean, stats->max, rate, (unsigned long long)checksum, verdict);
+	} else if (report->format == BENCH_JSON) {
+		fprintf(report->out, "%s\n  {\"kernel\": \"%s\", \"params\": \"%s\", \"items\": %.0f, \"trials\": %d, "
+				"\"reps\": %ld, \"min_s\": %.9e, \"median_s\": %.9e, \"p95_s\": %.9e, \"mean_s\": %.9e, "
+				"\"max_s\": %.9e, \"items_per_s\": %.6e, \"checksum\": \"%016llx\", \"check\": \"%s\"}",
+				report->records ? "," : "", kernel, params, items, stats->trials, stats->reps,
+				stats->min, stats->median, stats->p95, stats->mean, stats->max, rate,
+				(unsigned long long)checksum, verdict);
+	} else {
+		fprintf(report->out, "%-12s %-16s %6d %12.3e %12.3e %12.3e %14.4e  %s\n",
+				kernel, params, stats->trials, stats->min, stats->median, stats->p95, rate, verdict);
+	}
+	report->records++;
+	fflush(report->out);
+}
+
+static inline void Bench_end(struct bench_report * report) {
+	if (report->format == BENCH_JSON)
+		fprintf(report->out, "\n]\n");
+	fflush(report->out);
+}
+
+#endif
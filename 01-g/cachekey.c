@@ -0,0 +1,90 @@
+/*	File: cachekey.c
+ *
+ * 	Purpose:	Check the cache key of lutcache.h: the XXH64 of the reference test
+ *				vectors, and the key and histogram Lutcache_read gives an image at
+ *				several band heights against the known XXH64 of its top-down gray pixels.
+ *				The key must not depend on IMAGE_BAND_ROWS, which the tuner changes.
+ *
+ *	Compile:	gcc -O2 -Wall -o cachekey cachekey.c
+ *	Run:		./cachekey [<image> <xxh64 of its top-down 8-bit gray pixels, in hex>]
+ *
+ *	Notes:
+ *		1.	Without arguments the image is images/lena512.bmp (bottom-up), whose
+ *			gray pixels hash to c2071d38b33c10ef.  For another image, write its
+ *			gray pixels top-down to a raw file and take `xxhsum -H64` of that.
+ *		2.	The band heights are 16, 64, 100 (not a divisor of the height), 256
+ *			and the whole image.  The exit status is 1 if any check fails.
+ *
+ *	Author: Evelyn Evans
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image_io.h"
+#include "kernels.h"
+#include "lutcache.h"
+
+#define NOF_BAND_ROWS 5
+
+static const int Band_rows_list[NOF_BAND_ROWS] = {16, 64, 100, 256, 0};	/* 0: the image's height */
+
+uint64_t xxh64_of(const char * text);
+
+int main(int argc, char *argv[])
+{
+	const char * path = "images/lena512.bmp";
+	uint64_t expected = 0xc2071d38b33c10efULL, key;
+	int reference[KERNELS_GRAY_SHADES], histogram[KERNELS_GRAY_SHADES], failed = 0;
+	unsigned char * gray;
+	struct image image;
+
+	if (argc == 3) {
+		path = argv[1];
+		expected = strtoull(argv[2], NULL, 16);
+	} else if (argc != 1) {
+		fprintf(stderr, "usage: %s [<image> <xxh64 of its gray pixels, in hex>]\n", argv[0]);
+		return 1;
+	}
+
+	/* The reference XXH64 (seed 0) of the test vectors */
+	if (xxh64_of("") != 0xef46db3751d8e999ULL || xxh64_of("abc") != 0x44bc2cf5ad770999ULL
+			|| xxh64_of("Nobody inspects the spammish repetition") != 0xfbcea83c8a378bf1ULL) {
+		printf("xxh64: FAILED on the test vectors\n");
+		failed = 1;
+	}
+
+	if (Image_open(path, &image, IMAGE_MAP) != 0)
+		return 1;
+	gray = malloc((size_t)image.width * image.height);
+	if (Image_read_gray8(&image, gray) != 0)
+		return 1;
+	memset(reference, 0, sizeof(reference));
+	Kernel_histogram(gray, (long)image.width * image.height, reference);
+
+	for (int b = 0; b < NOF_BAND_ROWS; b++) {
+		Image_rows_per_band = Band_rows_list[b] > 0 ? Band_rows_list[b] : image.height;
+		memset(histogram, 0, sizeof(histogram));
+		memset(gray, 0, (size_t)image.width * image.height);
+		if (Lutcache_read(&image, gray, histogram, &key) != 0)
+			return 1;
+		printf("%s, bands of %4d rows: key %016llx %s\n", path, Image_rows_per_band, (unsigned long long)key,
+				key == expected && memcmp(histogram, reference, sizeof(histogram)) == 0 ? "ok" : "FAILED");
+		failed |= key != expected || memcmp(histogram, reference, sizeof(histogram)) != 0;
+	}
+
+	Image_close(&image);
+	free(gray);
+	return failed;
+}
+
+// the XXH64 of text, added in two uneven parts to go through the partial stripe
+uint64_t xxh64_of(const char * text) {
+	struct xxh64_state state;
+	int histogram[KERNELS_GRAY_SHADES] = {0};
+	long n = strlen(text);
+
+	Xxh64_init(&state);
+	Xxh64_update_histogram(&state, (const unsigned char *)text, n / 3, histogram);
+	Xxh64_update_histogram(&state, (const unsigned char *)text + n / 3, n - n / 3, histogram);
+	return Xxh64_digest(&state);
+}
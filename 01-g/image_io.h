@@ -0,0 +1,563 @@
+/* File:     image_io.h
+ *
+ * Purpose:  Read and write the images used by the equalizers through one
+ *           interface, whatever the file format:
+ *
+ *              BMP       8-bit indexed or 24-bit, bottom-up or top-down
+ *              PGM/PPM   binary P5/P6, 8- or 16-bit (maxval up to 65535)
+ *              raw       headerless, dimensions given in the name:
+ *                        raw:<width>x<height>[x<channels>[x<bits>]][p]:<path>
+ *                        (16-bit samples are little-endian; a trailing
+ *                        'p' means the channels are stored as planes)
+ *
+ *           Pixels are reached either as a whole-image view or as bands
+ *           of rows.  Both describe rows top-down with a byte stride that
+ *           is negative for bottom-up BMPs, so neither needs a copy when
+ *           the file is opened with IMAGE_MAP.  In IMAGE_READ mode the
+ *           bands are streamed through one small buffer.  Whole-image reads
+ *           go band by band, $IMAGE_BAND_ROWS rows at a time (default 256;
+ *           the tuner, tune.c, picks it per host).
+ *
+ *           A region of interest (struct image_roi, "<x>,<y>,<width>x<height>"
+ *           on the command line) is reached as a band too, with the first
+ *           pixel of the region as data: Image_roi_view points it into an
+ *           8-bit gray buffer, or straight into the mapped file when the
+ *           stored samples already are 8-bit gray.  The strided kernels of
+ *           kernels.h take such a view as it is.
+ *
+ * Example:
+ *    struct image img;
+ *    struct image_band band;
+ *    . . .
+ *    if (Image_open("images/lena512.bmp", &img, IMAGE_MAP) != 0) . . .
+ *    while (Image_next_band(&img, 64, &band) > 0)
+ *       for (y = 0; y < band.rows; y++)
+ *          row = band.data + y * band.stride;   // image row band.y0 + y
+ *    . . .
+ *    Image_read_gray8(&img, gray);              // whole image, 8-bit gray
+ *    Image_write_gray8("images/out.bmp", &img, gray);
+ *    . . .
+ *    Image_select_roi(argc, argv, "--roi", &img, &roi);    // --roi 64,32,256x128
+ *    Image_roi_view(&img, gray, &roi, &band);              // band.data: pixel (64, 32)
+ *    Image_close(&img);
+ */
+#ifndef _IMAGE_IO_H_
+#define _IMAGE_IO_H_
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define IMAGE_READ	0	/* stream bands through a buffer */
+#define IMAGE_MAP	1	/* mmap the file; views and bands point into it */
+#define IMAGE_BAND_ROWS	256	/* default rows per band of a whole-image read */
+
+enum image_format { IMAGE_BMP, IMAGE_PGM, IMAGE_PPM, IMAGE_RAW };
+
+struct image {
+	enum image_format format;
+	int width, height;
+	int channels;			/* samples per pixel: 1 (gray or indexed) or 3 */
+	int depth;				/* bytes per sample: 1 or 2 */
+	int maxval;				/* largest sample value */
+	int big_endian;			/* 16-bit samples are big-endian (PNM) */
+	int planar;				/* raw only: each channel stored as its own plane */
+	int bottom_up;			/* BMP: last row stored first */
+	int bgr;				/* BMP: 24-bit pixels are blue, green, red */
+	long data_offset;		/* file offset of the first stored row */
+	long row_bytes;			/* bytes per stored row (one plane), padding included */
+	unsigned char * header;	/* the data_offset bytes before the pixels */
+	FILE * file;
+	unsigned char * map;
+	size_t map_size;
+	int next_row;			/* band iterator position, in storage order */
+	unsigned char * band_buf;
+	size_t band_cap;
+};
+
+struct image_band {
+	int y0, rows;					/* covers image rows y0 .. y0+rows-1 */
+	const unsigned char * data;		/* first byte of row y0 */
+	long stride;					/* bytes from row y to row y+1 */
+	long plane_stride;				/* bytes between planes (planar raw), else 0 */
+};
+
+struct image_roi {
+	int x, y;						/* top-left pixel */
+	int width, height;
+};
+
+static inline unsigned Image_le16(const unsigned char * p) {
+	return p[0] | (p[1] << 8);
+}
+
+static inline unsigned Image_le32(const unsigned char * p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+static inline void Image_put_le32(unsigned char * p, unsigned v) {
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+/* Next integer of a PNM header, skipping whitespace and # comments */
+static inline int Image_pnm_int(FILE * f) {
+	int c, value = 0, digits = 0;
+
+	while ((c = getc(f)) != EOF) {
+		if (c == '#') {
+			while ((c = getc(f)) != EOF && c != '\n')
+				;
+		} else if (c < '0' || c > '9') {
+			if (digits)
+				break;
+		} else {
+			value = value * 10 + (c - '0');
+			digits++;
+		}
+	}
+	return digits ? value : -1;
+}
+
+static inline int Image_open_bmp(struct image * img) {
+	unsigned char h[54];
+	int width, height, bits;
+
+	if (fread(h, 1, sizeof(h), img->file) != sizeof(h))
+		return -1;
+	width = (int)Image_le32(&h[18]);
+	height = (int)Image_le32(&h[22]);
+	bits = Image_le16(&h[28]);
+	if (Image_le32(&h[30]) != 0 || (bits != 8 && bits != 24)) {
+		fprintf(stderr, "image: only uncompressed 8- and 24-bit BMPs are supported\n");
+		return -1;
+	}
+	if (width <= 0 || height == 0 || height == INT_MIN)	/* negative: top-down */
+		return -1;
+
+	img->format = IMAGE_BMP;
+	img->width = width;
+	img->height = height < 0 ? -height : height;
+	img->bottom_up = height > 0;
+	img->channels = bits / 8;
+	img->bgr = (bits == 24);
+	img->depth = 1;
+	img->maxval = 255;
+	img->data_offset = Image_le32(&h[10]);
+	img->row_bytes = ((long)img->width * bits + 31) / 32 * 4;
+	return 0;
+}
+
+static inline int Image_open_pnm(struct image * img, int magic) {
+	img->format = (magic == '5') ? IMAGE_PGM : IMAGE_PPM;
+	img->channels = (magic == '5') ? 1 : 3;
+	img->width = Image_pnm_int(img->file);
+	img->height = Image_pnm_int(img->file);
+	img->maxval = Image_pnm_int(img->file);
+	if (img->width <= 0 || img->height <= 0 || img->maxval <= 0 || img->maxval > 65535)
+		return -1;
+
+	img->depth = img->maxval > 255 ? 2 : 1;
+	img->big_endian = 1;
+	img->data_offset = ftell(img->file);	/* one whitespace byte already consumed */
+	img->row_bytes = (long)img->width * img->channels * img->depth;
+	return 0;
+}
+
+/* Parse "raw:<w>x<h>[x<c>[x<bits>]][p]:<path>", returning the path */
+static inline const char * Image_parse_raw(const char * spec, struct image * img) {
+	const char * p = spec + 4;
+	char * end;
+	long field[4] = {0, 0, 1, 8};
+
+	for (int i = 0; i < 4; i++) {
+		field[i] = strtol(p, &end, 10);
+		if (end == p)
+			return NULL;
+		p = end;
+		if (*p != 'x')
+			break;
+		p++;
+	}
+	if (*p == 'p') {
+		img->planar = 1;
+		p++;
+	}
+	if (*p != ':' || field[0] <= 0 || field[1] <= 0 || field[2] <= 0 || (field[3] != 8 && field[3] != 16))
+		return NULL;
+
+	img->format = IMAGE_RAW;
+	img->width = (int)field[0];
+	img->height = (int)field[1];
+	img->channels = (int)field[2];
+	img->depth = (int)field[3] / 8;
+	img->maxval = (1 << field[3]) - 1;
+	img->data_offset = 0;
+	img->row_bytes = (long)img->width * img->depth * (img->planar ? 1 : img->channels);
+	return p + 1;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Image_open
+ * Purpose:		Open an image and read its header.  The format is
+ * 				taken from the file's magic number, or from a raw:
+ * 				prefix on the name.
+ * Input args:	spec:	file name or raw:<w>x<h>...:<path>
+ * 				mode:	IMAGE_READ or IMAGE_MAP
+ * Output args:	img:	the opened image
+ * Return:		0 on success, -1 (with a message) on failure
+ */
+static inline int Image_open(const char * spec, struct image * img, int mode) {
+	const char * path = spec;
+	unsigned char magic[2] = {0, 0};
+	int status = -1;
+
+	memset(img, 0, sizeof(*img));
+	if (strncmp(spec, "raw:", 4) == 0 && (path = Image_parse_raw(spec, img)) == NULL) {
+		fprintf(stderr, "image: bad raw image name '%s'\n", spec);
+		return -1;
+	}
+
+	if ((img->file = fopen(path, "rb")) == NULL) {
+		fprintf(stderr, "image: cannot open %s\n", path);
+		return -1;
+	}
+
+	if (img->format == IMAGE_RAW) {
+		status = 0;
+	} else if (fread(magic, 1, 2, img->file) == 2) {
+		if (magic[0] == 'B' && magic[1] == 'M') {
+			rewind(img->file);
+			status = Image_open_bmp(img);
+		} else if (magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6')) {
+			status = Image_open_pnm(img, magic[1]);
+		}
+	}
+	if (status != 0) {
+		fprintf(stderr, "image: %s is not a supported BMP, PGM or PPM file\n", path);
+		fclose(img->file);
+		return -1;
+	}
+
+	/* keep the header so that the output can be written in the same form */
+	img->header = malloc(img->data_offset > 0 ? img->data_offset : 1);
+	rewind(img->file);
+	if (img->data_offset > 0 && fread(img->header, 1, img->data_offset, img->file) != (size_t)img->data_offset) {
+		fprintf(stderr, "image: %s is truncated\n", path);
+		fclose(img->file);
+		free(img->header);
+		return -1;
+	}
+
+	if (mode == IMAGE_MAP) {
+		struct stat st;
+		size_t need = img->data_offset + (size_t)img->row_bytes * img->height * (img->planar ? img->channels : 1);
+
+		if (fstat(fileno(img->file), &st) == 0 && (size_t)st.st_size >= need) {
+			img->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(img->file), 0);
+			if (img->map == MAP_FAILED)
+				img->map = NULL;	/* fall back to streaming */
+			else
+				img->map_size = st.st_size;
+		}
+	}
+
+	return 0;
+}
+
+static inline void Image_close(struct image * img) {
+	if (img->map != NULL)
+		munmap(img->map, img->map_size);
+	if (img->file != NULL)
+		fclose(img->file);
+	free(img->header);
+	free(img->band_buf);
+	memset(img, 0, sizeof(*img));
+}
+
+/*------------------------------------------------------------------
+ * Function:	Image_view
+ * Purpose:		Describe the whole image as one band that points
+ * 				straight into the mapped file
+ * Output args:	view:	rows 0 .. height-1
+ * Return:		0, or -1 when the image is not mapped
+ */
+static inline int Image_view(const struct image * img, struct image_band * view) {
+	const unsigned char * first;
+
+	if (img->map == NULL)
+		return -1;
+
+	first = img->map + img->data_offset;
+	view->y0 = 0;
+	view->rows = img->height;
+	view->plane_stride = img->planar ? img->row_bytes * img->height : 0;
+	if (img->bottom_up) {
+		view->data = first + (img->height - 1) * img->row_bytes;
+		view->stride = -img->row_bytes;
+	} else {
+		view->data = first;
+		view->stride = img->row_bytes;
+	}
+	return 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Image_next_band
+ * Purpose:		Return the next band of at most max_rows rows, in the
+ * 				order they are stored in the file.  The band points
+ * 				into the map, or into a buffer that is reused by the
+ * 				next call.
+ * Output args:	band:	the rows
+ * Return:		number of rows in the band, 0 at the end, -1 on error
+ */
+static inline int Image_next_band(struct image * img, int max_rows, struct image_band * band) {
+	int first = img->next_row, rows = img->height - img->next_row;
+	int planes = img->planar ? img->channels : 1;
+	const unsigned char * base;
+	long plane_bytes;
+
+	if (rows <= 0)
+		return 0;
+	if (rows > max_rows)
+		rows = max_rows;
+
+	if (img->map != NULL) {
+		base = img->map + img->data_offset + (long)first * img->row_bytes;
+		plane_bytes = img->row_bytes * img->height;
+	} else {
+		size_t need = (size_t)img->row_bytes * rows * planes;
+
+		if (need > img->band_cap) {
+			free(img->band_buf);
+			img->band_buf = malloc(need);
+			img->band_cap = need;
+		}
+		plane_bytes = img->row_bytes * rows;
+		for (int p = 0; p < planes; p++) {
+			long offset = img->data_offset + ((long)p * img->height + first) * img->row_bytes;
+			if (fseek(img->file, offset, SEEK_SET) != 0
+					|| fread(img->band_buf + p * plane_bytes, 1, plane_bytes, img->file) != (size_t)plane_bytes) {
+				fprintf(stderr, "image: short read at row %d\n", first);
+				return -1;
+			}
+		}
+		base = img->band_buf;
+	}
+
+	img->next_row += rows;
+	band->rows = rows;
+	band->plane_stride = img->planar ? plane_bytes : 0;
+	if (img->bottom_up) {
+		band->y0 = img->height - first - rows;
+		band->data = base + (rows - 1) * img->row_bytes;
+		band->stride = -img->row_bytes;
+	} else {
+		band->y0 = first;
+		band->data = base;
+		band->stride = img->row_bytes;
+	}
+	return rows;
+}
+
+/* Restart the band iterator at the first stored row */
+static inline void Image_rewind(struct image * img) {
+	img->next_row = 0;
+}
+
+/* Sample c of pixel x in a row, scaled to 0..255 */
+static inline unsigned Image_sample8(const struct image * img, const struct image_band * band,
+		const unsigned char * row, int x, int c) {
+	const unsigned char * p;
+	unsigned v;
+
+	if (img->planar)
+		p = row + c * band->plane_stride + (long)x * img->depth;
+	else
+		p = row + ((long)x * img->channels + c) * img->depth;
+
+	if (img->depth == 2)
+		v = img->big_endian ? (p[0] << 8 | p[1]) : (p[0] | p[1] << 8);
+	else
+		v = p[0];
+	if (img->maxval != 255)
+		v = (v * 255u + img->maxval / 2) / img->maxval;
+	return v;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Image_band_gray8
+ * Purpose:		Convert a band to tightly packed, top-down 8-bit gray.
+ * 				Colour pixels are reduced to luma (BT.601 weights).
+ * Output args:	out:	band->rows * width bytes
+ */
+static inline void Image_band_gray8(const struct image * img, const struct image_band * band, unsigned char * out) {
+	for (int y = 0; y < band->rows; y++) {
+		const unsigned char * row = band->data + y * band->stride;
+		unsigned char * dst = out + (long)y * img->width;
+
+		if (img->channels == 1 && img->depth == 1 && img->maxval == 255) {
+			memcpy(dst, row, img->width);
+		} else if (img->channels == 1) {
+			for (int x = 0; x < img->width; x++)
+				dst[x] = Image_sample8(img, band, row, x, 0);
+		} else {
+			int r = img->bgr ? 2 : 0, b = img->bgr ? 0 : 2;
+			for (int x = 0; x < img->width; x++)
+				dst[x] = (77 * Image_sample8(img, band, row, x, r) + 150 * Image_sample8(img, band, row, x, 1)
+						+ 29 * Image_sample8(img, band, row, x, b) + 128) >> 8;
+		}
+	}
+}
+
+static int Image_rows_per_band = 0;	/* set by a tuner; 0: ask Image_band_rows */
+
+/* Rows per band of a whole-image read: $IMAGE_BAND_ROWS, else IMAGE_BAND_ROWS */
+static inline int Image_band_rows(void) {
+	const char * value;
+
+	if (Image_rows_per_band == 0)
+		Image_rows_per_band = (value = getenv("IMAGE_BAND_ROWS")) != NULL && atoi(value) > 0 ? atoi(value)
+			: IMAGE_BAND_ROWS;
+	return Image_rows_per_band;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Image_read_gray8
+ * Purpose:		Read the whole image as top-down 8-bit gray
+ * Output args:	gray:	width * height bytes
+ * Return:		0 on success, -1 on a read error
+ */
+static inline int Image_read_gray8(struct image * img, unsigned char * gray) {
+	struct image_band band;
+	int rows;
+
+	Image_rewind(img);
+	while ((rows = Image_next_band(img, Image_band_rows(), &band)) > 0)
+		Image_band_gray8(img, &band, gray + (long)band.y0 * img->width);
+	return rows;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Image_select_roi
+ * Purpose:		Read the region of option (e.g. "--roi <x>,<y>,<width>x<height>")
+ * 				from the command line and check that it lies inside img
+ * Output args:	roi:	the region, or the whole image without the option
+ * Return:		1 if the option was given, 0 if not, -1 if it is malformed
+ */
+static inline int Image_select_roi(int argc, char * argv[], const char * option, const struct image * img,
+		struct image_roi * roi) {
+	char end;
+
+	roi->x = roi->y = 0;
+	roi->width = img->width;
+	roi->height = img->height;
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], option) != 0)
+			continue;
+		if (a + 1 >= argc || sscanf(argv[a + 1], "%d,%d,%dx%d%c", &roi->x, &roi->y, &roi->width, &roi->height,
+					&end) != 4) {
+			fprintf(stderr, "image: %s takes <x>,<y>,<width>x<height>\n", option);
+			return -1;
+		}
+		if (roi->x < 0 || roi->y < 0 || roi->width < 1 || roi->height < 1
+				|| roi->x + (long)roi->width > img->width || roi->y + (long)roi->height > img->height) {
+			fprintf(stderr, "image: %s %s is not inside the %dx%d image\n", option, argv[a + 1], img->width,
+					img->height);
+			return -1;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Image_roi_view
+ * Purpose:		Describe the rows of roi without copying them: inside
+ * 				gray, a top-down 8-bit buffer of the whole image, or,
+ * 				with gray NULL, inside the mapped file
+ * Output args:	view:	roi->height rows from image row roi->y; data is
+ * 						pixel (roi->x, roi->y), each row roi->width bytes
+ * Return:		0, or -1 (and no rows) when gray is NULL and the image
+ * 				is not mapped 8-bit gray
+ */
+static inline int Image_roi_view(const struct image * img, const unsigned char * gray, const struct image_roi * roi,
+		struct image_band * view) {
+	struct image_band whole = {0, 0, gray, img->width, 0};
+
+	if (gray == NULL && (img->channels != 1 || img->depth != 1 || img->maxval != 255 || Image_view(img, &whole) != 0)) {
+		memset(view, 0, sizeof(*view));
+		return -1;
+	}
+	view->y0 = roi->y;
+	view->rows = roi->height;
+	view->data = whole.data + roi->y * whole.stride + roi->x;
+	view->stride = whole.stride;
+	view->plane_stride = 0;
+	return 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Image_write_gray8
+ * Purpose:		Write an 8-bit gray image in the format of `like`.  An
+ * 				8-bit BMP keeps its original header and colour table;
+ * 				other BMPs get a gray palette, PNM becomes P5 and raw
+ * 				stays headerless.
+ * Input args:	path:	output file name
+ * 				like:	image whose format and size to use
+ * 				gray:	top-down pixels, width * height bytes
+ * Return:		0 on success, -1 on failure
+ */
+static inline int Image_write_gray8(const char * path, const struct image * like, const unsigned char * gray) {
+	int width = like->width, height = like->height;
+	static const unsigned char pad[4] = {0, 0, 0, 0};
+	FILE * fo = fopen(path, "wb");
+	long row_bytes = width;
+
+	if (fo == NULL) {
+		fprintf(stderr, "image: cannot create %s\n", path);
+		return -1;
+	}
+
+	if (like->format == IMAGE_BMP) {
+		row_bytes = ((long)width + 3) / 4 * 4;
+		if (like->channels == 1) {
+			fwrite(like->header, 1, like->data_offset, fo);
+		} else {
+			unsigned char h[54 + 1024] = {'B', 'M'};
+			Image_put_le32(&h[2], sizeof(h) + row_bytes * height);
+			Image_put_le32(&h[10], sizeof(h));
+			Image_put_le32(&h[14], 40);
+			Image_put_le32(&h[18], width);
+			Image_put_le32(&h[22], like->bottom_up ? height : -height);
+			h[26] = 1;
+			h[28] = 8;
+			Image_put_le32(&h[34], row_bytes * height);
+			Image_put_le32(&h[38], 2835);
+			Image_put_le32(&h[42], 2835);
+			Image_put_le32(&h[46], 256);
+			for (int i = 0; i < 256; i++)
+				h[54 + 4*i] = h[55 + 4*i] = h[56 + 4*i] = i;
+			fwrite(h, 1, sizeof(h), fo);
+		}
+		for (int s = 0; s < height; s++) {
+			int y = like->bottom_up ? height - 1 - s : s;
+			fwrite(gray + (long)y * width, 1, width, fo);
+			fwrite(pad, 1, row_bytes - width, fo);
+		}
+	} else {
+		if (like->format != IMAGE_RAW)
+			fprintf(fo, "P5\n%d %d\n255\n", width, height);
+		fwrite(gray, 1, (size_t)width * height, fo);
+	}
+
+	if (fclose(fo) != 0) {
+		fprintf(stderr, "image: error writing %s\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,782 @@
+/* File:     instrument.h
+ *
+ * Purpose:  Per-phase timing for the hot paths, in place of timer.h's
+ *           gettimeofday macro.  Code is split into named phases (read,
+ *           histogram, bcast, scatter, compute, gather, write, reduce, or
+ *           any name given to Instr_phase) that may nest; every thread adds
+ *           its calls, inclusive and self (children excluded) time to its
+ *           own totals, with no locks and no system calls on the hot path.
+ *           At the end of the run Instr_report prints the totals, and
+ *           Instr_report_mpi the min / mean / max over the ranks.
+ *
+ *           Time comes from clock_gettime(CLOCK_MONOTONIC_RAW), or from the
+ *           time stamp counter when compiled with -DINSTR_RDTSC (calibrated
+ *           against CLOCK_MONOTONIC_RAW over the run).  With INSTR_COUNTERS=1
+ *           in the environment each thread also counts cycles, instructions
+ *           and last-level cache misses per phase through perf_event_open;
+ *           that costs a read() per scope boundary, so it is off by default.
+ *           -DINSTR_DISABLE compiles every scope to nothing.
+ *
+ *           With INSTR_TRACE=<file.json> every scope boundary is also
+ *           stored in a per-thread ring of INSTR_TRACE_EVENTS events
+ *           (default 65536, allocated and touched up front), and the
+ *           report writes them out as one Chrome trace of the whole job:
+ *           a process per rank, a track per thread, one slice per scope.
+ *           Open it in https://ui.perfetto.dev or chrome://tracing.  A
+ *           full ring overwrites its oldest events.
+ *
+ * Note:     Custom phases must be registered in the same order on every
+ *           rank for the MPI report to line them up.  The MPI report is
+ *           only available when mpi.h is included before this file.
+ *           Times of a phase run by several threads are summed over them.
+ *           Rank clocks are aligned to rank 0's for the trace by timing a
+ *           few message round trips.
+ *
+ * Example:
+ *    #include "instrument.h"
+ *    . . .
+ *    Instr_begin(INSTR_SCATTER);
+ *    MPI_Scatterv(. . .);
+ *    Instr_end(INSTR_SCATTER);
+ *    . . .
+ *    {
+ *       INSTR_SCOPE(INSTR_COMPUTE);    // ends with the enclosing block
+ *       . . .
+ *    }
+ *    . . .
+ *    Instr_report_mpi(stdout, MPI_COMM_WORLD);
+ */
+#ifndef _INSTRUMENT_H_
+#define _INSTRUMENT_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(INSTR_RDTSC) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#define INSTR_MAX_PHASES 32
+#define INSTR_MAX_DEPTH 16
+#define INSTR_MAX_THREADS 256
+#define INSTR_UNSEEN (-2)	/* parent of a phase that has not run yet */
+
+enum instr_phase {
+	INSTR_READ, INSTR_HISTOGRAM, INSTR_BCAST, INSTR_SCATTER, INSTR_COMPUTE,
+	INSTR_GATHER, INSTR_WRITE, INSTR_REDUCE, INSTR_NOF_BUILTIN
+};
+
+enum instr_counter { INSTR_CYCLES, INSTR_INSTRUCTIONS, INSTR_LLC_MISSES, INSTR_NOF_COUNTERS };
+
+struct instr_totals {
+	uint64_t calls;
+	uint64_t ticks, self_ticks;					/* inclusive, children excluded */
+	uint64_t counts[INSTR_NOF_COUNTERS];		/* inclusive */
+};
+
+struct instr_frame {
+	int phase;
+	uint64_t start, child_ticks;
+	uint64_t counts[INSTR_NOF_COUNTERS];
+};
+
+/* One scope boundary in a thread's trace ring */
+struct instr_event {
+	uint64_t ticks;
+	int phase, begin;
+};
+
+/* A finished scope, as written to the trace */
+struct instr_span {
+	double start_ns, length_ns;		/* CLOCK_MONOTONIC_RAW of this process */
+	int phase, thread;
+};
+
+/* Everything one thread writes, on its own cache lines */
+struct instr_thread {
+	struct instr_totals phases[INSTR_MAX_PHASES];
+	struct instr_frame stack[INSTR_MAX_DEPTH];
+	int depth, overflow;
+	int perf_fd;								/* group leader, -1 when not counting */
+	int slot;									/* registration order, the trace's thread id */
+	struct instr_event * events;				/* trace ring, NULL when not tracing */
+	uint64_t nof_events, trace_mask;			/* events ever written, ring size - 1 */
+} __attribute__((aligned(64)));
+
+static struct {
+	const char * names[INSTR_MAX_PHASES];
+	_Atomic int parent[INSTR_MAX_PHASES];		/* enclosing phase, -1 at top level */
+	_Atomic int nof_phases;
+	atomic_flag registering;
+	struct instr_thread * threads[INSTR_MAX_THREADS];
+	_Atomic int nof_threads;
+	int counters;								/* 1 on, 0 off, -1 asked for but unavailable */
+	uint64_t origin_ticks;
+	double origin_ns;
+} Instr = {
+	{"read", "histogram", "bcast", "scatter", "compute", "gather", "write", "reduce"},
+	{[0 ... INSTR_MAX_PHASES-1] = INSTR_UNSEEN},
+	INSTR_NOF_BUILTIN, ATOMIC_FLAG_INIT, {0}, 0, 0, 0, 0
+};
+
+static __thread struct instr_thread * Instr_self;
+
+/*---------------------------------------------------------------- clocks */
+
+static inline double Instr_raw_ns(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/* Monotonic seconds since some point in the past, for GET_TIME-style use */
+static inline double Instr_now(void) {
+	return Instr_raw_ns() / 1e9;
+}
+
+static inline uint64_t Instr_ticks(void) {
+#if defined(INSTR_RDTSC) && (defined(__x86_64__) || defined(__i386__))
+	return __rdtsc();
+#else
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+	return (uint64_t)t.tv_sec * 1000000000u + t.tv_nsec;
+#endif
+}
+
+/* Seconds per tick: 1 ns, or the TSC period measured since the first scope */
+static inline double Instr_tick_seconds(void) {
+#if defined(INSTR_RDTSC) && (defined(__x86_64__) || defined(__i386__))
+	double ns = Instr_raw_ns() - Instr.origin_ns;
+	uint64_t ticks;
+
+	if (ns < 1e7) {		/* too short a run to calibrate on, wait 10 ms */
+		struct timespec pause = {0, 10000000};
+		nanosleep(&pause, NULL);
+		ns = Instr_raw_ns() - Instr.origin_ns;
+	}
+	ticks = __rdtsc() - Instr.origin_ticks;
+	return ticks ? ns / 1e9 / ticks : 1e-9;
+#else
+	return 1e-9;
+#endif
+}
+
+/*---------------------------------------------------------------- counters */
+
+#ifdef __linux__
+static inline int Instr_perf_open(uint64_t config, int group) {
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+/* Open this thread's cycles / instructions / LLC-miss group, if asked for */
+static inline void Instr_open_counters(struct instr_thread * self) {
+	const char * value = getenv("INSTR_COUNTERS");
+
+	self->perf_fd = -1;
+	if (value == NULL || strcmp(value, "0") == 0)
+		return;
+#ifdef __linux__
+	{
+		static const uint64_t configs[INSTR_NOF_COUNTERS] = {
+			PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES
+		};
+		int fds[INSTR_NOF_COUNTERS], opened = 0;
+
+		while (opened < INSTR_NOF_COUNTERS
+				&& (fds[opened] = Instr_perf_open(configs[opened], opened ? fds[0] : -1)) >= 0)
+			opened++;
+		if (opened == INSTR_NOF_COUNTERS) {
+			self->perf_fd = fds[0];
+			Instr.counters = 1;
+			return;
+		}
+		while (opened > 0)		/* the members first, then the leader */
+			close(fds[--opened]);
+	}
+#endif
+	if (Instr.counters == 0)
+		Instr.counters = -1;
+}
+
+static inline void Instr_read_counters(const struct instr_thread * self, uint64_t * counts) {
+	uint64_t values[1 + INSTR_NOF_COUNTERS];
+
+	if (read(self->perf_fd, values, sizeof(values)) == (ssize_t)sizeof(values))
+		memcpy(counts, values + 1, sizeof(uint64_t) * INSTR_NOF_COUNTERS);
+}
+
+/*---------------------------------------------------------------- trace ring */
+
+/* Trace file named by INSTR_TRACE, or NULL */
+static inline const char * Instr_trace_path(void) {
+	const char * path = getenv("INSTR_TRACE");
+	return (path != NULL && *path != '\0') ? path : NULL;
+}
+
+/* Allocate and touch this thread's ring so that recording never faults */
+static inline void Instr_open_trace(struct instr_thread * self) {
+	const char * value = getenv("INSTR_TRACE_EVENTS");
+	uint64_t capacity = 1;
+
+	if (Instr_trace_path() == NULL)
+		return;
+	while (capacity < (value != NULL && atol(value) > 0 ? (uint64_t)atol(value) : 65536))
+		capacity *= 2;
+	self->events = malloc(capacity * sizeof(struct instr_event));
+	if (self->events != NULL) {
+		memset(self->events, 0, capacity * sizeof(struct instr_event));
+		self->trace_mask = capacity - 1;
+	}
+}
+
+static inline void Instr_trace(struct instr_thread * self, int phase, int begin, uint64_t ticks) {
+	struct instr_event * event = &self->events[self->nof_events++ & self->trace_mask];
+
+	event->ticks = ticks;
+	event->phase = phase;
+	event->begin = begin;
+}
+
+/*---------------------------------------------------------------- scopes */
+
+/* This thread's record, created and registered on first use */
+static inline struct instr_thread * Instr_thread(void) {
+	struct instr_thread * self = Instr_self;
+	int slot;
+
+	if (__builtin_expect(self != NULL, 1))
+		return self;
+	self = aligned_alloc(64, sizeof(*self));
+	memset(self, 0, sizeof(*self));
+	slot = atomic_fetch_add(&Instr.nof_threads, 1);
+	if (slot == 0) {
+		Instr.origin_ns = Instr_raw_ns();
+		Instr.origin_ticks = Instr_ticks();
+	}
+	if (slot < INSTR_MAX_THREADS)
+		Instr.threads[slot] = self;
+	self->slot = slot;
+	Instr_open_counters(self);
+	Instr_open_trace(self);
+	return Instr_self = self;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Instr_phase
+ * Purpose:		Id of the phase called name, registering it the first
+ * 				time.  name must outlive the report.
+ * Return:		the id, or -1 when INSTR_MAX_PHASES are in use
+ */
+static inline int Instr_phase(const char * name) {
+	int id;
+
+	while (atomic_flag_test_and_set(&Instr.registering))
+		;
+	for (id = 0; id < Instr.nof_phases; id++) {
+		if (strcmp(Instr.names[id], name) == 0)
+			break;
+	}
+	if (id == Instr.nof_phases) {
+		if (id < INSTR_MAX_PHASES) {
+			Instr.names[id] = name;
+			Instr.nof_phases = id + 1;
+		} else {
+			id = -1;
+		}
+	}
+	atomic_flag_clear(&Instr.registering);
+	return id;
+}
+
+/* Enter phase; scopes must be closed in reverse order */
+static inline void Instr_begin(int phase) {
+#ifndef INSTR_DISABLE
+	struct instr_thread * self = Instr_thread();
+	struct instr_frame * frame;
+	int unseen = INSTR_UNSEEN;
+
+	if (phase < 0 || self->depth == INSTR_MAX_DEPTH) {
+		self->overflow++;
+		return;
+	}
+	frame = &self->stack[self->depth++];
+	frame->phase = phase;
+	frame->child_ticks = 0;
+	atomic_compare_exchange_strong_explicit(&Instr.parent[phase], &unseen,
+			self->depth > 1 ? self->stack[self->depth - 2].phase : -1,
+			memory_order_relaxed, memory_order_relaxed);
+	if (self->perf_fd >= 0)
+		Instr_read_counters(self, frame->counts);
+	frame->start = Instr_ticks();
+	if (self->events != NULL)
+		Instr_trace(self, phase, 1, frame->start);
+#endif
+}
+
+/* Leave the innermost phase (phase is that phase, for readability) */
+static inline void Instr_end(int phase) {
+#ifndef INSTR_DISABLE
+	uint64_t now = Instr_ticks(), elapsed;
+	struct instr_thread * self = Instr_self;
+	struct instr_frame * frame;
+	struct instr_totals * totals;
+
+	(void)phase;
+	if (self == NULL)
+		return;
+	if (self->overflow > 0) {
+		self->overflow--;
+		return;
+	}
+	if (self->depth == 0)
+		return;
+	frame = &self->stack[--self->depth];
+	if (self->events != NULL)
+		Instr_trace(self, frame->phase, 0, now);
+	totals = &self->phases[frame->phase];
+	elapsed = now - frame->start;
+
+	totals->calls++;
+	totals->ticks += elapsed;
+	totals->self_ticks += elapsed - frame->child_ticks;
+	if (self->perf_fd >= 0) {
+		uint64_t counts[INSTR_NOF_COUNTERS];
+		Instr_read_counters(self, counts);
+		for (int c = 0; c < INSTR_NOF_COUNTERS; c++)
+			totals->counts[c] += counts[c] - frame->counts[c];
+	}
+	if (self->depth > 0)
+		self->stack[self->depth - 1].child_ticks += elapsed;
+#endif
+}
+
+static inline int Instr_scope_begin(int phase) {
+	Instr_begin(phase);
+	return phase;
+}
+
+static inline void Instr_scope_end(int * phase) {
+	Instr_end(*phase);
+}
+
+/* A phase that lasts until the end of the enclosing block */
+#define INSTR_CONCAT_(a, b) a##b
+#define INSTR_CONCAT(a, b) INSTR_CONCAT_(a, b)
+#define INSTR_SCOPE(phase) \
+	int INSTR_CONCAT(instr_scope_, __LINE__) __attribute__((cleanup(Instr_scope_end), unused)) = \
+		Instr_scope_begin(phase)
+
+/*---------------------------------------------------------------- reports */
+
+/* Sum of every thread's totals.  Call once the other threads are done. */
+static inline void Instr_collect(struct instr_totals * totals) {
+	int nof_threads = Instr.nof_threads < INSTR_MAX_THREADS ? Instr.nof_threads : INSTR_MAX_THREADS;
+
+	memset(totals, 0, sizeof(struct instr_totals) * INSTR_MAX_PHASES);
+	for (int t = 0; t < nof_threads; t++) {
+		const struct instr_thread * thread = Instr.threads[t];
+		if (thread == NULL)
+			continue;
+		for (int p = 0; p < INSTR_MAX_PHASES; p++) {
+			totals[p].calls += thread->phases[p].calls;
+			totals[p].ticks += thread->phases[p].ticks;
+			totals[p].self_ticks += thread->phases[p].self_ticks;
+			for (int c = 0; c < INSTR_NOF_COUNTERS; c++)
+				totals[p].counts[c] += thread->phases[p].counts[c];
+		}
+	}
+}
+
+/* Nesting depth of a phase, from the parent each phase was first seen in */
+static inline int Instr_depth(int phase) {
+	int depth = 0;
+
+	for (int p = Instr.parent[phase]; p >= 0 && depth < INSTR_MAX_DEPTH; p = Instr.parent[p])
+		depth++;
+	return depth;
+}
+
+/* Phases in tree order: every phase directly after its parent */
+static inline int Instr_order(int * order) {
+	int n = 0, nof_phases = Instr.nof_phases;
+	int stack[INSTR_MAX_PHASES], top = 0;
+
+	for (int p = nof_phases - 1; p >= 0; p--) {
+		if (Instr.parent[p] < 0)
+			stack[top++] = p;
+	}
+	while (top > 0) {
+		int phase = stack[--top];
+		order[n++] = phase;
+		for (int p = nof_phases - 1; p >= 0; p--) {
+			if (Instr.parent[p] == phase && top < INSTR_MAX_PHASES)
+				stack[top++] = p;
+		}
+	}
+	return n;
+}
+
+static inline void Instr_print_name(FILE * out, int phase) {
+	char name[40];
+
+	snprintf(name, sizeof(name), "%*s%s", 2 * Instr_depth(phase), "", Instr.names[phase]);
+	fprintf(out, "%-20s", name);
+}
+
+static inline void Instr_print_counts(FILE * out, const double * counts) {
+	if (Instr.counters > 0)
+		fprintf(out, " %12.4e %12.4e %6.2f %12.4e", counts[INSTR_CYCLES], counts[INSTR_INSTRUCTIONS],
+				counts[INSTR_CYCLES] > 0 ? counts[INSTR_INSTRUCTIONS] / counts[INSTR_CYCLES] : 0.0,
+				counts[INSTR_LLC_MISSES]);
+	fprintf(out, "\n");
+}
+
+static inline void Instr_print_footer(FILE * out) {
+	if (Instr.counters < 0)
+		fprintf(out, "(hardware counters unavailable: perf_event_open failed)\n");
+	fflush(out);
+}
+
+/*---------------------------------------------------------------- traces */
+
+/*------------------------------------------------------------------
+ * Function:	Instr_trace_spans
+ * Purpose:		Pair the begin and end events left in every thread's
+ * 				ring into spans.  Scopes still open are closed now;
+ * 				ends whose begin was overwritten are dropped.
+ * Output args:	count:		number of spans
+ * 				dropped:	events that could not be paired
+ * Return:		the spans (malloc'ed), NULL when there are none
+ */
+static inline struct instr_span * Instr_trace_spans(long * count, long * dropped) {
+	int nof_threads = Instr.nof_threads < INSTR_MAX_THREADS ? Instr.nof_threads : INSTR_MAX_THREADS;
+	double tick_ns = Instr_tick_seconds() * 1e9;
+	uint64_t now = Instr_ticks();
+	struct instr_span * spans;
+	long capacity = 0, n = 0;
+
+	*dropped = 0;
+	for (int t = 0; t < nof_threads; t++) {
+		const struct instr_thread * thread = Instr.threads[t];
+		if (thread != NULL && thread->events != NULL)
+			capacity += thread->nof_events < thread->trace_mask + 1 ? thread->nof_events : thread->trace_mask + 1;
+	}
+	spans = malloc((capacity > 0 ? capacity : 1) * sizeof(struct instr_span));
+
+	for (int t = 0; t < nof_threads; t++) {
+		const struct instr_thread * thread = Instr.threads[t];
+		const struct instr_event * open[INSTR_MAX_DEPTH];
+		uint64_t first;
+		int depth = 0;
+
+		if (thread == NULL || thread->events == NULL)
+			continue;
+		first = thread->nof_events > thread->trace_mask + 1 ? thread->nof_events - thread->trace_mask - 1 : 0;
+		for (uint64_t e = first; e <= thread->nof_events; e++) {
+			const struct instr_event * event = (e < thread->nof_events) ? &thread->events[e & thread->trace_mask] : NULL;
+			uint64_t end;
+
+			if (event != NULL && event->begin) {
+				if (depth < INSTR_MAX_DEPTH)
+					open[depth++] = event;
+				else
+					(*dropped)++;
+				continue;
+			}
+			if (event != NULL && (depth == 0 || open[depth - 1]->phase != event->phase)) {
+				(*dropped)++;
+				continue;
+			}
+			/* an end event, or after the last event every scope still open */
+			for (end = event ? event->ticks : now; depth > 0; ) {
+				const struct instr_event * begin = open[--depth];
+				spans[n].start_ns = Instr.origin_ns + (double)(int64_t)(begin->ticks - Instr.origin_ticks) * tick_ns;
+				spans[n].length_ns = (double)(end - begin->ticks) * tick_ns;
+				spans[n].phase = begin->phase;
+				spans[n].thread = thread->slot;
+				n++;
+				if (event != NULL)
+					break;
+			}
+		}
+	}
+	*count = n;
+	if (n == 0) {
+		free(spans);
+		return NULL;
+	}
+	return spans;
+}
+
+/* Chrome trace events of one process; base_ns is the job's time zero */
+static inline void Instr_trace_events(FILE * out, const struct instr_span * spans, long n, int pid,
+		const char * process, double base_ns, int * first) {
+	int threads[INSTR_MAX_THREADS] = {0};
+
+	fprintf(out, "%s\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"%s\"}}",
+			*first ? "" : ",", pid, process);
+	fprintf(out, ",\n{\"name\": \"process_sort_index\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"sort_index\": %d}}",
+			pid, pid);
+	*first = 0;
+	for (long i = 0; i < n; i++) {
+		int thread = spans[i].thread;
+		if (thread >= 0 && thread < INSTR_MAX_THREADS && !threads[thread]) {
+			threads[thread] = 1;
+			fprintf(out, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+					"\"args\": {\"name\": \"%s %d\"}}", pid, thread, thread ? "thread" : "main", thread);
+		}
+		fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+				spans[i].phase < Instr.nof_phases ? Instr.names[spans[i].phase] : "?", pid, thread,
+				(spans[i].start_ns - base_ns) / 1e3, spans[i].length_ns / 1e3);
+	}
+}
+
+/* Write this process's trace to $INSTR_TRACE */
+static inline void Instr_trace_write(FILE * log) {
+	const char * path = Instr_trace_path();
+	struct instr_span * spans;
+	long n, dropped;
+	int first = 1;
+	FILE * out;
+
+	if (path == NULL)
+		return;
+	spans = Instr_trace_spans(&n, &dropped);
+	if ((out = fopen(path, "w")) == NULL) {
+		perror(path);
+		free(spans);
+		return;
+	}
+	fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+	Instr_trace_events(out, spans, n, 0, "process", n > 0 ? spans[0].start_ns : 0, &first);
+	fprintf(out, "\n]}\n");
+	fclose(out);
+	fprintf(log, "trace: %ld scopes written to %s (%ld events dropped)\n", n, path, dropped);
+	free(spans);
+}
+
+/*------------------------------------------------------------------
+ * Function:	Instr_report
+ * Purpose:		Print calls, inclusive and self seconds (and counters)
+ * 				of every phase that ran in this process
+ */
+static inline void Instr_report(FILE * out) {
+	struct instr_totals totals[INSTR_MAX_PHASES];
+	double tick = Instr_tick_seconds();
+	int order[INSTR_MAX_PHASES], n;
+
+	Instr_collect(totals);
+	n = Instr_order(order);
+	fprintf(out, "\n%-20s %10s %12s %12s", "phase", "calls", "total (s)", "self (s)");
+	if (Instr.counters > 0)
+		fprintf(out, " %12s %12s %6s %12s", "cycles", "instructions", "IPC", "LLC misses");
+	fprintf(out, "\n");
+	for (int i = 0; i < n; i++) {
+		const struct instr_totals * t = &totals[order[i]];
+		double counts[INSTR_NOF_COUNTERS];
+
+		if (t->calls == 0)
+			continue;
+		for (int c = 0; c < INSTR_NOF_COUNTERS; c++)
+			counts[c] = (double)t->counts[c];
+		Instr_print_name(out, order[i]);
+		fprintf(out, " %10llu %12.4e %12.4e", (unsigned long long)t->calls, t->ticks * tick, t->self_ticks * tick);
+		Instr_print_counts(out, counts);
+	}
+	Instr_print_footer(out);
+	Instr_trace_write(out);
+}
+
+#ifdef MPI_VERSION
+/*------------------------------------------------------------------
+ * Function:	Instr_clock_offset
+ * Purpose:		Offset of every rank's CLOCK_MONOTONIC_RAW from rank 0's,
+ * 				from the fastest of a few message round trips
+ * Output args:	offsets:	remote minus rank 0 clock, in ns (rank 0)
+ * Note:		Collective over comm
+ */
+static inline void Instr_clock_offset(MPI_Comm comm, double * offsets) {
+	int my_rank, comm_sz;
+
+	MPI_Comm_rank(comm, &my_rank);
+	MPI_Comm_size(comm, &comm_sz);
+	for (int r = 1; r < comm_sz; r++) {
+		double best = 1e30, remote;
+
+		for (int round = 0; round < 8; round++) {
+			if (my_rank == 0) {
+				double sent = Instr_raw_ns(), received;
+				MPI_Send(&sent, 1, MPI_DOUBLE, r, 0, comm);
+				MPI_Recv(&remote, 1, MPI_DOUBLE, r, 0, comm, MPI_STATUS_IGNORE);
+				received = Instr_raw_ns();
+				if (received - sent < best) {
+					best = received - sent;
+					offsets[r] = remote - (sent + received) / 2;
+				}
+			} else if (my_rank == r) {
+				MPI_Recv(&remote, 1, MPI_DOUBLE, 0, 0, comm, MPI_STATUS_IGNORE);
+				remote = Instr_raw_ns();
+				MPI_Send(&remote, 1, MPI_DOUBLE, 0, 0, comm);
+			}
+		}
+	}
+	if (my_rank == 0)
+		offsets[0] = 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Instr_trace_write_mpi
+ * Purpose:		Gather every rank's spans on rank 0 and write them to
+ * 				$INSTR_TRACE as one trace, with the clocks aligned
+ * Note:		Collective over comm; does nothing without INSTR_TRACE
+ */
+static inline void Instr_trace_write_mpi(FILE * log, MPI_Comm comm) {
+	const char * path = Instr_trace_path();
+	struct instr_span * spans, * all = NULL;
+	double * offsets = NULL, base_ns = 1e300;
+	long n, dropped, total_dropped;
+	int my_rank, comm_sz, bytes, * counts = NULL, * displs = NULL, total = 0, first = 1;
+	char host[64] = "", * hosts = NULL;
+	FILE * out;
+
+	if (path == NULL)
+		return;
+	MPI_Comm_rank(comm, &my_rank);
+	MPI_Comm_size(comm, &comm_sz);
+	spans = Instr_trace_spans(&n, &dropped);
+	bytes = (int)(n * sizeof(struct instr_span));
+	gethostname(host, sizeof(host) - 1);
+	if (my_rank == 0) {
+		offsets = malloc(comm_sz * sizeof(double));
+		counts = malloc(comm_sz * sizeof(int));
+		displs = malloc(comm_sz * sizeof(int));
+		hosts = malloc(comm_sz * sizeof(host));
+	}
+	Instr_clock_offset(comm, offsets);
+	MPI_Gather(host, sizeof(host), MPI_CHAR, hosts, sizeof(host), MPI_CHAR, 0, comm);
+	MPI_Gather(&bytes, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+	MPI_Reduce(&dropped, &total_dropped, 1, MPI_LONG, MPI_SUM, 0, comm);
+	if (my_rank == 0) {
+		for (int r = 0; r < comm_sz; r++) {
+			displs[r] = total;
+			total += counts[r];
+		}
+		all = malloc(total > 0 ? total : 1);
+	}
+	MPI_Gatherv(spans, bytes, MPI_BYTE, all, counts, displs, MPI_BYTE, 0, comm);
+	free(spans);
+	if (my_rank != 0)
+		return;
+
+	/* rank r's spans start at displs[r]; move them onto rank 0's clock */
+	for (int r = 0; r < comm_sz; r++) {
+		struct instr_span * rank_spans = (struct instr_span *)((char *)all + displs[r]);
+		for (long i = 0; i < counts[r] / (long)sizeof(struct instr_span); i++) {
+			rank_spans[i].start_ns -= offsets[r];
+			if (rank_spans[i].start_ns < base_ns)
+				base_ns = rank_spans[i].start_ns;
+		}
+	}
+	if ((out = fopen(path, "w")) != NULL) {
+		fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+		for (int r = 0; r < comm_sz; r++) {
+			char process[96];
+			snprintf(process, sizeof(process), "rank %d (%.64s)", r, hosts + r * sizeof(host));
+			Instr_trace_events(out, (struct instr_span *)((char *)all + displs[r]),
+					counts[r] / (long)sizeof(struct instr_span), r, process, base_ns, &first);
+		}
+		fprintf(out, "\n]}\n");
+		fclose(out);
+		fprintf(log, "trace: %ld scopes from %d ranks written to %s (%ld events dropped)\n",
+				total / (long)sizeof(struct instr_span), comm_sz, path, total_dropped);
+	} else {
+		perror(path);
+	}
+	free(all);
+	free(offsets);
+	free(counts);
+	free(displs);
+	free(hosts);
+}
+
+/*------------------------------------------------------------------
+ * Function:	Instr_report_mpi
+ * Purpose:		Print, on rank 0 of comm, every phase's calls, the min,
+ * 				mean and max over the ranks of its inclusive seconds,
+ * 				the imbalance (max / mean), the mean self seconds and
+ * 				the counters summed over the ranks
+ * Note:		Collective over comm
+ */
+static inline void Instr_report_mpi(FILE * out, MPI_Comm comm) {
+	enum { CALLS, TOTAL, SELF, COUNTS, NOF_FIELDS = COUNTS + INSTR_NOF_COUNTERS };
+	struct instr_totals totals[INSTR_MAX_PHASES];
+	double local[INSTR_MAX_PHASES][NOF_FIELDS], sum[INSTR_MAX_PHASES][NOF_FIELDS];
+	double low[INSTR_MAX_PHASES], high[INSTR_MAX_PHASES], seconds[INSTR_MAX_PHASES];
+	double tick = Instr_tick_seconds();
+	int my_rank, comm_sz, counters, order[INSTR_MAX_PHASES], n;
+
+	MPI_Comm_rank(comm, &my_rank);
+	MPI_Comm_size(comm, &comm_sz);
+	Instr_collect(totals);
+	for (int p = 0; p < INSTR_MAX_PHASES; p++) {
+		local[p][CALLS] = (double)totals[p].calls;
+		local[p][TOTAL] = seconds[p] = totals[p].ticks * tick;
+		local[p][SELF] = totals[p].self_ticks * tick;
+		for (int c = 0; c < INSTR_NOF_COUNTERS; c++)
+			local[p][COUNTS + c] = (double)totals[p].counts[c];
+	}
+	MPI_Reduce(local, sum, INSTR_MAX_PHASES * NOF_FIELDS, MPI_DOUBLE, MPI_SUM, 0, comm);
+	MPI_Reduce(seconds, low, INSTR_MAX_PHASES, MPI_DOUBLE, MPI_MIN, 0, comm);
+	MPI_Reduce(seconds, high, INSTR_MAX_PHASES, MPI_DOUBLE, MPI_MAX, 0, comm);
+	MPI_Reduce(&Instr.counters, &counters, 1, MPI_INT, MPI_MAX, 0, comm);
+	if (my_rank != 0) {
+		Instr_trace_write_mpi(out, comm);
+		return;
+	}
+
+	Instr.counters = counters;
+	n = Instr_order(order);
+	fprintf(out, "\n%-20s %10s %12s %12s %12s %7s %12s", "phase", "calls", "min (s)", "mean (s)", "max (s)",
+			"max/avg", "self avg (s)");
+	if (Instr.counters > 0)
+		fprintf(out, " %12s %12s %6s %12s", "cycles", "instructions", "IPC", "LLC misses");
+	fprintf(out, "\n");
+	for (int i = 0; i < n; i++) {
+		int p = order[i];
+		double mean = sum[p][TOTAL] / comm_sz;
+
+		if (sum[p][CALLS] == 0)
+			continue;
+		Instr_print_name(out, p);
+		fprintf(out, " %10.0f %12.4e %12.4e %12.4e %7.2f %12.4e", sum[p][CALLS], low[p], mean, high[p],
+				mean > 0 ? high[p] / mean : 1.0, sum[p][SELF] / comm_sz);
+		Instr_print_counts(out, &sum[p][COUNTS]);
+	}
+	fprintf(out, "(%d ranks; times are per rank, summed over its threads)\n", comm_sz);
+	Instr_print_footer(out);
+	Instr_trace_write_mpi(out, comm);
+}
+#endif
+
+#endif
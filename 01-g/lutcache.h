@@ -0,0 +1,488 @@
+/* File:     lutcache.h
+ *
+ * Purpose:  A content-addressed cache of equalization results, so that an
+ *           image submitted again is not equalized again.  The key is the
+ *           XXH64 hash of the image's 8-bit gray pixels (the entry checks
+ *           the size too), computed in the same pass that counts the histogram, band by
+ *           band while the file is read.  Each entry holds the 256-byte
+ *           lut and, by default, the equalized pixels.
+ *
+ *           Entries are files <dir>/<key>.eqc.  The store is bounded: after
+ *           every store the least recently used entries (oldest mtime, to
+ *           the nanosecond; a hit touches its entry) are removed until the
+ *           total fits.  The hits, misses and bytes reused are counted per
+ *           run and, in <dir>/stats, over all runs.
+ *
+ * Note:     Set from the environment (no EQ_CACHE: no cache):
+ *              EQ_CACHE        the cache directory (created if missing)
+ *              EQ_CACHE_KEEP   output (default): lut and pixels, a hit
+ *                              skips the whole equalization;
+ *                              lut: only the lut, 256 bytes an entry
+ *              EQ_CACHE_MB     the bound of the store in MiB (default 256)
+ *           The hash is the reference XXH64 (seed 0) of the gray pixels,
+ *           top-down, so `xxhsum -H64` of a raw gray file gives the same
+ *           key, whatever IMAGE_BAND_ROWS is (cachekey.c checks this).
+ *
+ * Example:
+ *    struct lut_cache cache;
+ *    . . .
+ *    if (Lutcache_open(&cache)) {
+ *       Lutcache_read(&img, gray, histogram, &key);   // pixels, histogram and key
+ *       if (Lutcache_find(&cache, key, &img, lut, out) == LUTCACHE_OUTPUT)
+ *          . . . out is the result . . .
+ *       else
+ *          . . . equalize, then Lutcache_store(&cache, key, &img, lut, out) . . .
+ *    }
+ *    Lutcache_report(&cache, stdout);
+ */
+#ifndef _LUTCACHE_H_
+#define _LUTCACHE_H_
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "dispatch.h"
+#include "image_io.h"
+#include "kernels.h"
+
+#define LUTCACHE_VERSION 1
+#define LUTCACHE_MB 256			/* default bound of the store */
+#define LUTCACHE_STRIPE 32		/* bytes per XXH64 stripe, 8 per lane */
+
+enum lutcache_keep { LUTCACHE_KEEP_LUT, LUTCACHE_KEEP_OUTPUT };
+enum lutcache_hit { LUTCACHE_MISS, LUTCACHE_LUT, LUTCACHE_OUTPUT };
+
+struct lut_cache {
+	char dir[256];
+	enum lutcache_keep keep;
+	long long max_bytes;
+	long hits, misses;
+	long long bytes_saved;		/* lut and pixel bytes reused instead of computed */
+};
+
+/* The first bytes of an entry, followed by the lut and, if kind is LUTCACHE_OUTPUT, the pixels */
+struct lutcache_header {
+	char magic[8];
+	int32_t version, kind, width, height;
+	uint64_t key;
+};
+
+/*---------------------------------------------------------------- XXH64 fused with the histogram */
+
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+/* Streaming XXH64: four lanes over 32-byte stripes, a partial stripe kept in mem */
+struct xxh64_state {
+	uint64_t v[4];
+	uint64_t total;
+	unsigned char mem[LUTCACHE_STRIPE];
+	int mem_size;
+};
+
+static inline uint64_t Xxh_rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t Xxh_read64(const unsigned char * p) {
+	uint64_t v;
+
+	memcpy(&v, p, 8);	/* little-endian hosts only, like the BMP reader */
+	return v;
+}
+
+static inline __attribute__((always_inline)) uint64_t Xxh_round(uint64_t acc, uint64_t input) {
+	return Xxh_rotl(acc + input * XXH_P2, 31) * XXH_P1;
+}
+
+static inline uint64_t Xxh_merge(uint64_t acc, uint64_t v) {
+	return (acc ^ Xxh_round(0, v)) * XXH_P1 + XXH_P4;
+}
+
+static inline void Xxh64_init(struct xxh64_state * s) {
+	s->v[0] = XXH_P1 + XXH_P2;
+	s->v[1] = XXH_P2;
+	s->v[2] = 0;
+	s->v[3] = -XXH_P1;
+	s->total = 0;
+	s->mem_size = 0;
+}
+
+/*
+ * n / 32 whole stripes: the four lanes advance on one stripe while its
+ * 32 pixels go to four sub-histograms, so each byte is loaded once
+ */
+static inline __attribute__((always_inline))
+long Hash_histogram_body(uint64_t * v, const unsigned char * in, long n, int * histogram) {
+	int sub[4][KERNELS_GRAY_SHADES];
+	uint64_t v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+	long i;
+
+	memset(sub, 0, sizeof(sub));
+	for (i = 0; i + LUTCACHE_STRIPE <= n; i += LUTCACHE_STRIPE) {
+		const unsigned char * p = in + i;
+
+		v0 = Xxh_round(v0, Xxh_read64(p));
+		v1 = Xxh_round(v1, Xxh_read64(p + 8));
+		v2 = Xxh_round(v2, Xxh_read64(p + 16));
+		v3 = Xxh_round(v3, Xxh_read64(p + 24));
+		for (int j = 0; j < LUTCACHE_STRIPE; j += 4) {
+			sub[0][p[j]]++;
+			sub[1][p[j+1]]++;
+			sub[2][p[j+2]]++;
+			sub[3][p[j+3]]++;
+		}
+	}
+	for (int k = 0; k < KERNELS_GRAY_SHADES; k++)
+		histogram[k] += sub[0][k] + sub[1][k] + sub[2][k] + sub[3][k];
+	v[0] = v0;
+	v[1] = v1;
+	v[2] = v2;
+	v[3] = v3;
+	return i;
+}
+
+typedef long (*hash_histogram_kernel)(uint64_t * v, const unsigned char * in, long n, int * histogram);
+
+static long Hash_histogram_sse2(uint64_t * v, const unsigned char * in, long n, int * histogram) {
+	return Hash_histogram_body(v, in, n, histogram);
+}
+
+#if DISPATCH_X86
+__attribute__((target("avx2")))
+static long Hash_histogram_avx2(uint64_t * v, const unsigned char * in, long n, int * histogram) {
+	return Hash_histogram_body(v, in, n, histogram);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static long Hash_histogram_avx512(uint64_t * v, const unsigned char * in, long n, int * histogram) {
+	return Hash_histogram_body(v, in, n, histogram);
+}
+#else
+#define Hash_histogram_avx2 Hash_histogram_sse2
+#define Hash_histogram_avx512 Hash_histogram_sse2
+#endif
+
+static const hash_histogram_kernel Hash_histogram_variants[ISA_COUNT] =
+	{Hash_histogram_sse2, Hash_histogram_avx2, Hash_histogram_avx512};
+
+/* One 32-byte stripe into the four lanes */
+static inline void Xxh64_stripe(uint64_t * v, const unsigned char * p) {
+	for (int lane = 0; lane < 4; lane++)
+		v[lane] = Xxh_round(v[lane], Xxh_read64(p + 8 * lane));
+}
+
+/*------------------------------------------------------------------
+ * Function:	Xxh64_update_histogram
+ * Purpose:		Add in[0..n) to the hash s and its gray levels to
+ * 				histogram; the whole stripes go through the fused
+ * 				kernel, the bytes of a partial stripe wait in s->mem
+ */
+static inline void Xxh64_update_histogram(struct xxh64_state * s, const unsigned char * in, long n, int * histogram) {
+	long i = 0;
+
+	s->total += n;
+	if (s->mem_size > 0) {
+		while (i < n && s->mem_size < LUTCACHE_STRIPE) {
+			histogram[in[i]]++;
+			s->mem[s->mem_size++] = in[i++];
+		}
+		if (s->mem_size < LUTCACHE_STRIPE)
+			return;
+		Xxh64_stripe(s->v, s->mem);
+		s->mem_size = 0;
+	}
+	i += Hash_histogram_variants[Isa_selected()](s->v, in + i, n - i, histogram);
+	for (; i < n; i++) {
+		histogram[in[i]]++;
+		s->mem[s->mem_size++] = in[i];
+	}
+}
+
+/* The hash of everything added to s */
+static inline uint64_t Xxh64_digest(const struct xxh64_state * s) {
+	const unsigned char * p = s->mem;
+	int rest = s->mem_size;
+	uint64_t h;
+
+	if (s->total >= LUTCACHE_STRIPE) {
+		h = Xxh_rotl(s->v[0], 1) + Xxh_rotl(s->v[1], 7) + Xxh_rotl(s->v[2], 12) + Xxh_rotl(s->v[3], 18);
+		for (int lane = 0; lane < 4; lane++)
+			h = Xxh_merge(h, s->v[lane]);
+	} else {
+		h = s->v[2] + XXH_P5;	/* the seed */
+	}
+	h += s->total;
+
+	for (; rest >= 8; p += 8, rest -= 8)
+		h = Xxh_rotl(h ^ Xxh_round(0, Xxh_read64(p)), 27) * XXH_P1 + XXH_P4;
+	if (rest >= 4) {
+		uint32_t w;
+
+		memcpy(&w, p, 4);
+		h = Xxh_rotl(h ^ (w * XXH_P1), 23) * XXH_P2 + XXH_P3;
+		p += 4;
+		rest -= 4;
+	}
+	for (; rest > 0; p++, rest--)
+		h = Xxh_rotl(h ^ (*p * XXH_P5), 11) * XXH_P1;
+
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+	return h;
+}
+
+/*---------------------------------------------------------------- the store */
+
+/*------------------------------------------------------------------
+ * Function:	Lutcache_open
+ * Purpose:		Set up cache from $EQ_CACHE, $EQ_CACHE_KEEP and
+ * 				$EQ_CACHE_MB, creating the directory
+ * Return:		1 if the cache is on, 0 if not (or on an error)
+ */
+static inline int Lutcache_open(struct lut_cache * cache) {
+	const char * dir = getenv("EQ_CACHE"), * keep = getenv("EQ_CACHE_KEEP"), * mb = getenv("EQ_CACHE_MB");
+
+	memset(cache, 0, sizeof(*cache));
+	if (dir == NULL || *dir == '\0')
+		return 0;
+	if (strlen(dir) >= sizeof(cache->dir) - 32) {
+		fprintf(stderr, "EQ_CACHE: directory name too long\n");
+		return 0;
+	}
+	strcpy(cache->dir, dir);
+	cache->keep = LUTCACHE_KEEP_OUTPUT;
+	if (keep != NULL && strcmp(keep, "lut") == 0)
+		cache->keep = LUTCACHE_KEEP_LUT;
+	else if (keep != NULL && *keep != '\0' && strcmp(keep, "output") != 0)
+		fprintf(stderr, "EQ_CACHE_KEEP=%s: expected lut or output, keeping output\n", keep);
+	cache->max_bytes = (long long)(mb != NULL && atoi(mb) > 0 ? atoi(mb) : LUTCACHE_MB) << 20;
+	if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+		perror(dir);
+		cache->dir[0] = '\0';
+		return 0;
+	}
+	return 1;
+}
+
+static inline int Lutcache_enabled(const struct lut_cache * cache) {
+	return cache->dir[0] != '\0';
+}
+
+/*------------------------------------------------------------------
+ * Function:	Lutcache_read
+ * Purpose:		Read img as top-down 8-bit gray like Image_read_gray8,
+ * 				hashing and counting each band while it is in cache
+ * Output args:	gray:		width * height bytes
+ * 				histogram:	the gray levels are added to it
+ * 				key:		the XXH64 of the gray pixels
+ * Return:		0 on success, -1 on a read error
+ * Note:		The pixels are hashed top-down whatever the band height,
+ * 				so the key does not change with IMAGE_BAND_ROWS.  Bands
+ * 				that arrive in that order (PGM, PPM, top-down BMP, a BMP
+ * 				read in one band) are hashed as they come; the rows of the
+ * 				others (a bottom-up BMP) are hashed once all are read.
+ */
+static inline int Lutcache_read(struct image * img, unsigned char * gray, int * histogram, uint64_t * key) {
+	struct xxh64_state state;
+	struct image_band band;
+	long hashed = 0;		/* rows 0 .. hashed - 1 are in the hash */
+	int rows;
+
+	Xxh64_init(&state);
+	Image_rewind(img);
+	while ((rows = Image_next_band(img, Image_band_rows(), &band)) > 0) {
+		unsigned char * out = gray + (long)band.y0 * img->width;
+
+		Image_band_gray8(img, &band, out);
+		if (band.y0 == hashed) {
+			Xxh64_update_histogram(&state, out, (long)band.rows * img->width, histogram);
+			hashed += band.rows;
+		}
+	}
+	if (rows == 0 && hashed < img->height)
+		Xxh64_update_histogram(&state, gray + hashed * img->width, (img->height - hashed) * img->width, histogram);
+	*key = Xxh64_digest(&state);
+	return rows;
+}
+
+static inline void Lutcache_path(const struct lut_cache * cache, uint64_t key, char * path, size_t size) {
+	snprintf(path, size, "%s/%016llx.eqc", cache->dir, (unsigned long long)key);
+}
+
+/* Add this lookup to the counts of <dir>/stats */
+static inline void Lutcache_count(const struct lut_cache * cache, int hit, long long saved) {
+	char path[300];
+	long hits = 0, misses = 0;
+	long long bytes = 0;
+	FILE * f;
+
+	snprintf(path, sizeof(path), "%s/stats", cache->dir);
+	if ((f = fopen(path, "r")) != NULL) {
+		if (fscanf(f, "%ld %ld %lld", &hits, &misses, &bytes) != 3)
+			hits = misses = bytes = 0;
+		fclose(f);
+	}
+	if ((f = fopen(path, "w")) != NULL) {
+		fprintf(f, "%ld %ld %lld\n", hits + hit, misses + !hit, bytes + saved);
+		fclose(f);
+	}
+}
+
+/*------------------------------------------------------------------
+ * Function:	Lutcache_find
+ * Purpose:		Look up the result for the pixels of key, of img's size
+ * Output args:	lut:	the lut, on a hit
+ * 				out:	the equalized pixels, on a LUTCACHE_OUTPUT hit
+ * Return:		LUTCACHE_MISS, LUTCACHE_LUT or LUTCACHE_OUTPUT
+ */
+static inline enum lutcache_hit Lutcache_find(struct lut_cache * cache, uint64_t key, const struct image * img,
+		unsigned char * lut, unsigned char * out) {
+	struct lutcache_header header;
+	size_t pixels = (size_t)img->width * img->height;
+	enum lutcache_hit hit = LUTCACHE_MISS;
+	long long saved = 0;
+	char path[300];
+	FILE * f;
+
+	Lutcache_path(cache, key, path, sizeof(path));
+	if ((f = fopen(path, "rb")) != NULL) {
+		if (fread(&header, sizeof(header), 1, f) == 1 && memcmp(header.magic, "EQCACHE", 8) == 0
+				&& header.version == LUTCACHE_VERSION && header.key == key && header.width == img->width
+				&& header.height == img->height && fread(lut, 1, KERNELS_GRAY_SHADES, f) == KERNELS_GRAY_SHADES) {
+			hit = LUTCACHE_LUT;
+			saved = KERNELS_GRAY_SHADES;
+			if (header.kind == LUTCACHE_OUTPUT && cache->keep == LUTCACHE_KEEP_OUTPUT
+					&& fread(out, 1, pixels, f) == pixels) {
+				hit = LUTCACHE_OUTPUT;
+				saved += pixels;
+			}
+		}
+		fclose(f);
+		if (hit != LUTCACHE_MISS)
+			utimes(path, NULL);	/* most recently used */
+	}
+
+	if (hit != LUTCACHE_MISS) {
+		cache->hits++;
+		cache->bytes_saved += saved;
+	} else {
+		cache->misses++;
+	}
+	Lutcache_count(cache, hit != LUTCACHE_MISS, saved);
+	return hit;
+}
+
+/* Remove the least recently used entries until the store fits in cache->max_bytes */
+static inline void Lutcache_evict(const struct lut_cache * cache) {
+	struct entry { char name[32]; double used; off_t size; } * entries = NULL;
+	int nof_entries = 0, capacity = 0;
+	long long total = 0;
+	char path[300];
+	struct dirent * d;
+	struct stat st;
+	DIR * dir;
+
+	if ((dir = opendir(cache->dir)) == NULL)
+		return;
+	while ((d = readdir(dir)) != NULL) {
+		size_t len = strlen(d->d_name);
+
+		if (len < 4 || len >= sizeof(entries->name) || strcmp(d->d_name + len - 4, ".eqc") != 0)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", cache->dir, d->d_name);
+		if (stat(path, &st) != 0)
+			continue;
+		if (nof_entries == capacity) {
+			capacity = capacity ? 2 * capacity : 64;
+			entries = realloc(entries, capacity * sizeof(*entries));
+		}
+		strcpy(entries[nof_entries].name, d->d_name);
+		entries[nof_entries].used = st.st_mtim.tv_sec + 1e-9 * st.st_mtim.tv_nsec;
+		entries[nof_entries].size = st.st_size;
+		total += st.st_size;
+		nof_entries++;
+	}
+	closedir(dir);
+
+	while (total > cache->max_bytes && nof_entries > 0) {
+		int oldest = 0;
+
+		for (int e = 1; e < nof_entries; e++)
+			if (entries[e].used < entries[oldest].used)
+				oldest = e;
+		snprintf(path, sizeof(path), "%s/%s", cache->dir, entries[oldest].name);
+		unlink(path);
+		total -= entries[oldest].size;
+		entries[oldest] = entries[--nof_entries];
+	}
+	free(entries);
+}
+
+/*------------------------------------------------------------------
+ * Function:	Lutcache_store
+ * Purpose:		Keep the result for the pixels of key: the lut and, with
+ * 				EQ_CACHE_KEEP=output, the pixels out; then trim the store
+ */
+static inline void Lutcache_store(const struct lut_cache * cache, uint64_t key, const struct image * img,
+		const unsigned char * lut, const unsigned char * out) {
+	struct lutcache_header header = {"EQCACHE", LUTCACHE_VERSION, LUTCACHE_LUT, img->width, img->height, key};
+	size_t pixels = (size_t)img->width * img->height;
+	char path[300], tmp[310];
+	int ok;
+	FILE * f;
+
+	if (cache->keep == LUTCACHE_KEEP_OUTPUT)
+		header.kind = LUTCACHE_OUTPUT;
+	Lutcache_path(cache, key, path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	if ((f = fopen(tmp, "wb")) == NULL) {
+		perror(tmp);
+		return;
+	}
+	ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(lut, 1, KERNELS_GRAY_SHADES, f) == KERNELS_GRAY_SHADES
+			&& (header.kind != LUTCACHE_OUTPUT || fwrite(out, 1, pixels, f) == pixels);
+	ok = fclose(f) == 0 && ok;
+	/* whole entries only: a reader never sees a half-written one */
+	if (!ok || rename(tmp, path) != 0) {
+		perror(path);
+		unlink(tmp);
+		return;
+	}
+	Lutcache_evict(cache);
+}
+
+/* The hit rate and bytes reused, of this run and of all runs on the directory */
+static inline void Lutcache_report(const struct lut_cache * cache, FILE * out) {
+	long hits = 0, misses = 0, lookups = cache->hits + cache->misses;
+	long long bytes = 0;
+	char path[300];
+	FILE * f;
+
+	if (!Lutcache_enabled(cache))
+		return;
+	fprintf(out, "cache %s (%s): %ld hits, %ld misses (hit rate %.1f%%), %lld bytes reused\n", cache->dir,
+			cache->keep == LUTCACHE_KEEP_OUTPUT ? "output" : "lut", cache->hits, cache->misses,
+			lookups > 0 ? 100.0 * cache->hits / lookups : 0.0, cache->bytes_saved);
+	snprintf(path, sizeof(path), "%s/stats", cache->dir);
+	if ((f = fopen(path, "r")) != NULL) {
+		if (fscanf(f, "%ld %ld %lld", &hits, &misses, &bytes) == 3 && hits + misses > 0)
+			fprintf(out, "cache, all runs: %ld hits, %ld misses (hit rate %.1f%%), %lld bytes reused\n", hits,
+					misses, 100.0 * hits / (hits + misses), bytes);
+		fclose(f);
+	}
+}
+
+#endif
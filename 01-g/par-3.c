@@ -2,110 +2,270 @@
  *
  * 	Purpose:	Implement histogram equalization to sharpen the quality of an image.
  * 
- *	Compile:	mpicc -g -Wall -o par par-3.c
- *	Run:		mpiexec -n <number of processes> ./Sum_MPI_v2
+ *	Compile:	mpicc -O2 -g -Wall -o par par-3.c -lm
+ *	Run:		mpiexec -n <number of processes> ./par [input image] [output image]
+ *				mpiexec ... ./par <input image> <output image> --roi <x>,<y>,<w>x<h> [--stats-roi <x>,<y>,<w>x<h>]
+ *				mpiexec ... ./par ... --stats	(min, max, mean and percentiles of the gray and colour channels)
+ *				AFFINITY=compact|scatter|l3 mpiexec ... pins the ranks (see affinity.h)
+ *				KERNEL_ISA=sse2|avx2|avx512 mpiexec ... forces a SIMD variant (see kernels.h)
+ *				BENCH_TRIALS=<n> mpiexec ... sets the number of timed passes (see bench.h)
+ *				EQ_CACHE=<dir> mpiexec ... reuses the results of images seen before (see lutcache.h)
+ *				./tune first saves this host's best settings, loaded here at startup (see tune.c)
+ *				mpiexec -n <number of processes> ./par --serve <socket>
+ *				./par --request <socket> "<input image> <output image>" [--repeat R] [--cold "<command>"]
  *
- *	Input:					images/lena512.bmp
- * 	output_imageput:		images/lena_copy.bmp (histogram equalized)
+ *	Input:		images/lena512.bmp, or any BMP/PGM/PPM/raw image (see image_io.h)
+ * 	Output:		images/lena_copy.bmp (histogram equalized, same format as the input)
  *
  *	Notes:
  *		1. 	The code for reading and writing BMP files was based off of Abhijit Nathwani's work 
  *			(https://abhijitnathwani.github.io/blog/2017/12/20/First-C-Program-for-Image-Processing)
  *		2. 	The algorithm for histogram equalization was adapted from Image Processing in C (2e) by Dwayne Phillips
- * 		3. 	"timer.h" was taken from An Introduction to Parallel Programming (2e) by Pacheco and Malensek
+ * 		3. 	The phase times at the end come from instrument.h (INSTR_COUNTERS=1 adds hardware counters)
+ *		4.	With --serve the processes stay up and equalize one image per request (see server.h):
+ *			process 0 reads "<input> <output>" from the socket and replies "ok <width> <height>
+ *			seconds <s>" once the output is written; "quit" stops them.  The buffers are kept
+ *			from request to request and only grow.  Started with --request instead (no mpiexec),
+ *			the program is the client and reports the latency per request.
+ *		5.	With EQ_CACHE process 0 hashes the pixels in the pass that counts the histogram and
+ *			looks the hash up in the cache directory; for an image seen before the cached output
+ *			is written without scattering, mapping or gathering anything.  Process 0 makes the
+ *			lut (or takes it from the cache) and broadcasts it, so the other processes only apply
+ *			it; the histogram comes from the hashing pass either way, so with EQ_CACHE_KEEP=lut
+ *			a hit only spares the lut itself.  The hit rate and the bytes reused are printed at
+ *			the end.
+ *		6.	With --roi only that region is equalized and the rest of the image is written unchanged;
+ *			the lut comes from the histogram of --stats-roi (default: the region itself), so one
+ *			region can be equalized by the statistics of another.  Both are strided views into
+ *			process 0's image buffer (see Image_roi_view): the rows of each are scattered to the
+ *			processes with a datatype of one region row, each process counts the histogram of its
+ *			rows of --stats-roi (combined with MPI_Reduce) and maps its rows of --roi, which are
+ *			gathered back into place.  Process 0 keeps its own rows where they are, a statistics
+ *			region equal to the region is scattered once, and nothing else is copied.  The cache
+ *			is not used.
+ *		7.	Process 0 counts the histogram band by band as it reads the image, either in the hashing
+ *			pass of note 5 or in that of stats.h, so every pixel is read from memory twice: once
+ *			there and once to apply the lut.  --stats prints the statistics of that pass; the stored
+ *			channels of a colour image are counted in it too, except with EQ_CACHE (gray only).
  *
  *	Important:
- *		The number of processes must be a power of 2.
+ *		Any number of processes works; when it does not divide the image size
+ *		the first (image_size % comm_sz) processes get one extra pixel.
  *
  *	Author: Evelyn Evans
  */
+#define _GNU_SOURCE		// sched_setaffinity, used by affinity.h
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <mpi.h>
-#include "timer.h"
-
-const int height = 512;
-const int width = 512;
-const int image_size = 512*512; 
-const int bmp_header_size = 54;
-const int color_table_size = 1024;
+#include "instrument.h"
+#include "affinity.h"
+#include "image_io.h"
+#include "kernels.h"
+#include "bench.h"
+#include "server.h"
+#include "lutcache.h"
+#include "tune.h"
+#include "stats.h"
+
+int height, width, image_size;		// taken from the input image on process 0
 const int nof_gray_shades = 256;
-const int bloat_serial = 16384;		// 2 ^ 14
+struct lut_cache cache;				// results of earlier images, on process 0 (EQ_CACHE)
+struct channel_stats image_stats[1 + STATS_MAX_CHANNELS];	// of the last image read, on process 0
+int nof_image_stats, show_stats;	// --stats: print them
 
 void initialize_histogram(int * histogram);
-void read_bmp(unsigned char * input_image, unsigned char * header, unsigned char * colorTable);
-void write_bmp(unsigned char * input_image, unsigned char * header, unsigned char * colorTable);
-void calculate_histogram(unsigned char * input_image, int * histogram);
 void calculate_histogram_sum(int * histogram, int * histogram_sum);
 void transpose_image(unsigned char * input_image, unsigned char * output_image, int * histogram_sum);
 void transpose_image_parallel(
 	unsigned char * local_input, 
 	unsigned char * local_output,  
-	int * histogram_sum, 
+	const unsigned char * lut, 
 	int chunk_size, 
-	int process, 
-	float Dm, 
-	float area,
-	int bloat);
+	int process);
+void transpose_trial(void * arg);
+void transpose_rows_parallel(const unsigned char * local_input, long input_stride, unsigned char * local_output,
+	int * histogram_sum, int roi_width, int rows, float Dm, float area);
+void transpose_rows_trial(void * arg);
+int equalize_roi(struct image * image, const char * output_path, struct image_roi * roi,
+	const struct image_roi * stats_roi, int my_rank, int comm_sz);
+MPI_Datatype split_rows(const int * region, int comm_sz, int * row_counts, int * row_displacements);
+void build_lut(int * histogram_sum, unsigned char * lut, float Dm, float area);
+int read_image(struct image * image, unsigned char * input_image, unsigned char * output_image, unsigned char * lut,
+	uint64_t * key);
+void store_result(uint64_t key, int hit, struct image * image, const unsigned char * lut, unsigned char * output_image);
+int serve(const char * socket_path, int my_rank, int comm_sz);
+int open_request(const char * line, struct image * image, int * dims, unsigned char ** input_image,
+	unsigned char ** output_image, int * capacity, char * output_path, char * reply);
+
+struct transpose_args {
+	unsigned char * local_input, * local_output;
+	const unsigned char * lut;
+	int chunk_size, process;
+};
+
+struct transpose_rows_args {
+	const unsigned char * local_input;
+	long input_stride;
+	unsigned char * local_output;
+	int * histogram_sum;
+	int roi_width, rows;
+};
+
+// one request's job, sent by process 0: width, height and what to do
+enum { JOB_QUIT, JOB_RUN, JOB_ERROR };
 
 int main(int argc,char *argv[])
 {
-    unsigned char input_image[image_size], output_image[image_size], header[bmp_header_size], colorTable[color_table_size];
-	int histogram[nof_gray_shades], histogram_sum[nof_gray_shades];
-	int chunk_size, my_rank, comm_sz, bloat;
-	double local_start, local_finish, local_elapsed, elapsed; 
+	const char * input_path = (argc > 1 && argv[1][0] != '-') ? argv[1] : "images/lena512.bmp";
+	const char * output_path = (argc > 2 && argv[1][0] != '-' && argv[2][0] != '-') ? argv[2] : "images/lena_copy.bmp";
+	struct image image;
+	struct image_roi roi, stats_roi;
+	unsigned char *input_image = NULL, *output_image = NULL, lut[nof_gray_shades];
+	int chunk_size, my_rank, comm_sz, dims[3], hit = LUTCACHE_MISS;
+	uint64_t key = 0;
+	int *chunk_sizes, *displacements;
+	struct bench_config config = Bench_default_config();
+	struct bench_stats stats;
+	struct transpose_args args;
 
 	unsigned char *local_input_image, *local_output_image;
 
+	// a client of --serve does not need MPI (see server.h)
+	int status = Server_client(argc, argv);
+	if (status >= 0)
+		return status;
+	show_stats = Stats_requested(argc, argv);
+	Tune_load("equalize");		// this host's profile, before anything reads the environment
+
 	/* Start Parallelization */
 
 	MPI_Init(NULL, NULL);
 	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
 	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+	Affinity_pin_rank(NULL, MPI_COMM_WORLD);
+	if (my_rank == 0)
+		Lutcache_open(&cache);
+
+	if (Server_path(argc, argv) != NULL) {
+		status = serve(Server_path(argc, argv), my_rank, comm_sz);
+		Instr_report_mpi(stdout, MPI_COMM_WORLD);
+		MPI_Finalize();
+		return status;
+	}
 
-	chunk_size = image_size / comm_sz;
-	bloat = bloat_serial * comm_sz;
+	if (my_rank == 0) {
+		Instr_begin(INSTR_READ);
+		if (Image_open(input_path, &image, IMAGE_MAP) != 0)
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		dims[0] = image.width;
+		dims[1] = image.height;
+		dims[2] = Image_select_roi(argc, argv, "--roi", &image, &roi);
+		status = Image_select_roi(argc, argv, "--stats-roi", &image, &stats_roi);
+		if (dims[2] < 0 || status < 0)
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		if (status == 0)
+			stats_roi = roi;
+		dims[2] |= status;		// a region mode if either was given
+		printf("width: %d\n", dims[0]);
+		printf("height: %d\n", dims[1]);
+		printf("kernel: %s\n", Isa_names[Isa_selected()]);
+		Tune_report(stdout);
+		Instr_end(INSTR_READ);
+	}
+	Instr_begin(INSTR_BCAST);
+	MPI_Bcast(dims, 3, MPI_INT, 0, MPI_COMM_WORLD);
+	Instr_end(INSTR_BCAST);
+	width = dims[0];
+	height = dims[1];
+	image_size = width * height;
+
+	if (dims[2]) {
+		status = equalize_roi(&image, output_path, &roi, &stats_roi, my_rank, comm_sz);
+		Instr_report_mpi(stdout, MPI_COMM_WORLD);
+		MPI_Finalize();
+		return status;
+	}
+
+	chunk_sizes = malloc(comm_sz * sizeof(int));
+	displacements = malloc(comm_sz * sizeof(int));
+	for (int p = 0, offset = 0; p < comm_sz; p++) {
+		chunk_sizes[p] = image_size / comm_sz + (p < image_size % comm_sz);
+		displacements[p] = offset;
+		offset += chunk_sizes[p];
+	}
+	chunk_size = chunk_sizes[my_rank];
 
 	local_input_image = malloc(chunk_size * sizeof(unsigned char));
 	local_output_image = malloc(chunk_size * sizeof(unsigned char));
 	
 	if (my_rank == 0) {
-		initialize_histogram(histogram);
-		read_bmp(input_image, header, colorTable);
-		calculate_histogram(input_image, histogram);
-		calculate_histogram_sum(histogram, histogram_sum);
+		input_image = malloc(image_size);
+		output_image = malloc(image_size);
+		if ((hit = read_image(&image, input_image, output_image, lut, &key)) < 0)
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		if (show_stats)
+			Stats_print(stdout, image_stats, nof_image_stats);
 	}
 
-	MPI_Bcast(histogram_sum, nof_gray_shades, MPI_INT, 0, MPI_COMM_WORLD);
-	MPI_Bcast(&bloat, 1, MPI_INT, 0, MPI_COMM_WORLD);
-
-	MPI_Scatter(input_image, chunk_size, MPI_UNSIGNED_CHAR, local_input_image, chunk_size, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
-
-	MPI_Barrier(MPI_COMM_WORLD);
-	local_start = MPI_Wtime();
-
-	transpose_image_parallel(local_input_image, local_output_image, histogram_sum, chunk_size, my_rank, (float)nof_gray_shades, (float)image_size, bloat);
-
-	local_finish = MPI_Wtime();
-	local_elapsed = local_finish - local_start;
-	MPI_Reduce(&local_elapsed, &elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
-
-	MPI_Gather(local_output_image, chunk_size, MPI_UNSIGNED_CHAR, output_image, chunk_size, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+	Instr_begin(INSTR_BCAST);
+	MPI_Bcast(&hit, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	Instr_end(INSTR_BCAST);
+
+	// a cached output is the result: nothing to equalize
+	if (hit != LUTCACHE_OUTPUT) {
+		Instr_begin(INSTR_BCAST);
+		MPI_Bcast(lut, nof_gray_shades, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+		Instr_end(INSTR_BCAST);
+
+		Instr_begin(INSTR_SCATTER);
+		MPI_Scatterv(input_image, chunk_sizes, displacements, MPI_UNSIGNED_CHAR, local_input_image, chunk_size, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+		Instr_end(INSTR_SCATTER);
+
+		// every trial is one pass over this process's chunk, timed by the slowest process
+		args.local_input = local_input_image;
+		args.local_output = local_output_image;
+		args.lut = lut;
+		args.chunk_size = chunk_size;
+		args.process = my_rank;
+		Bench_run_mpi(transpose_trial, &args, &config, MPI_COMM_WORLD, &stats);
+
+		Instr_begin(INSTR_GATHER);
+		MPI_Gatherv(local_output_image, chunk_size, MPI_UNSIGNED_CHAR, output_image, chunk_sizes, displacements, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+		Instr_end(INSTR_GATHER);
+	}
 
 	free(local_output_image);
 	free(local_input_image);
+	free(displacements);
+	free(chunk_sizes);
 
+	status = 0;
 	if(my_rank == 0) {
-		write_bmp(output_image, header, colorTable);
-		printf("time elapsed: %f sec\n", elapsed);
+		Instr_begin(INSTR_WRITE);
+		if (Image_write_gray8(output_path, &image, output_image) != 0)
+			status = 1;		// nothing is cached for an output that was not written
+		else
+			store_result(key, hit, &image, lut, output_image);
+		Image_close(&image);
+		Instr_end(INSTR_WRITE);
+		free(input_image);
+		free(output_image);
+		if (hit == LUTCACHE_OUTPUT)
+			printf("time elapsed: none, the output came from the cache\n");
+		else
+			printf("time elapsed: %e sec per pass (median of %d trials; min %e, p95 %e)\n",
+				stats.median, stats.trials, stats.min, stats.p95);
+		Lutcache_report(&cache, stdout);
 	}
+	Instr_report_mpi(stdout, MPI_COMM_WORLD);
 
 	MPI_Finalize();
 
 	/* End Parallelization */
 
-	return 0;
+	return status;
 }
 
 void initialize_histogram(int * histogram) {
@@ -114,64 +274,6 @@ void initialize_histogram(int * histogram) {
 	}
 }
 
-void read_bmp(unsigned char * input_image, unsigned char * header, unsigned char * colorTable) {
-	int i;
-
-	FILE *streamIn; 
-        streamIn = fopen("images/lena512.bmp", "r"); // Input file name
-   
-        if (streamIn == (FILE *)0) // check if the input file has not been opened succesfully.
-	{
-            printf("File opening error ocurred. Exiting program.\n");
-            exit(0);
- 	}
-	
- 	// int count = 0;
- 	for(i=0;i<54;i++) 
- 	{
- 		header[i] = getc(streamIn);  // strip output_image BMP header
- 		
- 	}
- 	int width = *(int*)&header[18]; // read the width from the image header
- 	int height = *(int*)&header[22]; // read the height from the image header
-	int bitDepth = *(int*)&header[28]; // read the bitDepth from the image header
-
-	if(bitDepth <= 8)
-		fread(colorTable, sizeof(unsigned char), 1024, streamIn);
-
-
-	printf("width: %d\n",width);
-	printf("height: %d\n",height );
-
-	fread(input_image, sizeof(unsigned char), (height * width), streamIn);
-	
- 	fclose(streamIn);
-}
-
-void write_bmp(unsigned char * input_image, unsigned char * header, unsigned char * colorTable) {
-	int width = *(int*)&header[18]; // read the width from the image header
-	int height = *(int*)&header[22]; // read the height from the image header
-   	int bitDepth = *(int*)&header[28]; // read the bitDepth from the image header
-
-	FILE *fo = fopen("images/lena_copy.bmp","wb"); // output_imageput File name
-	fwrite(header, sizeof(unsigned char), 54, fo); // write the image header to output_imageput file
-	if(bitDepth <= 8)
-		fwrite(colorTable, sizeof(unsigned char), 1024, fo);	
-	fwrite(input_image, sizeof(unsigned char), (height * width), fo);
-	 	
-	fclose(fo);
-}
-
-void calculate_histogram(unsigned char * input_image, int * histogram) {
-	int i, j, k;
-	for(i = 0; i < height; i++) {
-		for(j = 0; j < width; j++) {
-			k = (int)input_image[(i * width) + j];
-			histogram[k]++;
-		}
-	}
-}
-
 void calculate_histogram_sum(int * histogram, int * histogram_sum) {
 	int i;
 	int sum = 0;
@@ -196,19 +298,372 @@ void transpose_image(unsigned char * input_image, unsigned char * output_image,
 void transpose_image_parallel(
 	unsigned char * local_input, 
 	unsigned char * local_output, 
-	int * histogram_sum, 
+	const unsigned char * lut, 
 	int chunk_size, 
-	int process, 
-	float Dm, 
-	float area,
-	int bloat) {
+	int process) {
+
+	INSTR_SCOPE(INSTR_COMPUTE);
+
+	Kernel_apply_lut(local_input, local_output, chunk_size, lut);
+}
+
+// the mapping only depends on the gray level, so evaluate it once per level
+void build_lut(int * histogram_sum, unsigned char * lut, float Dm, float area) {
+	for(int k = 0; k < nof_gray_shades; k++) {
+		lut[k] = (unsigned char)((Dm/area) * (histogram_sum[k]));
+	}
+}
+
+void transpose_trial(void * arg) {
+	struct transpose_args * args = arg;
+	transpose_image_parallel(args->local_input, args->local_output, args->lut, args->chunk_size, args->process);
+}
+
+// this process's rows of the region, input_stride bytes apart, into packed rows of local_output
+void transpose_rows_parallel(const unsigned char * local_input, long input_stride, unsigned char * local_output,
+	int * histogram_sum, int roi_width, int rows, float Dm, float area) {
+
+	unsigned char lut[nof_gray_shades];
+	INSTR_SCOPE(INSTR_COMPUTE);
+
+	build_lut(histogram_sum, lut, Dm, area);
+	Kernel_apply_lut_rows(local_input, input_stride, local_output, roi_width, roi_width, rows, lut);
+}
+
+// the area is the number of pixels the histogram counted, that of the statistics region
+void transpose_rows_trial(void * arg) {
+	struct transpose_rows_args * args = arg;
+	transpose_rows_parallel(args->local_input, args->input_stride, args->local_output, args->histogram_sum,
+		args->roi_width, args->rows, (float)nof_gray_shades, (float)args->histogram_sum[nof_gray_shades - 1]);
+}
 
-	int k;
+// --roi: equalize the rows of roi by the histogram of stats_roi, both views into process 0's image buffer;
+// the rows of both are split among the processes, and those of roi gathered back into place (roi and
+// stats_roi are only set on process 0)
+int equalize_roi(struct image * image, const char * output_path, struct image_roi * roi,
+	const struct image_roi * stats_roi, int my_rank, int comm_sz) {
+
+	unsigned char *input_image = NULL, *roi_data = NULL, *stats_data = NULL, *local_input, *local_output;
+	unsigned char *local_stats = NULL;
+	const unsigned char *stats_rows;
+	long stats_stride;
+	int histogram[nof_gray_shades], local_histogram[nof_gray_shades], histogram_sum[nof_gray_shades];
+	int regions[8], *region = regions, *stats_region = regions + 4, same, status = 0;
+	int *row_counts = malloc(comm_sz * sizeof(int)), *row_displacements = malloc(comm_sz * sizeof(int));
+	int *stats_counts = malloc(comm_sz * sizeof(int)), *stats_displacements = malloc(comm_sz * sizeof(int));
+	struct bench_config config = Bench_default_config();
+	struct bench_stats stats;
+	struct transpose_rows_args args;
+	struct image_band view;
+	MPI_Datatype roi_row_t, stats_row_t;
 
-	for(int b = 0; b < bloat; b++) {
-		for(int i = 0; i < chunk_size; i++) {
-			k = local_input[i];
-			local_output[i] = (unsigned char)((Dm/area) * (histogram_sum[k]));
+	if (my_rank == 0) {
+		input_image = malloc(image_size);
+		Instr_begin(INSTR_READ);
+		if (show_stats ? (nof_image_stats = Stats_read_gray8(image, input_image, image_stats, 1)) < 0
+				: Image_read_gray8(image, input_image) != 0)
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		Instr_end(INSTR_READ);
+		if (show_stats)
+			Stats_print(stdout, image_stats, nof_image_stats);
+
+		if (Image_roi_view(image, input_image, stats_roi, &view) != 0)
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		stats_data = (unsigned char *)view.data;
+		if (Image_roi_view(image, input_image, roi, &view) != 0)
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		roi_data = (unsigned char *)view.data;
+		region[0] = roi->x;
+		region[1] = roi->y;
+		region[2] = roi->width;
+		region[3] = roi->height;
+		stats_region[0] = stats_roi->x;
+		stats_region[1] = stats_roi->y;
+		stats_region[2] = stats_roi->width;
+		stats_region[3] = stats_roi->height;
+	}
+	Instr_begin(INSTR_BCAST);
+	MPI_Bcast(regions, 8, MPI_INT, 0, MPI_COMM_WORLD);
+	Instr_end(INSTR_BCAST);
+	same = memcmp(region, stats_region, 4 * sizeof(int)) == 0;
+
+	roi_row_t = split_rows(region, comm_sz, row_counts, row_displacements);
+	args.rows = row_counts[my_rank];
+	args.roi_width = region[2];
+	args.histogram_sum = histogram_sum;
+	local_output = malloc((size_t)args.rows * region[2] + 1);
+	local_input = my_rank == 0 ? NULL : malloc((size_t)args.rows * region[2] + 1);
+
+	// process 0's rows are the first of the region and stay where they are
+	Instr_begin(INSTR_SCATTER);
+	MPI_Scatterv(roi_data, row_counts, row_displacements, roi_row_t,
+		my_rank == 0 ? MPI_IN_PLACE : local_input, args.rows * region[2], MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+	Instr_end(INSTR_SCATTER);
+	args.local_input = my_rank == 0 ? roi_data : local_input;
+	args.input_stride = my_rank == 0 ? width : region[2];
+
+	// the histogram of the statistics region: each process counts its rows of it, in place on process 0
+	stats_row_t = split_rows(stats_region, comm_sz, stats_counts, stats_displacements);
+	if (same) {
+		stats_rows = args.local_input;
+		stats_stride = args.input_stride;
+	} else {
+		if (my_rank != 0)
+			local_stats = malloc((size_t)stats_counts[my_rank] * stats_region[2] + 1);
+		Instr_begin(INSTR_SCATTER);
+		MPI_Scatterv(stats_data, stats_counts, stats_displacements, stats_row_t,
+			my_rank == 0 ? MPI_IN_PLACE : local_stats, stats_counts[my_rank] * stats_region[2], MPI_UNSIGNED_CHAR, 0,
+			MPI_COMM_WORLD);
+		Instr_end(INSTR_SCATTER);
+		stats_rows = my_rank == 0 ? stats_data : local_stats;
+		stats_stride = my_rank == 0 ? width : stats_region[2];
+	}
+	Instr_begin(INSTR_HISTOGRAM);
+	initialize_histogram(local_histogram);
+	Kernel_histogram_rows(stats_rows, stats_region[2], stats_counts[my_rank], stats_stride, local_histogram);
+	Instr_end(INSTR_HISTOGRAM);
+
+	Instr_begin(INSTR_REDUCE);
+	MPI_Reduce(local_histogram, histogram, nof_gray_shades, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+	Instr_end(INSTR_REDUCE);
+	if (my_rank == 0)
+		calculate_histogram_sum(histogram, histogram_sum);
+	Instr_begin(INSTR_BCAST);
+	MPI_Bcast(histogram_sum, nof_gray_shades, MPI_INT, 0, MPI_COMM_WORLD);
+	Instr_end(INSTR_BCAST);
+
+	args.local_output = local_output;
+	Bench_run_mpi(transpose_rows_trial, &args, &config, MPI_COMM_WORLD, &stats);
+
+	Instr_begin(INSTR_GATHER);
+	MPI_Gatherv(local_output, args.rows * region[2], MPI_UNSIGNED_CHAR, roi_data, row_counts, row_displacements,
+		roi_row_t, 0, MPI_COMM_WORLD);
+	Instr_end(INSTR_GATHER);
+
+	if (my_rank == 0) {
+		Instr_begin(INSTR_WRITE);
+		status = Image_write_gray8(output_path, image, input_image) != 0;
+		Image_close(image);
+		Instr_end(INSTR_WRITE);
+		printf("region: %dx%d at (%d, %d), lut from the %dx%d at (%d, %d)\n", roi->width, roi->height, roi->x,
+			roi->y, stats_roi->width, stats_roi->height, stats_roi->x, stats_roi->y);
+		printf("time elapsed: %e sec per pass (median of %d trials; min %e, p95 %e)\n",
+			stats.median, stats.trials, stats.min, stats.p95);
+		free(input_image);
+	}
+	MPI_Type_free(&stats_row_t);
+	MPI_Type_free(&roi_row_t);
+	free(local_stats);
+	free(local_input);
+	free(local_output);
+	free(stats_displacements);
+	free(stats_counts);
+	free(row_displacements);
+	free(row_counts);
+	return status;
+}
+
+// the rows of region (x, y, width, height) split among the processes, in rows, and the datatype of one of
+// its rows spaced like the image's rows
+MPI_Datatype split_rows(const int * region, int comm_sz, int * row_counts, int * row_displacements) {
+	MPI_Datatype row_type, region_row_t;
+
+	MPI_Type_contiguous(region[2], MPI_UNSIGNED_CHAR, &row_type);
+	MPI_Type_create_resized(row_type, 0, width, &region_row_t);
+	MPI_Type_commit(&region_row_t);
+	MPI_Type_free(&row_type);
+	for (int p = 0, offset = 0; p < comm_sz; p++) {
+		row_counts[p] = region[3] / comm_sz + (p < region[3] % comm_sz);
+		row_displacements[p] = offset;
+		offset += row_counts[p];
+	}
+	return region_row_t;
+}
+
+int serve(const char * socket_path, int my_rank, int comm_sz) {
+	struct image image;
+	unsigned char *input_image = NULL, *output_image = NULL, *local_input = NULL, *local_output = NULL;
+	unsigned char lut[nof_gray_shades];
+	int capacity = 0, local_capacity = 0, chunk_size;
+	int *chunk_sizes = malloc(comm_sz * sizeof(int)), *displacements = malloc(comm_sz * sizeof(int));
+	int job[4], listen_fd = -1, fd = -1, served = 0;
+	char line[SERVER_LINE], reply[SERVER_LINE], output_path[SERVER_LINE];
+	uint64_t key = 0;
+	double start = 0, service = 0;
+
+	if (my_rank == 0) {
+		listen_fd = Server_listen(socket_path);
+		if (listen_fd >= 0)
+			printf("serving on %s: %d processes, kernel %s\n", socket_path, comm_sz, Isa_names[Isa_selected()]);
+		Tune_report(stdout);
+		fflush(stdout);
+	}
+	MPI_Bcast(&listen_fd, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	if (listen_fd < 0) {
+		free(displacements);
+		free(chunk_sizes);
+		return 1;
+	}
+
+	for (;;) {
+		if (my_rank == 0) {
+			fd = Server_next(listen_fd, line, sizeof(line));
+			start = MPI_Wtime();
+			job[2] = open_request(line, &image, job, &input_image, &output_image, &capacity, output_path, reply);
+			if (job[2] == JOB_RUN) {
+				width = job[0];
+				height = job[1];
+				image_size = width * height;
+				if ((job[3] = read_image(&image, input_image, output_image, lut, &key)) < 0) {
+					Image_close(&image);
+					snprintf(reply, sizeof(reply), "error: cannot read the image of %.900s", line);
+					job[2] = JOB_ERROR;
+				}
+			}
+		}
+		Instr_begin(INSTR_BCAST);
+		MPI_Bcast(job, 4, MPI_INT, 0, MPI_COMM_WORLD);
+		Instr_end(INSTR_BCAST);
+		if (job[2] == JOB_QUIT)
+			break;
+		if (job[2] == JOB_ERROR) {
+			if (my_rank == 0)
+				Server_reply(fd, reply);
+			continue;
+		}
+
+		width = job[0];
+		height = job[1];
+		image_size = width * height;
+		for (int p = 0, offset = 0; p < comm_sz; p++) {
+			chunk_sizes[p] = image_size / comm_sz + (p < image_size % comm_sz);
+			displacements[p] = offset;
+			offset += chunk_sizes[p];
+		}
+		chunk_size = chunk_sizes[my_rank];
+		if (chunk_size > local_capacity) {
+			local_capacity = chunk_size;
+			local_input = realloc(local_input, local_capacity);
+			local_output = realloc(local_output, local_capacity);
 		}
+
+		if (job[3] != LUTCACHE_OUTPUT) {
+			Instr_begin(INSTR_BCAST);
+			MPI_Bcast(lut, nof_gray_shades, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+			Instr_end(INSTR_BCAST);
+
+			Instr_begin(INSTR_SCATTER);
+			MPI_Scatterv(input_image, chunk_sizes, displacements, MPI_UNSIGNED_CHAR, local_input, chunk_size, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+			Instr_end(INSTR_SCATTER);
+
+			transpose_image_parallel(local_input, local_output, lut, chunk_size, my_rank);
+
+			Instr_begin(INSTR_GATHER);
+			MPI_Gatherv(local_output, chunk_size, MPI_UNSIGNED_CHAR, output_image, chunk_sizes, displacements, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+			Instr_end(INSTR_GATHER);
+		}
+
+		if (my_rank == 0) {
+			Instr_begin(INSTR_WRITE);
+			if (Image_write_gray8(output_path, &image, output_image) != 0)
+				snprintf(reply, sizeof(reply), "error: cannot write %.900s", output_path);
+			else {
+				snprintf(reply, sizeof(reply), "ok %d %d seconds %.6e%s", width, height, MPI_Wtime() - start,
+					job[3] == LUTCACHE_OUTPUT ? " cached" : "");
+				store_result(key, job[3], &image, lut, output_image);
+			}
+			Image_close(&image);
+			Instr_end(INSTR_WRITE);
+			Server_reply(fd, reply);
+			service += MPI_Wtime() - start;
+			served++;
+		}
+	}
+
+	if (my_rank == 0) {
+		Server_reply(fd, "bye");
+		close(listen_fd);
+		unlink(socket_path);
+		printf("served %d requests, mean service time %.3e s\n", served, served > 0 ? service / served : 0);
+		Lutcache_report(&cache, stdout);
+	}
+	free(local_output);
+	free(local_input);
+	free(output_image);
+	free(input_image);
+	free(displacements);
+	free(chunk_sizes);
+	return 0;
+}
+
+// process 0: open the image of a request line, growing the image buffers to fit it
+int open_request(const char * line, struct image * image, int * dims, unsigned char ** input_image,
+	unsigned char ** output_image, int * capacity, char * output_path, char * reply) {
+
+	char input_path[SERVER_LINE];
+	int fields = sscanf(line, "%1023s %1023s", input_path, output_path);
+
+	if (fields == 1 && strcmp(input_path, "quit") == 0)
+		return JOB_QUIT;
+	if (fields != 2) {
+		snprintf(reply, SERVER_LINE, "error: expected \"<input image> <output image>\" or \"quit\"");
+		return JOB_ERROR;
+	}
+
+	Instr_begin(INSTR_READ);
+	if (Image_open(input_path, image, IMAGE_MAP) != 0) {
+		Instr_end(INSTR_READ);
+		snprintf(reply, SERVER_LINE, "error: cannot open %.900s", input_path);
+		return JOB_ERROR;
+	}
+	dims[0] = image->width;
+	dims[1] = image->height;
+	if (dims[0] * dims[1] > *capacity) {
+		*capacity = dims[0] * dims[1];
+		*input_image = realloc(*input_image, *capacity);
+		*output_image = realloc(*output_image, *capacity);
 	}
-}
\ No newline at end of file
+	Instr_end(INSTR_READ);
+	return JOB_RUN;
+}
+
+// process 0: read an opened image, counting its histogram and image_stats in the same pass, and make its
+// lut; with EQ_CACHE the pixels are hashed in it too, and a cached lut, and output if kept, are used instead
+// of computing them (returns the kind of hit, or -1)
+int read_image(struct image * image, unsigned char * input_image, unsigned char * output_image, unsigned char * lut,
+	uint64_t * key) {
+
+	int histogram[nof_gray_shades], histogram_sum[nof_gray_shades], status, hit = LUTCACHE_MISS;
+
+	initialize_histogram(histogram);
+	Instr_begin(INSTR_READ);
+	if (Lutcache_enabled(&cache)) {
+		status = Lutcache_read(image, input_image, histogram, key);
+		Stats_reset(image_stats, nof_image_stats = 1);
+		snprintf(image_stats[0].name, sizeof(image_stats[0].name), "gray");
+		memcpy(image_stats[0].histogram, histogram, sizeof(histogram));
+		Stats_finish(image_stats, 1);
+	} else {
+		status = (nof_image_stats = Stats_read_gray8(image, input_image, image_stats, show_stats)) < 0;
+		memcpy(histogram, image_stats[0].histogram, sizeof(histogram));
+	}
+	Instr_end(INSTR_READ);
+	if (status != 0)
+		return -1;
+
+	if (Lutcache_enabled(&cache) && (hit = Lutcache_find(&cache, *key, image, lut, output_image)) != LUTCACHE_MISS)
+		return hit;
+
+	Instr_begin(INSTR_HISTOGRAM);
+	calculate_histogram_sum(histogram, histogram_sum);
+	build_lut(histogram_sum, lut, (float)nof_gray_shades, (float)image_size);
+	Instr_end(INSTR_HISTOGRAM);
+	return LUTCACHE_MISS;
+}
+
+// process 0: keep what the cache did not have yet
+void store_result(uint64_t key, int hit, struct image * image, const unsigned char * lut, unsigned char * output_image) {
+	if (!Lutcache_enabled(&cache) || hit == LUTCACHE_OUTPUT || (hit == LUTCACHE_LUT && cache.keep == LUTCACHE_KEEP_LUT))
+		return;
+	Lutcache_store(&cache, key, image, lut, output_image);
+}
@@ -0,0 +1,332 @@
+/*	File: scaling.c
+ *
+ * 	Purpose:	Strong and weak scaling study of the parallel histogram equalization.
+ *				For every (processes, threads) pair the first `processes` ranks run
+ *				the whole pipeline on `threads` threads each: scatter, local
+ *				histograms, allreduce, mapping, LUT apply, gather.  Rank 0 prints
+ *				max/min/mean per-rank times, speedup, efficiency and the Karp-Flatt
+ *				serial fraction, and checks every output against a serial reference.
+ *
+ *	Compile:	mpicc -O2 -g -Wall -o scaling scaling.c -lpthread
+ *	Run:		mpiexec -n <max processes> ./scaling [--mode strong|weak|both]
+ *					[--procs 1,2,4] [--threads 1,2] [--size <edge>] [--image <file>]
+ *
+ *	Notes:
+ *		1.	Strong mode equalizes one image: the --image file, or a synthetic
+ *			<edge> x <edge> image (default 2048).  Weak mode gives every worker
+ *			(process x thread) <edge> x <edge> / 4 pixels of a taller image.
+ *		2.	Output checksums must be bit-identical to the serial reference for
+ *			every process and thread count; a mismatch makes the exit status 1.
+ *		3.	BENCH_TRIALS / BENCH_WARMUP (see bench.h) set the repetitions; each
+ *			rank's time is the median of its trials.
+ *
+ *	Author: Evelyn Evans
+ */
+#define _GNU_SOURCE		// sched_setaffinity, used by affinity.h
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "kernels.h"
+#include "bench.h"
+#include "image_io.h"
+#include "scaling.h"
+
+const int nof_gray_shades = 256;
+
+/* State of one run of the pipeline on one rank */
+struct equalize_job {
+	const unsigned char * local_input;
+	unsigned char * local_output;
+	long chunk_size;
+	long long image_size;
+	long long histogram[KERNELS_GRAY_SHADES];
+	int thread_histogram[SCALING_MAX_THREADS][KERNELS_GRAY_SHADES];
+	unsigned char lut[KERNELS_GRAY_SHADES];
+};
+
+void make_synthetic_image(unsigned char * image, long width, long height, unsigned seed);
+void reference_equalize(const unsigned char * in, unsigned char * out, long long n);
+void build_lut(const long long * histogram, long long n, unsigned char * lut);
+void histogram_thread(void * arg, int thread, int nof_threads);
+void apply_thread(void * arg, int thread, int nof_threads);
+double equalize_parallel(MPI_Comm comm, const unsigned char * image, unsigned char * output, long long image_size,
+	int nof_threads, int base_slot, uint64_t * checksum);
+int run_study(enum scaling_mode mode, const int * procs, int nof_procs, const int * threads, int nof_threads,
+	long edge, const char * image_path, int my_rank, int local_rank);
+
+int main(int argc, char *argv[])
+{
+	int my_rank, comm_sz, local_rank, failures = 0;
+	int procs[SCALING_MAX_POINTS], threads[SCALING_MAX_POINTS] = {1};
+	int nof_procs, nof_threads = 1;
+	const char * mode = "both", * image_path = NULL;
+	long edge = 2048;
+
+	MPI_Init(NULL, NULL);
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+	local_rank = Affinity_pin_rank(NULL, MPI_COMM_WORLD);
+
+	nof_procs = Scaling_powers_of_two(comm_sz, procs);
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "--mode") == 0 && a + 1 < argc)
+			mode = argv[++a];
+		else if (strcmp(argv[a], "--procs") == 0 && a + 1 < argc)
+			nof_procs = Scaling_parse_list(argv[++a], procs, SCALING_MAX_POINTS);
+		else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc)
+			nof_threads = Scaling_parse_list(argv[++a], threads, SCALING_MAX_POINTS);
+		else if (strcmp(argv[a], "--size") == 0 && a + 1 < argc)
+			edge = atol(argv[++a]);
+		else if (strcmp(argv[a], "--image") == 0 && a + 1 < argc)
+			image_path = argv[++a];
+		else
+			nof_procs = -1;
+	}
+	for (int i = 0; i < nof_procs; i++) {
+		if (procs[i] > comm_sz)
+			nof_procs = -1;
+	}
+	for (int i = 0; i < nof_threads; i++) {
+		if (threads[i] > SCALING_MAX_THREADS)
+			nof_threads = -1;
+	}
+	if (nof_procs <= 0 || nof_threads <= 0 || edge < 16) {
+		if (my_rank == 0)
+			fprintf(stderr, "usage: mpiexec -n <p> %s [--mode strong|weak|both] [--procs 1,2,..<=p] "
+					"[--threads 1,2,..] [--size <edge>] [--image <file>]\n", argv[0]);
+		MPI_Finalize();
+		return 1;
+	}
+
+	if (strcmp(mode, "weak") != 0)
+		failures += run_study(SCALING_STRONG, procs, nof_procs, threads, nof_threads, edge, image_path, my_rank, local_rank);
+	if (strcmp(mode, "strong") != 0)
+		failures += run_study(SCALING_WEAK, procs, nof_procs, threads, nof_threads, edge, NULL, my_rank, local_rank);
+
+	MPI_Finalize();
+	return failures != 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	run_study
+ * Purpose:		Measure every (procs, threads) pair, 1 x 1 first, and
+ * 				print the table on rank 0
+ * Return:		number of outputs that did not match the reference
+ * 				(rank 0), 0 elsewhere
+ */
+int run_study(enum scaling_mode mode, const int * procs, int nof_procs, const int * threads, int nof_threads,
+	long edge, const char * image_path, int my_rank, int local_rank) {
+
+	struct scaling_point points[SCALING_MAX_POINTS];
+	struct bench_config config = Bench_default_config();
+	struct image image;
+	unsigned char * input = NULL, * output = NULL, * expect = NULL;
+	long width = edge, height = edge;
+	int n = 0, failures = 0;
+	char title[128];
+
+	if (config.trials > 5 && getenv("BENCH_TRIALS") == NULL)
+		config.trials = 5;
+
+	/* the 1 x 1 baseline, then every requested pair */
+	points[n++] = (struct scaling_point){1, 1, 0, 0, 0, 0, -1};
+	for (int p = 0; p < nof_procs; p++) {
+		for (int t = 0; t < nof_threads && n < SCALING_MAX_POINTS; t++) {
+			if (procs[p] * threads[t] > 1)
+				points[n++] = (struct scaling_point){procs[p], threads[t], 0, 0, 0, 0, -1};
+		}
+	}
+
+	if (mode == SCALING_STRONG && image_path != NULL) {
+		int dims[2];
+		if (my_rank == 0) {
+			if (Image_open(image_path, &image, IMAGE_MAP) != 0)
+				MPI_Abort(MPI_COMM_WORLD, 1);
+			dims[0] = image.width;
+			dims[1] = image.height;
+		}
+		MPI_Bcast(dims, 2, MPI_INT, 0, MPI_COMM_WORLD);
+		width = dims[0];
+		height = dims[1];
+		snprintf(title, sizeof(title), "%s (%ldx%ld)", image_path, width, height);
+	} else if (mode == SCALING_STRONG) {
+		snprintf(title, sizeof(title), "synthetic %ldx%ld image", width, height);
+	} else {
+		snprintf(title, sizeof(title), "%ld pixels per worker", edge * edge / 4);
+	}
+
+	for (int i = 0; i < n; i++) {
+		struct scaling_point * point = &points[i];
+		int workers = point->procs * point->threads;
+		long long image_size;
+		double samples[BENCH_MAX_TRIALS], local;
+		struct bench_stats stats;
+		MPI_Comm comm;
+		uint64_t checksum = 0;
+
+		if (mode == SCALING_WEAK)
+			height = (edge * workers + 3) / 4;
+		image_size = (long long)width * height;
+		point->work = (double)image_size;
+
+		/* rank 0 owns the input, and a serial reference result to check against */
+		if (my_rank == 0 && (mode == SCALING_WEAK || i == 0)) {
+			free(input);
+			free(output);
+			free(expect);
+			input = malloc(image_size);
+			output = malloc(image_size);
+			expect = malloc(image_size);
+			if (input == NULL || output == NULL || expect == NULL)
+				MPI_Abort(MPI_COMM_WORLD, 1);
+			if (mode == SCALING_STRONG && image_path != NULL) {
+				if (Image_read_gray8(&image, input) != 0)
+					MPI_Abort(MPI_COMM_WORLD, 1);
+			} else {
+				make_synthetic_image(input, width, height, 12345u);
+			}
+			reference_equalize(input, expect, image_size);
+		}
+
+		comm = Scaling_comm(point->procs);
+		if (comm != MPI_COMM_NULL) {
+			for (int w = 0; w < config.warmup; w++)
+				equalize_parallel(comm, input, output, image_size, point->threads, local_rank * point->threads, &checksum);
+			for (int t = 0; t < config.trials; t++)
+				samples[t] = equalize_parallel(comm, input, output, image_size, point->threads,
+					local_rank * point->threads, &checksum);
+			Bench_summarize(samples, config.trials, 1, &stats);
+			local = stats.median;
+
+			Scaling_reduce(local, comm, point);
+			if (my_rank == 0) {
+				point->verified = (checksum == Bench_checksum(expect, image_size));
+				failures += !point->verified;
+			}
+			MPI_Comm_free(&comm);
+		}
+		MPI_Barrier(MPI_COMM_WORLD);
+	}
+
+	if (my_rank == 0)
+		Scaling_print_table(stdout, title, mode, points, n);
+	if (mode == SCALING_STRONG && image_path != NULL && my_rank == 0)
+		Image_close(&image);
+	free(input);
+	free(output);
+	free(expect);
+	return failures;
+}
+
+/*------------------------------------------------------------------
+ * Function:	equalize_parallel
+ * Purpose:		Equalize image (on rank 0 of comm) into output with
+ * 				every rank of comm running nof_threads threads
+ * Output args:	checksum:	of the output (rank 0)
+ * Return:		this rank's elapsed time, from a barrier to the end of
+ * 				its part of the gather
+ */
+double equalize_parallel(MPI_Comm comm, const unsigned char * image, unsigned char * output, long long image_size,
+	int nof_threads, int base_slot, uint64_t * checksum) {
+
+	static struct equalize_job job;
+	int my_rank, comm_sz, *counts, *displs;
+	long long local_histogram[KERNELS_GRAY_SHADES];
+	unsigned char * local_input, * local_output;
+	double start, elapsed;
+
+	MPI_Comm_rank(comm, &my_rank);
+	MPI_Comm_size(comm, &comm_sz);
+	counts = malloc(comm_sz * sizeof(int));
+	displs = malloc(comm_sz * sizeof(int));
+	for (int p = 0; p < comm_sz; p++) {
+		long first, count;
+		Scaling_block(image_size, p, comm_sz, &first, &count);
+		counts[p] = (int)count;
+		displs[p] = (int)first;
+	}
+	local_input = malloc(counts[my_rank] + 1);
+	local_output = malloc(counts[my_rank] + 1);
+
+	MPI_Barrier(comm);
+	start = MPI_Wtime();
+
+	MPI_Scatterv(image, counts, displs, MPI_UNSIGNED_CHAR, local_input, counts[my_rank], MPI_UNSIGNED_CHAR, 0, comm);
+
+	job.local_input = local_input;
+	job.local_output = local_output;
+	job.chunk_size = counts[my_rank];
+	job.image_size = image_size;
+	Scaling_run_threads(histogram_thread, &job, nof_threads, base_slot);
+	for (int k = 0; k < KERNELS_GRAY_SHADES; k++) {
+		local_histogram[k] = 0;
+		for (int t = 0; t < nof_threads; t++)
+			local_histogram[k] += job.thread_histogram[t][k];
+	}
+	MPI_Allreduce(local_histogram, job.histogram, KERNELS_GRAY_SHADES, MPI_LONG_LONG, MPI_SUM, comm);
+
+	build_lut(job.histogram, image_size, job.lut);
+	Scaling_run_threads(apply_thread, &job, nof_threads, base_slot);
+
+	MPI_Gatherv(local_output, counts[my_rank], MPI_UNSIGNED_CHAR, output, counts, displs, MPI_UNSIGNED_CHAR, 0, comm);
+	elapsed = MPI_Wtime() - start;
+
+	if (my_rank == 0)
+		*checksum = Bench_checksum(output, image_size);
+	free(local_input);
+	free(local_output);
+	free(counts);
+	free(displs);
+	return elapsed;
+}
+
+void histogram_thread(void * arg, int thread, int nof_threads) {
+	struct equalize_job * job = arg;
+	long first, count;
+
+	Scaling_block(job->chunk_size, thread, nof_threads, &first, &count);
+	memset(job->thread_histogram[thread], 0, sizeof(job->thread_histogram[thread]));
+	Kernel_histogram(job->local_input + first, count, job->thread_histogram[thread]);
+}
+
+void apply_thread(void * arg, int thread, int nof_threads) {
+	struct equalize_job * job = arg;
+	long first, count;
+
+	Scaling_block(job->chunk_size, thread, nof_threads, &first, &count);
+	Kernel_apply_lut(job->local_input + first, job->local_output + first, count, job->lut);
+}
+
+/* The mapping par-3.c uses: cumulative histogram scaled to 256 levels */
+void build_lut(const long long * histogram, long long n, unsigned char * lut) {
+	float Dm = nof_gray_shades, area = n;
+	long long sum = 0;
+
+	for (int k = 0; k < nof_gray_shades; k++) {
+		sum += histogram[k];
+		lut[k] = (unsigned char)((Dm/area) * sum);
+	}
+}
+
+/* Plain serial equalization, the result every configuration must reproduce */
+void reference_equalize(const unsigned char * in, unsigned char * out, long long n) {
+	long long histogram[KERNELS_GRAY_SHADES] = {0};
+	unsigned char lut[KERNELS_GRAY_SHADES];
+
+	for (long long i = 0; i < n; i++)
+		histogram[in[i]]++;
+	build_lut(histogram, n, lut);
+	for (long long i = 0; i < n; i++)
+		out[i] = lut[in[i]];
+}
+
+/* A low-contrast test card: diagonal gradient squeezed into 64..191 plus noise */
+void make_synthetic_image(unsigned char * image, long width, long height, unsigned seed) {
+	for (long y = 0; y < height; y++) {
+		for (long x = 0; x < width; x++) {
+			seed = seed * 1103515245u + 12345u;
+			image[y * width + x] = 64 + (((x + y) * 127 / (width + height - 1) + (seed >> 28)) & 127);
+		}
+	}
+}
@@ -0,0 +1,182 @@
+/* File:     scaling.h
+ *
+ * Purpose:  Helpers for strong and weak scaling studies inside one MPI
+ *           job: run a workload on the first p ranks with t threads each,
+ *           reduce the per-rank times to max / min / mean, and print
+ *           speedup, parallel efficiency and the Karp-Flatt serial
+ *           fraction against the 1 x 1 run.
+ *
+ *              strong   fixed problem:  S = T(1) / T(P),      E = S / P
+ *              weak     problem grows with P:
+ *                                       E = T(1) / T(P),      S = E * P
+ *              Karp-Flatt serial fraction  e = (1/S - 1/P) / (1 - 1/P)
+ *
+ *           P is the number of workers, ranks x threads.  T is the
+ *           slowest rank's time, since that is when the job finishes.
+ *
+ * Note:     The including file must define _GNU_SOURCE and include
+ *           mpi.h before this file (threads are pinned with affinity.h).
+ */
+#ifndef _SCALING_H_
+#define _SCALING_H_
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "affinity.h"
+
+#define SCALING_MAX_POINTS 64
+#define SCALING_MAX_THREADS 256
+
+enum scaling_mode { SCALING_STRONG, SCALING_WEAK };
+
+struct scaling_point {
+	int procs, threads;
+	double t_max, t_min, t_mean;	/* per-rank times, seconds */
+	double work;					/* problem size (pixels, terms) */
+	int verified;					/* 1 ok, 0 mismatch, -1 not checked */
+};
+
+/*---------------------------------------------------------------- threads */
+
+typedef void (*scaling_thread_fn)(void * arg, int thread, int nof_threads);
+
+struct scaling_thread {
+	scaling_thread_fn fn;
+	void * arg;
+	int thread, nof_threads, slot;
+	pthread_t id;
+};
+
+static inline void * Scaling_thread_main(void * p) {
+	struct scaling_thread * t = p;
+
+	Affinity_pin_thread(NULL, t->slot, NULL);
+	t->fn(t->arg, t->thread, t->nof_threads);
+	return NULL;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Scaling_run_threads
+ * Purpose:		Run fn(arg, t, nof_threads) for t = 0 .. nof_threads-1,
+ * 				thread 0 on the caller, and wait for all of them
+ * Input args:	base_slot:	affinity slot of thread 0 (node-local rank
+ * 							times nof_threads)
+ */
+static inline void Scaling_run_threads(scaling_thread_fn fn, void * arg, int nof_threads, int base_slot) {
+	struct scaling_thread threads[SCALING_MAX_THREADS];
+
+	if (nof_threads > SCALING_MAX_THREADS)
+		nof_threads = SCALING_MAX_THREADS;
+	for (int t = 1; t < nof_threads; t++) {
+		threads[t] = (struct scaling_thread){fn, arg, t, nof_threads, base_slot + t, 0};
+		pthread_create(&threads[t].id, NULL, Scaling_thread_main, &threads[t]);
+	}
+	if (nof_threads > 1)
+		Affinity_pin_thread(NULL, base_slot, NULL);
+	fn(arg, 0, nof_threads);
+	for (int t = 1; t < nof_threads; t++)
+		pthread_join(threads[t].id, NULL);
+}
+
+/* [first, first+count) of n items for part `part` of `parts`, remainder spread over the first parts */
+static inline void Scaling_block(long n, int part, int parts, long * first, long * count) {
+	long base = n / parts, extra = n % parts;
+
+	*count = base + (part < extra);
+	*first = part * base + (part < extra ? part : extra);
+}
+
+/*---------------------------------------------------------------- ranks */
+
+/* Communicator of world ranks 0 .. procs-1 (MPI_COMM_NULL on the others) */
+static inline MPI_Comm Scaling_comm(int procs) {
+	int my_rank;
+	MPI_Comm comm;
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+	MPI_Comm_split(MPI_COMM_WORLD, my_rank < procs ? 0 : MPI_UNDEFINED, my_rank, &comm);
+	return comm;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Scaling_reduce
+ * Purpose:		Reduce each rank's time to max, min and mean on rank 0
+ * 				of comm
+ * Input args:	local:	this rank's time
+ * Output args:	point:	t_max, t_min, t_mean (rank 0 only)
+ */
+static inline void Scaling_reduce(double local, MPI_Comm comm, struct scaling_point * point) {
+	double sum;
+	int comm_sz;
+
+	MPI_Comm_size(comm, &comm_sz);
+	MPI_Reduce(&local, &point->t_max, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+	MPI_Reduce(&local, &point->t_min, 1, MPI_DOUBLE, MPI_MIN, 0, comm);
+	MPI_Reduce(&local, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+	point->t_mean = sum / comm_sz;
+}
+
+/* Parse "1,2,4" into values[], returning the count or -1 */
+static inline int Scaling_parse_list(const char * list, int * values, int max) {
+	int n = 0;
+	char * end;
+
+	while (*list != '\0' && n < max) {
+		long v = strtol(list, &end, 10);
+		if (end == list || v <= 0)
+			return -1;
+		values[n++] = (int)v;
+		list = (*end == ',') ? end + 1 : end;
+	}
+	return n;
+}
+
+/* 1, 2, 4, ... up to max, plus max itself */
+static inline int Scaling_powers_of_two(int max, int * values) {
+	int n = 0;
+
+	for (int v = 1; v < max && n < SCALING_MAX_POINTS - 1; v *= 2)
+		values[n++] = v;
+	values[n++] = max;
+	return n;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Scaling_print_table
+ * Purpose:		Print the times, speedup, efficiency and Karp-Flatt
+ * 				serial fraction of each point, relative to points[0]
+ * 				(which should be the 1 x 1 run)
+ */
+static inline void Scaling_print_table(FILE * out, const char * title, enum scaling_mode mode,
+		const struct scaling_point * points, int n) {
+	double t1 = points[0].t_max;
+
+	fprintf(out, "\n%s scaling: %s\n", mode == SCALING_STRONG ? "strong" : "weak", title);
+	fprintf(out, "%5s %7s %7s %12s %12s %12s %14s %9s %9s %11s  %s\n", "procs", "threads", "workers",
+			"max (s)", "min (s)", "mean (s)", "work", "speedup", "effic.", "serial frac", "check");
+	for (int i = 0; i < n; i++) {
+		const struct scaling_point * p = &points[i];
+		int workers = p->procs * p->threads;
+		double efficiency, speedup;
+		char karp_flatt[32] = "-";
+
+		if (mode == SCALING_STRONG) {
+			speedup = t1 / p->t_max;
+			efficiency = speedup / workers;
+		} else {
+			efficiency = t1 / p->t_max;
+			speedup = efficiency * workers;
+		}
+		if (workers > 1)
+			snprintf(karp_flatt, sizeof(karp_flatt), "%.4f", (1.0 / speedup - 1.0 / workers) / (1.0 - 1.0 / workers));
+
+		fprintf(out, "%5d %7d %7d %12.4e %12.4e %12.4e %14.0f %9.3f %9.3f %11s  %s\n", p->procs, p->threads,
+				workers, p->t_max, p->t_min, p->t_mean, p->work, speedup, efficiency, karp_flatt,
+				p->verified > 0 ? "ok" : (p->verified == 0 ? "MISMATCH" : "-"));
+	}
+	fflush(out);
+}
+
+#endif
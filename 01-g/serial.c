@@ -2,17 +2,31 @@
  *
  * 	Purpose:	Implement histogram equalization to sharpen the quality of an image.
  * 
- *	Compile:	gcc serial.c -o serial
- *	Run:		./serial
+ *	Compile:	gcc -O2 serial.c -o serial -lm
+ *	Run:		./serial [input image] [output image]
+ *				./serial <input image> <output image> --roi <x>,<y>,<w>x<h> [--stats-roi <x>,<y>,<w>x<h>]
+ *				./serial ... --stats		(min, max, mean and percentiles of the gray and colour channels)
+ *				./serial --bench-kernels		(compare the SIMD variants, see kernels.h)
+ *				KERNEL_ISA=sse2|avx2|avx512 ./serial ...	(force a variant)
+ *				BENCH_TRIALS=<n> ./serial ...	(number of timed passes, see bench.h; bench.c runs the full suite)
+ *				./tune first saves this host's best settings, loaded here at startup (see tune.c)
  *
- *	Input:		images/lena512.bmp
- * 	Output:		images/lena_copy.bmp (histogram equalized)
+ *	Input:		images/lena512.bmp, or any BMP/PGM/PPM/raw image (see image_io.h)
+ * 	Output:		images/lena_copy.bmp (histogram equalized, same format as the input)
  *
  *	Notes:
  *		1. 	The code for reading and writing BMP files was based off of Abhijit Nathwani's work 
  *			(https://abhijitnathwani.github.io/blog/2017/12/20/First-C-Program-for-Image-Processing)
  *		2. 	The algorithm for histogram equalization was adapted from Image Processing in C
  *			(2e) by Dwayne Phillips
+ *		3. 	The phase times at the end come from instrument.h (INSTR_COUNTERS=1 adds hardware counters)
+ *		4.	With --roi only that region is equalized, by the histogram of --stats-roi (default: the
+ *			region itself), and the rest is written unchanged.  Both are strided views of the image
+ *			(see Image_roi_view), so nothing is copied; the timed passes write the region to out, and
+ *			the written image gets one more pass in place.
+ *		5.	The histogram is counted band by band as the image is read (see stats.h), so every pixel
+ *			is read from memory twice: once there and once to apply the lut.  --stats prints the
+ *			statistics of that pass, with the stored channels of a colour image counted in it too.
  *
  *	Author: Evelyn Evans
  */
@@ -20,48 +34,108 @@
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
-#include "timer.h"
-
-const int height = 512;
-const int width = 512;
-const int image_size = 512*512; 
-const int bmp_header_size = 54;
-const int color_table_size = 1024;
+#include "image_io.h"
+#include "kernels.h"
+#include "bench.h"
+#include "instrument.h"
+#include "tune.h"
+#include "stats.h"
+
+int height, width, image_size;		// taken from the input image
+struct image_roi roi;				// the region to equalize: the whole image without --roi
+long stats_area;					// the pixels the histogram counted
 const int nof_gray_shades = 256;
-const int bloat = 16384; // 2^14
 
 void initialize_histogram(int * histogram);
-void read_bmp(unsigned char * buf, unsigned char * header, unsigned char * colorTable);
-void write_bmp(unsigned char * buf, unsigned char * header, unsigned char * colorTable);
-void calculate_histogram(unsigned char * buf, int * histogram);
 void calculate_pdf(int * histogram, int * pdf);
 void cdf(unsigned char * buf, unsigned char * out, int * pdf);
+void cdf_trial(void * arg);
+
+struct cdf_args {
+	unsigned char * buf, * out;
+	int * pdf;
+};
 
 int main(int argc,char *argv[])
 {
-    unsigned char buf[image_size], out[image_size], header[bmp_header_size], colorTable[color_table_size];
+	const char * input_path = (argc > 1 && argv[1][0] != '-') ? argv[1] : "images/lena512.bmp";
+	const char * output_path = (argc > 2 && argv[1][0] != '-' && argv[2][0] != '-') ? argv[2] : "images/lena_copy.bmp";
+	struct image image;
+	struct image_roi stats_roi;
+	struct image_band view;
+	int roi_mode, stats_given, nof_stats, show_stats = Stats_requested(argc, argv);
+	struct channel_stats image_stats[1 + STATS_MAX_CHANNELS];
+	unsigned char *buf, *out;
 	int histogram[nof_gray_shades], pdf[nof_gray_shades];
-	double start_time, finish_time;
-
+	struct bench_config config = Bench_default_config();
+	struct bench_stats stats;
+	struct cdf_args args;
+
+	Tune_load("equalize");
+	if (argc > 1 && strcmp(argv[1], "--bench-kernels") == 0)
+		return Kernels_benchmark(64L << 20);
+
+	Instr_begin(INSTR_READ);
+	if (Image_open(input_path, &image, IMAGE_MAP) != 0)
+		exit(1);
+	width = image.width;
+	height = image.height;
+	image_size = width * height;
+	if ((roi_mode = Image_select_roi(argc, argv, "--roi", &image, &roi)) < 0
+			|| (stats_given = Image_select_roi(argc, argv, "--stats-roi", &image, &stats_roi)) < 0)
+		exit(1);
+	if (!stats_given)
+		stats_roi = roi;
+	roi_mode |= stats_given;
+	stats_area = (long)stats_roi.width * stats_roi.height;
+	printf("width: %d\n", width);
+	printf("height: %d\n", height);
+	printf("kernel: %s\n", Isa_names[Isa_selected()]);
+	Tune_report(stdout);
+
+	buf = malloc(image_size);
+	out = malloc(image_size);
+	if ((nof_stats = Stats_read_gray8(&image, buf, image_stats, show_stats)) < 0)
+		exit(1);
+	Instr_end(INSTR_READ);
+	if (show_stats)
+		Stats_print(stdout, image_stats, nof_stats);
+
+	Instr_begin(INSTR_HISTOGRAM);
 	initialize_histogram(histogram);
-    read_bmp(buf, header, colorTable);
-	calculate_histogram(buf, histogram);
+	if (roi_mode) {
+		Image_roi_view(&image, buf, &stats_roi, &view);
+		Kernel_histogram_rows(view.data, stats_roi.width, view.rows, view.stride, histogram);
+	} else {
+		memcpy(histogram, image_stats[0].histogram, sizeof(histogram));
+	}
 	calculate_pdf(histogram, pdf);
+	Instr_end(INSTR_HISTOGRAM);
 
 	/* Start Critical Function */
 
-	GET_TIME(start_time);
-
-	for(int i = 0; i < bloat; i++) {
-		cdf(buf, out, pdf);
-	}
-
-	GET_TIME(finish_time);
+	args.buf = buf;
+	args.out = out;
+	args.pdf = pdf;
+	Bench_run(cdf_trial, &args, &config, &stats);
 
 	/* End Critical Function */
 
-    write_bmp(out, header, colorTable);
-	printf("time elapsed: %f sec\n", finish_time - start_time);
+	Instr_begin(INSTR_WRITE);
+	if (roi_mode) {
+		// out only holds the region: equalize it where it is and write the whole image
+		cdf(buf, buf, pdf);
+		printf("region: %dx%d at (%d, %d), lut from the %dx%d at (%d, %d)\n", roi.width, roi.height, roi.x, roi.y,
+			stats_roi.width, stats_roi.height, stats_roi.x, stats_roi.y);
+	}
+	Image_write_gray8(output_path, &image, roi_mode ? buf : out);
+	Image_close(&image);
+	Instr_end(INSTR_WRITE);
+	free(buf);
+	free(out);
+	printf("time elapsed: %e sec per pass (median of %d trials; min %e, p95 %e)\n",
+		stats.median, stats.trials, stats.min, stats.p95);
+	Instr_report(stdout);
 
 	return 0;
 }
@@ -72,64 +146,6 @@ void initialize_histogram(int * histogram) {
 	}
 }
 
-void read_bmp(unsigned char * buf, unsigned char * header, unsigned char * colorTable) {
-	int i;
-
-	FILE *streamIn; 
-        streamIn = fopen("images/lena512.bmp", "r"); // Input file name
-   
-        if (streamIn == (FILE *)0) // check if the input file has not been opened succesfully.
-	{
-            printf("File opening error ocurred. Exiting program.\n");
-            exit(0);
- 	}
-	
- 	int count = 0;
- 	for(i=0;i<54;i++) 
- 	{
- 		header[i] = getc(streamIn);  // strip out BMP header
- 		
- 	}
- 	int width = *(int*)&header[18]; // read the width from the image header
- 	int height = *(int*)&header[22]; // read the height from the image header
-	int bitDepth = *(int*)&header[28]; // read the bitDepth from the image header
-
-	if(bitDepth <= 8)
-		fread(colorTable, sizeof(unsigned char), 1024, streamIn);
-
-
-	printf("width: %d\n",width);
-	printf("height: %d\n",height );
-
-	fread(buf, sizeof(unsigned char), (height * width), streamIn);
-	
- 	fclose(streamIn);
-}
-
-void write_bmp(unsigned char * buf, unsigned char * header, unsigned char * colorTable) {
-	int width = *(int*)&header[18]; // read the width from the image header
-	int height = *(int*)&header[22]; // read the height from the image header
-   	int bitDepth = *(int*)&header[28]; // read the bitDepth from the image header
-
-	FILE *fo = fopen("images/lena_copy.bmp","wb"); // Output File name
-	fwrite(header, sizeof(unsigned char), 54, fo); // write the image header to output file
-	if(bitDepth <= 8)
-		fwrite(colorTable, sizeof(unsigned char), 1024, fo);	
-	fwrite(buf, sizeof(unsigned char), (height * width), fo);
-	 	
-	fclose(fo);
-}
-
-void calculate_histogram(unsigned char * buf, int * histogram) {
-	int i, j, k;
-	for(i = 0; i < height; i++) {
-		for(j = 0; j < width; j++) {
-			k = (int)buf[(i * width) + j];
-			histogram[k]++;
-		}
-	}
-}
-
 void calculate_pdf(int * histogram, int * pdf) {
 	int i;
 	int sum = 0;
@@ -140,13 +156,20 @@ void calculate_pdf(int * histogram, int * pdf) {
 }
 
 void cdf(unsigned char * buf, unsigned char * out, int * pdf) {
-	int i, j, k;
-	float area = image_size;
+	int k;
+	float area = stats_area;
 	float Dm = nof_gray_shades;
-	for(i = 0; i < height; i++) {
-		for(j = 0; j < width; j++) {
-			k = buf[(i * width) + j];
-			out[(i * width) + j] = nof_gray_shades*((Dm/area) * (pdf[k]/nof_gray_shades));
-		}
+	long first = (long)roi.y * width + roi.x;
+	unsigned char lut[nof_gray_shades];
+	INSTR_SCOPE(INSTR_COMPUTE);
+
+	// the mapping only depends on the gray level, so evaluate it once per level
+	for(k = 0; k < nof_gray_shades; k++) {
+		lut[k] = nof_gray_shades*((Dm/area) * (pdf[k]/nof_gray_shades));
 	}
-}
\ No newline at end of file
+	Kernel_apply_lut_rows(buf + first, width, out + first, width, roi.width, roi.height, lut);
+}
+void cdf_trial(void * arg) {
+	struct cdf_args * args = arg;
+	cdf(args->buf, args->out, args->pdf);
+}
@@ -0,0 +1,143 @@
+/*	File: stats.c
+ *
+ * 	Purpose:	Histograms and summary statistics (min, max, mean, standard deviation,
+ *				percentiles) of every channel of several images, in one pass over all of
+ *				them with the tiled engine of stats.h, timed against a pass per channel.
+ *
+ *	Compile:	gcc -O2 -Wall -o stats stats.c -lm
+ *	Run:		./stats <image> [<image> ...]
+ *
+ *	Notes:
+ *		1.	Images with 8-bit samples are read straight from the mapped file, all their
+ *			channels at once (planar raw images as a plane per channel).  Others
+ *			(16-bit or maxval below 255) are converted to 8-bit gray first and only
+ *			that is counted.
+ *		2.	Both timings are the median of 5 trials (BENCH_TRIALS overrides, see
+ *			bench.h); the files are in the page cache after the first.
+ *
+ *	Author: Evelyn Evans
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image_io.h"
+#include "kernels.h"
+#include "bench.h"
+#include "stats.h"
+
+#define MAX_IMAGES 16
+
+struct stats_case {
+	struct stats_plane planes[STATS_MAX_PLANES];
+	int nof_planes, nof_channels;
+	struct channel_stats * stats;
+};
+
+int add_image(struct image * image, unsigned char ** gray, struct stats_case * c);
+void one_pass(void * arg);
+void pass_per_channel(void * arg);
+
+int main(int argc, char *argv[])
+{
+	struct image images[MAX_IMAGES];
+	unsigned char * gray[MAX_IMAGES] = {NULL};
+	int first_channel[MAX_IMAGES + 1];
+	struct bench_config config = Bench_default_config();
+	struct bench_stats fused, separate;
+	struct stats_case c = {.nof_planes = 0, .nof_channels = 0};
+	int nof_images = argc - 1;
+	long bytes = 0;
+
+	if (nof_images < 1 || nof_images > MAX_IMAGES) {
+		fprintf(stderr, "usage: %s <image> [<image> ...] (at most %d)\n", argv[0], MAX_IMAGES);
+		return 1;
+	}
+	if (config.trials > 5 && getenv("BENCH_TRIALS") == NULL)
+		config.trials = 5;
+
+	for (int i = 0; i < nof_images; i++) {
+		first_channel[i] = c.nof_channels;
+		if (Image_open(argv[i + 1], &images[i], IMAGE_MAP) != 0 || add_image(&images[i], &gray[i], &c) != 0)
+			return 1;
+	}
+	first_channel[nof_images] = c.nof_channels;
+	for (int p = 0; p < c.nof_planes; p++)
+		bytes += c.planes[p].width * c.planes[p].rows * c.planes[p].channels;
+
+	c.stats = malloc(c.nof_channels * sizeof(*c.stats));
+	Bench_run(pass_per_channel, &c, &config, &separate);
+	Bench_run(one_pass, &c, &config, &fused);
+	Stats_finish(c.stats, c.nof_channels);
+
+	for (int i = 0; i < nof_images; i++) {
+		printf("%s: %dx%d\n", argv[i + 1], images[i].width, images[i].height);
+		if (gray[i] != NULL)
+			snprintf(c.stats[first_channel[i]].name, sizeof(c.stats[0].name), "gray");
+		else
+			Stats_name_channels(&images[i], c.stats + first_channel[i]);
+		Stats_print(stdout, c.stats + first_channel[i], first_channel[i + 1] - first_channel[i]);
+		printf("\n");
+	}
+	printf("%d channels, %ld samples: one pass %e s (%.2f GB/s), a pass per channel %e s (%.2f GB/s)\n",
+		c.nof_channels, bytes, fused.median, bytes / fused.median / 1e9, separate.median,
+		bytes / separate.median / 1e9);
+
+	for (int i = 0; i < nof_images; i++) {
+		Image_close(&images[i]);
+		free(gray[i]);
+	}
+	free(c.stats);
+	return 0;
+}
+
+// the planes of one image: its mapped samples when they are 8-bit, else a gray copy
+int add_image(struct image * image, unsigned char ** gray, struct stats_case * c) {
+	struct image_band view;
+	int planes = image->planar ? image->channels : 1;
+
+	if (c->nof_planes + planes > STATS_MAX_PLANES) {
+		fprintf(stderr, "stats: too many planes\n");
+		return -1;
+	}
+	if (image->depth == 1 && image->maxval == 255 && Image_view(image, &view) == 0) {
+		for (int p = 0; p < planes; p++)
+			c->planes[c->nof_planes++] = (struct stats_plane){view.data + p * view.plane_stride, image->width,
+				view.rows, view.stride, image->planar ? 1 : image->channels};
+		c->nof_channels += image->channels;
+		return 0;
+	}
+	*gray = malloc((size_t)image->width * image->height);
+	if (Image_read_gray8(image, *gray) != 0)
+		return -1;
+	c->planes[c->nof_planes++] = (struct stats_plane){*gray, image->width, image->height, image->width, 1};
+	c->nof_channels++;
+	return 0;
+}
+
+void one_pass(void * arg) {
+	struct stats_case * c = arg;
+
+	Stats_reset(c->stats, c->nof_channels);
+	Stats_collect(c->planes, c->nof_planes, c->stats);
+}
+
+// the way without the engine: a full pass over each plane for each of its channels
+void pass_per_channel(void * arg) {
+	struct stats_case * c = arg;
+
+	Stats_reset(c->stats, c->nof_channels);
+	for (int p = 0, first = 0; p < c->nof_planes; first += c->planes[p].channels, p++) {
+		const struct stats_plane * plane = &c->planes[p];
+
+		for (int k = 0; k < plane->channels; k++) {
+			int * histogram = c->stats[first + k].histogram;
+
+			for (long y = 0; y < plane->rows; y++) {
+				const unsigned char * row = plane->data + y * plane->stride + k;
+
+				for (long x = 0; x < plane->width; x++)
+					histogram[row[x * plane->channels]]++;
+			}
+		}
+	}
+}
@@ -0,0 +1,283 @@
+/* File:     stats.h
+ *
+ * Purpose:  Histograms and summary statistics (min, max, mean, standard
+ *           deviation and percentiles) of several channels or images in
+ *           one streaming pass.  Each source is a plane of rows of 8-bit
+ *           samples, 1 to STATS_MAX_CHANNELS per pixel interleaved, such as
+ *           a gray buffer, a band of a 24-bit BMP or a whole mapped image;
+ *           a plane with c channels fills c entries of the statistics.
+ *
+ *           Stats_collect walks all the planes at once, a tile of
+ *           STATS_TILE_PIXELS pixels of each in turn, so the tables of every
+ *           channel (two interleaved sub-histograms per channel, to break
+ *           the store-to-load chains as in kernels.h) stay in cache for the
+ *           whole pass instead of being reloaded by a pass per channel.  The
+ *           summary statistics all come from the histograms afterwards, so
+ *           they cost no extra pass either.
+ *
+ *           Stats_read_gray8 is Image_read_gray8 with the statistics of the
+ *           gray pixels (counted by Kernel_histogram, the variant the tuner
+ *           picked), and of the stored channels of an 8-bit colour image,
+ *           collected band by band while each band is in cache: the
+ *           equalizers then read every pixel from memory twice in total,
+ *           once here and once to apply the lut.
+ *
+ * Example:
+ *    struct channel_stats stats[1 + STATS_MAX_CHANNELS];
+ *    . . .
+ *    n = Stats_read_gray8(&img, gray, stats, 1);   // stats[0]: gray, then the channels
+ *    . . .  stats[0].histogram is the histogram to equalize by  . . .
+ *    Stats_print(stdout, stats, n);
+ *
+ *    struct stats_plane planes[2] = {{gray, width, height, width, 1}, {rgb, width, height, 3 * width, 3}};
+ *    Stats_reset(stats, 4);
+ *    Stats_collect(planes, 2, stats);              // gray, red, green, blue in one pass
+ *    Stats_finish(stats, 4);
+ */
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image_io.h"
+#include "kernels.h"
+
+#define STATS_MAX_CHANNELS 4		/* samples per pixel of one plane */
+#define STATS_MAX_PLANES 64
+#define STATS_TILE_PIXELS 4096		/* pixels of one plane per turn */
+#define STATS_NOF_PERCENTILES 5
+
+static const int Stats_percentile_list[STATS_NOF_PERCENTILES] = {1, 5, 50, 95, 99};
+
+struct channel_stats {
+	char name[24];
+	int histogram[KERNELS_GRAY_SHADES];
+	long count;
+	int min, max;
+	double mean, stddev;
+	int percentile[STATS_NOF_PERCENTILES];	/* of Stats_percentile_list */
+};
+
+/* rows rows of width pixels of channels interleaved 8-bit samples, stride bytes apart */
+struct stats_plane {
+	const unsigned char * data;
+	long width, rows, stride;
+	int channels;
+};
+
+/* Clear n entries; names them "channel <i>" */
+static inline void Stats_reset(struct channel_stats * stats, int n) {
+	memset(stats, 0, n * sizeof(*stats));
+	for (int i = 0; i < n; i++)
+		snprintf(stats[i].name, sizeof(stats[i].name), "channel %d", i);
+}
+
+/* Name the entries of img's channels in stored order: "gray", "red", "green", "blue", ... */
+static inline void Stats_name_channels(const struct image * img, struct channel_stats * stats) {
+	static const char * const rgb[] = {"red", "green", "blue"}, * const bgr[] = {"blue", "green", "red"};
+
+	for (int c = 0; c < img->channels; c++) {
+		if (img->channels == 1)
+			snprintf(stats[c].name, sizeof(stats[c].name), "gray");
+		else if (img->channels == 3)
+			snprintf(stats[c].name, sizeof(stats[c].name), "%s", img->bgr ? bgr[c] : rgb[c]);
+		else
+			snprintf(stats[c].name, sizeof(stats[c].name), "channel %d", c);
+	}
+}
+
+/* n pixels of one row into two sub-histograms per channel; channels is a constant at every call */
+static inline __attribute__((always_inline))
+void Stats_span_body(const unsigned char * in, long n, int (* sub)[KERNELS_GRAY_SHADES], const int channels) {
+	long i;
+
+	for (i = 0; i + 2 <= n; i += 2) {
+		const unsigned char * even = in + i * channels, * odd = even + channels;
+
+		for (int c = 0; c < channels; c++) {
+			sub[2*c][even[c]]++;
+			sub[2*c + 1][odd[c]]++;
+		}
+	}
+	if (i < n)
+		for (int c = 0; c < channels; c++)
+			sub[2*c][in[i * channels + c]]++;
+}
+
+static inline void Stats_span(const unsigned char * in, long n, int (* sub)[KERNELS_GRAY_SHADES], int channels) {
+	switch (channels) {
+	case 1:
+		Stats_span_body(in, n, sub, 1);
+		break;
+	case 2:
+		Stats_span_body(in, n, sub, 2);
+		break;
+	case 3:
+		Stats_span_body(in, n, sub, 3);
+		break;
+	default:
+		Stats_span_body(in, n, sub, 4);
+		break;
+	}
+}
+
+/*------------------------------------------------------------------
+ * Function:	Stats_collect
+ * Purpose:		Add the samples of every plane to the histograms of
+ * 				stats, the planes' channels in order, one tile of each
+ * 				plane in turn
+ * In/out args:	stats:	one entry per channel of all the planes;
+ * 						only the histograms change (see Stats_finish)
+ * Return:		0, or -1 if a plane has no or too many channels
+ */
+static inline int Stats_collect(const struct stats_plane * planes, int nof_planes, struct channel_stats * stats) {
+	long row[STATS_MAX_PLANES], column[STATS_MAX_PLANES];
+	int (* sub)[KERNELS_GRAY_SHADES];
+	int nof_channels = 0, busy = nof_planes;
+
+	if (nof_planes > STATS_MAX_PLANES)
+		return -1;
+	for (int p = 0; p < nof_planes; p++) {
+		if (planes[p].channels < 1 || planes[p].channels > STATS_MAX_CHANNELS)
+			return -1;
+		nof_channels += planes[p].channels;
+		row[p] = column[p] = 0;
+	}
+	sub = calloc(2 * nof_channels, sizeof(*sub));
+
+	while (busy > 0) {
+		busy = 0;
+		for (int p = 0, first = 0; p < nof_planes; first += planes[p].channels, p++) {
+			const struct stats_plane * plane = &planes[p];
+			long n;
+
+			if (row[p] >= plane->rows || plane->width <= 0)
+				continue;
+			n = plane->width - column[p] < STATS_TILE_PIXELS ? plane->width - column[p] : STATS_TILE_PIXELS;
+			Stats_span(plane->data + row[p] * plane->stride + column[p] * plane->channels, n, sub + 2 * first,
+					plane->channels);
+			column[p] += n;
+			if (column[p] == plane->width) {
+				column[p] = 0;
+				row[p]++;
+			}
+			busy += row[p] < plane->rows;
+		}
+	}
+
+	for (int c = 0; c < nof_channels; c++)
+		for (int k = 0; k < KERNELS_GRAY_SHADES; k++)
+			stats[c].histogram[k] += sub[2*c][k] + sub[2*c + 1][k];
+	free(sub);
+	return 0;
+}
+
+/* Level below which a fraction q of the samples lie (nearest rank) */
+static inline int Stats_percentile(const struct channel_stats * s, double q) {
+	long rank = (long)ceil(q * s->count), seen = 0;
+
+	for (int k = 0; k < KERNELS_GRAY_SHADES; k++)
+		if ((seen += s->histogram[k]) >= rank && seen > 0)
+			return k;
+	return s->max;
+}
+
+/* The summary statistics of n entries, from their histograms */
+static inline void Stats_finish(struct channel_stats * stats, int n) {
+	for (int i = 0; i < n; i++) {
+		struct channel_stats * s = &stats[i];
+		double sum = 0, squares = 0;
+
+		s->count = 0;
+		s->min = KERNELS_GRAY_SHADES - 1;
+		s->max = 0;
+		for (int k = 0; k < KERNELS_GRAY_SHADES; k++) {
+			if (s->histogram[k] == 0)
+				continue;
+			s->count += s->histogram[k];
+			sum += (double)k * s->histogram[k];
+			squares += (double)k * k * s->histogram[k];
+			if (k < s->min)
+				s->min = k;
+			s->max = k;
+		}
+		if (s->count == 0) {
+			s->min = s->max = 0;
+			s->mean = s->stddev = 0;
+		} else {
+			s->mean = sum / s->count;
+			s->stddev = sqrt(fmax(squares / s->count - s->mean * s->mean, 0));
+		}
+		for (int p = 0; p < STATS_NOF_PERCENTILES; p++)
+			s->percentile[p] = Stats_percentile(s, Stats_percentile_list[p] / 100.0);
+	}
+}
+
+/*------------------------------------------------------------------
+ * Function:	Stats_read_gray8
+ * Purpose:		Read img as top-down 8-bit gray like Image_read_gray8,
+ * 				collecting the statistics of each band while it is in
+ * 				cache: the gray pixels and, with channels set and 8-bit
+ * 				interleaved colour samples, each stored channel
+ * Output args:	gray:	width * height bytes
+ * 				stats:	1 + STATS_MAX_CHANNELS entries; stats[0] is
+ * 						the gray pixels, then the channels by name
+ * Return:		the number of entries filled, or -1 on a read error
+ */
+static inline int Stats_read_gray8(struct image * img, unsigned char * gray, struct channel_stats * stats,
+		int channels) {
+	struct stats_plane colour;
+	struct image_band band;
+	int n = 1, rows;
+
+	if (channels && img->channels > 1 && img->channels <= STATS_MAX_CHANNELS && img->depth == 1
+			&& img->maxval == 255 && !img->planar)
+		n += img->channels;
+	Stats_reset(stats, n);
+	snprintf(stats[0].name, sizeof(stats[0].name), "gray");
+	if (n > 1)
+		Stats_name_channels(img, stats + 1);
+
+	Image_rewind(img);
+	while ((rows = Image_next_band(img, Image_band_rows(), &band)) > 0) {
+		unsigned char * out = gray + (long)band.y0 * img->width;
+
+		Image_band_gray8(img, &band, out);
+		Kernel_histogram(out, (long)band.rows * img->width, stats[0].histogram);
+		if (n > 1) {
+			colour = (struct stats_plane){band.data, img->width, band.rows, band.stride, img->channels};
+			Stats_collect(&colour, 1, stats + 1);
+		}
+	}
+	if (rows < 0)
+		return -1;
+	Stats_finish(stats, n);
+	return n;
+}
+
+/* 1 if the command line asks for the statistics (--stats) */
+static inline int Stats_requested(int argc, char * argv[]) {
+	for (int a = 1; a < argc; a++)
+		if (strcmp(argv[a], "--stats") == 0)
+			return 1;
+	return 0;
+}
+
+/* A row per entry: count, min, max, mean, standard deviation and the percentiles */
+static inline void Stats_print(FILE * out, const struct channel_stats * stats, int n) {
+	fprintf(out, "%-10s %10s %5s %5s %8s %8s", "channel", "pixels", "min", "max", "mean", "stddev");
+	for (int p = 0; p < STATS_NOF_PERCENTILES; p++)
+		fprintf(out, "  p%-3d", Stats_percentile_list[p]);
+	fprintf(out, "\n");
+	for (int i = 0; i < n; i++) {
+		fprintf(out, "%-10s %10ld %5d %5d %8.2f %8.2f", stats[i].name, stats[i].count, stats[i].min, stats[i].max,
+				stats[i].mean, stats[i].stddev);
+		for (int p = 0; p < STATS_NOF_PERCENTILES; p++)
+			fprintf(out, " %5d", stats[i].percentile[p]);
+		fprintf(out, "\n");
+	}
+}
+
+#endif
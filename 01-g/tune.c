@@ -0,0 +1,219 @@
+/*	File: tune.c
+ *
+ * 	Purpose:	Auto-tuner for the equalizers.  Times short trials of the settings that
+ *				decide their speed on this host, on a synthetic image, and saves the best
+ *				as the host's "equalize" profile (see tune.h), which par-3.c and serial.c
+ *				load at startup:
+ *					KERNEL_ISA		the SIMD variant of the histogram and LUT kernels
+ *					HISTOGRAM_WAYS	the number of sub-histograms the histogram interleaves
+ *					IMAGE_BAND_ROWS	the rows per band of the read, convert, hash and
+ *									histogram pass (see lutcache.h)
+ *
+ *	Compile:	gcc -O2 -Wall -o tune tune.c
+ *	Run:		./tune [--size <edge>] [--dry-run]
+ *
+ *	Notes:
+ *		1.	The image is <edge> x <edge> (default 4096), big enough that it does not fit
+ *			in the caches, like the real inputs.  --dry-run prints the table without
+ *			saving the profile.
+ *		2.	Each setting gets 5 trials (BENCH_TRIALS overrides, see bench.h); the
+ *			variant is picked on the histogram and LUT times together, since every
+ *			image needs both.
+ *		3.	par-3.c has no threads, so the ranks/threads split is left to mpiexec -n;
+ *			scaling.c measures it.
+ *
+ *	Author: Evelyn Evans
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kernels.h"
+#include "bench.h"
+#include "image_io.h"
+#include "lutcache.h"
+#include "tune.h"
+
+#define NOF_BAND_ROWS 5
+
+const int nof_gray_shades = 256;
+static const int Band_rows_list[NOF_BAND_ROWS] = {16, 64, 256, 1024, 4096};
+
+struct tune_case {
+	const unsigned char * in;
+	unsigned char * out;
+	long n;
+	int isa, ways;
+	int histogram[KERNELS_GRAY_SHADES];
+	unsigned char lut[KERNELS_GRAY_SHADES];
+	struct image * image;
+	unsigned char * gray;
+};
+
+void make_synthetic_image(unsigned char * image, int edge, unsigned seed);
+int write_pgm(const char * path, const unsigned char * image, int edge);
+void time_histogram(void * arg);
+void time_lut(void * arg);
+void time_read(void * arg);
+void print_row(const char * setting, const char * value, const struct bench_stats * stats, long n);
+
+int main(int argc, char *argv[])
+{
+	struct bench_config config = Bench_default_config();
+	struct bench_stats stats;
+	struct tune_case c;
+	struct image image;
+	struct tune_setting best[3];
+	double hist_time[ISA_COUNT][HISTOGRAM_NOF_WAYS], lut_time[ISA_COUNT], read_time, best_score = 1e30;
+	int edge = 4096, dry_run = 0, best_isa = ISA_SSE2, best_ways = 2, best_rows = 0;
+	char path[] = "/tmp/tune-XXXXXX", value[32], notes[1024];
+	unsigned char * image_data;
+	int fd;
+
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "--size") == 0 && a + 1 < argc) {
+			edge = atoi(argv[++a]);
+		} else if (strcmp(argv[a], "--dry-run") == 0) {
+			dry_run = 1;
+		} else {
+			edge = 0;
+		}
+	}
+	if (edge < 256 || edge > 32768) {
+		fprintf(stderr, "usage: %s [--size <edge, 256 to 32768>] [--dry-run]\n", argv[0]);
+		return 1;
+	}
+	if (config.trials > 5 && getenv("BENCH_TRIALS") == NULL)
+		config.trials = 5;
+	if (config.warmup > 1 && getenv("BENCH_WARMUP") == NULL)
+		config.warmup = 1;
+
+	c.n = (long)edge * edge;
+	image_data = malloc(c.n);
+	c.out = malloc(c.n);
+	c.in = image_data;
+	make_synthetic_image(image_data, edge, 12345u);
+	for (int k = 0; k < nof_gray_shades; k++)
+		c.lut[k] = (unsigned char)(255 - k);
+
+	printf("tuning on a %dx%d image, %d trials per setting\n", edge, edge, config.trials);
+	printf("%-16s %-14s %12s %10s\n", "setting", "value", "time (s)", "GB/s");
+
+	// the variant and the interleaving: histogram and LUT kernels on their own
+	for (int v = 0; v < ISA_COUNT; v++) {
+		double score;
+		int ways = 0;
+
+		if (!Isa_supported((enum isa)v))
+			continue;
+		c.isa = v;
+		for (int w = 0; w < HISTOGRAM_NOF_WAYS; w++) {
+			c.ways = w;
+			Bench_run(time_histogram, &c, &config, &stats);
+			hist_time[v][w] = stats.median;
+			snprintf(value, sizeof(value), "%s x%d", Isa_names[v], Histogram_ways_list[w]);
+			print_row("histogram", value, &stats, c.n);
+			if (hist_time[v][w] < hist_time[v][ways])
+				ways = w;
+		}
+		Bench_run(time_lut, &c, &config, &stats);
+		lut_time[v] = stats.median;
+		print_row("lut", Isa_names[v], &stats, c.n);
+
+		score = hist_time[v][ways] + lut_time[v];
+		if (score < best_score) {
+			best_score = score;
+			best_isa = v;
+			best_ways = ways;
+		}
+	}
+
+	// the band height of the fused read, with the chosen variant
+	setenv("KERNEL_ISA", Isa_names[best_isa], 1);
+	fd = mkstemp(path);
+	if (fd < 0 || write_pgm(path, image_data, edge) != 0 || Image_open(path, &image, IMAGE_MAP) != 0) {
+		fprintf(stderr, "tune: cannot write the test image %s\n", path);
+		return 1;
+	}
+	close(fd);
+	c.image = &image;
+	c.gray = c.out;
+	read_time = 1e30;
+	for (int r = 0; r < NOF_BAND_ROWS && Band_rows_list[r] <= edge; r++) {
+		Image_rows_per_band = Band_rows_list[r];
+		Bench_run(time_read, &c, &config, &stats);
+		snprintf(value, sizeof(value), "%d rows", Band_rows_list[r]);
+		print_row("read+hash+hist", value, &stats, c.n);
+		if (stats.median < read_time) {
+			read_time = stats.median;
+			best_rows = r;
+		}
+	}
+	Image_close(&image);
+	unlink(path);
+
+	snprintf(best[0].name, sizeof(best[0].name), "KERNEL_ISA");
+	snprintf(best[0].value, sizeof(best[0].value), "%s", Isa_names[best_isa]);
+	snprintf(best[1].name, sizeof(best[1].name), "HISTOGRAM_WAYS");
+	snprintf(best[1].value, sizeof(best[1].value), "%d", Histogram_ways_list[best_ways]);
+	snprintf(best[2].name, sizeof(best[2].name), "IMAGE_BAND_ROWS");
+	snprintf(best[2].value, sizeof(best[2].value), "%d", Band_rows_list[best_rows]);
+	snprintf(notes, sizeof(notes),
+		"# %dx%d image: histogram %.2f GB/s (%d-way, default 4-way %.2f GB/s), lut %.2f GB/s,\n"
+		"# read+hash+histogram %.2f GB/s in bands of %d rows\n",
+		edge, edge, c.n / hist_time[best_isa][best_ways] / 1e9, Histogram_ways_list[best_ways],
+		c.n / hist_time[best_isa][2] / 1e9, c.n / lut_time[best_isa] / 1e9, c.n / read_time / 1e9,
+		Band_rows_list[best_rows]);
+
+	printf("\nbest: KERNEL_ISA=%s HISTOGRAM_WAYS=%s IMAGE_BAND_ROWS=%s\n%s", best[0].value, best[1].value,
+		best[2].value, notes);
+	free(image_data);
+	free(c.out);
+	return dry_run ? 0 : Tune_save("equalize", best, 3, notes) != 0;
+}
+
+/* A low-contrast test card: diagonal gradient squeezed into 64..191 plus noise (as in bench.c) */
+void make_synthetic_image(unsigned char * image, int edge, unsigned seed) {
+	for (long y = 0; y < edge; y++) {
+		for (long x = 0; x < edge; x++) {
+			seed = seed * 1103515245u + 12345u;
+			image[y * edge + x] = 64 + (((x + y) * 127 / (2 * edge - 1) + (seed >> 28)) & 127);
+		}
+	}
+}
+
+int write_pgm(const char * path, const unsigned char * image, int edge) {
+	FILE * f = fopen(path, "wb");
+	int ok;
+
+	if (f == NULL)
+		return -1;
+	fprintf(f, "P5\n%d %d\n255\n", edge, edge);
+	ok = fwrite(image, 1, (size_t)edge * edge, f) == (size_t)edge * edge;
+	return fclose(f) == 0 && ok ? 0 : -1;
+}
+
+void time_histogram(void * arg) {
+	struct tune_case * c = arg;
+
+	memset(c->histogram, 0, sizeof(c->histogram));
+	Histogram_ways_variants[c->isa][c->ways](c->in, c->n, c->histogram);
+}
+
+void time_lut(void * arg) {
+	struct tune_case * c = arg;
+
+	Lut_apply_variants[c->isa](c->in, c->out, c->n, c->lut);
+}
+
+void time_read(void * arg) {
+	struct tune_case * c = arg;
+	uint64_t key;
+
+	memset(c->histogram, 0, sizeof(c->histogram));
+	Lutcache_read(c->image, c->gray, c->histogram, &key);
+}
+
+void print_row(const char * setting, const char * value, const struct bench_stats * stats, long n) {
+	printf("%-16s %-14s %12.4e %10.2f\n", setting, value, stats->median, n / stats->median / 1e9);
+	fflush(stdout);
+}
@@ -0,0 +1,324 @@
+/* File:	Pi_MPI.c
+ * Purpose:	Compute pi to many digits with the Chudnovsky series, split
+ * 		among the processes by binary splitting
+ *
+ * Compile:	mpicc -O2 -g -Wall -o Pi_MPI Pi_MPI.c -lm			(built-in bignum, see bignum.h)
+ * 		mpicc -O2 -g -Wall -DUSE_GMP -o Pi_MPI Pi_MPI.c -lm -lgmp	(GMP)
+ * Run:		[AFFINITY=compact|scatter|l3] mpiexec -n <number of processes> ./Pi_MPI
+ * 			[--digits 1000000] [--out pi.txt]
+ *
+ * Algorithm:
+ * 	1.	The N = digits / 14.18 terms of
+ * 		1/pi = 12 sum_k (-1)^k (6k)! (13591409 + 545140134 k) / ((3k)! (k!)^3 640320^(3k+3/2))
+ * 		are split among the processes (Sum_split)
+ * 	2.	Each process reduces its terms to the integers P, Q, T by binary
+ * 		splitting: [a, b) = [a, m) + [m, b) with
+ * 		P = P1 P2, Q = Q1 Q2, T = Q2 T1 + P1 T2
+ * 	3.	The processes merge their (P, Q, T) in a binary tree: at step s,
+ * 		process r receives from r + 2^s and merges, r + 2^s sends and is done
+ * 	4.	Process 0 computes pi = 426880 sqrt(10005) Q / T
+ *
+ * Notes:
+ * 	1.	The first 50 digits are checked against a constant; the whole
+ * 		result can be checked by comparing the built-in and GMP builds.
+ * 	2.	The table gives each process's terms and its time in binary
+ * 		splitting, in merging and waiting for its partner in the tree.
+ * 	3.	Numbers in a range that ends at term N never need their P, so it
+ * 		is not computed.
+ */
+
+#define _GNU_SOURCE	/* sched_setaffinity, used by affinity.h */
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <mpi.h>
+#include "affinity.h"
+#include "sum_kernels.h"
+#include "instrument.h"
+#include "bignum.h"
+
+#define DIGITS_PER_TERM 14.181647462725477	/* log10(640320^3 / 1728) */
+#define PI_CHECK "31415926535897932384626433832795028841971693993751"
+
+/* The binary splitting sums of a range of terms */
+struct pqt {
+	struct bignum P, Q, T;
+};
+
+/* Per-process times for the table */
+struct pi_stats {
+	double terms, split, merge, wait;
+};
+
+/* P, Q, T of the terms [a, b); P only if need_p */
+void Split(int64_t a, int64_t b, int need_p, struct pqt* r);
+
+/* left = left followed by right; left's P only if need_p */
+void Merge(struct pqt* left, struct pqt* right, int need_p);
+
+/* Send / receive P, Q, T */
+void Send_pqt(const struct pqt* x, int dest, MPI_Comm comm);
+void Recv_pqt(struct pqt* x, int source, MPI_Comm comm);
+
+void Pqt_init(struct pqt* x);
+void Pqt_free(struct pqt* x);
+
+int main(int argc, char* argv[]) {
+	int my_rank, comm_sz, step, status = 0;
+	int64_t digits = 1000000, terms, first, last;
+	const char* out_path = NULL;
+	double start, finish, digits_time = 0;
+	struct pi_stats stats = {0}, * all = NULL;
+	struct pqt mine, other;
+	char* text = NULL;
+	int digits_phase;
+
+	/* Initialize MPI */
+	MPI_Init(NULL, NULL);
+
+	/* Get my process rank */
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+
+	/* Find out the amount of processes being used */
+	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "--digits") == 0 && a + 1 < argc)
+			digits = atoll(argv[++a]);
+		else if (strcmp(argv[a], "--out") == 0 && a + 1 < argc)
+			out_path = argv[++a];
+		else
+			digits = -1;
+	}
+	if (digits < 50) {
+		if (my_rank == 0)
+			fprintf(stderr, "usage: mpiexec -n <p> %s [--digits <at least 50>] [--out <file>]\n", argv[0]);
+		MPI_Finalize();
+		return 1;
+	}
+
+	/* Pin ranks to cpus as requested by $AFFINITY */
+	Affinity_pin_rank(NULL, MPI_COMM_WORLD);
+	digits_phase = Instr_phase("digits");
+
+	/* Divide the terms among processes */
+	terms = (int64_t) (digits / DIGITS_PER_TERM) + 2;
+	Sum_split(0, terms, my_rank, comm_sz, &first, &last);
+	stats.terms = (double) (last - first);
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	start = MPI_Wtime();
+
+	/* Binary splitting of my terms */
+	Pqt_init(&mine);
+	Pqt_init(&other);
+	Instr_begin(INSTR_COMPUTE);
+	if (first < last)
+		Split(first, last, last != terms, &mine);
+	else
+		Bn_set_i64(&mine.Q, 1), Bn_set_i64(&mine.P, 1), Bn_set_i64(&mine.T, 0);
+	Instr_end(INSTR_COMPUTE);
+	stats.split = MPI_Wtime() - start;
+
+	/* Merge tree: the partner's range follows mine */
+	Instr_begin(INSTR_REDUCE);
+	for (step = 1; step < comm_sz; step *= 2) {
+		if (my_rank % (2 * step) == 0) {
+			int partner = my_rank + step;
+			double wait_start;
+			int64_t partner_last;
+
+			if (partner >= comm_sz)
+				continue;
+			wait_start = MPI_Wtime();
+			Recv_pqt(&other, partner, MPI_COMM_WORLD);
+			stats.wait += MPI_Wtime() - wait_start;
+
+			/* the merged range ends where the last process in it ends */
+			Sum_split(0, terms, (partner + step < comm_sz ? partner + step : comm_sz) - 1, comm_sz,
+					&first, &partner_last);
+			Merge(&mine, &other, partner_last != terms);
+		} else {
+			Send_pqt(&mine, my_rank - step, MPI_COMM_WORLD);
+			break;
+		}
+	}
+	Instr_end(INSTR_REDUCE);
+	stats.merge = MPI_Wtime() - start - stats.split - stats.wait;
+
+	/* Digits from Q and T */
+	if (my_rank == 0) {
+		double digits_start = MPI_Wtime();
+
+		Instr_begin(digits_phase);
+		text = Bn_pi_digits(&mine.Q, &mine.T, digits);
+		Instr_end(digits_phase);
+		digits_time = MPI_Wtime() - digits_start;
+	}
+	finish = MPI_Wtime();
+
+	if (my_rank == 0)
+		all = malloc(comm_sz * sizeof(struct pi_stats));
+	MPI_Gather(&stats, 4, MPI_DOUBLE, all, 4, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+	if (my_rank == 0) {
+		double split_max = 0, merge_max = 0;
+
+		printf("digits: %" PRId64 ", terms: %" PRId64 ", processes: %d, bignum: %s\n",
+				digits, terms, comm_sz, BN_BACKEND);
+		printf("%5s %10s %12s %12s %12s\n", "rank", "terms", "split (s)", "merge (s)", "wait (s)");
+		for (int r = 0; r < comm_sz; r++) {
+			printf("%5d %10.0f %12.4e %12.4e %12.4e\n", r, all[r].terms, all[r].split, all[r].merge, all[r].wait);
+			if (all[r].split > split_max)
+				split_max = all[r].split;
+			if (all[r].merge > merge_max)
+				merge_max = all[r].merge;
+		}
+		printf("split %.3f s (slowest process), merge %.3f s (slowest), digits %.3f s, total %.3f s\n",
+				split_max, merge_max, digits_time, finish - start);
+		printf("%.3e digits/s\n", digits / (finish - start));
+
+		printf("%c.%.50s...%s\n", text[0], text + 1, text + strlen(text) - 50);
+		if (strncmp(text, PI_CHECK, strlen(PI_CHECK)) != 0) {
+			printf("first 50 digits: MISMATCH\n");
+			status = 1;
+		} else {
+			printf("first 50 digits: ok\n");
+		}
+		if (out_path != NULL) {
+			FILE* out = fopen(out_path, "w");
+			if (out == NULL || fprintf(out, "%c.%s\n", text[0], text + 1) < 0) {
+				perror(out_path);
+				status = 1;
+			}
+			if (out != NULL)
+				fclose(out);
+		}
+		free(text);
+		free(all);
+	}
+	Pqt_free(&mine);
+	Pqt_free(&other);
+	Instr_report_mpi(stdout, MPI_COMM_WORLD);
+
+	MPI_Bcast(&status, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	MPI_Finalize();
+	return status;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Split
+ * Purpose:	P, Q, T of the terms [a, b) by binary splitting
+ * Input args:	a, b:	the range of terms
+ * 		need_p:	whether the caller uses P
+ * Output args:	r:	the sums
+ */
+void Split(int64_t a, int64_t b, int need_p, struct pqt* r) {
+	if (b - a == 1) {
+		struct bignum factor;
+
+		Bn_init(&factor);
+		if (a == 0) {
+			Bn_set_i64(&r->P, 1);
+			Bn_set_i64(&r->Q, 1);
+		} else {
+			/* P = (6a-5)(2a-1)(6a-1), Q = a^3 640320^3 / 24 */
+			Bn_set_i64(&r->P, (6 * a - 5) * (2 * a - 1));
+			Bn_set_i64(&factor, 6 * a - 1);
+			Bn_mul(&r->P, &r->P, &factor);
+			Bn_set_i64(&r->Q, a);		/* a^3 overflows int64_t from a = 2^21 */
+			Bn_set_i64(&factor, a);
+			Bn_mul(&r->Q, &r->Q, &factor);
+			Bn_mul(&r->Q, &r->Q, &factor);
+			Bn_set_i64(&factor, 10939058860032000LL);
+			Bn_mul(&r->Q, &r->Q, &factor);
+		}
+		/* T = (-1)^a P (13591409 + 545140134 a) */
+		Bn_set_i64(&factor, (a & 1 ? -1 : 1) * (13591409 + 545140134 * a));
+		Bn_mul(&r->T, &r->P, &factor);
+		Bn_free(&factor);
+	} else {
+		struct pqt right;
+		int64_t m = a + (b - a) / 2;
+
+		Pqt_init(&right);
+		Split(a, m, 1, r);
+		Split(m, b, need_p, &right);
+		Merge(r, &right, need_p);
+		Pqt_free(&right);
+	}
+}
+
+/*------------------------------------------------------------------
+ * Function:	Merge
+ * Purpose:	Combine two consecutive ranges:
+ * 		P = P1 P2, Q = Q1 Q2, T = Q2 T1 + P1 T2
+ * In/out args:	left:	the first range, then both
+ * Input args:	right:	the second range (its T is overwritten)
+ * 		need_p:	whether the merged P is used
+ */
+void Merge(struct pqt* left, struct pqt* right, int need_p) {
+	Bn_mul(&left->T, &left->T, &right->Q);
+	Bn_mul(&right->T, &left->P, &right->T);
+	Bn_add(&left->T, &left->T, &right->T);
+	if (need_p)
+		Bn_mul(&left->P, &left->P, &right->P);
+	Bn_mul(&left->Q, &left->Q, &right->Q);
+}
+
+/*------------------------------------------------------------------
+ * Function:	Send_pqt
+ * Purpose:	Send P, Q, T as a header of sizes and signs and one
+ * 		array of 32-bit words
+ */
+void Send_pqt(const struct pqt* x, int dest, MPI_Comm comm) {
+	const struct bignum* parts[3] = {&x->P, &x->Q, &x->T};
+	int64_t header[6], total = 0;
+	uint32_t* words;
+
+	for (int k = 0; k < 3; k++) {
+		header[2 * k] = Bn_words(parts[k]);
+		total += header[2 * k];
+	}
+	words = malloc((total + 1) * sizeof(uint32_t));
+	total = 0;
+	for (int k = 0; k < 3; k++) {
+		header[2 * k + 1] = Bn_export(parts[k], words + total);
+		total += header[2 * k];
+	}
+	MPI_Send(header, 6, MPI_INT64_T, dest, 0, comm);
+	MPI_Send(words, (int) total, MPI_UINT32_T, dest, 1, comm);
+	free(words);
+}
+
+void Recv_pqt(struct pqt* x, int source, MPI_Comm comm) {
+	struct bignum* parts[3] = {&x->P, &x->Q, &x->T};
+	int64_t header[6], total;
+	uint32_t* words;
+
+	MPI_Recv(header, 6, MPI_INT64_T, source, 0, comm, MPI_STATUS_IGNORE);
+	total = header[0] + header[2] + header[4];
+	words = malloc((total + 1) * sizeof(uint32_t));
+	MPI_Recv(words, (int) total, MPI_UINT32_T, source, 1, comm, MPI_STATUS_IGNORE);
+	total = 0;
+	for (int k = 0; k < 3; k++) {
+		Bn_import(parts[k], words + total, header[2 * k], (int) header[2 * k + 1]);
+		total += header[2 * k];
+	}
+	free(words);
+}
+
+void Pqt_init(struct pqt* x) {
+	Bn_init(&x->P);
+	Bn_init(&x->Q);
+	Bn_init(&x->T);
+}
+
+void Pqt_free(struct pqt* x) {
+	Bn_free(&x->P);
+	Bn_free(&x->Q);
+	Bn_free(&x->T);
+}
@@ -0,0 +1,211 @@
+/* File:	Reduce_bench.c
+ * Purpose:	Head-to-head latency of the reduction strategies in reduce.h
+ * 		(linear, tree, butterfly, MPI_Reduce, MPI_Allreduce, MPI_Ireduce)
+ * 		over a sweep of process counts and message sizes, to pick the
+ * 		--reduce of Sum_MPI_v1 / Sum_MPI_v2 for a given scale.
+ *
+ * Compile:	mpicc -O2 -g -Wall -o Reduce_bench Reduce_bench.c -lm -lpthread
+ * Run:		mpiexec -n <max processes> ./Reduce_bench [--procs 1,2,4,8] [--sizes 1,64,4096,65536]
+ * 			[--strategies linear,tree,butterfly,reduce,allreduce,ireduce] [--work <terms>]
+ * 			[--format text|csv|json] [--trials N] [--warmup N]
+ *
+ * Notes:
+ * 	1.	--procs defaults to 1, 2, 4, ... up to the number of processes; each
+ * 		point uses the first `procs` ranks.  --sizes counts doubles per
+ * 		rank.  A row's time is the slowest rank's per call (bench.h's
+ * 		Bench_run_mpi) and items/s is bytes reduced per second.
+ * 	2.	After timing, every strategy's result is checked against the exact
+ * 		sum (rank r contributes r + 1 + i to element i).
+ * 	3.	With --work w (default 100000) an "ireduce+work" row starts the
+ * 		MPI_Ireduce, sums w terms of the summation kernel (the next batch,
+ * 		as Sum_MPI_v2 --reduce ireduce does) and then waits; the "work" row
+ * 		times the w terms alone.  Their difference is the latency the
+ * 		overlap leaves exposed.
+ */
+
+#define _GNU_SOURCE	/* sched_setaffinity, used by affinity.h */
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "sum_kernels.h"
+#include "bench.h"
+#include "scaling.h"
+#include "reduce.h"
+
+#define MAX_SIZES 16
+#define STRATEGY_WORK REDUCE_NOF_STRATEGIES	/* the "work" row: no reduction */
+
+/* One benchmark case on comm */
+struct reduce_case {
+	MPI_Comm comm;
+	int strategy;		/* enum reduce_strategy, or STRATEGY_WORK */
+	int count;		/* doubles per rank */
+	int64_t work;		/* terms summed while an ireduce is in flight */
+	double* in, * out;
+	double sink;		/* keeps the work from being optimized away */
+};
+
+/* Timed kernel: one reduction of the case */
+void Time_reduce(void* arg);
+
+/* 1 if the case's reduction gives the exact sum, on every rank of comm */
+int Check_reduce(struct reduce_case* c);
+
+int main(int argc, char* argv[]) {
+	struct bench_config config = Bench_default_config();
+	struct bench_report report = {NULL, BENCH_TEXT, 0};
+	struct bench_stats stats;
+	int my_rank, comm_sz, failures = 0;
+	int procs[SCALING_MAX_POINTS], nof_procs, sizes[MAX_SIZES] = {1, 64, 4096, 65536}, nof_sizes = 4;
+	int use[REDUCE_NOF_STRATEGIES];
+	int64_t work = 100000;
+	const char* strategies = "linear,tree,butterfly,reduce,allreduce,ireduce";
+
+	MPI_Init(NULL, NULL);
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+	nof_procs = Scaling_powers_of_two(comm_sz, procs);
+
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "--procs") == 0 && a + 1 < argc) {
+			nof_procs = Scaling_parse_list(argv[++a], procs, SCALING_MAX_POINTS);
+		} else if (strcmp(argv[a], "--sizes") == 0 && a + 1 < argc) {
+			nof_sizes = Scaling_parse_list(argv[++a], sizes, MAX_SIZES);
+		} else if (strcmp(argv[a], "--strategies") == 0 && a + 1 < argc) {
+			strategies = argv[++a];
+		} else if (strcmp(argv[a], "--work") == 0 && a + 1 < argc) {
+			work = atoll(argv[++a]);
+		} else if (strcmp(argv[a], "--format") == 0 && a + 1 < argc) {
+			config.format = Bench_parse_format(argv[++a]);
+		} else if (strcmp(argv[a], "--trials") == 0 && a + 1 < argc) {
+			config.trials = atoi(argv[++a]);
+		} else if (strcmp(argv[a], "--warmup") == 0 && a + 1 < argc) {
+			config.warmup = atoi(argv[++a]);
+		} else {
+			nof_procs = -1;
+		}
+	}
+	for (int s = 0; s < REDUCE_NOF_STRATEGIES; s++) {
+		const char* at = strstr(strategies, Reduce_names[s]);
+		size_t len = strlen(Reduce_names[s]);
+
+		/* whole names only: "reduce" must not match inside "allreduce" */
+		use[s] = 0;
+		while (at != NULL && !use[s]) {
+			use[s] = (at == strategies || at[-1] == ',') && (at[len] == ',' || at[len] == '\0');
+			at = strstr(at + 1, Reduce_names[s]);
+		}
+	}
+	for (int i = 0; i < nof_procs; i++)
+		if (procs[i] > comm_sz)
+			nof_procs = -1;
+	if (nof_procs < 1 || nof_sizes < 1 || work < 0) {
+		if (my_rank == 0)
+			fprintf(stderr, "usage: mpiexec -n <p> %s [--procs 1,2,..,p] [--sizes 1,64,4096] "
+					"[--strategies linear,tree,...] [--work <terms>] [--format text|csv|json] "
+					"[--trials N] [--warmup N]\n", argv[0]);
+		MPI_Finalize();
+		return 1;
+	}
+	if (config.trials < 1)
+		config.trials = 1;
+	if (config.trials > BENCH_MAX_TRIALS)
+		config.trials = BENCH_MAX_TRIALS;
+
+	if (my_rank == 0) {
+		printf("processes: %d, kernel for --work: %s\n", comm_sz, Sum_kernel_name());
+		Bench_begin(&report, stdout, config.format);
+	}
+
+	for (int pi = 0; pi < nof_procs; pi++) {
+		MPI_Comm comm = Scaling_comm(procs[pi]);
+
+		for (int si = 0; si < nof_sizes; si++) {
+			struct reduce_case c = {comm, 0, sizes[si], 0, NULL, NULL, 0};
+			char params[32];
+			int sub_rank;
+
+			if (comm == MPI_COMM_NULL)
+				break;
+			MPI_Comm_rank(comm, &sub_rank);
+			c.in = malloc(c.count * sizeof(double));
+			c.out = malloc(c.count * sizeof(double));
+			for (int i = 0; i < c.count; i++)
+				c.in[i] = sub_rank + 1 + i;
+			snprintf(params, sizeof(params), "p=%d n=%d", procs[pi], c.count);
+
+			for (int s = 0; s <= REDUCE_NOF_STRATEGIES; s++) {
+				for (int overlap = 0; overlap <= 1; overlap++) {
+					const char* name = s < REDUCE_NOF_STRATEGIES ? Reduce_names[s] : "work";
+					int ok = -1;
+
+					/* the work row and the overlapped ireduce row need --work */
+					if (overlap && (s != REDUCE_IREDUCE || work == 0))
+						continue;
+					if (s == STRATEGY_WORK ? (work == 0 || !use[REDUCE_IREDUCE]) : !use[s])
+						continue;
+					c.strategy = s;
+					c.work = (overlap || s == STRATEGY_WORK) ? work : 0;
+					Bench_run_mpi(Time_reduce, &c, &config, comm, &stats);
+					if (s != STRATEGY_WORK) {
+						ok = Check_reduce(&c);
+						failures += !ok;
+					}
+					if (sub_rank == 0)
+						Bench_record(&report, overlap ? "ireduce+work" : name, params,
+								(double) c.count * sizeof(double) * procs[pi], &stats, 0, ok);
+				}
+			}
+			free(c.in);
+			free(c.out);
+		}
+		if (comm != MPI_COMM_NULL)
+			MPI_Comm_free(&comm);
+	}
+	if (my_rank == 0)
+		Bench_end(&report);
+
+	MPI_Allreduce(MPI_IN_PLACE, &failures, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+	MPI_Finalize();
+	return failures != 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Time_reduce
+ * Purpose:		One call of the case: a reduction to rank 0 of comm,
+ * 				with c->work terms summed while an ireduce is in flight
+ */
+void Time_reduce(void* arg) {
+	struct reduce_case* c = arg;
+	MPI_Request request = MPI_REQUEST_NULL;
+
+	if (c->strategy != STRATEGY_WORK)
+		Reduce_start(c->in, c->out, c->count, MPI_DOUBLE, MPI_SUM, 0, c->comm,
+				(enum reduce_strategy) c->strategy, &request);
+	if (c->work > 0)
+		c->sink += Sum_kernel(0, c->work);
+	MPI_Wait(&request, MPI_STATUS_IGNORE);
+}
+
+/*------------------------------------------------------------------
+ * Function:	Check_reduce
+ * Purpose:		Run the case once more and compare with the exact sum,
+ * 				on rank 0 and, for the all-reduces, on every rank
+ * Return:		1 if every rank that should have the result has it
+ */
+int Check_reduce(struct reduce_case* c) {
+	int sub_rank, comm_sz, ok = 1, all;
+
+	MPI_Comm_rank(c->comm, &sub_rank);
+	MPI_Comm_size(c->comm, &comm_sz);
+	memset(c->out, 0, c->count * sizeof(double));
+	Time_reduce(c);
+	if (sub_rank == 0 || c->strategy == REDUCE_BUTTERFLY || c->strategy == REDUCE_ALLREDUCE)
+		for (int i = 0; i < c->count; i++)
+			if (c->out[i] != comm_sz * (comm_sz + 1) / 2.0 + (double) comm_sz * i)
+				ok = 0;
+	MPI_Allreduce(&ok, &all, 1, MPI_INT, MPI_MIN, c->comm);
+	return all;
+}
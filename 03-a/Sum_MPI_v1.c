@@ -1,8 +1,12 @@
 /* File:	Sum_MPI_v1.c
  * Purpose:	A parallel algorithm to calculate the summation of a function
  *
- * Compile:	mpicc -g -Wall -o Sum_MPI_v1 Sum_MPI_v1.c -lm 
- * Run:		mpiexec -n <number of processes> ./Sum_MPI_v1
+ * Compile:	mpicc -O2 -g -Wall -o Sum_MPI_v1 Sum_MPI_v1.c -lm -lpthread
+ * Run:		[AFFINITY=compact|scatter|l3] [INSTR_COUNTERS=1] mpiexec -n <number of processes> ./Sum_MPI_v1 
+ * 			[--kernel ordered|paired|repro] [--eps <tolerance>]
+ * 			[--reduce linear|tree|butterfly|reduce|allreduce|ireduce]
+ * 			[--n <list or range> [--repeat R]] [--jobs <file>] [--format text|csv|json]
+ * 			[--schedule static|guided|trapezoid [--dispatch rma|coordinator]] [--threads <t>]
  *
  * Algorithm:
  * 	1.	Each process calculates its local summation
@@ -10,26 +14,88 @@
  * 	2b. 	Process 0 sums the calculations and prints the results 
  *
  *	n = 1000000000
+ *
+ *	With --eps n is not read: the program sums the fewest terms that give pi
+ *	to the tolerance with a tail correction, and compares that against the
+ *	time brute force needs (see Sum_to_tolerance in sum_kernels.h).
+ *
+ *	With --reduce the partial sums reach process 0 another way (see
+ *	reduce.h); the default is linear, the Send/Recv loop of step 2.
+ *
+ *	With --n or --jobs n is not read either: the program runs every
+ *	configuration of the sweep in this one launch and prints a row for
+ *	each (see sweep.h).
+ *
+ *	With --schedule guided or trapezoid the terms are handed out in
+ *	shrinking chunks as processes become free, instead of one block per
+ *	process (see schedule.h); each process's terms and idle time are
+ *	reported.
+ *
+ *	With --threads t (or $SUM_THREADS; 0 = every cpu of the process) each
+ *	process sums its terms on a work-stealing pool of t threads (see
+ *	pool.h).  Only the main thread calls MPI.
+ *
+ *	./Sum_tune saves this host's best variant, threads per process and
+ *	grain, loaded here at startup (see tune.h), and the number of
+ *	processes to go with them: a launch with another -n gets a note.
  */
+#define _GNU_SOURCE	/* sched_setaffinity, used by affinity.h */
 #include <math.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
 #include <mpi.h>
 #include <stdio.h>
+#include "affinity.h"
+#include "sum_kernels.h"
+#include "instrument.h"
+#include "reduce.h"
+#include "sweep.h"
+#include "schedule.h"
+#include "pool.h"
+#include "tune.h"
 
-/* Calculate the summation term */
-double Summation_term(int lower_limit, int upper_limit);
+/* Add the summation term of a range to a struct sum_acc (a sched_work, see schedule.h) */
+void Summation_term(int64_t lower_limit, int64_t upper_limit, void* acc);
 
 /* Get user input */
-void Get_input(int my_rank, int comm_sz, int* lower_limit, 
-	int* upper_limit);
+void Get_input(int my_rank, int comm_sz, int64_t* lower_limit, 
+	int64_t* upper_limit);
+
+/* This process, for Parallel_summation */
+struct rank_info {
+	int my_rank, comm_sz;
+	struct sched_stats sched;	/* of the last Parallel_summation */
+};
+
+/* Sum [lower_limit, upper_limit) over all processes (a sum_driver, see sum_kernels.h) */
+double Parallel_summation(int64_t lower_limit, int64_t upper_limit, double* seconds, void* arg);
 
-int main(void) {
-	int my_rank, comm_sz, local_i, local_n, i, n;
-	double local_summation, total_summation, start, finish;
-	int source;
+/* The configurations of a sweep, read on process 0 and sent to all */
+int Get_configs(int my_rank, int comm_sz, int argc, char* argv[], struct sum_config* configs,
+	enum bench_format* format);
 
-	/* Initialize MPI */
-	MPI_Init(NULL, NULL);
+/* Run the configurations, a results row each on process 0 */
+void Run_sweep(struct rank_info* rank, const struct sum_config* configs, int nof_configs,
+	enum bench_format format);
+
+/* The datatype of an array of struct sum_config */
+void Build_mpi_type(struct sum_config* config, MPI_Datatype* input_mpi_t_p);
+
+int main(int argc, char* argv[]) {
+	int my_rank, comm_sz, nof_configs, local_rank, provided;
+	int64_t i, n;
+	double total_summation, elapsed, eps;
+	struct rank_info rank;
+	static struct sum_config configs[SWEEP_MAX_CONFIGS];
+	enum bench_format format;
+
+	/* This host's tuned settings, before anything reads them (see tune.h) */
+	Tune_load("sum");
+
+	/* Initialize MPI: the pool's threads do not call it */
+	MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
 
 	/* Get my process rank */
 	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
@@ -37,64 +103,263 @@ int main(void) {
 	/* Find out the amount of processes being used */
 	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
 
+	/* Pick the summation kernel (see sum_kernels.h) */
+	if (Sum_select_mode(argc, argv) != 0 || (eps = Sum_select_eps(argc, argv)) < 0
+			|| Reduce_select(argc, argv) != 0 || Sched_select(argc, argv) != 0
+			|| Pool_select(argc, argv) != 0) {
+		MPI_Finalize();
+		return 1;
+	}
+
+	/* Pin ranks to cpus as requested by $AFFINITY */
+	local_rank = Affinity_pin_rank(NULL, MPI_COMM_WORLD);
+	if (provided < MPI_THREAD_FUNNELED && Pool_threads(1) > 1 && my_rank == 0)
+		fprintf(stderr, "warning: MPI only provides thread level %d\n", provided);
+	if (my_rank == 0)
+		Tune_expect(stderr, "SUM_RANKS", comm_sz, "processes");
+	Pool_start(Pool_threads(1), local_rank * Pool_threads(1));
+	rank.my_rank = my_rank;
+	rank.comm_sz = comm_sz;
+
+	if (eps > 0) {
+		/* Accuracy-driven: as few terms as eps allows, vs brute force */
+		int status = Sum_to_tolerance(eps, Parallel_summation, &rank, my_rank == 0 ? stdout : NULL);
+		if (my_rank == 0)
+			printf("kernel: %s, reduce: %s\n", Sum_kernel_name(), Reduce_names[Reduce_strategy(REDUCE_LINEAR)]);
+		Instr_report_mpi(stderr, MPI_COMM_WORLD);
+		Pool_stop();
+		MPI_Finalize();
+		return status;
+	}
+
+	/* A sweep from --n / --jobs: every configuration in this launch */
+	nof_configs = Get_configs(my_rank, comm_sz, argc, argv, configs, &format);
+	if (nof_configs != 0) {
+		if (nof_configs > 0) {
+			Run_sweep(&rank, configs, nof_configs, format);
+			Instr_report_mpi(stderr, MPI_COMM_WORLD);
+		}
+		Pool_stop();
+		MPI_Finalize();
+		return nof_configs < 0;
+	}
+
 	/* Get input */
 	Get_input(my_rank, comm_sz, &i, &n);
 
-	/* Divide work among processes */
-	local_n = n / comm_sz;
-	local_i = (local_n * my_rank);
+	total_summation = Parallel_summation(i, n, &elapsed, &rank);
 
-	/* Edge case for when n < p */
-	if(my_rank == comm_sz - 1) {
-		local_n += n % comm_sz;
+	if (my_rank == 0) {
+		total_summation = total_summation * 4;
+		if (Sum_mode() == SUM_REPRO)
+			printf("%.17g\n", total_summation);	/* the same bits for any comm_sz */
+		else
+			printf("%f\n", total_summation);
+		printf("elapsed time: %f seconds\n", elapsed);
+		printf("kernel: %s\n", Sum_kernel_name());
+		printf("reduce: %s\n", Reduce_names[Reduce_strategy(REDUCE_LINEAR)]);
+		Tune_report(stdout);
 	}
+	Sched_report(stdout, &rank.sched, MPI_COMM_WORLD);
+	if (my_rank == 0)
+		Pool_report(stdout, "process 0's pool");
+	Instr_report_mpi(stderr, MPI_COMM_WORLD);
+
+	Pool_stop();
+	MPI_Finalize();
+	return 0;
+}
+
+/*------------------------------------------------------------------
+ * Function: 	Parallel_summation
+ * Purpose: 	Sum [lower_limit, upper_limit) over all processes,
+ * 		collecting the partial sums on process 0 by hand unless
+ * 		another reduction is chosen.
+ * 		The terms are split among the processes by the schedule
+ * 		(schedule.h).  With the ireduce strategy and the static
+ * 		schedule the range is cut into REDUCE_BATCHES batches, and
+ * 		each batch's reduction runs while the next batch is summed.
+ * Input args:	lower_limit, upper_limit: the range of i
+ * 		arg: 	the struct rank_info of this process; its sched
+ * 			gets what the process did
+ * Output args:	seconds: 	elapsed time on this process
+ * Return:	the sum, on process 0
+ */
+double Parallel_summation(int64_t lower_limit, int64_t upper_limit, double* seconds, void* arg) {
+	struct rank_info* rank = arg;
+	enum reduce_strategy strategy = Reduce_strategy(REDUCE_LINEAR);
+	int nof_batches = strategy == REDUCE_IREDUCE && Sched_kind() == SCHED_STATIC ? REDUCE_BATCHES : 1, b;
+	int64_t first, last;
+	double local_summation[REDUCE_BATCHES], batch_total[REDUCE_BATCHES];
+	double total_summation = 0, start, loc_elapsed;
+	struct sum_acc local_acc[REDUCE_BATCHES], total_acc[REDUCE_BATCHES];
+	MPI_Request requests[REDUCE_BATCHES];
+	MPI_Datatype acc_type = MPI_DATATYPE_NULL;
+	MPI_Op acc_op = MPI_OP_NULL;
+	struct sched_stats batch;
+
+	memset(&rank->sched, 0, sizeof(rank->sched));
+	if (Sum_mode() == SUM_REPRO)
+		Sum_acc_mpi(&acc_type, &acc_op);
 
 	MPI_Barrier(MPI_COMM_WORLD);
 	start = MPI_Wtime();
+	for (b = 0; b < nof_batches; b++) {
+		/* Perform the function locally: a static block of the batch, or chunks as they come */
+		Sum_split(lower_limit, upper_limit, b, nof_batches, &first, &last);
+		Sum_acc_init(&local_acc[b]);
+		Sched_run(first, last, Summation_term, &local_acc[b], MPI_COMM_WORLD, &batch);
+		local_summation[b] = Sum_acc_value(&local_acc[b]);
+		rank->sched.terms += batch.terms;
+		rank->sched.chunks += batch.chunks;
+		rank->sched.busy += batch.busy;
+		rank->sched.wait += batch.wait;
+		rank->sched.done += batch.done;
 
-	/* Perform the function locally */
-	local_summation = Summation_term(local_i, local_n + local_i);
-
+		Instr_begin(INSTR_REDUCE);
+		if (Sum_mode() == SUM_REPRO)
+			/* exact merge (user-defined MPI_Op): the same bits for any comm_sz */
+			Reduce_start(&local_acc[b], &total_acc[b], 1, acc_type, acc_op, 0, MPI_COMM_WORLD,
+					strategy, &requests[b]);
+		else
+			Reduce_start(&local_summation[b], &batch_total[b], 1, MPI_DOUBLE, MPI_SUM, 0,
+					MPI_COMM_WORLD, strategy, &requests[b]);
+		Instr_end(INSTR_REDUCE);
+	}
+	Instr_begin(INSTR_REDUCE);
+	MPI_Waitall(nof_batches, requests, MPI_STATUSES_IGNORE);
+	Instr_end(INSTR_REDUCE);
+	loc_elapsed = MPI_Wtime() - start;
 
-	if (my_rank != 0) {
-		MPI_Send(&local_summation, 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
-	} else {
-		total_summation = local_summation;
-		for (source = 1; source < comm_sz; source++) {		
-			MPI_Recv(&local_summation, 1, MPI_DOUBLE, source, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-			total_summation += local_summation;
-		}
+	if (rank->my_rank == 0) {
+		for (b = 1; b < nof_batches; b++)
+			if (Sum_mode() == SUM_REPRO)
+				Sum_acc_add(&total_acc[0], &total_acc[b]);
+			else
+				batch_total[0] += batch_total[b];
+		total_summation = Sum_mode() == SUM_REPRO ? Sum_acc_value(&total_acc[0]) : batch_total[0];
 	}
-	finish = MPI_Wtime();
+	*seconds = loc_elapsed;
 
-	if (my_rank == 0) {
-		total_summation = total_summation * 4;	
-		printf("%f\n", total_summation);
-		printf("elapsed time: %f seconds\n", finish-start);
+	return total_summation;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Get_configs
+ * Purpose:	Read the sweep of --n / --repeat / --jobs on process 0 and
+ * 		send it to every process
+ * Input args:	my_rank, comm_sz, argc, argv
+ * Output args:	configs:	the configurations, on every process
+ * 		format:		the row format (process 0)
+ * Return:	the number of configurations: 0 without --n or --jobs,
+ * 		-1 on an error
+ */
+int Get_configs(int my_rank, int comm_sz, int argc, char* argv[], struct sum_config* configs,
+		enum bench_format* format) {
+	int nof_configs = 0, dest;
+	MPI_Datatype config_mpi_t;
+	INSTR_SCOPE(INSTR_BCAST);
+
+	if (my_rank == 0)
+		nof_configs = Sweep_configs(argc, argv, configs, SWEEP_MAX_CONFIGS, format);
+	if (my_rank == 0)
+		for (dest = 1; dest < comm_sz; dest++)
+			MPI_Send(&nof_configs, 1, MPI_INT, dest, 0, MPI_COMM_WORLD);
+	else
+		MPI_Recv(&nof_configs, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	if (nof_configs > 0) {
+		/* all the configurations in one message */
+		Build_mpi_type(configs, &config_mpi_t);
+		if (my_rank == 0)
+			for (dest = 1; dest < comm_sz; dest++)
+				MPI_Send(configs, nof_configs, config_mpi_t, dest, 0, MPI_COMM_WORLD);
+		else
+			MPI_Recv(configs, nof_configs, config_mpi_t, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		MPI_Type_free(&config_mpi_t);
 	}
+	return nof_configs;
+}
 
-	MPI_Finalize();
-	return 0;
+/*------------------------------------------------------------------
+ * Function:	Run_sweep
+ * Purpose:	Sum each configuration repeat times and print its row
+ * Input args:	rank:		this process
+ * 		configs:	the configurations
+ * 		format:		the row format
+ */
+void Run_sweep(struct rank_info* rank, const struct sum_config* configs, int nof_configs,
+		enum bench_format format) {
+	struct bench_report report = {NULL, BENCH_TEXT, 0};
+	enum sum_mode kernel = Sum_mode();
+	double seconds[SWEEP_MAX_REPEAT], sum = 0;
+
+	if (rank->my_rank == 0)
+		Sweep_begin(&report, stdout, format);
+	for (int c = 0; c < nof_configs; c++) {
+		Sum_set_mode(configs[c].mode >= 0 ? (enum sum_mode)configs[c].mode : kernel);
+		for (int r = 0; r < configs[c].repeat; r++)
+			sum = Parallel_summation(configs[c].lower_limit, configs[c].upper_limit, &seconds[r], rank);
+		if (rank->my_rank == 0)
+			Sweep_row(&report, &configs[c], rank->comm_sz, Sum_kernel_name(),
+					Reduce_names[Reduce_strategy(REDUCE_LINEAR)], seconds, 4 * sum);
+	}
+	if (rank->my_rank == 0)
+		Sweep_end(&report);
+	Sum_set_mode(kernel);
 }
 
 /*------------------------------------------------------------------
  * Function: 	Summation_term
  * Purpose: 	Calculate the summation term, which can be written
- * 				as [(-1)^i] / [2i+1]
- * Input args:	i
+ * 				as [(-1)^i] / [2i+1], and add it to acc
+ * Input args:	lower_limit, upper_limit: the range of i
+ * In/out args:	acc:	a struct sum_acc: the sum, exact in repro mode
+ * 			(see sum_kernels.h)
  */
-double Summation_term(int lower_limit, int upper_limit) {
-	int i = 0;
-	double result = 0;
-
-	for (i = lower_limit; i < upper_limit; i++) {
-		result += pow(-1.0,(double)i) / ((2.0*i)+1);
-	}
+void Summation_term(int64_t lower_limit, int64_t upper_limit, void* acc) {
+	INSTR_SCOPE(INSTR_COMPUTE);
 
-	return result;
+	/* SIMD variant picked at startup (see sum_kernels.h), on the pool's threads */
+	Pool_sum(lower_limit, upper_limit, acc);
 }
 
 
+/*------------------------------------------------------------------
+ * Function: 	Build_mpi_type	
+ * Purpose: 	Build a derived datatype so that the input values of a
+ * 		configuration (the limits, the repeat count and the kernel)
+ * 		can be sent in a single message; its extent is that of
+ * 		struct sum_config, so an array of them goes in one message too
+ * Input args:	config: pointer to a configuration (for the addresses)
+ * Output args: input_mpi_t_p: the new MPI datatype
+ */
+void Build_mpi_type(
+		struct sum_config*	config,		/* in */
+		MPI_Datatype* 	input_mpi_t_p	/* out */) {
+	
+	int array_of_blocklengths[4] = {1, 1, 1, 1};
+	MPI_Datatype array_of_types[4] = {MPI_INT64_T, MPI_INT64_T, MPI_INT64_T, MPI_INT64_T};
+	MPI_Aint base_addr, field_addr[4];
+	MPI_Aint array_of_displacements[4] = {0};
+	MPI_Datatype packed;
+
+	MPI_Get_address(config, &base_addr);
+	MPI_Get_address(&config->lower_limit, &field_addr[0]);
+	MPI_Get_address(&config->upper_limit, &field_addr[1]);
+	MPI_Get_address(&config->repeat, &field_addr[2]);
+	MPI_Get_address(&config->mode, &field_addr[3]);
+	for (int k = 0; k < 4; k++)
+		array_of_displacements[k] = field_addr[k] - base_addr;
+
+	MPI_Type_create_struct(4, array_of_blocklengths,
+			array_of_displacements, array_of_types,
+			&packed);
+	MPI_Type_create_resized(packed, 0, sizeof(struct sum_config), input_mpi_t_p);
+	MPI_Type_free(&packed);
+
+	MPI_Type_commit(input_mpi_t_p);
+}	/* Build_mpi_type */
+
 /*------------------------------------------------------------------
  * Function:	Get_input
  * Purpose:		Get the user input, the lower and upper limits of
@@ -107,30 +372,29 @@ double Summation_term(int lower_limit, int upper_limit) {
 void Get_input(
 	int my_rank,		/* in */ 
 	int comm_sz,		/* in */ 
-	int* lower_limit,	/* out */ 
-	int* upper_limit	/* out */) {
+	int64_t* lower_limit,	/* out */ 
+	int64_t* upper_limit	/* out */) {
+
+	int dest;
+	INSTR_SCOPE(INSTR_BCAST);
 
-MPI_Bcast(lower_limit, 1, MPI_INT, 0, MPI_COMM_WORLD);
-MPI_Bcast(upper_limit, 1, MPI_INT, 0, MPI_COMM_WORLD);
 	/* in this case, i is assumed to be 0 */
 	*lower_limit = 0;
 
-	int dest;
-
 	if (my_rank == 0) { 
 		printf("Enter n: ");
 		fflush(stdout);	
-		scanf("%d", upper_limit);
+		scanf("%" SCNd64, upper_limit);
 		for (dest = 1; dest < comm_sz; dest++) {
-			MPI_Send(lower_limit, 1, MPI_INT, dest, 0,
+			MPI_Send(lower_limit, 1, MPI_INT64_T, dest, 0,
 					MPI_COMM_WORLD);
-			MPI_Send(upper_limit, 1, MPI_INT, dest, 0,
+			MPI_Send(upper_limit, 1, MPI_INT64_T, dest, 0,
 					MPI_COMM_WORLD);
 		}
 	} else { /* my_rank != = */
-		MPI_Recv(lower_limit, 1, MPI_INT, 0, 0, MPI_COMM_WORLD,
+		MPI_Recv(lower_limit, 1, MPI_INT64_T, 0, 0, MPI_COMM_WORLD,
 				MPI_STATUS_IGNORE);
-		MPI_Recv(upper_limit, 1, MPI_INT, 0, 0, MPI_COMM_WORLD,
+		MPI_Recv(upper_limit, 1, MPI_INT64_T, 0, 0, MPI_COMM_WORLD,
 				MPI_STATUS_IGNORE);
 	}
 }	/* Get_input */
@@ -1,8 +1,16 @@
 /* File:	Sum_MPI_v2.c
  * Purpose:	A parallel algorithm to calculate the summation of a function
  *
- * Compile:	mpicc -g -Wall -o Sum_MPI_v2 Sum_MPI_v2.c -lm 
- * Run:		mpiexec -n <number of processes> ./Sum_MPI_v2
+ * Compile:	mpicc -O2 -g -Wall -o Sum_MPI_v2 Sum_MPI_v2.c -lm -lpthread
+ * Run:		[AFFINITY=compact|scatter|l3] [INSTR_COUNTERS=1] mpiexec -n <number of processes> ./Sum_MPI_v2 
+ * 			[--kernel ordered|paired|repro] [--eps <tolerance>]
+ * 			[--reduce linear|tree|butterfly|reduce|allreduce|ireduce]
+ * 			[--n <list or range> [--repeat R]] [--jobs <file>] [--format text|csv|json]
+ * 			[--schedule static|guided|trapezoid [--dispatch rma|coordinator]]
+ * 			[--progressive <tolerance> [--batch <terms>] [--max-n <n>] [--every <seconds>]]
+ * 			[--cache <dir> [--checkpoint-every <terms>]] [--threads <t>]
+ * 			[--serve <socket>]
+ * 		./Sum_MPI_v2 --request <socket> "<n> [kernel]" [--repeat R] [--cold "<command>"]
  *
  * Algorithm:
  * 	1.		Each process calculates its local summation
@@ -10,25 +18,150 @@
  * 	2b. 	Process 0 sums the calculations and prints the results 
  *
  * Assume n = 1000000000
+ *
+ * With --eps n is not read: the program sums the fewest terms that give pi
+ * to the tolerance with a tail correction, and compares that against the
+ * time brute force needs (see Sum_to_tolerance in sum_kernels.h).
+ *
+ * With --reduce the partial sums reach process 0 another way (see
+ * reduce.h); the default is MPI_Reduce.  The elapsed time includes the
+ * reduction, so the strategies can be compared.
+ *
+ * With --n or --jobs n is not read either: the program runs every
+ * configuration of the sweep in this one launch and prints a row for
+ * each (see sweep.h).  Process 0 sends them to the others in a single
+ * message of the derived datatype built by Build_mpi_type.
+ *
+ * With --schedule guided or trapezoid the terms are handed out in
+ * shrinking chunks as processes become free, instead of one block per
+ * process (see schedule.h); each process's terms and idle time are
+ * reported.
+ *
+ * With --progressive n is not read: the processes sum batches of --batch
+ * terms each (default 1000000) in order, and share each batch's exact
+ * partial sums and rounding error bounds with MPI_Iallreduce while they
+ * sum the next batch.  Since the series alternates, the terms not summed
+ * add at most 4 / (2N + 1) to the error after N terms, so every process
+ * knows the same bound and they all stop at the first batch that brings
+ * it under the tolerance (or at --max-n).  Process 0 prints a progress
+ * line every --every seconds (default 1); the exit status is 1 if the
+ * tolerance was not reached.
+ *
+ * With --cache <dir> (or $SUM_CACHE) exact prefix sums are kept on disk
+ * every --checkpoint-every terms (see checkpoint.h): a run for n starts
+ * from the largest cached prefix <= n and the processes sum only the
+ * rest, so growing or repeated runs of n (and sweeps) are incremental.
+ *
+ * With --threads t (or $SUM_THREADS; 0 = every cpu of the process) each
+ * process sums its terms on a work-stealing pool of t threads (see
+ * pool.h) instead of on its main thread alone.  Only the main thread
+ * calls MPI.
+ *
+ * With --serve <socket> the processes stay up and serve requests (see
+ * server.h): process 0 reads "<n> [ordered|paired|repro]" from the
+ * socket, sends it to all in one message (Build_mpi_type), and replies
+ * with pi, n, the time and the kernel; "quit" stops them.  Started with
+ * --request instead (no mpiexec), the program is the client and reports
+ * the latency per request, against a cold launch with --cold.
+ *
+ * ./Sum_tune saves this host's best variant, threads per process and
+ * grain, loaded at startup (see tune.h), with the number of processes to
+ * go with them: a launch with another -n gets a note.
  */
 
+#define _GNU_SOURCE	/* sched_setaffinity, used by affinity.h */
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
 #include <mpi.h>
+#include "affinity.h"
+#include "sum_kernels.h"
+#include "instrument.h"
+#include "reduce.h"
+#include "sweep.h"
+#include "schedule.h"
+#include "checkpoint.h"
+#include "pool.h"
+#include "tune.h"
+#include "server.h"
 
-/* Calculate the summation term */
-double Summation_term(int lower_limit, int upper_limit);
+#define PROGRESS_SLICE 65536	/* terms per exactly deposited kernel call */
+
+/* Add the summation term of a range to a struct sum_acc (a sched_work, see schedule.h) */
+void Summation_term(int64_t lower_limit, int64_t upper_limit, void* acc);
 
 /* Get user input */
-void Get_input(int my_rank, int comm_sz, int* lower_limit, int* upper_limit);
+void Get_input(int my_rank, int comm_sz, int64_t* lower_limit, int64_t* upper_limit);
+
+/* This process, for Parallel_summation */
+struct rank_info {
+	int my_rank, comm_sz;
+	struct sched_stats sched;	/* of the last Parallel_summation */
+	int64_t cached;			/* terms the last Cached_summation loaded from the cache */
+};
+
+/* Sum [lower_limit, upper_limit) over all processes (a sum_driver, see sum_kernels.h) */
+double Parallel_summation(int64_t lower_limit, int64_t upper_limit, double* seconds, void* arg);
+
+/* Parallel_summation starting from the checkpoint cache (a sum_driver) */
+double Cached_summation(int64_t lower_limit, int64_t upper_limit, double* seconds, void* arg);
+
+/* The configurations of a sweep, read on process 0 and sent to all */
+int Get_configs(int my_rank, int comm_sz, int argc, char* argv[], struct sum_config* configs,
+	enum bench_format* format);
+
+/* Run the configurations, a results row each on process 0 */
+void Run_sweep(struct rank_info* rank, const struct sum_config* configs, int nof_configs,
+	enum bench_format format);
+
+/* The datatype of an array of struct sum_config */
+void Build_mpi_type(struct sum_config* config, MPI_Datatype* input_mpi_t_p);
+
+/* Serve summation requests on a UNIX socket until "quit"; 0, or 1 on an error */
+int Serve(struct rank_info* rank, const char* path);
 
-int main(void) {
-	int my_rank, comm_sz, local_i, local_n, i, n;
-	double local_summation, total_summation, start, finish, loc_elapsed, elapsed;
+/* The job of a request line, on process 0 (repeat 0: quit, -1: malformed) */
+void Parse_request(const char* line, struct sum_config* job);
 
-	/* Initialize MPI */
-	MPI_Init(NULL, NULL);
+/* Settings of the progressive mode */
+struct progress_options {
+	double tolerance;	/* 0: not progressive */
+	int64_t batch;		/* terms per process and batch */
+	int64_t max_n;		/* stop here even if not converged */
+	double every;		/* seconds between progress lines */
+};
+
+/* The progressive mode's settings from argv; 0, or -1 on an error */
+int Get_progress_options(int my_rank, int argc, char* argv[], struct progress_options* options);
+
+/* Sum batches until the error bound is under the tolerance; 0 if it got there */
+int Progressive_summation(struct rank_info* rank, const struct progress_options* options);
+double Batch_summation(int64_t lower_limit, int64_t upper_limit, struct sum_acc* acc);
+void Progress_merge(MPI_Request* requests, const struct sum_acc* batch_acc, const double* batch_bound,
+	struct sum_acc* total_acc, double* rounding);
+
+int main(int argc, char* argv[]) {
+	int my_rank, comm_sz, nof_configs, local_rank, provided;
+	int64_t i, n;
+	double total_summation, elapsed, eps;
+	struct rank_info rank;
+	static struct sum_config configs[SWEEP_MAX_CONFIGS];
+	enum bench_format format;
+	struct progress_options progress;
+
+	/* A client of --serve does not need MPI (see server.h) */
+	int status = Server_client(argc, argv);
+	if (status >= 0)
+		return status;
+
+	/* This host's tuned settings, before anything reads them (see tune.h) */
+	Tune_load("sum");
+
+	/* Initialize MPI: the pool's threads do not call it */
+	MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
 
 	/* Get my process rank */
 	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
@@ -36,81 +169,602 @@ int main(void) {
 	/* Find out the amount of processes being used */
 	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
 
+	/* Pick the summation kernel (see sum_kernels.h) */
+	if (Sum_select_mode(argc, argv) != 0 || (eps = Sum_select_eps(argc, argv)) < 0
+			|| Reduce_select(argc, argv) != 0 || Sched_select(argc, argv) != 0
+			|| Get_progress_options(my_rank, argc, argv, &progress) != 0 || Checkpoint_select(argc, argv) != 0
+			|| Pool_select(argc, argv) != 0) {
+		MPI_Finalize();
+		return 1;
+	}
+
+	/* Pin ranks to cpus as requested by $AFFINITY */
+	local_rank = Affinity_pin_rank(NULL, MPI_COMM_WORLD);
+	if (provided < MPI_THREAD_FUNNELED && Pool_threads(1) > 1 && my_rank == 0)
+		fprintf(stderr, "warning: MPI only provides thread level %d\n", provided);
+	if (my_rank == 0)
+		Tune_expect(stderr, "SUM_RANKS", comm_sz, "processes");
+	Pool_start(Pool_threads(1), local_rank * Pool_threads(1));
+	rank.my_rank = my_rank;
+	rank.comm_sz = comm_sz;
+
+	if (Server_path(argc, argv) != NULL) {
+		/* Server: one launch for many requests */
+		status = Serve(&rank, Server_path(argc, argv));
+		Instr_report_mpi(stderr, MPI_COMM_WORLD);
+		Pool_stop();
+		MPI_Finalize();
+		return status;
+	}
+
+	if (eps > 0) {
+		/* Accuracy-driven: as few terms as eps allows, vs brute force */
+		status = Sum_to_tolerance(eps, Parallel_summation, &rank, my_rank == 0 ? stdout : NULL);
+		if (my_rank == 0)
+			printf("kernel: %s, reduce: %s\n", Sum_kernel_name(), Reduce_names[Reduce_strategy(REDUCE_MPI)]);
+		Instr_report_mpi(stderr, MPI_COMM_WORLD);
+		Pool_stop();
+		MPI_Finalize();
+		return status;
+	}
+
+	if (progress.tolerance > 0) {
+		/* Progressive: batches until the shared error bound is small enough */
+		status = Progressive_summation(&rank, &progress);
+		Instr_report_mpi(stderr, MPI_COMM_WORLD);
+		Pool_stop();
+		MPI_Finalize();
+		return status;
+	}
+
+	/* A sweep from --n / --jobs: every configuration in this launch */
+	nof_configs = Get_configs(my_rank, comm_sz, argc, argv, configs, &format);
+	if (nof_configs != 0) {
+		if (nof_configs > 0) {
+			Run_sweep(&rank, configs, nof_configs, format);
+			Instr_report_mpi(stderr, MPI_COMM_WORLD);
+		}
+		Pool_stop();
+		MPI_Finalize();
+		return nof_configs < 0;
+	}
+
 	/* Get input */
 	Get_input(my_rank, comm_sz, &i, &n);
 
-	/* Divide work among processes */
-	local_n = n / comm_sz;
-	local_i = (local_n * my_rank);
+	total_summation = Cached_summation(i, n, &elapsed, &rank);
 
-	/* Edge case for when n < p */
-	if(my_rank == comm_sz - 1) {
-		local_n += n % comm_sz;
+	if (my_rank == 0) {
+		total_summation = total_summation * 4;
+		if (Sum_mode() == SUM_REPRO)
+			printf("%.17g\n", total_summation);	/* the same bits for any comm_sz */
+		else
+			printf("%f\n", total_summation);
+		printf("elapsed time: %f seconds\n", elapsed);
+		printf("kernel: %s\n", Sum_kernel_name());
+		printf("reduce: %s\n", Reduce_names[Reduce_strategy(REDUCE_MPI)]);
+		Tune_report(stdout);
+		if (Checkpoint_enabled())
+			printf("cache: %" PRId64 " terms loaded, %" PRId64 " summed (%s)\n", rank.cached,
+					n - i - rank.cached, Checkpoint_path());
 	}
+	Sched_report(stdout, &rank.sched, MPI_COMM_WORLD);
+	if (my_rank == 0)
+		Pool_report(stdout, "process 0's pool");
+	Instr_report_mpi(stderr, MPI_COMM_WORLD);
+
+	Pool_stop();
+	MPI_Finalize();
+	return 0;
+}
+
+/*------------------------------------------------------------------
+ * Function: 	Parallel_summation
+ * Purpose: 	Sum [lower_limit, upper_limit) over all processes
+ * 		The terms are split among the processes by the schedule
+ * 		(schedule.h).  With the ireduce strategy and the static
+ * 		schedule the range is cut into REDUCE_BATCHES batches, and
+ * 		each batch's reduction runs while the next batch is summed.
+ * Input args:	lower_limit, upper_limit: the range of i
+ * 		arg: 	the struct rank_info of this process; its sched
+ * 			gets what the process did
+ * Output args:	seconds: 	time of the local summation and the reduction
+ * 				(slowest process, on process 0)
+ * Return:	the sum, on process 0
+ */
+double Parallel_summation(int64_t lower_limit, int64_t upper_limit, double* seconds, void* arg) {
+	struct rank_info* rank = arg;
+	enum reduce_strategy strategy = Reduce_strategy(REDUCE_MPI);
+	int nof_batches = strategy == REDUCE_IREDUCE && Sched_kind() == SCHED_STATIC ? REDUCE_BATCHES : 1, b;
+	int64_t first, last;
+	double local_summation[REDUCE_BATCHES], batch_total[REDUCE_BATCHES];
+	double total_summation = 0, start, loc_elapsed;
+	struct sum_acc local_acc[REDUCE_BATCHES], total_acc[REDUCE_BATCHES];
+	MPI_Request requests[REDUCE_BATCHES];
+	MPI_Datatype acc_type = MPI_DATATYPE_NULL;
+	MPI_Op acc_op = MPI_OP_NULL;
+	struct sched_stats batch;
+
+	memset(&rank->sched, 0, sizeof(rank->sched));
+	if (Sum_mode() == SUM_REPRO)
+		Sum_acc_mpi(&acc_type, &acc_op);
 
 	MPI_Barrier(MPI_COMM_WORLD);
 	start = MPI_Wtime();
-	/* Perform the function locally */
-	local_summation = Summation_term(local_i, local_n + local_i);
-	finish = MPI_Wtime();
-	loc_elapsed = finish-start;
-	MPI_Reduce(&local_summation, &total_summation, 1, MPI_DOUBLE, MPI_SUM, 0, 
-			MPI_COMM_WORLD);
-	MPI_Reduce(&loc_elapsed, &elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
-	
+	for (b = 0; b < nof_batches; b++) {
+		/* Perform the function locally: a static block of the batch, or chunks as they come */
+		Sum_split(lower_limit, upper_limit, b, nof_batches, &first, &last);
+		Sum_acc_init(&local_acc[b]);
+		Sched_run(first, last, Summation_term, &local_acc[b], MPI_COMM_WORLD, &batch);
+		local_summation[b] = Sum_acc_value(&local_acc[b]);
+		rank->sched.terms += batch.terms;
+		rank->sched.chunks += batch.chunks;
+		rank->sched.busy += batch.busy;
+		rank->sched.wait += batch.wait;
+		rank->sched.done += batch.done;
 
-	if (my_rank == 0) {
-		total_summation = total_summation * 4;
-		printf("%f\n", total_summation);
-		printf("elapsed time: %f seconds\n", finish-start);
+		Instr_begin(INSTR_REDUCE);
+		if (Sum_mode() == SUM_REPRO)
+			/* exact merge (user-defined MPI_Op): the same bits for any comm_sz */
+			Reduce_start(&local_acc[b], &total_acc[b], 1, acc_type, acc_op, 0, MPI_COMM_WORLD,
+					strategy, &requests[b]);
+		else
+			Reduce_start(&local_summation[b], &batch_total[b], 1, MPI_DOUBLE, MPI_SUM, 0,
+					MPI_COMM_WORLD, strategy, &requests[b]);
+		Instr_end(INSTR_REDUCE);
 	}
+	Instr_begin(INSTR_REDUCE);
+	MPI_Waitall(nof_batches, requests, MPI_STATUSES_IGNORE);
+	Instr_end(INSTR_REDUCE);
+	loc_elapsed = MPI_Wtime() - start;
 
-	MPI_Finalize();
+	if (rank->my_rank == 0) {
+		for (b = 1; b < nof_batches; b++)
+			if (Sum_mode() == SUM_REPRO)
+				Sum_acc_add(&total_acc[0], &total_acc[b]);
+			else
+				batch_total[0] += batch_total[b];
+		total_summation = Sum_mode() == SUM_REPRO ? Sum_acc_value(&total_acc[0]) : batch_total[0];
+	}
+	/* slowest process, on process 0 */
+	MPI_Reduce(&loc_elapsed, seconds, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+	return total_summation;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Cached_summation
+ * Purpose:	Parallel_summation with the checkpoint cache (checkpoint.h):
+ * 		process 0 loads the largest cached prefix [0, k) of the
+ * 		range, and the processes sum [k, upper_limit) a checkpoint
+ * 		interval at a time.  Each interval's accumulators are merged
+ * 		exactly on process 0, which adds them to the prefix and
+ * 		stores the new prefix at each checkpoint.
+ * Input args:	lower_limit, upper_limit: the range of i; the cache only
+ * 		holds prefixes, so with lower_limit > 0 (or the cache off)
+ * 		this is Parallel_summation
+ * 		arg: 	the struct rank_info of this process; cached gets the
+ * 			terms loaded, sched what the process did
+ * Output args:	seconds: 	time of the loading, summation and reductions
+ * 				(slowest process, on process 0)
+ * Return:	the sum, on process 0
+ */
+double Cached_summation(int64_t lower_limit, int64_t upper_limit, double* seconds, void* arg) {
+	struct rank_info* rank = arg;
+	struct sum_acc prefix, local_acc, interval_acc;
+	struct sched_stats interval;
+	int64_t first = 0, last;
+	double start, loc_elapsed;
+
+	rank->cached = 0;
+	if (lower_limit != 0 || !Checkpoint_enabled())
+		return Parallel_summation(lower_limit, upper_limit, seconds, arg);
+
+	memset(&rank->sched, 0, sizeof(rank->sched));
+	MPI_Barrier(MPI_COMM_WORLD);
+	start = MPI_Wtime();
+	if (rank->my_rank == 0)
+		first = Checkpoint_find(upper_limit, &prefix);
+	MPI_Bcast(&first, 1, MPI_INT64_T, 0, MPI_COMM_WORLD);
+	rank->cached = first;
+
+	for (; first < upper_limit; first = last) {
+		last = Checkpoint_next(first) < upper_limit ? Checkpoint_next(first) : upper_limit;
+		Sum_acc_init(&local_acc);
+		Sched_run(first, last, Summation_term, &local_acc, MPI_COMM_WORLD, &interval);
+		rank->sched.terms += interval.terms;
+		rank->sched.chunks += interval.chunks;
+		rank->sched.busy += interval.busy;
+		rank->sched.wait += interval.wait;
+		rank->sched.done += interval.done;
+
+		Instr_begin(INSTR_REDUCE);
+		Sum_acc_reduce(&local_acc, &interval_acc, 0, MPI_COMM_WORLD);
+		Instr_end(INSTR_REDUCE);
+		if (rank->my_rank == 0) {
+			Sum_acc_add(&prefix, &interval_acc);
+			if (last % Checkpoint_settings.every == 0)
+				Checkpoint_store(last, &prefix);
+		}
+	}
+	loc_elapsed = MPI_Wtime() - start;
+	MPI_Reduce(&loc_elapsed, seconds, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+	return rank->my_rank == 0 ? Sum_acc_value(&prefix) : 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Serve
+ * Purpose:	Serve requests on the UNIX socket at path: process 0
+ * 		waits for a request and sends its job to every process,
+ * 		all of them sum it (Cached_summation, so --cache, --threads
+ * 		and --schedule apply), and process 0 replies.  The pool,
+ * 		the datatypes and the cache stay warm between requests.
+ * Input args:	rank:	this process
+ * 		path:	the socket
+ * Return:	0, or 1 if the socket could not be opened
+ * Note:	Process 0 prints the number of requests and their mean
+ * 		service time (request read to reply sent) when it stops.
+ */
+int Serve(struct rank_info* rank, const char* path) {
+	struct sum_config job = {0, 0, 0, -1};
+	MPI_Datatype job_mpi_t;
+	enum sum_mode kernel = Sum_mode();
+	char line[SERVER_LINE], reply[SERVER_LINE];
+	int listen_fd = -1, fd = -1, served = 0;
+	double sum, seconds, start = 0, service = 0;
+
+	Build_mpi_type(&job, &job_mpi_t);
+	if (rank->my_rank == 0) {
+		listen_fd = Server_listen(path);
+		if (listen_fd >= 0)
+			printf("serving on %s: %d processes, %d threads each, kernel %s\n", path, rank->comm_sz,
+					Pool.nof_threads, Sum_kernel_name());
+		Tune_report(stdout);
+		fflush(stdout);
+	}
+	MPI_Bcast(&listen_fd, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	if (listen_fd < 0) {
+		MPI_Type_free(&job_mpi_t);
+		return 1;
+	}
+
+	for (;;) {
+		if (rank->my_rank == 0) {
+			fd = Server_next(listen_fd, line, sizeof(line));
+			start = MPI_Wtime();
+			Parse_request(line, &job);
+		}
+		Instr_begin(INSTR_BCAST);
+		MPI_Bcast(&job, 1, job_mpi_t, 0, MPI_COMM_WORLD);
+		Instr_end(INSTR_BCAST);
+		if (job.repeat == 0)
+			break;
+		if (job.repeat < 0) {
+			if (rank->my_rank == 0)
+				Server_reply(fd, "error: expected \"<n> [ordered|paired|repro]\" or \"quit\"");
+			continue;
+		}
+
+		Sum_set_mode(job.mode >= 0 ? (enum sum_mode)job.mode : kernel);
+		sum = Cached_summation(job.lower_limit, job.upper_limit, &seconds, rank);
+		if (rank->my_rank == 0) {
+			snprintf(reply, sizeof(reply), "pi %.17g n %" PRId64 " seconds %.6e kernel %s", 4 * sum,
+					job.upper_limit, seconds, Sum_kernel_name());
+			Server_reply(fd, reply);
+			service += MPI_Wtime() - start;
+			served++;
+		}
+	}
+	Sum_set_mode(kernel);
+	MPI_Type_free(&job_mpi_t);
+
+	if (rank->my_rank == 0) {
+		Server_reply(fd, "bye");
+		close(listen_fd);
+		unlink(path);
+		printf("served %d requests, mean service time %.3e s\n", served, served > 0 ? service / served : 0);
+	}
 	return 0;
 }
 
 /*------------------------------------------------------------------
- * Function: 	Summation_term
- * Purpose: 	Calculate the summation term, which can be written
- * 				as [(-1)^i] / [2i+1]
- * Input args:	i
+ * Function:	Parse_request
+ * Purpose:	Turn "<n> [ordered|paired|repro]" into the job [0, n)
+ * 		with that kernel, "quit" into repeat 0, anything else
+ * 		into repeat -1
+ */
+void Parse_request(const char* line, struct sum_config* job) {
+	char count[64], kernel[32];
+	int fields = sscanf(line, "%63s %31s", count, kernel);
+	char* end;
+
+	job->lower_limit = 0;
+	job->repeat = -1;
+	job->mode = -1;
+	if (fields >= 1 && strcmp(count, "quit") == 0) {
+		job->repeat = 0;
+		return;
+	}
+	if (fields < 1 || (job->upper_limit = Sweep_count(count, &end)) < 0 || *end != '\0')
+		return;
+	if (fields == 2 && (job->mode = Sum_parse_mode(kernel)) < 0)
+		return;
+	job->repeat = 1;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Get_configs
+ * Purpose:	Read the sweep of --n / --repeat / --jobs on process 0 and
+ * 		send it to every process
+ * Input args:	my_rank, comm_sz, argc, argv
+ * Output args:	configs:	the configurations, on every process
+ * 		format:		the row format (process 0)
+ * Return:	the number of configurations: 0 without --n or --jobs,
+ * 		-1 on an error
+ */
+int Get_configs(int my_rank, int comm_sz, int argc, char* argv[], struct sum_config* configs,
+		enum bench_format* format) {
+	int nof_configs = 0;
+	MPI_Datatype config_mpi_t;
+	INSTR_SCOPE(INSTR_BCAST);
+
+	if (my_rank == 0)
+		nof_configs = Sweep_configs(argc, argv, configs, SWEEP_MAX_CONFIGS, format);
+	MPI_Bcast(&nof_configs, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	if (nof_configs > 0) {
+		/* all the configurations in one message */
+		Build_mpi_type(configs, &config_mpi_t);
+		MPI_Bcast(configs, nof_configs, config_mpi_t, 0, MPI_COMM_WORLD);
+		MPI_Type_free(&config_mpi_t);
+	}
+	return nof_configs;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Run_sweep
+ * Purpose:	Sum each configuration repeat times and print its row
+ * Input args:	rank:		this process
+ * 		configs:	the configurations
+ * 		format:		the row format
+ */
+void Run_sweep(struct rank_info* rank, const struct sum_config* configs, int nof_configs,
+		enum bench_format format) {
+	struct bench_report report = {NULL, BENCH_TEXT, 0};
+	enum sum_mode kernel = Sum_mode();
+	double seconds[SWEEP_MAX_REPEAT], sum = 0;
+
+	if (rank->my_rank == 0)
+		Sweep_begin(&report, stdout, format);
+	for (int c = 0; c < nof_configs; c++) {
+		Sum_set_mode(configs[c].mode >= 0 ? (enum sum_mode)configs[c].mode : kernel);
+		for (int r = 0; r < configs[c].repeat; r++)
+			sum = Cached_summation(configs[c].lower_limit, configs[c].upper_limit, &seconds[r], rank);
+		if (rank->my_rank == 0)
+			Sweep_row(&report, &configs[c], rank->comm_sz, Sum_kernel_name(),
+					Reduce_names[Reduce_strategy(REDUCE_MPI)], seconds, 4 * sum);
+	}
+	if (rank->my_rank == 0)
+		Sweep_end(&report);
+	Sum_set_mode(kernel);
+}
+
+/*------------------------------------------------------------------
+ * Function:	Get_progress_options
+ * Purpose:	Read --progressive, --batch, --max-n and --every
+ * Input args:	my_rank:	only process 0 prints the usage message
+ * Output args:	options:	tolerance 0 without --progressive
+ * Return:	0, or -1 (with a message) for a bad value
+ */
+int Get_progress_options(int my_rank, int argc, char* argv[], struct progress_options* options) {
+	int bad = 0;
+
+	options->tolerance = 0;
+	options->batch = 1000000;
+	options->max_n = (int64_t)1 << 52;	/* 2i+1 exact in a double up to here */
+	options->every = 1.0;
+
+	for (int a = 1; a + 1 < argc; a++) {
+		char* end;
+
+		if (strcmp(argv[a], "--progressive") == 0)
+			bad = !((options->tolerance = strtod(argv[a + 1], &end)) > 0);	/* NaN too */
+		else if (strcmp(argv[a], "--batch") == 0)
+			bad = (options->batch = Sweep_count(argv[a + 1], &end)) < 1;	/* 1000000 or 1e6 */
+		else if (strcmp(argv[a], "--max-n") == 0)
+			bad = (options->max_n = Sweep_count(argv[a + 1], &end)) < 1;
+		else if (strcmp(argv[a], "--every") == 0)
+			bad = !((options->every = strtod(argv[a + 1], &end)) > 0);
+		else
+			continue;
+		if (bad || *end != '\0') {
+			if (my_rank == 0)
+				fprintf(stderr, "%s %s: expected a positive number\n", argv[a], argv[a + 1]);
+			return -1;
+		}
+	}
+	if (options->max_n < options->batch) {
+		if (my_rank == 0)
+			fprintf(stderr, "--max-n %" PRId64 ": expected at least the batch, %" PRId64 "\n",
+					options->max_n, options->batch);
+		return -1;
+	}
+	return 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Batch_summation
+ * Purpose:	Add [lower_limit, upper_limit) to acc in slices of
+ * 		PROGRESS_SLICE terms, each deposited exactly
+ * Return:	a bound on the rounding error of the slices (0 in repro
+ * 		mode, where acc holds every term exactly)
+ */
+double Batch_summation(int64_t lower_limit, int64_t upper_limit, struct sum_acc* acc) {
+	double bound = 0;
+
+	for (int64_t lo = lower_limit; lo < upper_limit; lo += PROGRESS_SLICE) {
+		int64_t hi = upper_limit - lo > PROGRESS_SLICE ? lo + PROGRESS_SLICE : upper_limit;
+
+		Summation_term(lo, hi, acc);
+		/* recursive summation of m terms: (m - 1) u sum |a_i|, with
+		   sum 1/(2i+1) <= 1/(2lo+1) + ln((2hi-1)/(2lo+1)) / 2 */
+		if (Sum_mode() != SUM_REPRO)
+			bound += (hi - lo - 1) * (DBL_EPSILON / 2)
+				* (1.0 / (2.0 * lo + 1) + 0.5 * log((2.0 * hi - 1) / (2.0 * lo + 1)));
+	}
+	return bound;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Progressive_summation
+ * Purpose:	Sum batches of options->batch terms per process until the
+ * 		error bound of pi is under options->tolerance.  Batch k is
+ * 		[k G, (k + 1) G) with G = comm_sz * batch, split among the
+ * 		processes.  Its exact partial sums and rounding bounds are
+ * 		all-reduced without blocking while batch k + 1 is summed, and
+ * 		the bound is checked once they arrive.
+ * Input args:	rank:		this process
+ * 		options:	tolerance, batch, max_n, every
+ * Return:	0 if the bound got under the tolerance, 1 if max_n came
+ * 		first
+ * Note:	Every process gets the same totals, so they all stop after
+ * 		the same batch without another message.  The batch in flight
+ * 		when the bound is reached is added too: its terms are summed
+ * 		already.
  */
-double Summation_term(int lower_limit, int upper_limit) {
-	int i = 0;
-	double result = 0;
+int Progressive_summation(struct rank_info* rank, const struct progress_options* options) {
+	int64_t global = options->batch * rank->comm_sz, summed = 0, first, last;
+	struct sum_acc local_acc[2], batch_acc[2], total_acc;
+	double local_bound[2], batch_bound[2], rounding = 0, truncation, pi = 0, bound = INFINITY;
+	double start, last_line;
+	MPI_Request requests[2][2];
+	MPI_Datatype acc_type;
+	MPI_Op acc_op;
+	int k, started, batches;
+
+	Sum_acc_mpi(&acc_type, &acc_op);
+	Sum_acc_init(&total_acc);
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	start = last_line = MPI_Wtime();
+	for (k = 0; ; k++) {
+		int slot = k % 2;
+
+		/* my part of batch k, reduced in the background */
+		started = k * global < options->max_n;
+		if (started) {
+			Sum_split(k * global, (k + 1) * global < options->max_n ? (k + 1) * global : options->max_n,
+					rank->my_rank, rank->comm_sz, &first, &last);
+			Sum_acc_init(&local_acc[slot]);
+			local_bound[slot] = Batch_summation(first, last, &local_acc[slot]);
+
+			Instr_begin(INSTR_REDUCE);
+			MPI_Iallreduce(&local_acc[slot], &batch_acc[slot], 1, acc_type, acc_op, MPI_COMM_WORLD,
+					&requests[slot][0]);
+			MPI_Iallreduce(&local_bound[slot], &batch_bound[slot], 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD,
+					&requests[slot][1]);
+			Instr_end(INSTR_REDUCE);
+		}
+		if (k == 0)
+			continue;
+
+		/* batch k - 1 has been reducing while batch k was summed */
+		Progress_merge(requests[1 - slot], &batch_acc[1 - slot], &batch_bound[1 - slot], &total_acc, &rounding);
+		summed = k * global < options->max_n ? k * global : options->max_n;
+		pi = 4 * Sum_acc_value(&total_acc);
+		bound = 4.0 / (2.0 * summed + 1) + 4 * rounding + fabs(pi) * DBL_EPSILON;
+		if (bound <= options->tolerance || summed >= options->max_n)
+			break;
+
+		if (rank->my_rank == 0 && options->every > 0 && MPI_Wtime() - last_line >= options->every) {
+			last_line = MPI_Wtime();
+			printf("progress: %14" PRId64 " terms, pi ~ %.15f, bound %.3e, %8.2f s, %.3e terms/s\n",
+					summed, pi, bound, last_line - start, summed / (last_line - start));
+			fflush(stdout);
+		}
+	}
+	batches = k;
+	if (started) {
+		Progress_merge(requests[k % 2], &batch_acc[k % 2], &batch_bound[k % 2], &total_acc, &rounding);
+		summed = (k + 1) * global < options->max_n ? (k + 1) * global : options->max_n;
+		batches++;
+	}
+
+	/* the rest of the series changes the sum by at most its first term */
+	pi = 4 * Sum_acc_value(&total_acc);
+	truncation = 4.0 / (2.0 * summed + 1);
+	bound = truncation + 4 * rounding + fabs(pi) * DBL_EPSILON;
 
-	for (i = lower_limit; i < upper_limit; i++) {
-		result += pow(-1.0,(double)i) / ((2.0*i)+1);
+	if (rank->my_rank == 0) {
+		printf("%.17g\n", pi);
+		printf("terms: %" PRId64 " in %d batches of %" PRId64 " per process, %.6f seconds\n",
+				summed, batches, options->batch, MPI_Wtime() - start);
+		printf("error bound %.3e (tolerance %.3e): series tail %.3e, rounding %.3e; error vs M_PI %.3e\n",
+				bound, options->tolerance, truncation, 4 * rounding, fabs(pi - M_PI));
+		printf("kernel: %s\n", Sum_kernel_name());
+		if (bound > options->tolerance)
+			printf("stopped at --max-n %" PRId64 " before reaching the tolerance\n", options->max_n);
 	}
+	return bound > options->tolerance;
+}
+
+/* Wait for a batch's all-reduces, then add its sum and rounding bound to the totals */
+void Progress_merge(MPI_Request* requests, const struct sum_acc* batch_acc, const double* batch_bound,
+		struct sum_acc* total_acc, double* rounding) {
+	Instr_begin(INSTR_REDUCE);
+	MPI_Waitall(2, requests, MPI_STATUSES_IGNORE);
+	Instr_end(INSTR_REDUCE);
+	Sum_acc_add(total_acc, batch_acc);
+	*rounding += *batch_bound;
+}
+
+/*------------------------------------------------------------------
+ * Function: 	Summation_term
+ * Purpose: 	Calculate the summation term, which can be written
+ * 				as [(-1)^i] / [2i+1], and add it to acc
+ * Input args:	lower_limit, upper_limit: the range of i
+ * In/out args:	acc:	a struct sum_acc: the sum, exact in repro mode
+ * 			(see sum_kernels.h)
+ */
+void Summation_term(int64_t lower_limit, int64_t upper_limit, void* acc) {
+	INSTR_SCOPE(INSTR_COMPUTE);
 
-	return result;
+	/* SIMD variant picked at startup (see sum_kernels.h), on the pool's threads */
+	Pool_sum(lower_limit, upper_limit, acc);
 }
 
 /*------------------------------------------------------------------
  * Function: 	Build_mpi_type	
- * Purpose: 	Build a derived datatype so that the three input
- * 		values can be sent in a single message
- * Input args:	lower_limit: pointer to the lower limit (i)
- * 		upper_limit: pointer to the upper limit (n)
+ * Purpose: 	Build a derived datatype so that the input values of a
+ * 		configuration (the limits, the repeat count and the kernel)
+ * 		can be sent in a single message; its extent is that of
+ * 		struct sum_config, so an array of them goes in one message too
+ * Input args:	config: pointer to a configuration (for the addresses)
  * Output args: input_mpi_t_p: the new MPI datatype
  */
 void Build_mpi_type(
-		int* 		lower_limit,	/* in */
-		int* 		upper_limit,	/* in */
+		struct sum_config*	config,		/* in */
 		MPI_Datatype* 	input_mpi_t_p	/* out */) {
 	
-	int array_of_blocklengths[2] = {1, 1};
-	MPI_Datatype array_of_types[2] = {MPI_INT, MPI_INT};
-	MPI_Aint lower_limit_addr, upper_limit_addr;
-	MPI_Aint array_of_displacements[2] = {0};
+	int array_of_blocklengths[4] = {1, 1, 1, 1};
+	MPI_Datatype array_of_types[4] = {MPI_INT64_T, MPI_INT64_T, MPI_INT64_T, MPI_INT64_T};
+	MPI_Aint base_addr, field_addr[4];
+	MPI_Aint array_of_displacements[4] = {0};
+	MPI_Datatype packed;
 
-	MPI_Get_address(lower_limit, &lower_limit_addr);
-	MPI_Get_address(upper_limit, &upper_limit_addr);
-	array_of_displacements[1] = upper_limit_addr - lower_limit_addr;
+	MPI_Get_address(config, &base_addr);
+	MPI_Get_address(&config->lower_limit, &field_addr[0]);
+	MPI_Get_address(&config->upper_limit, &field_addr[1]);
+	MPI_Get_address(&config->repeat, &field_addr[2]);
+	MPI_Get_address(&config->mode, &field_addr[3]);
+	for (int k = 0; k < 4; k++)
+		array_of_displacements[k] = field_addr[k] - base_addr;
 
-	MPI_Type_create_struct(2, array_of_blocklengths,
+	MPI_Type_create_struct(4, array_of_blocklengths,
 			array_of_displacements, array_of_types,
-			input_mpi_t_p);
+			&packed);
+	MPI_Type_create_resized(packed, 0, sizeof(struct sum_config), input_mpi_t_p);
+	MPI_Type_free(&packed);
 
 	MPI_Type_commit(input_mpi_t_p);
 }	/* Build_mpi_type */
@@ -127,8 +781,8 @@ void Build_mpi_type(
 void Get_input(
 		int my_rank,		/* in */ 
 		int comm_sz,		/* in */ 
-		int* lower_limit,	/* out */ 
-		int* upper_limit	/* out */) {
+		int64_t* lower_limit,	/* out */ 
+		int64_t* upper_limit	/* out */) {
 	
 	/* in this case, i is assumed to be 0 */
 	*lower_limit = 0;
@@ -136,9 +790,11 @@ void Get_input(
 	if (my_rank == 0) {
 		printf("Enter n: ");
 		fflush(stdout);	
-		scanf("%d", upper_limit);
+		scanf("%" SCNd64, upper_limit);
 	}
 
-	MPI_Bcast(lower_limit, 1, MPI_INT, 0, MPI_COMM_WORLD);
-	MPI_Bcast(upper_limit, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	Instr_begin(INSTR_BCAST);
+	MPI_Bcast(lower_limit, 1, MPI_INT64_T, 0, MPI_COMM_WORLD);
+	MPI_Bcast(upper_limit, 1, MPI_INT64_T, 0, MPI_COMM_WORLD);
+	Instr_end(INSTR_BCAST);
 }	/* Get_input */
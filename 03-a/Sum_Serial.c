@@ -4,41 +4,90 @@
  * Input: 	The lower limit i, and the upper limit n'
  * Output:	The summation from i to n of 4*[(-1)^i / 2i+4]
  *
- * Compile:	gcc Sum_Serial.c -o Sum_Serial -lm 
- * Run:		./Sum_Serial 
+ * Compile:	gcc -O2 Sum_Serial.c -o Sum_Serial -lm 
+ * Run:		./Sum_Serial [--kernel ordered|paired|repro]	(paired: faster, not bit-identical; repro: same bits for any split; see sum_kernels.h)
+ * 		./Sum_Serial --eps <tolerance>	(pi to the tolerance with a tail correction, timed against brute force)
+ * 		./Sum_Serial --n <list or range> [--repeat R] [--jobs <file>] [--format text|csv|json]
+ * 			(a sweep in one run, a row per configuration; see sweep.h)
+ * 		./Sum_Serial --bench-kernels [n]	(compare the SIMD variants, see sum_kernels.h)
+ * 		KERNEL_ISA=sse2|avx2|avx512 ./Sum_Serial	(force a variant)
+ * 		INSTR_COUNTERS=1 ./Sum_Serial	(hardware counters in the phase report, see instrument.h)
+ * 		./Sum_tune first saves this host's best variant, loaded here at startup (see tune.h)
  *
- * n = 1000000000
+ * n = 1000000000 (any 64-bit n works, see sum_kernels.h)
  */
 
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
-#include "timer.h"
+#include <string.h>
+#include "instrument.h"
+#include "sum_kernels.h"
+#include "sweep.h"
+#include "tune.h"
 
 /* Calculate the summation */
-double Summation(int i, int n);
+double Summation(int64_t i, int64_t n);
 
 /* Get the input value */
-void Get_input(int* n);
+void Get_input(int64_t* n);
 
-int main(void) {
-	int i = 0, n;	
-	double result = 0, start, finish;
+/* Summation as a sum_driver, for --eps (see sum_kernels.h) */
+double Timed_summation(int64_t lower_limit, int64_t upper_limit, double* seconds, void* arg);
+
+/* Run the configurations of a sweep, a results row each */
+void Run_sweep(const struct sum_config* configs, int nof_configs, enum bench_format format);
+
+int main(int argc, char* argv[]) {
+	int64_t i = 0, n;
+	double result = 0, start, finish, eps;
+	static struct sum_config configs[SWEEP_MAX_CONFIGS];
+	enum bench_format format;
+	int nof_configs;
+
+	Tune_load("sum");
+	if (argc > 1 && strcmp(argv[1], "--bench-kernels") == 0)
+		return Sum_kernels_benchmark(argc > 2 ? atoll(argv[2]) : 100000000);
+	if (Sum_select_mode(argc, argv) != 0 || (eps = Sum_select_eps(argc, argv)) < 0)
+		return 1;
+	if (eps > 0) {
+		/* Accuracy-driven: as few terms as eps allows, vs brute force */
+		int status = Sum_to_tolerance(eps, Timed_summation, NULL, stdout);
+		printf("kernel: %s\n", Sum_kernel_name());
+		Instr_report(stderr);
+		return status;
+	}
+
+	/* A sweep from --n / --jobs: every configuration in this run */
+	nof_configs = Sweep_configs(argc, argv, configs, SWEEP_MAX_CONFIGS, &format);
+	if (nof_configs != 0) {
+		if (nof_configs > 0) {
+			Run_sweep(configs, nof_configs, format);
+			Instr_report(stderr);
+		}
+		return nof_configs < 0;
+	}
 
 	Get_input(&n);
 	
 	/* Start timer */
-	GET_TIME(start);
+	start = Instr_now();
 
 	/* Execute functions */
 	result = Summation(i, n);
 
 	/* End timer */
-	GET_TIME(finish);
+	finish = Instr_now();
 
 	/* Output result and time */
-	printf("%f\n", result);
+	if (Sum_mode() == SUM_REPRO)
+		printf("%.17g\n", result);	/* the same bits as the MPI programs */
+	else
+		printf("%f\n", result);
 	printf("elapsed time: %e seconds\n", finish-start);
+	printf("kernel: %s\n", Sum_kernel_name());
+	Tune_report(stdout);
+	Instr_report(stderr);
 	
 	return 0;
 } /* main */
@@ -49,12 +98,11 @@ int main(void) {
  * Input args:	The lower limit i, and the upper limit n
  * Output:	The sum of all summands times 4
  */
-double Summation(int i, int n) {
-	double sum = 0.0;
+double Summation(int64_t i, int64_t n) {
+	double sum;
+	INSTR_SCOPE(INSTR_COMPUTE);
 
-	for(i; i < n; i++) {
-		sum += (pow(-1.0,(double)i) / ((2.0*i)+1));
-	}	
+	sum = Sum_kernel(i, n);
 	
 	return 4*sum;
 } /* Summation */
@@ -65,6 +113,41 @@ double Summation(int i, int n) {
  * 		we want to know n.
  * Output args:	n: 	pointer to upper limit n
  */
-void Get_input(int* n) {
-	printf("enter n: "); scanf("%d", n);
+void Get_input(int64_t* n) {
+	printf("enter n: "); scanf("%" SCNd64, n);
 } /* Get_input */
+
+/*--------------------------------------------------------------------
+ * Function:	Timed_summation
+ * Purpose:	Summation of [lower_limit, upper_limit) without the factor 4,
+ * 		and its time
+ * Output args:	seconds:	elapsed time
+ */
+double Timed_summation(int64_t lower_limit, int64_t upper_limit, double* seconds, void* arg) {
+	double start = Instr_now(), sum = Summation(lower_limit, upper_limit) / 4;
+
+	*seconds = Instr_now() - start;
+	return sum;
+} /* Timed_summation */
+
+/*--------------------------------------------------------------------
+ * Function:	Run_sweep
+ * Purpose:	Sum each configuration repeat times and print its row
+ * Input args:	configs:	the configurations
+ * 		format:		the row format
+ */
+void Run_sweep(const struct sum_config* configs, int nof_configs, enum bench_format format) {
+	struct bench_report report = {NULL, BENCH_TEXT, 0};
+	enum sum_mode kernel = Sum_mode();
+	double seconds[SWEEP_MAX_REPEAT], sum = 0;
+
+	Sweep_begin(&report, stdout, format);
+	for (int c = 0; c < nof_configs; c++) {
+		Sum_set_mode(configs[c].mode >= 0 ? (enum sum_mode)configs[c].mode : kernel);
+		for (int r = 0; r < configs[c].repeat; r++)
+			sum = Timed_summation(configs[c].lower_limit, configs[c].upper_limit, &seconds[r], NULL);
+		Sweep_row(&report, &configs[c], 1, Sum_kernel_name(), "-", seconds, 4 * sum);
+	}
+	Sweep_end(&report);
+	Sum_set_mode(kernel);
+} /* Run_sweep */
@@ -0,0 +1,180 @@
+/* File:	Sum_Series.c
+ * Purpose:	Several series summed by the drivers of series.h: each series is
+ * 		only its term function and accumulator kind, and runs serially,
+ * 		on the thread pool and over MPI without a program of its own
+ *
+ * Compile:	mpicc -O2 -g -Wall -o Sum_Series Sum_Series.c -lm -lpthread
+ * Run:		mpiexec -n <number of processes> ./Sum_Series [--series leibniz|basel|log2|all]
+ * 			[--driver serial|threads|mpi|all] [--n <terms>] [--threads <t>]
+ *
+ * Notes:
+ * 	1.	Every driver of every chosen series prints a row: time, terms per
+ * 		second, the sum and its distance from the limit (the tail of n
+ * 		terms is part of that distance).  serial and threads run on
+ * 		process 0, mpi on all processes, each on a pool of --threads
+ * 		threads (default 1 for mpi, every cpu for threads).
+ * 	2.	The "hand-written" row sums the Leibniz series with the loop of the
+ * 		original programs, written out; the plain serial driver has to match
+ * 		its bits and its speed, which shows the series was specialized at
+ * 		compile time.
+ *
+ * n = 100000000 by default (any 64-bit n works)
+ */
+
+#define _GNU_SOURCE	/* sched_getaffinity, used by affinity.h and pool.h */
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "instrument.h"
+#include "sum_kernels.h"
+#include "sweep.h"
+#include "pool.h"
+#include "series.h"
+
+/* pi / 4 = 1 - 1/3 + 1/5 - ... */
+static inline double Leibniz_term(int64_t i) {
+	return (i & 1 ? -1.0 : 1.0) / ((2.0*i)+1);
+}
+SERIES_DEFINE(Leibniz, Leibniz_term, plain)
+
+/* pi^2 / 6 = 1 + 1/4 + 1/9 + ...: all positive, so compensated */
+static inline double Basel_term(int64_t i) {
+	double k = i + 1.0;
+
+	return 1.0 / (k * k);
+}
+SERIES_DEFINE(Basel, Basel_term, kahan)
+
+/* ln 2 = 1 - 1/2 + 1/3 - ...: exact, the same bits for any split */
+static inline double Log2_term(int64_t i) {
+	return (i & 1 ? -1.0 : 1.0) / (i + 1.0);
+}
+SERIES_DEFINE(Log2, Log2_term, exact)
+
+struct series_entry {
+	const char* name;
+	pool_leaf leaf;
+	const char* accumulator;
+	double limit;
+};
+
+static const struct series_entry Series_table[] = {
+	{"leibniz", Leibniz_leaf, "plain", M_PI / 4},
+	{"basel", Basel_leaf, "kahan", M_PI * M_PI / 6},
+	{"log2", Log2_leaf, "exact", M_LN2},
+};
+#define NOF_SERIES (int)(sizeof(Series_table) / sizeof(Series_table[0]))
+
+enum driver { DRIVER_SERIAL, DRIVER_THREADS, DRIVER_MPI, NOF_DRIVERS };
+static const char* const Driver_names[NOF_DRIVERS] = {"serial", "threads", "mpi"};
+
+/* The Leibniz loop of the original programs, written out */
+double Hand_written(int64_t lower_limit, int64_t upper_limit);
+
+/* Print a result row (process 0) */
+void Print_row(const char* series, const char* driver, const char* accumulator, int workers, int64_t n,
+		double seconds, double sum, double limit);
+
+int main(int argc, char* argv[]) {
+	int my_rank, comm_sz, provided, local_rank, threads;
+	const char* series = "all", * driver = "all";
+	int64_t n = 100000000;
+	double seconds, sum;
+	char* end;
+
+	MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+
+	for (int a = 1; a + 1 < argc; a += 2) {
+		if (strcmp(argv[a], "--series") == 0)
+			series = argv[a + 1];
+		else if (strcmp(argv[a], "--driver") == 0)
+			driver = argv[a + 1];
+		else if (strcmp(argv[a], "--n") == 0)
+			n = Sweep_count(argv[a + 1], &end);
+		else if (strcmp(argv[a], "--threads") != 0)
+			n = -1;
+	}
+	if (argc % 2 == 0 || n < 1 || Pool_select(argc, argv) != 0) {
+		if (my_rank == 0)
+			fprintf(stderr, "usage: mpiexec -n <p> %s [--series leibniz|basel|log2|all] "
+					"[--driver serial|threads|mpi|all] [--n <terms>] [--threads <t>]\n", argv[0]);
+		MPI_Finalize();
+		return 1;
+	}
+	local_rank = Affinity_pin_rank(NULL, MPI_COMM_WORLD);
+
+	if (my_rank == 0) {
+		printf("%-9s %-12s %-6s %7s %14s %12s %12s %20s %10s\n", "series", "driver", "acc", "workers", "n",
+				"time (s)", "terms/s", "sum", "vs limit");
+		if (strcmp(series, "all") == 0 || strcmp(series, "leibniz") == 0) {
+			double start = Instr_now();
+
+			sum = Hand_written(0, n);
+			Print_row("leibniz", "hand-written", "plain", 1, n, Instr_now() - start, sum, M_PI / 4);
+		}
+	}
+
+	for (int s = 0; s < NOF_SERIES; s++) {
+		const struct series_entry* e = &Series_table[s];
+
+		if (strcmp(series, "all") != 0 && strcmp(series, e->name) != 0)
+			continue;
+		for (int d = 0; d < NOF_DRIVERS; d++) {
+			if (strcmp(driver, "all") != 0 && strcmp(driver, Driver_names[d]) != 0)
+				continue;
+			if (d == DRIVER_MPI) {
+				threads = Pool_threads(1);
+				Pool_start(threads, local_rank * threads);
+				sum = Series_mpi(e->leaf, 0, n, &seconds, MPI_COMM_WORLD);
+				Pool_stop();
+				threads *= comm_sz;
+			} else if (my_rank == 0) {
+				threads = d == DRIVER_THREADS ? Pool_threads(0) : 1;
+				Pool_start(threads, 0);
+				sum = d == DRIVER_THREADS ? Series_threads(e->leaf, 0, n, &seconds)
+						: Series_serial(e->leaf, 0, n, &seconds);
+				Pool_stop();
+			} else {
+				continue;
+			}
+			if (my_rank == 0)
+				Print_row(e->name, Driver_names[d], e->accumulator, threads, n, seconds, sum, e->limit);
+		}
+	}
+	Instr_report_mpi(stdout, MPI_COMM_WORLD);
+
+	MPI_Finalize();
+	return 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Hand_written
+ * Purpose:	The summation loop of Sum_Serial before the kernels,
+ * 		with the sign taken from the parity of i (pow(-1, i) is
+ * 		exactly that)
+ * Return:	the sum of (-1)^i / (2i+1) for lower_limit <= i < upper_limit
+ */
+double Hand_written(int64_t lower_limit, int64_t upper_limit) {
+	double result = 0;
+
+	for (int64_t i = lower_limit; i < upper_limit; i++) {
+		result += (i & 1 ? -1.0 : 1.0) / ((2.0*i)+1);
+	}
+	return result;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Print_row
+ * Purpose:	One row of the results table: the run, its rate, the sum
+ * 		and sum - limit
+ */
+void Print_row(const char* series, const char* driver, const char* accumulator, int workers, int64_t n,
+		double seconds, double sum, double limit) {
+	printf("%-9s %-12s %-6s %7d %14" PRId64 " %12.4e %12.4e %20.17f %10.3e\n", series, driver, accumulator,
+			workers, n, seconds, seconds > 0 ? n / seconds : 0, sum, sum - limit);
+	fflush(stdout);
+}
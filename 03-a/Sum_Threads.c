@@ -0,0 +1,147 @@
+/* File:	Sum_Threads.c
+ * Purpose:	A shared-memory algorithm to calculate the summation of a function:
+ * 		the terms are summed by the work-stealing thread pool of pool.h,
+ * 		without processes or messages
+ *
+ * Input: 	The lower limit i, and the upper limit n'
+ * Output:	The summation from i to n of 4*[(-1)^i / 2i+4]
+ *
+ * Compile:	gcc -O2 -g -Wall -o Sum_Threads Sum_Threads.c -lm -lpthread
+ * Run:		[AFFINITY=compact|scatter|l3] ./Sum_Threads [--threads <t>] [--kernel ordered|paired|repro]
+ * 		./Sum_Threads --n <list or range> [--repeat R] [--jobs <file>] [--format text|csv|json]
+ * 			(a sweep in one run, a row per configuration; see sweep.h)
+ * 		./Sum_tune first saves this host's best variant, threads and grain, loaded
+ * 		here at startup (see tune.h)
+ *
+ * Notes:
+ * 	1.	--threads 0 (the default) or $SUM_THREADS=0 uses every cpu the
+ * 		process may run on.  Each thread's terms, tasks, steals and busy
+ * 		time are printed after the result.
+ * 	2.	With --kernel repro the result has the same bits as Sum_Serial
+ * 		and the MPI programs, for any number of threads.
+ *
+ * n = 1000000000 (any 64-bit n works, see sum_kernels.h)
+ */
+
+#define _GNU_SOURCE	/* sched_getaffinity, used by affinity.h and pool.h */
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "instrument.h"
+#include "sum_kernels.h"
+#include "sweep.h"
+#include "pool.h"
+#include "tune.h"
+
+/* Calculate the summation */
+double Summation(int64_t i, int64_t n);
+
+/* Get the input value */
+void Get_input(int64_t* n);
+
+/* Run the configurations of a sweep, a results row each */
+void Run_sweep(const struct sum_config* configs, int nof_configs, enum bench_format format);
+
+int main(int argc, char* argv[]) {
+	int64_t i = 0, n;
+	double result = 0, start, finish;
+	static struct sum_config configs[SWEEP_MAX_CONFIGS];
+	enum bench_format format;
+	int nof_configs;
+
+	Tune_load("sum");
+	if (Sum_select_mode(argc, argv) != 0 || Pool_select(argc, argv) != 0)
+		return 1;
+	Pool_start(Pool_threads(0), 0);
+
+	/* A sweep from --n / --jobs: every configuration in this run */
+	nof_configs = Sweep_configs(argc, argv, configs, SWEEP_MAX_CONFIGS, &format);
+	if (nof_configs != 0) {
+		if (nof_configs > 0) {
+			Run_sweep(configs, nof_configs, format);
+			Instr_report(stderr);
+		}
+		Pool_stop();
+		return nof_configs < 0;
+	}
+
+	Get_input(&n);
+
+	/* Start timer */
+	start = Instr_now();
+
+	/* Execute functions */
+	result = Summation(i, n);
+
+	/* End timer */
+	finish = Instr_now();
+
+	/* Output result and time */
+	if (Sum_mode() == SUM_REPRO)
+		printf("%.17g\n", result);	/* the same bits as Sum_Serial */
+	else
+		printf("%f\n", result);
+	printf("elapsed time: %e seconds\n", finish-start);
+	printf("kernel: %s, threads: %d\n", Sum_kernel_name(), Pool.nof_threads);
+	Tune_report(stdout);
+	Pool_report(stdout, "pool");
+	Instr_report(stderr);
+
+	Pool_stop();
+	return 0;
+} /* main */
+
+/*--------------------------------------------------------------------
+ * Function:	Summation
+ * Purpose:	Calculate and return the sum of all summands, on every
+ * 		thread of the pool
+ * Input args:	The lower limit i, and the upper limit n
+ * Output:	The sum of all summands times 4
+ */
+double Summation(int64_t i, int64_t n) {
+	struct sum_acc acc;
+	INSTR_SCOPE(INSTR_COMPUTE);
+
+	Sum_acc_init(&acc);
+	Pool_sum(i, n, &acc);
+
+	return 4*Sum_acc_value(&acc);
+} /* Summation */
+
+/*--------------------------------------------------------------------
+ * Function:	Get_input
+ * Purpose:	Get the user input, in this case we assume i = 0, and
+ * 		we want to know n.
+ * Output args:	n: 	pointer to upper limit n
+ */
+void Get_input(int64_t* n) {
+	printf("enter n: "); scanf("%" SCNd64, n);
+} /* Get_input */
+
+/*--------------------------------------------------------------------
+ * Function:	Run_sweep
+ * Purpose:	Sum each configuration repeat times and print its row
+ * Input args:	configs:	the configurations
+ * 		format:		the row format
+ * Note:	The procs column is the number of threads.
+ */
+void Run_sweep(const struct sum_config* configs, int nof_configs, enum bench_format format) {
+	struct bench_report report = {NULL, BENCH_TEXT, 0};
+	enum sum_mode kernel = Sum_mode();
+	double seconds[SWEEP_MAX_REPEAT], sum = 0;
+
+	Sweep_begin(&report, stdout, format);
+	for (int c = 0; c < nof_configs; c++) {
+		Sum_set_mode(configs[c].mode >= 0 ? (enum sum_mode)configs[c].mode : kernel);
+		for (int r = 0; r < configs[c].repeat; r++) {
+			double start = Instr_now();
+
+			sum = Summation(configs[c].lower_limit, configs[c].upper_limit);
+			seconds[r] = Instr_now() - start;
+		}
+		Sweep_row(&report, &configs[c], Pool.nof_threads, Sum_kernel_name(), "-", seconds, sum);
+	}
+	Sweep_end(&report);
+	Sum_set_mode(kernel);
+} /* Run_sweep */
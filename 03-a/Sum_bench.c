@@ -0,0 +1,136 @@
+/* File:	Sum_bench.c
+ * Purpose:	Benchmark suite for the summation kernels.  Times the ordered and
+ * 		paired kernels from sum_kernels.h and optionally the original pow()
+ * 		loop over a list of term counts.  The ordered kernel must match the
+ * 		pow() loop bit for bit; the paired and repro kernels must be at least
+ * 		as close to the exact sum as the pow() loop (or within 1 ulp of it).  Every
+ * 		count is also run from a first term past 2^32, so the 64-bit
+ * 		index path is timed and checked the same way as [0, n).
+ *
+ * Compile:	gcc -O2 -Wall -o Sum_bench Sum_bench.c -lm
+ * Run:		./Sum_bench [--n 1000000,10000000,100000000] [--kernels ordered,paired,repro,reference]
+ * 			[--first 0,10000000000] [--format text|csv|json] [--trials N] [--warmup N]
+ *
+ * Notes:
+ * 	1.	The kernel variant comes from dispatch.h (KERNEL_ISA=sse2|avx2|avx512).
+ * 	2.	Harness settings are described in bench.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sum_kernels.h"
+#include "bench.h"
+
+#define MAX_COUNTS 16
+
+/* One benchmark case: the terms [first, first + n) and the last result */
+struct sum_case {
+	int64_t first, n;
+	double result;
+};
+
+/* Timed kernels; Time_summation runs Sum_kernel in the mode last set */
+void Time_summation(void* arg);
+void Time_reference(void* arg);
+
+/* Parse a comma separated list of term counts (or first terms) */
+int Parse_counts(const char* list, int64_t* counts, int64_t min);
+
+int main(int argc, char* argv[]) {
+	struct bench_config config = Bench_default_config();
+	struct bench_report report;
+	int64_t counts[MAX_COUNTS] = {1000000, 10000000, 100000000}, firsts[MAX_COUNTS] = {0, 10000000000LL};
+	int nof_counts = 3, nof_firsts = 2;
+	const char* kernels = "ordered,paired,repro";
+	int failures = 0;
+
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "--n") == 0 && a + 1 < argc) {
+			nof_counts = Parse_counts(argv[++a], counts, 1);
+		} else if (strcmp(argv[a], "--first") == 0 && a + 1 < argc) {
+			nof_firsts = Parse_counts(argv[++a], firsts, 0);
+		} else if (strcmp(argv[a], "--kernels") == 0 && a + 1 < argc) {
+			kernels = argv[++a];
+		} else if (strcmp(argv[a], "--format") == 0 && a + 1 < argc) {
+			config.format = Bench_parse_format(argv[++a]);
+		} else if (strcmp(argv[a], "--trials") == 0 && a + 1 < argc) {
+			config.trials = atoi(argv[++a]);
+		} else if (strcmp(argv[a], "--warmup") == 0 && a + 1 < argc) {
+			config.warmup = atoi(argv[++a]);
+		} else {
+			fprintf(stderr, "usage: %s [--n 1000000,...] [--kernels ordered,paired,repro,reference] "
+					"[--first 0,...] [--format text|csv|json] [--trials N] [--warmup N]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nof_counts <= 0 || nof_firsts <= 0 || config.trials < 1 || config.trials > BENCH_MAX_TRIALS) {
+		fprintf(stderr, "Sum_bench: n must be positive, trials from 1 to %d\n", BENCH_MAX_TRIALS);
+		return 1;
+	}
+
+	Bench_begin(&report, stdout, config.format);
+
+	for (int f = 0; f < nof_firsts; f++) {
+		for (int c = 0; c < nof_counts; c++) {
+			struct sum_case sc = {firsts[f], counts[c], 0.0};
+			struct bench_stats stats;
+			double expect = Sum_reference(sc.first, sc.first + sc.n);
+			double exact = Sum_exact(sc.first, sc.first + sc.n);
+			char params[64];
+			int ok;
+
+			for (int m = 0; m < SUM_NOF_MODES; m++) {
+				/* "summation" is the old name of the ordered kernel */
+				if (strstr(kernels, Sum_mode_names[m]) == NULL
+						&& !(m == SUM_ORDERED && strstr(kernels, "summation") != NULL))
+					continue;
+				Sum_set_mode((enum sum_mode)m);
+				snprintf(params, sizeof(params), "n=%" PRId64 "@%" PRId64 "/%s", sc.n, sc.first,
+						Isa_names[Sum_kernel_isa()]);
+				Bench_run(Time_summation, &sc, &config, &stats);
+				if (m == SUM_ORDERED)
+					ok = memcmp(&sc.result, &expect, sizeof(double)) == 0;
+				else
+					ok = fabs(sc.result - exact) <= fabs(expect - exact) || Sum_ulps(sc.result, exact) <= 1;
+				Bench_record(&report, Sum_mode_names[m], params, sc.n, &stats,
+						Bench_checksum(&sc.result, sizeof(double)), ok);
+				failures += !ok;
+			}
+
+			if (strstr(kernels, "reference") != NULL) {
+				snprintf(params, sizeof(params), "n=%" PRId64 "@%" PRId64 "/pow", sc.n, sc.first);
+				Bench_run(Time_reference, &sc, &config, &stats);
+				Bench_record(&report, "reference", params, sc.n, &stats,
+						Bench_checksum(&sc.result, sizeof(double)), -1);
+			}
+		}
+	}
+
+	Bench_end(&report);
+	return failures != 0;
+} /* main */
+
+void Time_summation(void* arg) {
+	struct sum_case* sc = arg;
+	sc->result = Sum_kernel(sc->first, sc->first + sc->n);
+}
+
+void Time_reference(void* arg) {
+	struct sum_case* sc = arg;
+	sc->result = Sum_reference(sc->first, sc->first + sc->n);
+}
+
+int Parse_counts(const char* list, int64_t* counts, int64_t min) {
+	int n = 0;
+	char* end;
+
+	while (*list != '\0' && n < MAX_COUNTS) {
+		long long count = strtoll(list, &end, 10);
+		if (end == list || count < min)
+			return -1;
+		counts[n++] = count;
+		list = (*end == ',') ? end + 1 : end;
+	}
+	return n;
+} /* Parse_counts */
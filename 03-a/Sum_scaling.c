@@ -0,0 +1,248 @@
+/* File:	Sum_scaling.c
+ * Purpose:	Strong and weak scaling study of the parallel summation.  For every
+ * 		(processes, threads) pair the first `processes` ranks split the terms
+ * 		into processes x threads blocks, sum them with the dispatched kernel
+ * 		and reduce to rank 0, which prints max/min/mean per-rank times,
+ * 		speedup, efficiency and the Karp-Flatt serial fraction.
+ *
+ * Compile:	mpicc -O2 -g -Wall -o Sum_scaling Sum_scaling.c -lm -lpthread
+ * Run:		mpiexec -n <max processes> ./Sum_scaling [--mode strong|weak|both]
+ * 			[--procs 1,2,4] [--threads 1,2] [--n <terms>] [--kernel ordered|paired|repro]
+ * 			[--engine blocks|pool]
+ *
+ * Notes:
+ * 	1.	Strong mode sums n terms (default 100000000) at every point.  Weak
+ * 		mode gives every worker (process x thread) n / 4 terms.
+ * 	2.	Each result is checked against the serial kernel over the same terms.
+ * 		Splitting the terms changes the rounding, so the check allows an
+ * 		absolute difference of 1e-12; anything larger makes the exit status 1.
+ * 		With --kernel repro the partial sums are merged exactly and the
+ * 		result has to match bit for bit.
+ * 	3.	BENCH_TRIALS / BENCH_WARMUP (see bench.h) set the repetitions; each
+ * 		rank's time is the median of its trials.
+ * 	4.	--engine blocks (the default) gives each thread one block of its
+ * 		rank's terms.  --engine pool sums them on the work-stealing pool of
+ * 		pool.h, the engine of Sum_Threads and of Sum_MPI_v1/v2 --threads;
+ * 		comparing the 1 x t and t x 1 rows then gives threads against an
+ * 		equal number of ranks.
+ */
+
+#define _GNU_SOURCE	/* sched_setaffinity, used by affinity.h */
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "sum_kernels.h"
+#include "sweep.h"
+#include "bench.h"
+#include "scaling.h"
+#include "pool.h"
+
+#define SUM_TOLERANCE 1e-12
+
+/* The terms of one rank and the partial sum of each of its threads */
+struct sum_job {
+	long lower_limit, local_n;
+	double partial[SCALING_MAX_THREADS];
+	struct sum_acc acc[SCALING_MAX_THREADS];	/* exact partial sums (repro mode) */
+};
+
+static int Use_pool = 0;	/* --engine pool */
+
+/* Sum this rank's terms on nof_threads threads */
+void Sum_thread(void* arg, int thread, int nof_threads);
+
+/* Time one parallel summation of n terms over comm, returning this rank's time */
+double Sum_parallel(MPI_Comm comm, long n, int nof_threads, int base_slot, double* total);
+
+/* Measure every (procs, threads) pair and print the table on rank 0 */
+int Run_study(enum scaling_mode mode, const int* procs, int nof_procs, const int* threads, int nof_threads,
+		long n, int my_rank, int local_rank);
+
+int main(int argc, char* argv[]) {
+	int my_rank, comm_sz, local_rank, failures = 0;
+	int procs[SCALING_MAX_POINTS], threads[SCALING_MAX_POINTS] = {1};
+	int nof_procs, nof_threads = 1;
+	const char* mode = "both";
+	char* end;
+	long n = 100000000;
+
+	MPI_Init(NULL, NULL);
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+	local_rank = Affinity_pin_rank(NULL, MPI_COMM_WORLD);
+
+	nof_procs = Scaling_powers_of_two(comm_sz, procs);
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "--mode") == 0 && a + 1 < argc)
+			mode = argv[++a];
+		else if (strcmp(argv[a], "--procs") == 0 && a + 1 < argc)
+			nof_procs = Scaling_parse_list(argv[++a], procs, SCALING_MAX_POINTS);
+		else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc)
+			nof_threads = Scaling_parse_list(argv[++a], threads, SCALING_MAX_POINTS);
+		else if (strcmp(argv[a], "--n") == 0 && a + 1 < argc) {
+			n = Sweep_count(argv[++a], &end);	/* 100000000 or 1e8, as the Sum drivers take it */
+			if (*end != '\0')
+				n = -1;
+		}
+		else if (strcmp(argv[a], "--kernel") == 0 && a + 1 < argc)
+			a++;	/* taken by Sum_select_mode */
+		else if (strcmp(argv[a], "--engine") == 0 && a + 1 < argc)
+			Use_pool = strcmp(argv[++a], "pool") == 0 ? 1 : (strcmp(argv[a], "blocks") == 0 ? 0 : -1);
+		else
+			nof_procs = -1;
+	}
+	for (int i = 0; i < nof_procs; i++) {
+		if (procs[i] > comm_sz)
+			nof_procs = -1;
+	}
+	for (int i = 0; i < nof_threads; i++) {
+		if (threads[i] > SCALING_MAX_THREADS)
+			nof_threads = -1;
+	}
+	if (nof_procs <= 0 || nof_threads <= 0 || n < 4 || Use_pool < 0 || Sum_select_mode(argc, argv) != 0) {
+		if (my_rank == 0)
+			fprintf(stderr, "usage: mpiexec -n <p> %s [--mode strong|weak|both] [--procs 1,2,..<=p] "
+					"[--threads 1,2,..] [--n <terms>] [--kernel ordered|paired|repro] "
+					"[--engine blocks|pool]\n", argv[0]);
+		MPI_Finalize();
+		return 1;
+	}
+	if (my_rank == 0)
+		printf("kernel: %s, threads: %s\n", Sum_kernel_name(), Use_pool ? "work-stealing pool" : "one block each");
+
+	if (strcmp(mode, "weak") != 0)
+		failures += Run_study(SCALING_STRONG, procs, nof_procs, threads, nof_threads, n, my_rank, local_rank);
+	if (strcmp(mode, "strong") != 0)
+		failures += Run_study(SCALING_WEAK, procs, nof_procs, threads, nof_threads, n, my_rank, local_rank);
+
+	MPI_Finalize();
+	return failures != 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Run_study
+ * Purpose:	Measure every (procs, threads) pair, 1 x 1 first, and
+ * 		print the table on rank 0
+ * Return:	number of results outside SUM_TOLERANCE (rank 0), 0
+ * 		elsewhere
+ */
+int Run_study(enum scaling_mode mode, const int* procs, int nof_procs, const int* threads, int nof_threads,
+		long n, int my_rank, int local_rank) {
+	struct scaling_point points[SCALING_MAX_POINTS];
+	struct bench_config config = Bench_default_config();
+	int count = 0, failures = 0;
+	char title[128];
+
+	if (config.trials > 5 && getenv("BENCH_TRIALS") == NULL)
+		config.trials = 5;
+
+	points[count++] = (struct scaling_point){1, 1, 0, 0, 0, 0, -1};
+	for (int p = 0; p < nof_procs; p++) {
+		for (int t = 0; t < nof_threads && count < SCALING_MAX_POINTS; t++) {
+			if (procs[p] * threads[t] > 1)
+				points[count++] = (struct scaling_point){procs[p], threads[t], 0, 0, 0, 0, -1};
+		}
+	}
+	if (mode == SCALING_STRONG)
+		snprintf(title, sizeof(title), "%ld terms", n);
+	else
+		snprintf(title, sizeof(title), "%ld terms per worker", n / 4);
+
+	for (int i = 0; i < count; i++) {
+		struct scaling_point* point = &points[i];
+		long terms = (mode == SCALING_WEAK) ? n / 4 * point->procs * point->threads : n;
+		double samples[BENCH_MAX_TRIALS], total = 0, expect;
+		struct bench_stats stats;
+		MPI_Comm comm;
+
+		point->work = (double) terms;
+
+		comm = Scaling_comm(point->procs);
+		if (comm != MPI_COMM_NULL) {
+			if (Use_pool)
+				Pool_start(point->threads, local_rank * point->threads);
+			for (int w = 0; w < config.warmup; w++)
+				Sum_parallel(comm, terms, point->threads, local_rank * point->threads, &total);
+			for (int t = 0; t < config.trials; t++)
+				samples[t] = Sum_parallel(comm, terms, point->threads, local_rank * point->threads, &total);
+			Bench_summarize(samples, config.trials, 1, &stats);
+			if (Use_pool)
+				Pool_stop();
+
+			Scaling_reduce(stats.median, comm, point);
+			if (my_rank == 0) {
+				expect = Sum_kernel(0, terms);
+				if (Sum_mode() == SUM_REPRO)
+					point->verified = memcmp(&total, &expect, sizeof(double)) == 0;
+				else
+					point->verified = fabs(total - expect) <= SUM_TOLERANCE;
+				failures += !point->verified;
+			}
+			MPI_Comm_free(&comm);
+		}
+		MPI_Barrier(MPI_COMM_WORLD);
+	}
+
+	if (my_rank == 0)
+		Scaling_print_table(stdout, title, mode, points, count);
+	return failures;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Sum_parallel
+ * Purpose:	Sum the first n terms over comm with nof_threads
+ * 		threads per rank
+ * Output args:	total:	the sum (rank 0)
+ * Return:	this rank's elapsed time, from a barrier to the end of
+ * 		its part of the reduction
+ */
+double Sum_parallel(MPI_Comm comm, long n, int nof_threads, int base_slot, double* total) {
+	static struct sum_job job;
+	int my_rank, comm_sz;
+	double local_summation = 0, start;
+
+	MPI_Comm_rank(comm, &my_rank);
+	MPI_Comm_size(comm, &comm_sz);
+
+	MPI_Barrier(comm);
+	start = MPI_Wtime();
+
+	Scaling_block(n, my_rank, comm_sz, &job.lower_limit, &job.local_n);
+	if (Use_pool) {
+		/* the pool's threads: the exact sum of their accumulators in acc[0] */
+		Sum_acc_init(&job.acc[0]);
+		Pool_sum(job.lower_limit, job.lower_limit + job.local_n, &job.acc[0]);
+		job.partial[0] = Sum_acc_value(&job.acc[0]);
+		nof_threads = 1;
+	} else {
+		Scaling_run_threads(Sum_thread, &job, nof_threads, base_slot);
+	}
+	if (Sum_mode() == SUM_REPRO) {
+		struct sum_acc total_acc;
+
+		for (int t = 1; t < nof_threads; t++)
+			Sum_acc_add(&job.acc[0], &job.acc[t]);
+		Sum_acc_reduce(&job.acc[0], &total_acc, 0, comm);
+		if (my_rank == 0)
+			*total = Sum_acc_value(&total_acc);
+	} else {
+		for (int t = 0; t < nof_threads; t++)
+			local_summation += job.partial[t];
+		MPI_Reduce(&local_summation, total, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+	}
+
+	return MPI_Wtime() - start;
+}
+
+void Sum_thread(void* arg, int thread, int nof_threads) {
+	struct sum_job* job = arg;
+	long first, count;
+
+	Scaling_block(job->local_n, thread, nof_threads, &first, &count);
+	first += job->lower_limit;
+	Sum_acc_init(&job->acc[thread]);
+	Sum_kernel_acc(first, first + count, &job->acc[thread]);
+	job->partial[thread] = Sum_acc_value(&job->acc[thread]);
+}
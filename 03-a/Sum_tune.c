@@ -0,0 +1,268 @@
+/* File:	Sum_tune.c
+ * Purpose:	Auto-tuner for the summation programs: times short trials of the
+ * 		settings that decide their speed on this host and saves the best as
+ * 		the host's "sum" profile (see tune.h), which Sum_Serial, Sum_Threads
+ * 		and Sum_MPI_v1/v2 load at startup:
+ * 			KERNEL_ISA	the SIMD variant of the kernel of the chosen mode
+ * 			SUM_THREADS	threads per process of the best ranks x threads
+ * 					split of the host's cpus
+ * 			SUM_RANKS	the number of processes of that split (a run
+ * 					with another -n gets a warning)
+ * 			SUM_GRAIN	the smallest task of the thread pool, in terms
+ *
+ * Compile:	mpicc -O2 -g -Wall -o Sum_tune Sum_tune.c -lm -lpthread
+ * Run:		mpiexec -n <max processes> ./Sum_tune [--n <terms>] [--workers <w>]
+ * 			[--kernel ordered|paired|repro] [--dry-run]
+ *
+ * Notes:
+ * 	1.	The splits are r processes x (w / r) threads for r = 1 .. min(p, w),
+ * 		where w is the number of cpus of the host (--workers overrides it);
+ * 		the first r processes of the launch take part.  Each split sums n
+ * 		terms (default 100000000); the kernel variants are timed on n / 10.
+ * 	2.	Each setting gets 5 trials (BENCH_TRIALS overrides, see bench.h), and
+ * 		a split's time is its slowest process's median.
+ * 	3.	The grain only matters with more than one thread per process; with
+ * 		one it is not tuned and not saved.
+ * 	4.	The kernel mode changes the rounding, so it is not tuned: the profile
+ * 		is for the mode of --kernel / $SUM_KERNEL.
+ */
+
+#define _GNU_SOURCE	/* sched_setaffinity, used by affinity.h and pool.h */
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <mpi.h>
+#include "sum_kernels.h"
+#include "sweep.h"
+#include "bench.h"
+#include "scaling.h"
+#include "pool.h"
+#include "tune.h"
+
+#define NOF_GRAINS 4
+
+static const int64_t Grain_list[NOF_GRAINS] = {16384, 65536, 262144, 1048576};
+
+/* One kernel variant on [0, n) */
+struct kernel_trial {
+	enum sum_mode mode;
+	int isa;
+	int64_t n;
+};
+
+/* Time one kernel variant (process 0); the time per call */
+double Time_kernel(enum sum_mode mode, int isa, int64_t n, const struct bench_config* config);
+void Kernel_trial(void* arg);
+
+/* Time the pool summation of n terms over comm; the slowest process's median (on process 0 of comm) */
+double Time_split(MPI_Comm comm, int64_t n, const struct bench_config* config);
+
+int main(int argc, char* argv[]) {
+	int my_rank, comm_sz, local_rank, provided, workers = 0, dry_run = 0;
+	int best_isa = ISA_SSE2, best_ranks = 1, best_threads = 1, best_grain = -1;
+	int64_t n = 100000000;
+	double best_time = 1e30, time;
+	struct bench_config config = Bench_default_config();
+	struct tune_setting best[4];
+	char* end, notes[1024] = "";
+	int nof_settings = 3;
+
+	MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "--n") == 0 && a + 1 < argc)
+			n = Sweep_count(argv[++a], &end);
+		else if (strcmp(argv[a], "--workers") == 0 && a + 1 < argc)
+			workers = atoi(argv[++a]);
+		else if (strcmp(argv[a], "--kernel") == 0 && a + 1 < argc)
+			a++;	/* taken by Sum_select_mode */
+		else if (strcmp(argv[a], "--dry-run") == 0)
+			dry_run = 1;
+		else
+			n = -1;
+	}
+	if (workers == 0)
+		workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (n < 1000 || workers < 1 || workers > POOL_MAX_THREADS || Sum_select_mode(argc, argv) != 0) {
+		if (my_rank == 0)
+			fprintf(stderr, "usage: mpiexec -n <p> %s [--n <terms>] [--workers <w>] "
+					"[--kernel ordered|paired|repro] [--dry-run]\n", argv[0]);
+		MPI_Finalize();
+		return 1;
+	}
+	if (config.trials > 5 && getenv("BENCH_TRIALS") == NULL)
+		config.trials = 5;
+	if (config.warmup > 1 && getenv("BENCH_WARMUP") == NULL)
+		config.warmup = 1;
+	local_rank = Affinity_pin_rank(NULL, MPI_COMM_WORLD);
+
+	/* The variant: process 0 alone, on n / 10 terms */
+	if (my_rank == 0) {
+		printf("tuning the %s kernel on %d processes, %d workers, %d trials per setting\n",
+				Sum_mode_names[Sum_mode()], comm_sz, workers, config.trials);
+		printf("%-10s %-20s %12s %12s\n", "setting", "value", "time (s)", "terms/s");
+		for (int v = 0; v < ISA_COUNT; v++) {
+			if (!Isa_supported((enum isa)v))
+				continue;
+			time = Time_kernel(Sum_mode(), v, n / 10, &config);
+			printf("%-10s %-20s %12.4e %12.4e\n", "kernel", Isa_names[v], time, n / 10 / time);
+			if (time < best_time) {
+				best_time = time;
+				best_isa = v;
+			}
+		}
+		snprintf(notes, sizeof(notes), "# %s kernel: %.3e terms/s with %s\n", Sum_mode_names[Sum_mode()],
+				n / 10 / best_time, Isa_names[best_isa]);
+	}
+	MPI_Bcast(&best_isa, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	setenv("KERNEL_ISA", Isa_names[best_isa], 1);	/* before the first Isa_selected */
+
+	/* The split: r processes x workers / r threads */
+	best_time = 1e30;
+	for (int r = 1; r <= comm_sz && r <= workers; r++) {
+		int threads = workers / r;
+		MPI_Comm comm = Scaling_comm(r);
+
+		if (comm != MPI_COMM_NULL) {
+			Pool_start(threads, local_rank * threads);
+			time = Time_split(comm, n, &config);
+			Pool_stop();
+			MPI_Comm_free(&comm);
+			if (my_rank == 0) {
+				char value[32];
+
+				snprintf(value, sizeof(value), "%d x %d", r, threads);
+				printf("%-10s %-20s %12.4e %12.4e\n", "split", value, time, n / time);
+				if (time < best_time) {
+					best_time = time;
+					best_ranks = r;
+					best_threads = threads;
+				}
+			}
+		}
+		MPI_Barrier(MPI_COMM_WORLD);
+	}
+	MPI_Bcast(&best_ranks, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	MPI_Bcast(&best_threads, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	if (my_rank == 0)
+		snprintf(notes + strlen(notes), sizeof(notes) - strlen(notes),
+				"# %" PRId64 " terms in %.3e s as %d processes x %d threads (mpiexec -n %d)\n", n, best_time,
+				best_ranks, best_threads, best_ranks);
+
+	/* The grain of the best split's pool */
+	if (best_threads > 1) {
+		MPI_Comm comm = Scaling_comm(best_ranks);
+
+		best_time = 1e30;
+		if (comm != MPI_COMM_NULL) {
+			Pool_start(best_threads, local_rank * best_threads);
+			for (int g = 0; g < NOF_GRAINS; g++) {
+				Pool_min_grain = Grain_list[g];
+				time = Time_split(comm, n, &config);
+				if (my_rank == 0) {
+					char value[32];
+
+					snprintf(value, sizeof(value), "%" PRId64 " terms", Grain_list[g]);
+					printf("%-10s %-20s %12.4e %12.4e\n", "grain", value, time, n / time);
+					if (time < best_time) {
+						best_time = time;
+						best_grain = g;
+					}
+				}
+			}
+			Pool_stop();
+			MPI_Comm_free(&comm);
+		}
+		MPI_Barrier(MPI_COMM_WORLD);
+	}
+
+	if (my_rank == 0) {
+		snprintf(best[0].name, sizeof(best[0].name), "KERNEL_ISA");
+		snprintf(best[0].value, sizeof(best[0].value), "%s", Isa_names[best_isa]);
+		snprintf(best[1].name, sizeof(best[1].name), "SUM_THREADS");
+		snprintf(best[1].value, sizeof(best[1].value), "%d", best_threads);
+		snprintf(best[2].name, sizeof(best[2].name), "SUM_RANKS");
+		snprintf(best[2].value, sizeof(best[2].value), "%d", best_ranks);
+		if (best_grain >= 0) {
+			snprintf(best[3].name, sizeof(best[3].name), "SUM_GRAIN");
+			snprintf(best[3].value, sizeof(best[3].value), "%" PRId64, Grain_list[best_grain]);
+			nof_settings = 4;
+		}
+		printf("\nbest:");
+		for (int s = 0; s < nof_settings; s++)
+			printf(" %s=%s", best[s].name, best[s].value);
+		printf("\n%s", notes);
+		if (!dry_run && Tune_save("sum", best, nof_settings, notes) != 0)
+			MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+
+	MPI_Finalize();
+	return 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Time_kernel
+ * Purpose:	Time the variant isa of mode's kernel on [0, n): the
+ * 		plain sum, or the exact deposits in repro mode
+ * Return:	the median time per call
+ */
+double Time_kernel(enum sum_mode mode, int isa, int64_t n, const struct bench_config* config) {
+	struct kernel_trial trial = {mode, isa, n};
+	struct bench_stats stats;
+
+	Bench_run(Kernel_trial, &trial, config, &stats);
+	return stats.median;
+}
+
+void Kernel_trial(void* arg) {
+	struct kernel_trial* trial = arg;
+	struct sum_acc acc;
+	volatile double sink;
+
+	if (trial->mode == SUM_REPRO) {
+		Sum_acc_init(&acc);
+		Sum_repro_variants[trial->isa](0, trial->n, &acc);
+		sink = Sum_acc_value(&acc);
+	} else {
+		sink = Sum_variants[trial->mode][trial->isa](0, trial->n);
+	}
+	(void)sink;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Time_split
+ * Purpose:	Sum [0, n) over comm, each process its part of Sum_split
+ * 		on its pool, merged exactly on process 0, config->trials
+ * 		times after config->warmup untimed runs
+ * Return:	on process 0 of comm, the slowest process's median time
+ */
+double Time_split(MPI_Comm comm, int64_t n, const struct bench_config* config) {
+	double samples[BENCH_MAX_TRIALS], median, slowest;
+	struct sum_acc local, total;
+	struct bench_stats stats;
+	int my_rank, comm_sz;
+	int64_t first, last;
+
+	MPI_Comm_rank(comm, &my_rank);
+	MPI_Comm_size(comm, &comm_sz);
+	Sum_split(0, n, my_rank, comm_sz, &first, &last);
+	for (int t = -config->warmup; t < config->trials; t++) {
+		double start;
+
+		MPI_Barrier(comm);
+		start = MPI_Wtime();
+		Sum_acc_init(&local);
+		Pool_sum(first, last, &local);
+		Sum_acc_reduce(&local, &total, 0, comm);
+		if (t >= 0)
+			samples[t] = MPI_Wtime() - start;
+	}
+	Bench_summarize(samples, config->trials, 1, &stats);
+	median = stats.median;
+	MPI_Reduce(&median, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+	return slowest;
+}
@@ -0,0 +1,385 @@
+/* File:     affinity.h
+ *
+ * Purpose:  Pin MPI ranks and worker threads to cpus according to a
+ *           placement policy.  The topology (cores, packages and L3
+ *           domains) is read from /sys/devices/system/cpu.
+ *
+ * Policies: none      leave placement to the OS (default)
+ *           compact   fill the hyperthreads of a core, then the cores of
+ *                     an L3 domain, then the next domain
+ *           scatter   spread consecutive slots across L3 domains, using
+ *                     distinct physical cores before hyperthreads
+ *           l3        one slot per L3 domain; the slot may use every cpu
+ *                     of its domain
+ *
+ * Note:     The policy is taken from the AFFINITY environment variable
+ *           unless one is passed explicitly.  The including file must
+ *           define _GNU_SOURCE before its first #include so that
+ *           sched_setaffinity and the CPU_* macros are declared.  The
+ *           MPI helpers are only available when mpi.h is included
+ *           before this file.
+ *
+ * Example:
+ *    #define _GNU_SOURCE
+ *    #include <mpi.h>
+ *    #include "affinity.h"
+ *    . . .
+ *    MPI_Init(NULL, NULL);
+ *    Affinity_pin_rank(NULL, MPI_COMM_WORLD);   // with a policy, the map on rank 0's stderr
+ *    . . .
+ *    // in worker thread t of a rank running nthreads threads
+ *    Affinity_pin_thread(NULL, local_rank * nthreads + t, NULL);
+ */
+#ifndef _AFFINITY_H_
+#define _AFFINITY_H_
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define AFFINITY_MAX_CPUS 1024
+#define AFFINITY_LINE 256
+
+struct affinity_cpu {
+	int cpu;		/* logical cpu number */
+	int core;		/* core_id within the package */
+	int package;	/* physical_package_id */
+	int l3;			/* lowest cpu sharing this cpu's L3 */
+	int sibling;	/* index among the hyperthreads of its core */
+	int domain_pos;	/* position inside its L3 domain, cores first */
+};
+
+struct affinity_topology {
+	int nof_cpus;
+	int nof_l3;
+	struct affinity_cpu cpus[AFFINITY_MAX_CPUS];
+};
+
+/* Parse a sysfs cpu list such as "0-3,8,10-11" into cpus[] */
+static inline int Affinity_parse_list(const char * list, int * cpus, int max) {
+	int n = 0;
+	const char * p = list;
+
+	while (*p != '\0' && *p != '\n') {
+		char * end;
+		long lo = strtol(p, &end, 10), hi;
+		if (end == p)
+			break;
+		hi = lo;
+		if (*end == '-')
+			hi = strtol(end + 1, &end, 10);
+		for (long c = lo; c <= hi && n < max; c++)
+			cpus[n++] = (int)c;
+		p = (*end == ',') ? end + 1 : end;
+	}
+	return n;
+}
+
+static inline int Affinity_read_int(const char * path, int fallback) {
+	FILE * f = fopen(path, "r");
+	int value = fallback;
+
+	if (f == NULL)
+		return fallback;
+	if (fscanf(f, "%d", &value) != 1)
+		value = fallback;
+	fclose(f);
+	return value;
+}
+
+/* Lowest cpu that shares an L3 (or, failing that, the last level) cache */
+static inline int Affinity_read_l3(int cpu, int package) {
+	char path[128], list[1024];
+	int best_level = 0, id = -1;
+
+	for (int index = 0; index < 16; index++) {
+		int shared[AFFINITY_MAX_CPUS];
+		int level;
+		FILE * f;
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+		level = Affinity_read_int(path, -1);
+		if (level < 0)
+			break;
+		if (level < best_level || level > 3)
+			continue;
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+		if ((f = fopen(path, "r")) == NULL)
+			continue;
+		if (fgets(list, sizeof(list), f) != NULL && Affinity_parse_list(list, shared, AFFINITY_MAX_CPUS) > 0) {
+			best_level = level;
+			id = shared[0];
+		}
+		fclose(f);
+	}
+
+	/* no cache information: treat each package as one domain */
+	return id >= 0 ? id : -1 - package;
+}
+
+/* Order two cpus by (package, l3, core, cpu) */
+static inline int Affinity_compare_compact(const void * a, const void * b) {
+	const struct affinity_cpu * x = a, * y = b;
+
+	if (x->package != y->package) return x->package - y->package;
+	if (x->l3 != y->l3) return x->l3 - y->l3;
+	if (x->core != y->core) return x->core - y->core;
+	return x->cpu - y->cpu;
+}
+
+/* Order two cpus by (domain_pos, l3) so that neighbours land in different domains */
+static inline int Affinity_compare_scatter(const void * a, const void * b) {
+	const struct affinity_cpu * x = a, * y = b;
+
+	if (x->domain_pos != y->domain_pos) return x->domain_pos - y->domain_pos;
+	if (x->package != y->package) return x->package - y->package;
+	return x->l3 - y->l3;
+}
+
+static inline void Affinity_order_topology(struct affinity_topology * topo);
+
+/*------------------------------------------------------------------
+ * Function:	Affinity_read_topology
+ * Purpose:		Read the online cpus and their core, package and L3
+ * 				ids.  The cpus are returned in compact order.
+ * Output args:	topo:	the topology
+ * Return:		the number of cpus found (at least 1)
+ */
+static inline int Affinity_read_topology(struct affinity_topology * topo) {
+	char path[128], list[4096];
+	int online[AFFINITY_MAX_CPUS];
+	int n = 0;
+	FILE * f;
+
+	if ((f = fopen("/sys/devices/system/cpu/online", "r")) != NULL) {
+		if (fgets(list, sizeof(list), f) != NULL)
+			n = Affinity_parse_list(list, online, AFFINITY_MAX_CPUS);
+		fclose(f);
+	}
+	if (n == 0) {
+		long conf = sysconf(_SC_NPROCESSORS_ONLN);
+		n = conf > 0 ? (conf < AFFINITY_MAX_CPUS ? (int)conf : AFFINITY_MAX_CPUS) : 1;
+		for (int i = 0; i < n; i++)
+			online[i] = i;
+	}
+
+	topo->nof_cpus = n;
+	for (int i = 0; i < n; i++) {
+		struct affinity_cpu * c = &topo->cpus[i];
+		c->cpu = online[i];
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", c->cpu);
+		c->core = Affinity_read_int(path, c->cpu);
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", c->cpu);
+		c->package = Affinity_read_int(path, 0);
+		c->l3 = Affinity_read_l3(c->cpu, c->package);
+	}
+
+	Affinity_order_topology(topo);
+	return n;
+}
+
+/* Sort topo->cpus into compact order and fill in the derived fields */
+static inline void Affinity_order_topology(struct affinity_topology * topo) {
+	int n = topo->nof_cpus;
+
+	qsort(topo->cpus, n, sizeof(struct affinity_cpu), Affinity_compare_compact);
+
+	/* number the hyperthreads of each core, then place cores before siblings in each domain */
+	topo->nof_l3 = 0;
+	for (int i = 0; i < n; i++) {
+		struct affinity_cpu * c = &topo->cpus[i];
+		int first_in_domain = (i == 0 || c->l3 != topo->cpus[i-1].l3 || c->package != topo->cpus[i-1].package);
+		int same_core = (!first_in_domain && c->core == topo->cpus[i-1].core);
+
+		c->sibling = same_core ? topo->cpus[i-1].sibling + 1 : 0;
+		if (first_in_domain)
+			topo->nof_l3++;
+	}
+	for (int i = 0, start = 0; i < n; i++) {
+		struct affinity_cpu * c = &topo->cpus[i];
+		int pos = 0;
+
+		if (i > 0 && (c->l3 != topo->cpus[i-1].l3 || c->package != topo->cpus[i-1].package))
+			start = i;
+		for (int j = start; j < n && topo->cpus[j].l3 == c->l3 && topo->cpus[j].package == c->package; j++) {
+			const struct affinity_cpu * d = &topo->cpus[j];
+			if (d->sibling < c->sibling || (d->sibling == c->sibling && j < i))
+				pos++;
+		}
+		c->domain_pos = pos;
+	}
+}
+
+/* Set once an unknown policy has been reported (or must not be, on ranks other than 0) */
+static struct {
+	int warned;
+} Affinity_state;
+
+/*
+ * Resolve the policy name: explicit argument, then $AFFINITY, then "none".
+ * An unknown name is reported once per process and taken as "none".
+ */
+static inline const char * Affinity_policy(const char * policy) {
+	if (policy == NULL || *policy == '\0')
+		policy = getenv("AFFINITY");
+	if (policy == NULL || *policy == '\0')
+		policy = "none";
+	if (strcmp(policy, "none") != 0 && strcmp(policy, "compact") != 0 && strcmp(policy, "scatter") != 0
+			&& strcmp(policy, "l3") != 0) {
+		if (!Affinity_state.warned)
+			fprintf(stderr, "affinity: unknown policy '%s', leaving placement to the OS\n", policy);
+		Affinity_state.warned = 1;
+		policy = "none";
+	}
+	return policy;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Affinity_cpuset
+ * Purpose:		Compute the cpus a slot may run on under a policy
+ * Input args:	topo:	the topology from Affinity_read_topology
+ * 				policy:	compact, scatter, l3 or none
+ * 				slot:	rank-local slot number (wraps around)
+ * Output args:	set:	the chosen cpus
+ * Return:		0 on success, -1 for "none" or an unknown policy
+ */
+static inline int Affinity_cpuset(
+		const struct affinity_topology * topo,	/* in */
+		const char * policy,					/* in */
+		int slot,								/* in */
+		cpu_set_t * set							/* out */) {
+
+	struct affinity_cpu order[AFFINITY_MAX_CPUS];
+	int n = topo->nof_cpus;
+
+	CPU_ZERO(set);
+	if (slot < 0)
+		slot = 0;
+
+	if (strcmp(policy, "compact") == 0) {
+		CPU_SET(topo->cpus[slot % n].cpu, set);
+	} else if (strcmp(policy, "scatter") == 0) {
+		memcpy(order, topo->cpus, n * sizeof(struct affinity_cpu));
+		qsort(order, n, sizeof(struct affinity_cpu), Affinity_compare_scatter);
+		CPU_SET(order[slot % n].cpu, set);
+	} else if (strcmp(policy, "l3") == 0) {
+		int domain = -1, want = slot % topo->nof_l3;
+		for (int i = 0; i < n; i++) {
+			if (i == 0 || topo->cpus[i].l3 != topo->cpus[i-1].l3 || topo->cpus[i].package != topo->cpus[i-1].package)
+				domain++;
+			if (domain == want)
+				CPU_SET(topo->cpus[i].cpu, set);
+		}
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Write a cpu set as a compact list, e.g. "0-3,8" */
+static inline void Affinity_format(const cpu_set_t * set, char * buf, int len) {
+	int used = 0;
+
+	buf[0] = '\0';
+	for (int c = 0; c < CPU_SETSIZE && used < len; c++) {
+		int end = c;
+		if (!CPU_ISSET(c, set))
+			continue;
+		while (end + 1 < CPU_SETSIZE && CPU_ISSET(end + 1, set))
+			end++;
+		if (end > c)
+			used += snprintf(buf + used, len - used, "%s%d-%d", used ? "," : "", c, end);
+		else
+			used += snprintf(buf + used, len - used, "%s%d", used ? "," : "", c);
+		c = end;
+	}
+}
+
+/*------------------------------------------------------------------
+ * Function:	Affinity_pin_thread
+ * Purpose:		Pin the calling thread (or single-threaded process)
+ * 				to the cpus of a slot
+ * Input args:	policy:	policy name, or NULL to use $AFFINITY
+ * 				slot:	rank-local slot number
+ * Output args:	where:	cpus actually allowed afterwards (may be NULL)
+ * Return:		0 if the thread was pinned, -1 otherwise
+ */
+static inline int Affinity_pin_thread(const char * policy, int slot, cpu_set_t * where) {
+	static struct affinity_topology topo;
+	static int have_topology = 0;
+	cpu_set_t set;
+	int pinned = -1;
+
+	policy = Affinity_policy(policy);
+	if (strcmp(policy, "none") != 0) {
+		if (!have_topology) {
+			Affinity_read_topology(&topo);
+			have_topology = 1;
+		}
+		if (Affinity_cpuset(&topo, policy, slot, &set) == 0) {
+			if (sched_setaffinity(0, sizeof(cpu_set_t), &set) == 0)
+				pinned = 0;
+			else
+				perror("affinity: sched_setaffinity");
+		}
+	}
+
+	if (where != NULL)
+		sched_getaffinity(0, sizeof(cpu_set_t), where);
+	return pinned;
+}
+
+#ifdef MPI_VERSION
+/*------------------------------------------------------------------
+ * Function:	Affinity_pin_rank
+ * Purpose:		Pin each rank by its node-local rank and, unless the
+ * 				policy is none, print the resulting rank -> cpu map
+ * 				on rank 0 of comm, to stderr so that it stays out of
+ * 				the programs' results (csv, json, tables)
+ * Input args:	policy:	policy name, or NULL to use $AFFINITY
+ * 				comm:	communicator of the ranks to place
+ * Return:		this rank's node-local rank (the base slot for its
+ * 				worker threads)
+ * Note:		Collective over comm.
+ */
+static inline int Affinity_pin_rank(const char * policy, MPI_Comm comm) {
+	char line[AFFINITY_LINE], host[MPI_MAX_PROCESSOR_NAME], cpus[AFFINITY_LINE - 64];
+	char * lines = NULL;
+	int my_rank, comm_sz, local_rank = 0, host_len;
+	cpu_set_t where;
+	MPI_Comm node_comm;
+
+	MPI_Comm_rank(comm, &my_rank);
+	MPI_Comm_size(comm, &comm_sz);
+
+	MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL, &node_comm);
+	MPI_Comm_rank(node_comm, &local_rank);
+	MPI_Comm_free(&node_comm);
+
+	Affinity_state.warned |= my_rank != 0;	/* an unknown policy is reported by rank 0 alone */
+	policy = Affinity_policy(policy);
+	Affinity_pin_thread(policy, local_rank, &where);
+
+	MPI_Get_processor_name(host, &host_len);
+	Affinity_format(&where, cpus, sizeof(cpus));
+	snprintf(line, sizeof(line), "rank %d (%.64s, local %d) -> cpus %.150s", my_rank, host, local_rank, cpus);
+
+	if (my_rank == 0)
+		lines = malloc((size_t)comm_sz * AFFINITY_LINE);
+	MPI_Gather(line, AFFINITY_LINE, MPI_CHAR, lines, AFFINITY_LINE, MPI_CHAR, 0, comm);
+	if (my_rank == 0 && strcmp(policy, "none") != 0) {
+		fprintf(stderr, "affinity: policy %s\n", policy);
+		for (int r = 0; r < comm_sz; r++)
+			fprintf(stderr, "   %s\n", lines + (size_t)r * AFFINITY_LINE);
+	}
+	free(lines);
+
+	return local_rank;
+}
+#endif
+
+#endif
@@ -0,0 +1,585 @@
+/* File:     bignum.h
+ *
+ * Purpose:  Signed big integers for Pi_MPI.c: multiply, add, move between
+ *           ranks as 32-bit words, and turn the Chudnovsky sums Q and T
+ *           into decimal digits of pi.
+ *
+ *           The built-in version keeps base 10^9 limbs (least significant
+ *           first), so the digits come out without a radix conversion.
+ *           Products use schoolbook multiplication below BN_FFT_THRESHOLD
+ *           limbs and a complex double FFT above it: the limbs are split
+ *           into base 1000 digits, both factors go through one transform
+ *           as the real and imaginary parts, and every rounded coefficient
+ *           is checked to be within 0.25 of an integer.  Division and the
+ *           square root are Newton iterations that double the precision
+ *           each step, so they cost a few multiplications.
+ *
+ *           Compiled with -DUSE_GMP the same functions are thin wrappers
+ *           around GMP's mpz_t (link with -lgmp).
+ *
+ * Note:     The FFT coefficients stay below 2^53 with room to spare up to
+ *           about 10^8 digits per operand.
+ */
+#ifndef _BIGNUM_H_
+#define _BIGNUM_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef USE_GMP
+#include <gmp.h>
+
+#define BN_BACKEND "gmp"
+
+struct bignum {
+	mpz_t z;
+};
+
+static inline void Bn_init(struct bignum* x) {
+	mpz_init(x->z);
+}
+
+static inline void Bn_free(struct bignum* x) {
+	mpz_clear(x->z);
+}
+
+static inline void Bn_set_i64(struct bignum* x, int64_t value) {
+	mpz_set_si(x->z, (long) value);
+}
+
+/* r = a * b (r may be a or b) */
+static inline void Bn_mul(struct bignum* r, const struct bignum* a, const struct bignum* b) {
+	mpz_mul(r->z, a->z, b->z);
+}
+
+/* r = a + b (r may be a or b) */
+static inline void Bn_add(struct bignum* r, const struct bignum* a, const struct bignum* b) {
+	mpz_add(r->z, a->z, b->z);
+}
+
+/* Approximate number of decimal digits */
+static inline int64_t Bn_digits(const struct bignum* x) {
+	return (int64_t) mpz_sizeinbase(x->z, 10);
+}
+
+/* Number of 32-bit words Bn_export writes */
+static inline int64_t Bn_words(const struct bignum* x) {
+	return (int64_t) ((mpz_sizeinbase(x->z, 2) + 31) / 32);
+}
+
+/* The magnitude as words; returns the sign (-1, 0, 1) */
+static inline int Bn_export(const struct bignum* x, uint32_t* words) {
+	mpz_export(words, NULL, -1, sizeof(uint32_t), 0, 0, x->z);
+	return mpz_sgn(x->z);
+}
+
+static inline void Bn_import(struct bignum* x, const uint32_t* words, int64_t count, int sign) {
+	mpz_import(x->z, (size_t) count, -1, sizeof(uint32_t), 0, 0, words);
+	if (sign < 0)
+		mpz_neg(x->z, x->z);
+}
+
+/*------------------------------------------------------------------
+ * Function:	Bn_pi_digits
+ * Purpose:		pi = 426880 sqrt(10005) Q / T, as the
+ * 				string "31415..." of digits + 1 digits (truncated)
+ * Return:		malloc'ed string
+ */
+static inline char* Bn_pi_digits(const struct bignum* Q, const struct bignum* T, int64_t digits) {
+	mpz_t scale, root, num;
+	char* text;
+
+	mpz_inits(scale, root, num, NULL);
+	mpz_ui_pow_ui(scale, 10, (unsigned long) (2 * (digits + 10)));
+	mpz_mul_ui(root, scale, 10005);
+	mpz_sqrt(root, root);
+	mpz_mul(num, root, Q->z);
+	mpz_mul_ui(num, num, 426880);
+	mpz_tdiv_q(num, num, T->z);
+	text = mpz_get_str(NULL, 10, num);
+	text[digits + 1] = '\0';
+	mpz_clears(scale, root, num, NULL);
+	return text;
+}
+
+#else
+
+#include <complex.h>
+
+#define BN_BACKEND "built-in (FFT)"
+#define BN_BASE 1000000000u
+#define BN_BASE_DIGITS 9
+#define BN_FFT_THRESHOLD 48		/* limbs in the smaller factor */
+
+struct bignum {
+	uint32_t* limb;			/* base 10^9, least significant first */
+	int64_t size, capacity;		/* limbs in use (no leading zeros), allocated */
+	int sign;			/* -1, 0 (size == 0) or 1 */
+};
+
+static inline void Bn_init(struct bignum* x) {
+	x->limb = NULL;
+	x->size = x->capacity = 0;
+	x->sign = 0;
+}
+
+static inline void Bn_free(struct bignum* x) {
+	free(x->limb);
+	Bn_init(x);
+}
+
+static inline void Bn_reserve(struct bignum* x, int64_t capacity) {
+	if (capacity > x->capacity) {
+		x->limb = realloc(x->limb, capacity * sizeof(uint32_t));
+		if (x->limb == NULL) {
+			fprintf(stderr, "bignum: out of memory for %lld limbs\n", (long long) capacity);
+			exit(1);
+		}
+		x->capacity = capacity;
+	}
+}
+
+/* Drop leading zero limbs and fix the sign of zero */
+static inline void Bn_trim(struct bignum* x) {
+	while (x->size > 0 && x->limb[x->size - 1] == 0)
+		x->size--;
+	if (x->size == 0)
+		x->sign = 0;
+}
+
+/* Swap the contents of x and y */
+static inline void Bn_swap(struct bignum* x, struct bignum* y) {
+	struct bignum t = *x;
+
+	*x = *y;
+	*y = t;
+}
+
+static inline void Bn_copy(struct bignum* r, const struct bignum* a) {
+	if (r == a)
+		return;
+	Bn_reserve(r, a->size);
+	memcpy(r->limb, a->limb, a->size * sizeof(uint32_t));
+	r->size = a->size;
+	r->sign = a->sign;
+}
+
+static inline void Bn_set_i64(struct bignum* x, int64_t value) {
+	uint64_t magnitude = value < 0 ? -(uint64_t) value : (uint64_t) value;
+
+	Bn_reserve(x, 3);
+	x->sign = value < 0 ? -1 : 1;
+	for (x->size = 0; magnitude != 0; magnitude /= BN_BASE)
+		x->limb[x->size++] = (uint32_t) (magnitude % BN_BASE);
+	Bn_trim(x);
+}
+
+/* Compare |a| and |b| */
+static inline int Bn_cmp_mag(const struct bignum* a, const struct bignum* b) {
+	if (a->size != b->size)
+		return a->size < b->size ? -1 : 1;
+	for (int64_t i = a->size - 1; i >= 0; i--) {
+		if (a->limb[i] != b->limb[i])
+			return a->limb[i] < b->limb[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+/* r = a + b (r may be a or b) */
+static inline void Bn_add(struct bignum* r, const struct bignum* a, const struct bignum* b) {
+	const struct bignum* big = a, * small = b;
+	int64_t i;
+
+	if (b->sign == 0) {
+		Bn_copy(r, a);
+		return;
+	}
+	if (a->sign == 0) {
+		Bn_copy(r, b);
+		return;
+	}
+	if (Bn_cmp_mag(a, b) < 0) {
+		big = b;
+		small = a;
+	}
+	Bn_reserve(r, big->size + 1);
+	if (a->sign == b->sign) {
+		uint32_t carry = 0;
+
+		for (i = 0; i < big->size; i++) {
+			uint32_t sum = big->limb[i] + (i < small->size ? small->limb[i] : 0) + carry;
+			carry = sum >= BN_BASE;
+			r->limb[i] = carry ? sum - BN_BASE : sum;
+		}
+		r->limb[i] = carry;
+		r->size = big->size + 1;
+	} else {
+		int32_t borrow = 0;
+
+		for (i = 0; i < big->size; i++) {
+			int64_t diff = (int64_t) big->limb[i] - (i < small->size ? small->limb[i] : 0) - borrow;
+			borrow = diff < 0;
+			r->limb[i] = (uint32_t) (borrow ? diff + BN_BASE : diff);
+		}
+		r->size = big->size;
+	}
+	r->sign = big->sign;
+	Bn_trim(r);
+}
+
+/* r = a * small, 0 <= small < 2^32 (r may be a) */
+static inline void Bn_mul_small(struct bignum* r, const struct bignum* a, uint32_t small) {
+	uint64_t carry = 0;
+
+	Bn_reserve(r, a->size + 2);
+	for (int64_t i = 0; i < a->size; i++) {
+		uint64_t t = (uint64_t) a->limb[i] * small + carry;
+		r->limb[i] = (uint32_t) (t % BN_BASE);
+		carry = t / BN_BASE;
+	}
+	r->size = a->size;
+	for (; carry != 0; carry /= BN_BASE)
+		r->limb[r->size++] = (uint32_t) (carry % BN_BASE);
+	r->sign = small == 0 ? 0 : a->sign;
+	Bn_trim(r);
+}
+
+/* r = a / small, truncated (r may be a) */
+static inline void Bn_div_small(struct bignum* r, const struct bignum* a, uint32_t small) {
+	uint64_t rest = 0;
+
+	Bn_reserve(r, a->size);
+	for (int64_t i = a->size - 1; i >= 0; i--) {
+		uint64_t t = rest * BN_BASE + a->limb[i];
+		r->limb[i] = (uint32_t) (t / small);
+		rest = t % small;
+	}
+	r->size = a->size;
+	r->sign = a->sign;
+	Bn_trim(r);
+}
+
+/*
+ * r = a * BN_BASE^shift: shift > 0 appends zero limbs, shift < 0 drops
+ * limbs (the magnitude is truncated, so negative values round to zero)
+ */
+static inline void Bn_shift(struct bignum* r, const struct bignum* a, int64_t shift) {
+	int64_t size = a->size + shift;
+
+	if (size <= 0) {
+		r->size = 0;
+		r->sign = 0;
+		return;
+	}
+	Bn_reserve(r, size);
+	if (shift >= 0) {
+		memmove(r->limb + shift, a->limb, a->size * sizeof(uint32_t));
+		memset(r->limb, 0, shift * sizeof(uint32_t));
+	} else {
+		memmove(r->limb, a->limb - shift, size * sizeof(uint32_t));
+	}
+	r->size = size;
+	r->sign = a->sign;
+	Bn_trim(r);
+}
+
+/*---------------------------------------------------------------- FFT */
+
+/* e^(-2 pi i k / n) for k < n / 2, n the largest transform so far */
+static double complex* Bn_roots;
+static int64_t Bn_roots_n;
+
+static inline void Bn_fft_roots(int64_t n) {
+	if (n <= Bn_roots_n)
+		return;
+	free(Bn_roots);
+	Bn_roots = malloc(n / 2 * sizeof(double complex));
+	for (int64_t k = 0; k < n / 2; k++) {
+		double angle = -2 * M_PI * (double) k / (double) n;
+		Bn_roots[k] = cos(angle) + I * sin(angle);
+	}
+	Bn_roots_n = n;
+}
+
+/* In-place radix-2 transform of length n (a power of two); inverse is unscaled */
+static inline void Bn_fft(double complex* a, int64_t n, int inverse) {
+	for (int64_t i = 1, j = 0; i < n; i++) {
+		int64_t bit = n >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j) {
+			double complex t = a[i];
+			a[i] = a[j];
+			a[j] = t;
+		}
+	}
+	for (int64_t len = 2; len <= n; len <<= 1) {
+		int64_t stride = Bn_roots_n / len;
+
+		for (int64_t i = 0; i < n; i += len) {
+			for (int64_t k = 0; k < len / 2; k++) {
+				double complex w = inverse ? conj(Bn_roots[k * stride]) : Bn_roots[k * stride];
+				double complex u = a[i + k], v = a[i + k + len / 2] * w;
+				a[i + k] = u + v;
+				a[i + k + len / 2] = u - v;
+			}
+		}
+	}
+}
+
+/* r = |a| * |b| through the FFT, base 1000 digits; r must not be a or b */
+static inline void Bn_mul_fft(struct bignum* r, const struct bignum* a, const struct bignum* b) {
+	int64_t na = 3 * a->size, nb = 3 * b->size, n = 1, i;
+	double complex* c, * product;
+	double worst = 0;
+	int64_t carry = 0;
+	int square = a == b;
+
+	while (n < na + nb)
+		n <<= 1;
+	Bn_fft_roots(n);
+	c = calloc(n, sizeof(double complex));
+	product = malloc(n * sizeof(double complex));
+	if (c == NULL || product == NULL) {
+		fprintf(stderr, "bignum: out of memory for a %lld point FFT\n", (long long) n);
+		exit(1);
+	}
+
+	for (i = 0; i < a->size; i++) {
+		uint32_t limb = a->limb[i];
+		c[3 * i] = limb % 1000;
+		c[3 * i + 1] = limb / 1000 % 1000;
+		c[3 * i + 2] = limb / 1000000;
+	}
+	for (i = 0; !square && i < b->size; i++) {
+		uint32_t limb = b->limb[i];
+		c[3 * i] += I * (limb % 1000);
+		c[3 * i + 1] += I * (limb / 1000 % 1000);
+		c[3 * i + 2] += I * (limb / 1000000);
+	}
+	Bn_fft(c, n, 0);
+
+	/* c = A + iB: A_j = (c_j + conj c_-j) / 2, B_j = (c_j - conj c_-j) / 2i */
+	for (i = 0; i < n; i++) {
+		double complex x = c[i], y = conj(c[(n - i) & (n - 1)]);
+		product[i] = square ? x * x : (x + y) * (x - y) * (-0.25 * I);
+	}
+	Bn_fft(product, n, 1);
+
+	Bn_reserve(r, a->size + b->size + 1);
+	memset(r->limb, 0, (a->size + b->size + 1) * sizeof(uint32_t));
+	for (i = 0; i < na + nb; i++) {
+		double value = creal(product[i]) / n, rounded = nearbyint(value);
+		int64_t digit;
+
+		if (fabs(value - rounded) > worst)
+			worst = fabs(value - rounded);
+		carry += (int64_t) rounded;
+		digit = carry % 1000;
+		carry /= 1000;
+		r->limb[i / 3] += (uint32_t) digit * (i % 3 == 0 ? 1 : i % 3 == 1 ? 1000 : 1000000);
+	}
+	if (worst > 0.25) {
+		fprintf(stderr, "bignum: FFT rounding error %.3f at %lld points, product unreliable\n",
+				worst, (long long) n);
+		exit(1);
+	}
+	r->size = a->size + b->size;
+	free(c);
+	free(product);
+}
+
+/* r = |a| * |b| by rows; r must not be a or b */
+static inline void Bn_mul_school(struct bignum* r, const struct bignum* a, const struct bignum* b) {
+	Bn_reserve(r, a->size + b->size);
+	memset(r->limb, 0, (a->size + b->size) * sizeof(uint32_t));
+	for (int64_t i = 0; i < a->size; i++) {
+		uint64_t carry = 0;
+		int64_t j;
+
+		for (j = 0; j < b->size; j++) {
+			uint64_t t = r->limb[i + j] + (uint64_t) a->limb[i] * b->limb[j] + carry;
+			r->limb[i + j] = (uint32_t) (t % BN_BASE);
+			carry = t / BN_BASE;
+		}
+		r->limb[i + j] = (uint32_t) carry;
+	}
+	r->size = a->size + b->size;
+}
+
+/* r = a * b (r may be a or b) */
+static inline void Bn_mul(struct bignum* r, const struct bignum* a, const struct bignum* b) {
+	struct bignum product;
+
+	if (a->sign == 0 || b->sign == 0) {
+		r->size = 0;
+		r->sign = 0;
+		return;
+	}
+	Bn_init(&product);
+	if (a->size < BN_FFT_THRESHOLD || b->size < BN_FFT_THRESHOLD)
+		Bn_mul_school(&product, a, b);
+	else
+		Bn_mul_fft(&product, a, b);
+	product.sign = a->sign * b->sign;
+	Bn_trim(&product);
+	Bn_swap(r, &product);
+	Bn_free(&product);
+}
+
+/* Approximate number of decimal digits */
+static inline int64_t Bn_digits(const struct bignum* x) {
+	return x->size * BN_BASE_DIGITS;
+}
+
+/* Number of 32-bit words Bn_export writes */
+static inline int64_t Bn_words(const struct bignum* x) {
+	return x->size;
+}
+
+/* The magnitude as words; returns the sign (-1, 0, 1) */
+static inline int Bn_export(const struct bignum* x, uint32_t* words) {
+	memcpy(words, x->limb, x->size * sizeof(uint32_t));
+	return x->sign;
+}
+
+static inline void Bn_import(struct bignum* x, const uint32_t* words, int64_t count, int sign) {
+	Bn_reserve(x, count);
+	memcpy(x->limb, words, count * sizeof(uint32_t));
+	x->size = count;
+	x->sign = sign;
+	Bn_trim(x);
+}
+
+/*---------------------------------------------------------------- Newton */
+
+/*
+ * Z ~ BN_BASE^(2p) / d for d with p limbs, the precision doubling each
+ * step from the top two limbs; a few units off in the last limb
+ */
+static inline void Bn_reciprocal(struct bignum* Z, const struct bignum* d) {
+	struct bignum dq, E, C, one;
+	int64_t p = d->size, q = 2;
+	unsigned __int128 top = (unsigned __int128) d->limb[p - 1] * BN_BASE + d->limb[p - 2], z;
+
+	Bn_init(&dq);
+	Bn_init(&E);
+	Bn_init(&C);
+	Bn_init(&one);
+
+	/* BN_BASE^4 / top in 128-bit arithmetic */
+	z = ((unsigned __int128) 1000000000000000000ULL * 1000000000000000000ULL) / top;
+	Bn_reserve(Z, 4);
+	for (Z->size = 0; z != 0; z /= BN_BASE)
+		Z->limb[Z->size++] = (uint32_t) (z % BN_BASE);
+	Z->sign = 1;
+
+	while (q < p) {
+		int64_t next = 2 * q - 1 < p ? 2 * q - 1 : p;
+
+		Bn_shift(&dq, d, next - p);		/* the top `next` limbs of d */
+		Bn_shift(Z, Z, next - q);
+		Bn_set_i64(&one, 1);
+		Bn_shift(&one, &one, 2 * next);
+		Bn_mul(&E, &dq, Z);
+		E.sign = -E.sign;
+		Bn_add(&E, &one, &E);			/* BN_BASE^(2 next) - dq Z */
+		Bn_mul(&C, Z, &E);
+		Bn_shift(&C, &C, -2 * next);
+		Bn_add(Z, Z, &C);
+		q = next;
+	}
+	Bn_free(&dq);
+	Bn_free(&E);
+	Bn_free(&C);
+	Bn_free(&one);
+}
+
+/* Y ~ BN_BASE^p / sqrt(n) for a small n, p limbs of precision */
+static inline void Bn_inverse_sqrt(struct bignum* Y, uint32_t n, int64_t p) {
+	struct bignum Y2, E, one;
+	int64_t q = 2;
+	uint64_t y = (uint64_t) (1 / sqrt((double) n) * 1e18);
+
+	Bn_init(&Y2);
+	Bn_init(&E);
+	Bn_init(&one);
+	Bn_set_i64(Y, (int64_t) y);
+
+	/* y' = y + y (1 - n y^2) / 2, about 16 more digits at first and then doubling */
+	while (q < p) {
+		int64_t next = 2 * q - 1 < p ? 2 * q - 1 : p;
+
+		Bn_shift(Y, Y, next - q);
+		Bn_mul(&Y2, Y, Y);
+		Bn_shift(&Y2, &Y2, -next);
+		Bn_mul_small(&Y2, &Y2, n);
+		Bn_set_i64(&one, 1);
+		Bn_shift(&one, &one, next);
+		Y2.sign = -Y2.sign;
+		Bn_add(&E, &one, &Y2);			/* BN_BASE^next (1 - n y^2) */
+		Bn_mul(&E, Y, &E);
+		Bn_shift(&E, &E, -next);
+		Bn_div_small(&E, &E, 2);		/* the magnitude; the sign stays */
+		Bn_add(Y, Y, &E);
+		q = next;
+	}
+	Bn_free(&Y2);
+	Bn_free(&E);
+	Bn_free(&one);
+}
+
+/*------------------------------------------------------------------
+ * Function:	Bn_pi_digits
+ * Purpose:		pi = 426880 sqrt(10005) Q / T, as the
+ * 				string "31415..." of digits + 1 digits (truncated)
+ * Return:		malloc'ed string
+ */
+static inline char* Bn_pi_digits(const struct bignum* Q, const struct bignum* T, int64_t digits) {
+	int64_t P = (digits + BN_BASE_DIGITS - 1) / BN_BASE_DIGITS + 2, p = P + 2, shift;
+	struct bignum Qt, Tt, Z, S, pi;
+	char* text, * at;
+
+	Bn_init(&Qt);
+	Bn_init(&Tt);
+	Bn_init(&Z);
+	Bn_init(&S);
+	Bn_init(&pi);
+
+	/* the top p limbs of Q and of T: Q ~ Qt BASE^eQ, T ~ Tt BASE^eT */
+	Bn_shift(&Qt, Q, p - Q->size);
+	Bn_shift(&Tt, T, p - T->size);
+	Bn_reciprocal(&Z, &Tt);
+	Bn_inverse_sqrt(&S, 10005, p);
+	Bn_mul_small(&S, &S, 10005);		/* sqrt(10005) BASE^p */
+
+	/* pi BASE^P = 426880 S Qt Z BASE^(eQ - eT - 3p + P) */
+	Bn_mul(&pi, &S, &Qt);
+	Bn_mul(&pi, &pi, &Z);
+	Bn_mul_small(&pi, &pi, 426880);
+	shift = (Q->size - p) - (T->size - p) - 3 * p + P;
+	Bn_shift(&pi, &pi, shift);
+
+	/* "3" and P limbs of 9 digits */
+	text = malloc(pi.size * BN_BASE_DIGITS + 2);
+	at = text + sprintf(text, "%u", pi.limb[pi.size - 1]);
+	for (int64_t i = pi.size - 2; i >= 0; i--)
+		at += sprintf(at, "%09u", pi.limb[i]);
+	if (at - text > digits + 1)
+		text[digits + 1] = '\0';
+
+	Bn_free(&Qt);
+	Bn_free(&Tt);
+	Bn_free(&Z);
+	Bn_free(&S);
+	Bn_free(&pi);
+	return text;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,221 @@
+/* File:     checkpoint.h
+ *
+ * Purpose:  An on-disk cache of exact partial sums of the series, so that
+ *           a run to n = 2e9 after one to 1e9 only sums the terms it has
+ *           not seen.  Every --checkpoint-every terms (default 1e8) the
+ *           prefix sum [0, k) is stored as a superaccumulator (struct
+ *           sum_acc), exactly; a query for n loads the largest stored
+ *           prefix k <= n and sums [k, n) only.
+ *
+ *           The entries of one series, kernel (Sum_kernel_name) and
+ *           CHECKPOINT_VERSION live in one file of the cache directory,
+ *              <dir>/leibniz-repro-avx2-v1.ckpt
+ *           a header and then records of (k, accumulator, check word),
+ *           appended as they are computed.  Bump CHECKPOINT_VERSION when
+ *           the kernels' results change, so old entries are not used.
+ *
+ * Note:     --cache <dir> or $SUM_CACHE turn the cache on (Checkpoint_select).
+ *           In repro mode a prefix is the exact sum of its terms, so a
+ *           cached result has the same bits as an uncached one.  In the
+ *           other modes an entry is the exact sum of the rounded partial
+ *           sums it was made of: within the kernel's rounding error, but
+ *           not bit-identical across process counts.
+ */
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "sum_kernels.h"
+
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_SERIES "leibniz"	/* (-1)^i / (2i+1) */
+#define CHECKPOINT_EVERY 100000000	/* terms between checkpoints */
+#define CHECKPOINT_MAGIC "SUMCKPT"
+
+struct checkpoint_header {
+	char magic[8];
+	int32_t version, chunks;
+	char key[48];			/* series and kernel */
+};
+
+struct checkpoint_record {
+	int64_t index;			/* the prefix [0, index) */
+	struct sum_acc acc;		/* its exact sum, normalized */
+	uint64_t check;			/* Checkpoint_check: torn or stale records are skipped */
+};
+
+static struct {
+	char dir[256];			/* "" when the cache is off */
+	int64_t every;
+} Checkpoint_settings = {"", CHECKPOINT_EVERY};
+
+/* Apply --cache <dir> and --checkpoint-every <terms> (else $SUM_CACHE); 0, or -1 for a bad value */
+static inline int Checkpoint_select(int argc, char* argv[]) {
+	const char* dir = getenv("SUM_CACHE");
+
+	for (int a = 1; a + 1 < argc; a++) {
+		if (strcmp(argv[a], "--cache") == 0) {
+			dir = argv[a + 1];
+		} else if (strcmp(argv[a], "--checkpoint-every") == 0) {
+			char* end;
+			double every = strtod(argv[a + 1], &end);
+
+			if (*end != '\0' || every < 1 || every > 9e18 || every != (int64_t)every) {
+				fprintf(stderr, "--checkpoint-every %s: expected a number of terms\n", argv[a + 1]);
+				return -1;
+			}
+			Checkpoint_settings.every = (int64_t)every;
+		}
+	}
+	if (dir != NULL && strlen(dir) >= sizeof(Checkpoint_settings.dir)) {
+		fprintf(stderr, "cache directory %s: name too long\n", dir);
+		return -1;
+	}
+	snprintf(Checkpoint_settings.dir, sizeof(Checkpoint_settings.dir), "%s", dir != NULL ? dir : "");
+	return 0;
+}
+
+static inline int Checkpoint_enabled(void) {
+	return Checkpoint_settings.dir[0] != '\0';
+}
+
+/* The cache key of the running kernel: "leibniz-repro-avx2" */
+static inline void Checkpoint_key(char* key, size_t size) {
+	snprintf(key, size, "%s-%s", CHECKPOINT_SERIES, Sum_kernel_name());
+	for (char* c = key; *c != '\0'; c++)
+		if (*c == '/')
+			*c = '-';
+}
+
+/* The file holding the running kernel's entries */
+static inline const char* Checkpoint_path(void) {
+	static char path[512];
+	char key[48];
+
+	Checkpoint_key(key, sizeof(key));
+	snprintf(path, sizeof(path), "%s/%s-v%d.ckpt", Checkpoint_settings.dir, key, CHECKPOINT_VERSION);
+	return path;
+}
+
+/* FNV-1a of a record's index and accumulator */
+static inline uint64_t Checkpoint_check(const struct checkpoint_record* record) {
+	const unsigned char* bytes = (const unsigned char*)record;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (size_t b = 0; b < offsetof(struct checkpoint_record, check); b++)
+		hash = (hash ^ bytes[b]) * 0x100000001b3ULL;
+	return hash;
+}
+
+static inline void Checkpoint_fill_header(struct checkpoint_header* header) {
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	header->version = CHECKPOINT_VERSION;
+	header->chunks = SUM_ACC_CHUNKS;
+	Checkpoint_key(header->key, sizeof(header->key));
+}
+
+/*------------------------------------------------------------------
+ * Function:	Checkpoint_find
+ * Purpose:		The largest cached prefix [0, k) with k <= upper_limit
+ * Output args:	acc:	its exact sum (zero if there is none)
+ * Return:		k, or 0 if the cache has no usable entry
+ */
+static inline int64_t Checkpoint_find(int64_t upper_limit, struct sum_acc* acc) {
+	struct checkpoint_header header, expected;
+	struct checkpoint_record record;
+	int64_t best = 0;
+	FILE* in = fopen(Checkpoint_path(), "rb");
+
+	Sum_acc_init(acc);
+	if (in == NULL)
+		return 0;
+	Checkpoint_fill_header(&expected);
+	if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(&header, &expected, sizeof(header)) != 0) {
+		fprintf(stderr, "%s: not a checkpoint file of this kernel, ignored\n", Checkpoint_path());
+		fclose(in);
+		return 0;
+	}
+	while (fread(&record, sizeof(record), 1, in) == 1) {
+		if (record.check != Checkpoint_check(&record))
+			continue;
+		if (record.index > best && record.index <= upper_limit) {
+			best = record.index;
+			*acc = record.acc;
+		}
+	}
+	fclose(in);
+	return best;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Checkpoint_store
+ * Purpose:		Append the prefix [0, index) with exact sum acc
+ * Return:		0, or -1 (with a message) if it could not be written
+ * Note:		Records are appended whole, so several runs may share a
+ * 				cache; a duplicate entry is harmless.  A torn record at
+ * 				the end (a crash or a full disk) is cut off first, so
+ * 				that it does not shift the records written after it.
+ */
+static inline int Checkpoint_store(int64_t index, const struct sum_acc* acc) {
+	struct checkpoint_record record;
+	struct stat file;
+	FILE* out;
+	off_t whole;
+	int status = 0;
+
+	if (mkdir(Checkpoint_settings.dir, 0777) != 0 && errno != EEXIST) {
+		perror(Checkpoint_settings.dir);
+		return -1;
+	}
+	if ((out = fopen(Checkpoint_path(), "ab")) == NULL) {
+		perror(Checkpoint_path());
+		return -1;
+	}
+	if (fstat(fileno(out), &file) != 0) {
+		perror(Checkpoint_path());
+		fclose(out);
+		return -1;
+	}
+	/* The header and k whole records, or nothing if the header is torn */
+	whole = file.st_size < (off_t)sizeof(struct checkpoint_header) ? 0
+			: file.st_size - (file.st_size - (off_t)sizeof(struct checkpoint_header)) % (off_t)sizeof(record);
+	if (whole != file.st_size && ftruncate(fileno(out), whole) != 0) {
+		perror(Checkpoint_path());
+		fclose(out);
+		return -1;
+	}
+	if (whole == 0) {
+		struct checkpoint_header header;
+
+		Checkpoint_fill_header(&header);
+		status = fwrite(&header, sizeof(header), 1, out) == 1 ? 0 : -1;
+	}
+	memset(&record, 0, sizeof(record));
+	record.index = index;
+	record.acc = *acc;
+	Sum_acc_normalize(&record.acc);
+	record.check = Checkpoint_check(&record);
+	if (fwrite(&record, sizeof(record), 1, out) != 1)
+		status = -1;
+	if (fclose(out) != 0 || status != 0) {
+		fprintf(stderr, "%s: could not write the checkpoint at %" PRId64 "\n", Checkpoint_path(), index);
+		return -1;
+	}
+	return 0;
+}
+
+/* The next checkpoint after index */
+static inline int64_t Checkpoint_next(int64_t index) {
+	return (index / Checkpoint_settings.every + 1) * Checkpoint_settings.every;
+}
+
+#endif
@@ -0,0 +1,117 @@
+/* File:     dispatch.h
+ *
+ * Purpose:  Pick the instruction set used by the multiversioned kernels
+ *           at run time, so that one binary runs the SSE2, AVX2 or
+ *           AVX-512 version of a hot loop depending on the host.
+ *
+ * Note:     The best variant the cpu supports is used unless the
+ *           KERNEL_ISA environment variable names another one (sse2,
+ *           avx2 or avx512).  Asking for a variant the cpu lacks prints a
+ *           warning and falls back to the default choice.  A kernel that
+ *           does not gain from wider vectors can cap its default with
+ *           Isa_preferred.  On non-x86 hosts only the portable ("sse2")
+ *           variant exists.  The cpu is probed and the choice made once
+ *           per process, so dispatching in a hot loop costs a load.
+ *
+ * Example:
+ *    #include "dispatch.h"
+ *    . . .
+ *    static const lut_fn variants[ISA_COUNT] = {Lut_sse2, Lut_avx2, Lut_avx512};
+ *    variants[Isa_selected()](in, out, n, lut);
+ */
+#ifndef _DISPATCH_H_
+#define _DISPATCH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DISPATCH_X86 1
+#include <immintrin.h>
+#else
+#define DISPATCH_X86 0
+#endif
+
+enum isa { ISA_SSE2, ISA_AVX2, ISA_AVX512, ISA_COUNT };
+
+static const char * const Isa_names[ISA_COUNT] = {"sse2", "avx2", "avx512"};
+
+/* Does this cpu run the given variant?  Asks the cpu; see Isa_supported */
+static inline int Isa_probe(enum isa isa) {
+#if DISPATCH_X86
+	__builtin_cpu_init();
+	switch (isa) {
+		case ISA_SSE2:		return 1;
+		case ISA_AVX2:		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+		case ISA_AVX512:	return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+		default:			return 0;
+	}
+#else
+	return isa == ISA_SSE2;
+#endif
+}
+
+/* Isa_probe, asked once per variant */
+static inline int Isa_supported(enum isa isa) {
+	static int supported[ISA_COUNT] = {-1, -1, -1};
+
+	if ((int)isa < 0 || isa >= ISA_COUNT)
+		return 0;
+	if (supported[isa] < 0)
+		supported[isa] = Isa_probe(isa);
+	return supported[isa];
+}
+
+/* Variant named by $KERNEL_ISA if the cpu supports it, else -1 */
+static inline int Isa_forced(void) {
+	static int forced = -2;
+	const char * wanted;
+
+	if (forced != -2)
+		return forced;
+
+	forced = -1;
+	if ((wanted = getenv("KERNEL_ISA")) != NULL && *wanted != '\0') {
+		int i;
+		for (i = 0; i < ISA_COUNT && strcmp(wanted, Isa_names[i]) != 0; i++)
+			;
+		if (i == ISA_COUNT)
+			fprintf(stderr, "dispatch: unknown KERNEL_ISA '%s', ignored\n", wanted);
+		else if (!Isa_supported((enum isa)i))
+			fprintf(stderr, "dispatch: this cpu does not support %s, KERNEL_ISA ignored\n", wanted);
+		else
+			forced = i;
+	}
+	return forced;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Isa_preferred
+ * Purpose:		Return the variant to run for a kernel whose fastest
+ * 				version is at most `cap`: $KERNEL_ISA if it is set
+ * 				and supported, otherwise the best supported variant
+ * 				not above cap; decided once per cap
+ */
+static inline enum isa Isa_preferred(enum isa cap) {
+	static int preferred[ISA_COUNT] = {-1, -1, -1};
+	int forced, i;
+
+	if (preferred[cap] >= 0)
+		return (enum isa)preferred[cap];
+	if ((forced = Isa_forced()) >= 0) {
+		preferred[cap] = forced;
+		return (enum isa)forced;
+	}
+	for (i = cap; i > ISA_SSE2 && !Isa_supported((enum isa)i); i--)
+		;
+	preferred[cap] = i;
+	return (enum isa)i;
+}
+
+/* The variant to run: $KERNEL_ISA, or the best one the cpu supports */
+static inline enum isa Isa_selected(void) {
+	return Isa_preferred((enum isa)(ISA_COUNT - 1));
+}
+
+#endif
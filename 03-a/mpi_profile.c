@@ -0,0 +1,658 @@
+/*	File: mpi_profile.c
+ *
+ * 	Purpose:	PMPI interposition profiler.  Linked into (or preloaded under) any of
+ *				the MPI programs, it wraps the point-to-point and collective calls
+ *				they use and records, per rank and per call site, the number of
+ *				calls, the bytes moved, the time spent and the time spent waiting
+ *				for the other ranks.  At MPI_Finalize rank 0 prints a summary per
+ *				MPI function, the busiest call sites (file:line when the program
+ *				was built with -g) and a rank x rank matrix of the bytes sent.
+ *
+ *	Compile:	mpicc -O2 -g -Wall -o par par-3.c mpi_profile.c -ldl
+ *				or, as a preload library for unmodified binaries:
+ *				mpicc -O2 -g -Wall -shared -fPIC -o libmpi_profile.so mpi_profile.c -ldl
+ *	Run:		mpiexec -n <p> ./par
+ *				mpiexec -x LD_PRELOAD=./libmpi_profile.so -n <p> ./par
+ *				MPI_PROFILE_WAIT=0 mpiexec ...	(do not measure collective wait times)
+ *				MPI_PROFILE_OUT=<file> mpiexec ...	(write the report there instead of stdout)
+ *
+ *	Notes:
+ *		1.	Wait time of a blocking collective is measured with a PMPI_Barrier on
+ *			the same communicator just before it: the barrier's time is how long
+ *			this rank waited for the slowest one to arrive, and the rest is the
+ *			collective itself.  This adds one barrier per collective, so set
+ *			MPI_PROFILE_WAIT=0 for timings that must match an unprofiled run.
+ *			All of MPI_Barrier, MPI_Wait and MPI_Waitall counts as wait.
+ *		2.	Bytes are the logical data movement each call defines (a broadcast
+ *			sends the buffer from the root to every other rank, an allreduce
+ *			from every rank to every other rank), not the messages of the
+ *			algorithm the MPI library picks.
+ *		3.	The matrix is printed for up to 32 ranks.
+ *
+ *	Author: Evelyn Evans
+ */
+#define _GNU_SOURCE		// dladdr
+#include <dlfcn.h>
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#define PROF_MAX_SITES 256		// distinct (function, call site) pairs per rank
+#define PROF_MAX_COMMS 16		// communicators whose world ranks are cached
+#define PROF_MATRIX_RANKS 32
+
+enum prof_fn {
+	PROF_SEND, PROF_RECV, PROF_SENDRECV, PROF_ISEND, PROF_IRECV, PROF_WAIT, PROF_WAITALL,
+	PROF_BARRIER, PROF_BCAST, PROF_SCATTER, PROF_SCATTERV, PROF_GATHER, PROF_GATHERV,
+	PROF_REDUCE, PROF_ALLREDUCE, PROF_ALLGATHER, PROF_ALLTOALL, PROF_IREDUCE, PROF_IALLREDUCE,
+	PROF_NOF_FNS
+};
+
+static const char * const prof_names[PROF_NOF_FNS] = {
+	"MPI_Send", "MPI_Recv", "MPI_Sendrecv", "MPI_Isend", "MPI_Irecv", "MPI_Wait", "MPI_Waitall",
+	"MPI_Barrier", "MPI_Bcast", "MPI_Scatter", "MPI_Scatterv", "MPI_Gather", "MPI_Gatherv",
+	"MPI_Reduce", "MPI_Allreduce", "MPI_Allgather", "MPI_Alltoall", "MPI_Ireduce", "MPI_Iallreduce"
+};
+
+struct prof_stats {
+	double calls, bytes, time, wait;
+};
+
+struct prof_site {
+	const void * address;		// return address in the caller, NULL if the slot is free
+	int fn;
+	struct prof_stats stats;
+};
+
+/* A call site as sent to rank 0 at MPI_Finalize */
+struct prof_site_out {
+	int fn;
+	unsigned long offset;		// from the start of the module
+	char module[200];
+	struct prof_stats stats;
+	double time_max;			// largest time of one rank
+};
+
+struct prof_comm {
+	MPI_Comm comm;
+	int size;
+	int * world;				// world rank of each rank of comm
+};
+
+static struct {
+	int active, measure_wait;
+	int world_rank, world_size;
+	double start;
+	struct prof_stats fns[PROF_NOF_FNS];
+	struct prof_site sites[PROF_MAX_SITES];
+	int lost_sites;
+	double * sent;				// bytes this rank sent to each world rank
+	struct prof_comm comms[PROF_MAX_COMMS];
+	int next_comm;
+} Prof;
+
+/*---------------------------------------------------------------- recording */
+
+static void prof_start(void) {
+	const char * wait = getenv("MPI_PROFILE_WAIT");
+
+	PMPI_Comm_rank(MPI_COMM_WORLD, &Prof.world_rank);
+	PMPI_Comm_size(MPI_COMM_WORLD, &Prof.world_size);
+	Prof.sent = calloc(Prof.world_size, sizeof(double));
+	Prof.measure_wait = (wait == NULL || strcmp(wait, "0") != 0);
+	Prof.active = 1;
+	Prof.start = PMPI_Wtime();
+}
+
+/* World rank of rank `rank` of comm, or -1 */
+static int prof_world_rank(MPI_Comm comm, int rank) {
+	struct prof_comm * c = NULL;
+
+	if (rank < 0)
+		return -1;
+	if (comm == MPI_COMM_WORLD)
+		return rank;
+	for (int i = 0; i < PROF_MAX_COMMS; i++) {
+		if (Prof.comms[i].world != NULL && Prof.comms[i].comm == comm) {
+			c = &Prof.comms[i];
+			break;
+		}
+	}
+	if (c == NULL) {
+		MPI_Group group, world_group;
+		int * ranks;
+
+		c = &Prof.comms[Prof.next_comm];
+		Prof.next_comm = (Prof.next_comm + 1) % PROF_MAX_COMMS;
+		free(c->world);
+		c->comm = comm;
+		PMPI_Comm_size(comm, &c->size);
+		c->world = malloc(c->size * sizeof(int));
+		ranks = malloc(c->size * sizeof(int));
+		for (int i = 0; i < c->size; i++)
+			ranks[i] = i;
+		PMPI_Comm_group(comm, &group);
+		PMPI_Comm_group(MPI_COMM_WORLD, &world_group);
+		PMPI_Group_translate_ranks(group, c->size, ranks, world_group, c->world);
+		PMPI_Group_free(&group);
+		PMPI_Group_free(&world_group);
+		free(ranks);
+	}
+	return rank < c->size ? c->world[rank] : -1;
+}
+
+/* Count bytes sent from this rank to rank `to` of comm */
+static void prof_sent(MPI_Comm comm, int to, double bytes) {
+	int world = prof_world_rank(comm, to);
+
+	if (world >= 0 && world < Prof.world_size && bytes > 0)
+		Prof.sent[world] += bytes;
+}
+
+/* The same to every other rank of comm */
+static void prof_sent_all(MPI_Comm comm, double bytes) {
+	int my_rank, comm_sz;
+
+	PMPI_Comm_rank(comm, &my_rank);
+	PMPI_Comm_size(comm, &comm_sz);
+	for (int r = 0; r < comm_sz; r++) {
+		if (r != my_rank)
+			prof_sent(comm, r, bytes);
+	}
+}
+
+static double prof_bytes(int count, MPI_Datatype type) {
+	int size = 0;
+
+	if (type != MPI_DATATYPE_NULL)
+		PMPI_Type_size(type, &size);
+	return (double)count * size;
+}
+
+static void prof_record(int fn, const void * site, double bytes, double time, double wait) {
+	struct prof_stats * stats = &Prof.fns[fn];
+	unsigned slot = (unsigned)(((unsigned long)site >> 2) * 2654435761u + fn) % PROF_MAX_SITES;
+
+	if (!Prof.active)
+		return;
+	stats->calls++;
+	stats->bytes += bytes;
+	stats->time += time;
+	stats->wait += wait;
+
+	for (int probe = 0; probe < PROF_MAX_SITES; probe++, slot = (slot + 1) % PROF_MAX_SITES) {
+		struct prof_site * s = &Prof.sites[slot];
+		if (s->address == NULL) {
+			s->address = site;
+			s->fn = fn;
+		}
+		if (s->address == site && s->fn == fn) {
+			s->stats.calls++;
+			s->stats.bytes += bytes;
+			s->stats.time += time;
+			s->stats.wait += wait;
+			return;
+		}
+	}
+	Prof.lost_sites++;
+}
+
+/* Barrier ahead of a blocking collective: its time is this rank's wait */
+static double prof_wait(MPI_Comm comm) {
+	double start;
+
+	if (!Prof.active || !Prof.measure_wait)
+		return 0;
+	start = PMPI_Wtime();
+	PMPI_Barrier(comm);
+	return PMPI_Wtime() - start;
+}
+
+#define PROF_SITE __builtin_return_address(0)
+
+/*---------------------------------------------------------------- wrappers */
+
+int MPI_Init(int * argc, char *** argv) {
+	int status = PMPI_Init(argc, argv);
+	prof_start();
+	return status;
+}
+
+int MPI_Init_thread(int * argc, char *** argv, int required, int * provided) {
+	int status = PMPI_Init_thread(argc, argv, required, provided);
+	prof_start();
+	return status;
+}
+
+int MPI_Send(const void * buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm) {
+	double start = PMPI_Wtime(), bytes = prof_bytes(count, type);
+	int status = PMPI_Send(buf, count, type, dest, tag, comm);
+
+	prof_record(PROF_SEND, PROF_SITE, bytes, PMPI_Wtime() - start, 0);
+	prof_sent(comm, dest, bytes);
+	return status;
+}
+
+int MPI_Recv(void * buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Status * status) {
+	double start = PMPI_Wtime();
+	MPI_Status local;
+	int received = 0, result;
+
+	result = PMPI_Recv(buf, count, type, source, tag, comm, status == MPI_STATUS_IGNORE ? &local : status);
+	PMPI_Get_count(status == MPI_STATUS_IGNORE ? &local : status, type, &received);
+	prof_record(PROF_RECV, PROF_SITE, prof_bytes(received, type), PMPI_Wtime() - start, 0);
+	return result;
+}
+
+int MPI_Sendrecv(const void * sendbuf, int sendcount, MPI_Datatype sendtype, int dest, int sendtag,
+	void * recvbuf, int recvcount, MPI_Datatype recvtype, int source, int recvtag, MPI_Comm comm, MPI_Status * status) {
+
+	double start = PMPI_Wtime(), bytes = prof_bytes(sendcount, sendtype);
+	int result = PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag, recvbuf, recvcount, recvtype,
+		source, recvtag, comm, status);
+
+	prof_record(PROF_SENDRECV, PROF_SITE, bytes, PMPI_Wtime() - start, 0);
+	prof_sent(comm, dest, bytes);
+	return result;
+}
+
+int MPI_Isend(const void * buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm, MPI_Request * request) {
+	double start = PMPI_Wtime(), bytes = prof_bytes(count, type);
+	int status = PMPI_Isend(buf, count, type, dest, tag, comm, request);
+
+	prof_record(PROF_ISEND, PROF_SITE, bytes, PMPI_Wtime() - start, 0);
+	prof_sent(comm, dest, bytes);
+	return status;
+}
+
+int MPI_Irecv(void * buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Request * request) {
+	double start = PMPI_Wtime();
+	int status = PMPI_Irecv(buf, count, type, source, tag, comm, request);
+
+	prof_record(PROF_IRECV, PROF_SITE, 0, PMPI_Wtime() - start, 0);
+	return status;
+}
+
+int MPI_Wait(MPI_Request * request, MPI_Status * status) {
+	double start = PMPI_Wtime(), elapsed;
+	int result = PMPI_Wait(request, status);
+
+	elapsed = PMPI_Wtime() - start;
+	prof_record(PROF_WAIT, PROF_SITE, 0, elapsed, elapsed);
+	return result;
+}
+
+int MPI_Waitall(int count, MPI_Request requests[], MPI_Status statuses[]) {
+	double start = PMPI_Wtime(), elapsed;
+	int result = PMPI_Waitall(count, requests, statuses);
+
+	elapsed = PMPI_Wtime() - start;
+	prof_record(PROF_WAITALL, PROF_SITE, 0, elapsed, elapsed);
+	return result;
+}
+
+int MPI_Barrier(MPI_Comm comm) {
+	double start = PMPI_Wtime(), elapsed;
+	int status = PMPI_Barrier(comm);
+
+	elapsed = PMPI_Wtime() - start;
+	prof_record(PROF_BARRIER, PROF_SITE, 0, elapsed, elapsed);
+	return status;
+}
+
+int MPI_Bcast(void * buf, int count, MPI_Datatype type, int root, MPI_Comm comm) {
+	double start = PMPI_Wtime(), wait = prof_wait(comm), bytes = prof_bytes(count, type);
+	int my_rank, status = PMPI_Bcast(buf, count, type, root, comm);
+
+	PMPI_Comm_rank(comm, &my_rank);
+	prof_record(PROF_BCAST, PROF_SITE, my_rank == root ? bytes : 0, PMPI_Wtime() - start, wait);
+	if (my_rank == root)
+		prof_sent_all(comm, bytes);
+	return status;
+}
+
+int MPI_Scatter(const void * sendbuf, int sendcount, MPI_Datatype sendtype, void * recvbuf, int recvcount,
+	MPI_Datatype recvtype, int root, MPI_Comm comm) {
+
+	double start = PMPI_Wtime(), wait = prof_wait(comm), bytes = 0;
+	int my_rank, status = PMPI_Scatter(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm);
+
+	PMPI_Comm_rank(comm, &my_rank);
+	if (my_rank == root) {
+		bytes = prof_bytes(sendcount, sendtype);
+		prof_sent_all(comm, bytes);
+	}
+	prof_record(PROF_SCATTER, PROF_SITE, bytes, PMPI_Wtime() - start, wait);
+	return status;
+}
+
+int MPI_Scatterv(const void * sendbuf, const int sendcounts[], const int displs[], MPI_Datatype sendtype,
+	void * recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm) {
+
+	double start = PMPI_Wtime(), wait = prof_wait(comm), bytes = 0;
+	int my_rank, comm_sz, status = PMPI_Scatterv(sendbuf, sendcounts, displs, sendtype, recvbuf, recvcount,
+		recvtype, root, comm);
+
+	PMPI_Comm_rank(comm, &my_rank);
+	PMPI_Comm_size(comm, &comm_sz);
+	if (my_rank == root) {
+		for (int r = 0; r < comm_sz; r++) {
+			double part = prof_bytes(sendcounts[r], sendtype);
+			bytes += part;
+			if (r != root)
+				prof_sent(comm, r, part);
+		}
+	}
+	prof_record(PROF_SCATTERV, PROF_SITE, bytes, PMPI_Wtime() - start, wait);
+	return status;
+}
+
+int MPI_Gather(const void * sendbuf, int sendcount, MPI_Datatype sendtype, void * recvbuf, int recvcount,
+	MPI_Datatype recvtype, int root, MPI_Comm comm) {
+
+	double start = PMPI_Wtime(), wait = prof_wait(comm), bytes = prof_bytes(sendcount, sendtype);
+	int my_rank, status = PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm);
+
+	PMPI_Comm_rank(comm, &my_rank);
+	if (my_rank != root)
+		prof_sent(comm, root, bytes);
+	prof_record(PROF_GATHER, PROF_SITE, bytes, PMPI_Wtime() - start, wait);
+	return status;
+}
+
+int MPI_Gatherv(const void * sendbuf, int sendcount, MPI_Datatype sendtype, void * recvbuf, const int recvcounts[],
+	const int displs[], MPI_Datatype recvtype, int root, MPI_Comm comm) {
+
+	double start = PMPI_Wtime(), wait = prof_wait(comm), bytes = prof_bytes(sendcount, sendtype);
+	int my_rank, status = PMPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype,
+		root, comm);
+
+	PMPI_Comm_rank(comm, &my_rank);
+	if (my_rank != root)
+		prof_sent(comm, root, bytes);
+	prof_record(PROF_GATHERV, PROF_SITE, bytes, PMPI_Wtime() - start, wait);
+	return status;
+}
+
+int MPI_Reduce(const void * sendbuf, void * recvbuf, int count, MPI_Datatype type, MPI_Op op, int root, MPI_Comm comm) {
+	double start = PMPI_Wtime(), wait = prof_wait(comm), bytes = prof_bytes(count, type);
+	int my_rank, status = PMPI_Reduce(sendbuf, recvbuf, count, type, op, root, comm);
+
+	PMPI_Comm_rank(comm, &my_rank);
+	if (my_rank != root)
+		prof_sent(comm, root, bytes);
+	prof_record(PROF_REDUCE, PROF_SITE, bytes, PMPI_Wtime() - start, wait);
+	return status;
+}
+
+int MPI_Allreduce(const void * sendbuf, void * recvbuf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm) {
+	double start = PMPI_Wtime(), wait = prof_wait(comm), bytes = prof_bytes(count, type);
+	int status = PMPI_Allreduce(sendbuf, recvbuf, count, type, op, comm);
+
+	prof_sent_all(comm, bytes);
+	prof_record(PROF_ALLREDUCE, PROF_SITE, bytes, PMPI_Wtime() - start, wait);
+	return status;
+}
+
+int MPI_Allgather(const void * sendbuf, int sendcount, MPI_Datatype sendtype, void * recvbuf, int recvcount,
+	MPI_Datatype recvtype, MPI_Comm comm) {
+
+	double start = PMPI_Wtime(), wait = prof_wait(comm), bytes = prof_bytes(sendcount, sendtype);
+	int status = PMPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+
+	prof_sent_all(comm, bytes);
+	prof_record(PROF_ALLGATHER, PROF_SITE, bytes, PMPI_Wtime() - start, wait);
+	return status;
+}
+
+int MPI_Alltoall(const void * sendbuf, int sendcount, MPI_Datatype sendtype, void * recvbuf, int recvcount,
+	MPI_Datatype recvtype, MPI_Comm comm) {
+
+	double start = PMPI_Wtime(), wait = prof_wait(comm), bytes = prof_bytes(sendcount, sendtype);
+	int comm_sz, status = PMPI_Alltoall(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+
+	PMPI_Comm_size(comm, &comm_sz);
+	prof_sent_all(comm, bytes);
+	prof_record(PROF_ALLTOALL, PROF_SITE, bytes * (comm_sz - 1), PMPI_Wtime() - start, wait);
+	return status;
+}
+
+int MPI_Ireduce(const void * sendbuf, void * recvbuf, int count, MPI_Datatype type, MPI_Op op, int root,
+	MPI_Comm comm, MPI_Request * request) {
+
+	double start = PMPI_Wtime(), bytes = prof_bytes(count, type);
+	int my_rank, status = PMPI_Ireduce(sendbuf, recvbuf, count, type, op, root, comm, request);
+
+	PMPI_Comm_rank(comm, &my_rank);
+	if (my_rank != root)
+		prof_sent(comm, root, bytes);
+	prof_record(PROF_IREDUCE, PROF_SITE, bytes, PMPI_Wtime() - start, 0);
+	return status;
+}
+
+int MPI_Iallreduce(const void * sendbuf, void * recvbuf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm,
+	MPI_Request * request) {
+
+	double start = PMPI_Wtime(), bytes = prof_bytes(count, type);
+	int status = PMPI_Iallreduce(sendbuf, recvbuf, count, type, op, comm, request);
+
+	prof_sent_all(comm, bytes);
+	prof_record(PROF_IALLREDUCE, PROF_SITE, bytes, PMPI_Wtime() - start, 0);
+	return status;
+}
+
+int MPI_Comm_free(MPI_Comm * comm) {
+	for (int i = 0; i < PROF_MAX_COMMS; i++) {
+		if (Prof.comms[i].world != NULL && Prof.comms[i].comm == *comm) {
+			free(Prof.comms[i].world);
+			Prof.comms[i].world = NULL;
+		}
+	}
+	return PMPI_Comm_free(comm);
+}
+
+/*---------------------------------------------------------------- report */
+
+/* "1.5M"-style byte counts */
+static const char * prof_human(double bytes, char * buf, size_t len) {
+	const char * units = " KMGTP";
+	int u = 0;
+
+	while (bytes >= 1024 && u < 5) {
+		bytes /= 1024;
+		u++;
+	}
+	if (u == 0)
+		snprintf(buf, len, "%.0f", bytes);
+	else
+		snprintf(buf, len, "%.1f%c", bytes, units[u]);
+	return buf;
+}
+
+/* Module and module-relative offset of a call site, the same on every rank */
+static void prof_locate(const void * address, struct prof_site_out * out) {
+	Dl_info info;
+
+	out->offset = (unsigned long)address;
+	strcpy(out->module, "?");
+	if (dladdr(address, &info) != 0 && info.dli_fname != NULL) {
+		const Elf64_Ehdr * header = info.dli_fbase;
+		snprintf(out->module, sizeof(out->module), "%s", info.dli_fname);
+		if (header == NULL || header->e_type != ET_EXEC)	// position independent
+			out->offset -= (unsigned long)info.dli_fbase;
+	}
+	out->offset -= 1;		// back from the return address into the call instruction
+}
+
+/* file:line (function) of a call site, from addr2line, or module+offset */
+static void prof_describe(const struct prof_site_out * site, char * buf, size_t len) {
+	char command[400], function[128] = "", line[256] = "";
+	const char * base = strrchr(site->module, '/');
+	FILE * pipe;
+
+	snprintf(buf, len, "%s+0x%lx", base ? base + 1 : site->module, site->offset);
+	if (site->module[0] != '/' && strchr(site->module, '/') == NULL)
+		return;
+	snprintf(command, sizeof(command), "addr2line -f -e '%s' 0x%lx 2>/dev/null", site->module, site->offset);
+	if ((pipe = popen(command, "r")) == NULL)
+		return;
+	if (fgets(function, sizeof(function), pipe) != NULL && fgets(line, sizeof(line), pipe) != NULL
+			&& line[0] != '?') {
+		const char * file = strrchr(line, '/');
+		function[strcspn(function, "\n")] = '\0';
+		line[strcspn(line, "\n ")] = '\0';
+		snprintf(buf, len, "%s (%s)", file ? file + 1 : line, function);
+	}
+	pclose(pipe);
+}
+
+static int prof_compare_time(const void * a, const void * b) {
+	double x = ((const struct prof_site_out *)a)->stats.time, y = ((const struct prof_site_out *)b)->stats.time;
+	return (x < y) - (x > y);
+}
+
+/*------------------------------------------------------------------
+ * Function:	prof_report
+ * Purpose:		Gather every rank's numbers on rank 0 and print the
+ * 				function summary, the call sites and the byte matrix
+ */
+static void prof_report(void) {
+	int size = Prof.world_size, rank = Prof.world_rank, nof_sites = 0, total_sites = 0;
+	double wall = PMPI_Wtime() - Prof.start, fns[PROF_NOF_FNS][4], walls_sum, mpi_time = 0, mpi_sum;
+	double times_min[PROF_NOF_FNS], times_max[PROF_NOF_FNS], local_times[PROF_NOF_FNS], waits_max[PROF_NOF_FNS];
+	double local_waits[PROF_NOF_FNS], * matrix = NULL;
+	int * site_counts = NULL, * displs = NULL;
+	struct prof_site_out * local_sites, * sites = NULL;
+	const char * path = getenv("MPI_PROFILE_OUT");
+	FILE * out = stdout;
+	char bytes[32];
+
+	Prof.active = 0;
+	for (int f = 0; f < PROF_NOF_FNS; f++) {
+		local_times[f] = Prof.fns[f].time;
+		local_waits[f] = Prof.fns[f].wait;
+		mpi_time += Prof.fns[f].time;
+	}
+	PMPI_Reduce(Prof.fns, fns, PROF_NOF_FNS * 4, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(local_times, times_min, PROF_NOF_FNS, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(local_times, times_max, PROF_NOF_FNS, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(local_waits, waits_max, PROF_NOF_FNS, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(&wall, &walls_sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(&mpi_time, &mpi_sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+	/* call sites, as module offsets so that every rank names them alike */
+	local_sites = calloc(PROF_MAX_SITES, sizeof(struct prof_site_out));
+	for (int s = 0; s < PROF_MAX_SITES; s++) {
+		if (Prof.sites[s].address == NULL)
+			continue;
+		local_sites[nof_sites].fn = Prof.sites[s].fn;
+		local_sites[nof_sites].stats = Prof.sites[s].stats;
+		local_sites[nof_sites].time_max = Prof.sites[s].stats.time;
+		prof_locate(Prof.sites[s].address, &local_sites[nof_sites]);
+		nof_sites++;
+	}
+	nof_sites *= sizeof(struct prof_site_out);
+	if (rank == 0) {
+		site_counts = malloc(size * sizeof(int));
+		displs = malloc(size * sizeof(int));
+		matrix = malloc((size_t)size * size * sizeof(double));
+	}
+	PMPI_Gather(&nof_sites, 1, MPI_INT, site_counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	if (rank == 0) {
+		for (int r = 0; r < size; r++) {
+			displs[r] = total_sites;
+			total_sites += site_counts[r];
+		}
+		sites = malloc(total_sites > 0 ? total_sites : 1);
+	}
+	PMPI_Gatherv(local_sites, nof_sites, MPI_BYTE, sites, site_counts, displs, MPI_BYTE, 0, MPI_COMM_WORLD);
+	PMPI_Gather(Prof.sent, size, MPI_DOUBLE, matrix, size, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	free(local_sites);
+
+	if (rank != 0)
+		return;
+	if (path != NULL && (out = fopen(path, "w")) == NULL) {
+		perror(path);
+		out = stdout;
+	}
+
+	fprintf(out, "\nMPI profile: %d ranks, %.4e s mean wall time per rank, %.1f%% of it in MPI%s\n", size,
+		walls_sum / size, walls_sum > 0 ? 100 * mpi_sum / walls_sum : 0.0,
+		Prof.measure_wait ? "" : " (collective waits not measured)");
+	fprintf(out, "%-15s %10s %10s %12s %12s %12s %12s %12s %7s\n", "function", "calls", "bytes",
+		"min (s)", "mean (s)", "max (s)", "wait avg (s)", "wait max (s)", "%wall");
+	for (int f = 0; f < PROF_NOF_FNS; f++) {
+		if (fns[f][0] == 0)
+			continue;
+		fprintf(out, "%-15s %10.0f %10s %12.4e %12.4e %12.4e %12.4e %12.4e %7.2f\n", prof_names[f], fns[f][0],
+			prof_human(fns[f][1], bytes, sizeof(bytes)), times_min[f], fns[f][2] / size, times_max[f],
+			fns[f][3] / size, waits_max[f], walls_sum > 0 ? 100 * fns[f][2] / walls_sum : 0.0);
+	}
+
+	/* merge the call sites of all ranks */
+	total_sites /= sizeof(struct prof_site_out);
+	nof_sites = 0;
+	for (int i = 0; i < total_sites; i++) {
+		int j;
+		for (j = 0; j < nof_sites; j++) {
+			if (sites[j].fn == sites[i].fn && sites[j].offset == sites[i].offset
+					&& strcmp(sites[j].module, sites[i].module) == 0)
+				break;
+		}
+		if (j == nof_sites) {
+			sites[nof_sites++] = sites[i];
+		} else {
+			sites[j].stats.calls += sites[i].stats.calls;
+			sites[j].stats.bytes += sites[i].stats.bytes;
+			sites[j].stats.time += sites[i].stats.time;
+			sites[j].stats.wait += sites[i].stats.wait;
+			if (sites[i].time_max > sites[j].time_max)
+				sites[j].time_max = sites[i].time_max;
+		}
+	}
+	qsort(sites, nof_sites, sizeof(struct prof_site_out), prof_compare_time);
+	fprintf(out, "\n%-15s %-36s %10s %10s %12s %12s %12s\n", "call site", "", "calls", "bytes",
+		"mean (s)", "max (s)", "wait avg (s)");
+	for (int i = 0; i < nof_sites; i++) {
+		char where[256];
+		prof_describe(&sites[i], where, sizeof(where));
+		fprintf(out, "%-15s %-36s %10.0f %10s %12.4e %12.4e %12.4e\n", prof_names[sites[i].fn], where,
+			sites[i].stats.calls, prof_human(sites[i].stats.bytes, bytes, sizeof(bytes)),
+			sites[i].stats.time / size, sites[i].time_max, sites[i].stats.wait / size);
+	}
+	if (Prof.lost_sites > 0)
+		fprintf(out, "(rank 0 ran out of call-site slots %d times; those calls are in the summary only)\n",
+			Prof.lost_sites);
+
+	if (size <= PROF_MATRIX_RANKS) {
+		fprintf(out, "\nbytes sent (row = sender, column = receiver)\n%6s", "");
+		for (int c = 0; c < size; c++)
+			fprintf(out, " %8d", c);
+		fprintf(out, "\n");
+		for (int r = 0; r < size; r++) {
+			fprintf(out, "%6d", r);
+			for (int c = 0; c < size; c++)
+				fprintf(out, " %8s", prof_human(matrix[(size_t)r * size + c], bytes, sizeof(bytes)));
+			fprintf(out, "\n");
+		}
+	} else {
+		fprintf(out, "\n(byte matrix not printed for more than %d ranks)\n", PROF_MATRIX_RANKS);
+	}
+	if (out != stdout)
+		fclose(out);
+	else
+		fflush(out);
+	free(sites);
+	free(site_counts);
+	free(displs);
+	free(matrix);
+}
+
+int MPI_Finalize(void) {
+	if (Prof.active)
+		prof_report();
+	free(Prof.sent);
+	return PMPI_Finalize();
+}
@@ -0,0 +1,341 @@
+/* File:     pool.h
+ *
+ * Purpose:  A work-stealing thread pool for the summation: Pool_sum adds
+ *           the terms of [lower, upper) to an accumulator using every
+ *           thread of the pool, with no processes or messages.  Pool_run
+ *           does the same for any leaf function (the series of series.h).
+ *
+ *           A range is split recursively: a thread halves its task,
+ *           pushes the upper half on its own deque and goes on with the
+ *           lower half, until the task is at most a grain of terms, which
+ *           it sums into its own accumulator.  It then pops its latest
+ *           half; an idle thread steals the oldest (largest) half from
+ *           another thread's deque.  The grain adapts to the number of
+ *           threads, POOL_TASKS_PER_THREAD leaves per thread, so the load
+ *           evens out without the tasks getting small (at least
+ *           $SUM_GRAIN terms, default POOL_MIN_GRAIN).  Each thread's
+ *           record (accumulator, deque, counts) sits on its own cache
+ *           lines, and the accumulators are merged exactly at the end.
+ *
+ *           The leaves only depend on the range, the number of threads
+ *           and the grain, not on who sums them, so every run with the same
+ *           number of threads gives the same bits; in repro mode any
+ *           number of threads does (see sum_kernels.h).
+ *
+ * Note:     --threads <t> or $SUM_THREADS set the size (Pool_select,
+ *           Pool_threads); 0 means every cpu this process may run on.
+ *           Pool_start creates the threads once and Pool_sum reuses
+ *           them, so an MPI rank can call it for each of its chunks.
+ *           Only the calling thread runs Pool_sum (MPI_THREAD_FUNNELED
+ *           is enough).  The including file must define _GNU_SOURCE (see
+ *           affinity.h).
+ *
+ * Example:
+ *    Pool_select(argc, argv);
+ *    Pool_start(Pool_threads(0), 0);
+ *    Sum_acc_init(&acc);
+ *    Pool_sum(0, n, &acc);
+ *    . . . Sum_acc_value(&acc) . . .
+ *    Pool_stop();
+ */
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include "affinity.h"
+#include "instrument.h"
+#include "sum_kernels.h"
+
+#define POOL_MAX_THREADS 256
+#define POOL_DEQUE 128			/* > 64 halvings of a 64-bit range */
+#define POOL_TASKS_PER_THREAD 16
+#define POOL_MIN_GRAIN 65536	/* terms: ~0.1 ms, well above a steal */
+
+static int64_t Pool_min_grain = 0;	/* set by a tuner; 0: ask Pool_grain_floor */
+
+struct pool_task {
+	int64_t first, last;
+};
+
+/* What a thread does with a leaf task: add the sum of [first, last) to acc */
+typedef void (*pool_leaf)(int64_t first, int64_t last, struct sum_acc* acc);
+
+/* Everything one thread writes, on its own cache lines */
+struct pool_worker {
+	struct sum_acc acc;			/* this thread's part of the job */
+	struct pool_task deque[POOL_DEQUE];
+	int64_t top, bottom;		/* thieves take deque[top], the owner deque[bottom - 1] */
+	atomic_flag lock;
+	double terms, tasks, steals, busy;	/* since Pool_start */
+	pthread_t id;
+} __attribute__((aligned(64)));
+
+static struct {
+	int nof_threads, base_slot;
+	struct pool_worker* workers;
+	pthread_mutex_t mutex;
+	pthread_cond_t start, done;
+	int generation, running, stopping;
+	_Atomic int64_t remaining;	/* terms of the job not summed yet */
+	int64_t grain;
+	pool_leaf leaf;
+	double jobs;
+} Pool = {1, 0, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	0, 0, 0, 0, 0, NULL, 0};
+
+static int Pool_forced = -1;
+
+/* Apply --threads <t>; 0, or -1 for a bad count */
+static inline int Pool_select(int argc, char* argv[]) {
+	for (int a = 1; a + 1 < argc; a++) {
+		if (strcmp(argv[a], "--threads") == 0) {
+			char* end;
+			long t = strtol(argv[a + 1], &end, 10);
+
+			if (*end != '\0' || t < 0 || t > POOL_MAX_THREADS) {
+				fprintf(stderr, "--threads %s: expected 0 (every cpu) to %d\n", argv[a + 1], POOL_MAX_THREADS);
+				return -1;
+			}
+			Pool_forced = (int)t;
+		}
+	}
+	return 0;
+}
+
+/* --threads, else $SUM_THREADS, else fallback; 0 becomes the cpus this process may use */
+static inline int Pool_threads(int fallback) {
+	const char* env = getenv("SUM_THREADS");
+	int threads = Pool_forced >= 0 ? Pool_forced : (env != NULL ? atoi(env) : fallback);
+
+	if (threads <= 0) {
+		cpu_set_t set;
+
+		threads = sched_getaffinity(0, sizeof(set), &set) == 0 ? CPU_COUNT(&set) : 1;
+	}
+	return threads < POOL_MAX_THREADS ? threads : POOL_MAX_THREADS;
+}
+
+/* The smallest leaf task: $SUM_GRAIN, else POOL_MIN_GRAIN */
+static inline int64_t Pool_grain_floor(void) {
+	const char* env;
+
+	if (Pool_min_grain == 0)
+		Pool_min_grain = (env = getenv("SUM_GRAIN")) != NULL && atoll(env) > 0 ? atoll(env) : POOL_MIN_GRAIN;
+	return Pool_min_grain;
+}
+
+/*---------------------------------------------------------------- deques */
+
+static inline void Pool_lock(struct pool_worker* w) {
+	while (atomic_flag_test_and_set_explicit(&w->lock, memory_order_acquire))
+		;
+}
+
+static inline void Pool_unlock(struct pool_worker* w) {
+	atomic_flag_clear_explicit(&w->lock, memory_order_release);
+}
+
+static inline void Pool_push(struct pool_worker* w, int64_t first, int64_t last) {
+	Pool_lock(w);
+	w->deque[w->bottom % POOL_DEQUE] = (struct pool_task){first, last};
+	w->bottom++;
+	Pool_unlock(w);
+}
+
+/* The owner's latest task; 0 if the deque is empty */
+static inline int Pool_pop(struct pool_worker* w, struct pool_task* task) {
+	int found = 0;
+
+	Pool_lock(w);
+	if (w->bottom > w->top) {
+		*task = w->deque[--w->bottom % POOL_DEQUE];
+		found = 1;
+	}
+	Pool_unlock(w);
+	return found;
+}
+
+/* Another thread's oldest task, trying each thread after self once; 0 if none */
+static inline int Pool_steal(int self, struct pool_task* task) {
+	for (int k = 1; k < Pool.nof_threads; k++) {
+		struct pool_worker* victim = &Pool.workers[(self + k) % Pool.nof_threads];
+		int found = 0;
+
+		Pool_lock(victim);
+		if (victim->bottom > victim->top) {
+			*task = victim->deque[victim->top++ % POOL_DEQUE];
+			found = 1;
+		}
+		Pool_unlock(victim);
+		if (found)
+			return 1;
+	}
+	return 0;
+}
+
+/*---------------------------------------------------------------- workers */
+
+/* Split and sum tasks until every term of the job is summed */
+static inline void Pool_work(int self) {
+	struct pool_worker* w = &Pool.workers[self];
+	struct pool_task task;
+
+	while (atomic_load(&Pool.remaining) > 0) {
+		double start;
+
+		if (!Pool_pop(w, &task)) {
+			if (!Pool_steal(self, &task)) {
+				sched_yield();
+				continue;
+			}
+			w->steals++;
+		}
+		while (task.last - task.first > Pool.grain) {
+			int64_t middle = task.first + (task.last - task.first) / 2;
+
+			Pool_push(w, middle, task.last);
+			task.last = middle;
+		}
+		start = Instr_now();
+		Pool.leaf(task.first, task.last, &w->acc);
+		w->busy += Instr_now() - start;
+		w->terms += task.last - task.first;
+		w->tasks++;
+		atomic_fetch_sub(&Pool.remaining, task.last - task.first);
+	}
+}
+
+static inline void* Pool_thread_main(void* arg) {
+	int self = (int)(intptr_t)arg, seen = 0;
+
+	Affinity_pin_thread(NULL, Pool.base_slot + self, NULL);
+	pthread_mutex_lock(&Pool.mutex);
+	for (;;) {
+		while (Pool.generation == seen && !Pool.stopping)
+			pthread_cond_wait(&Pool.start, &Pool.mutex);
+		if (Pool.stopping)
+			break;
+		seen = Pool.generation;
+		pthread_mutex_unlock(&Pool.mutex);
+
+		Pool_work(self);
+
+		pthread_mutex_lock(&Pool.mutex);
+		if (--Pool.running == 0)
+			pthread_cond_signal(&Pool.done);
+	}
+	pthread_mutex_unlock(&Pool.mutex);
+	return NULL;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Pool_start
+ * Purpose:		Create the pool's threads; the caller is thread 0
+ * Input args:	nof_threads:	size of the pool (1: Pool_sum runs the
+ * 								kernel on the caller)
+ * 				base_slot:		affinity slot of thread 0 (node-local
+ * 								rank times nof_threads)
+ */
+static inline void Pool_start(int nof_threads, int base_slot) {
+	Pool.nof_threads = nof_threads < 1 ? 1 : (nof_threads > POOL_MAX_THREADS ? POOL_MAX_THREADS : nof_threads);
+	Pool.base_slot = base_slot;
+	Pool.stopping = 0;
+	Pool.jobs = 0;
+	Pool.workers = aligned_alloc(64, Pool.nof_threads * sizeof(struct pool_worker));
+	memset(Pool.workers, 0, Pool.nof_threads * sizeof(struct pool_worker));
+	for (int t = 0; t < Pool.nof_threads; t++)
+		atomic_flag_clear(&Pool.workers[t].lock);
+	if (Pool.nof_threads > 1)
+		Affinity_pin_thread(NULL, base_slot, NULL);
+	for (int t = 1; t < Pool.nof_threads; t++)
+		pthread_create(&Pool.workers[t].id, NULL, Pool_thread_main, (void*)(intptr_t)t);
+}
+
+/* Stop and join the pool's threads */
+static inline void Pool_stop(void) {
+	pthread_mutex_lock(&Pool.mutex);
+	Pool.stopping = 1;
+	pthread_cond_broadcast(&Pool.start);
+	pthread_mutex_unlock(&Pool.mutex);
+	for (int t = 1; t < Pool.nof_threads; t++)
+		pthread_join(Pool.workers[t].id, NULL);
+	free(Pool.workers);
+	Pool.workers = NULL;
+	Pool.nof_threads = 1;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Pool_run
+ * Purpose:		Run leaf over lower_limit <= i < upper_limit, split into
+ * 				tasks on every thread of the pool
+ * In/out args:	acc:	the exact sum of the threads' accumulators is
+ * 						added to it
+ */
+static inline void Pool_run(int64_t lower_limit, int64_t upper_limit, pool_leaf leaf, struct sum_acc* acc) {
+	int64_t grain;
+
+	if (Pool.workers == NULL || Pool.nof_threads == 1 || upper_limit <= lower_limit) {
+		leaf(lower_limit, upper_limit, acc);
+		return;
+	}
+	Pool.leaf = leaf;
+	grain = (upper_limit - lower_limit) / ((int64_t)Pool.nof_threads * POOL_TASKS_PER_THREAD);
+	Pool.grain = grain > Pool_grain_floor() ? grain : Pool_grain_floor();
+	for (int t = 0; t < Pool.nof_threads; t++) {
+		Sum_acc_init(&Pool.workers[t].acc);
+		Pool.workers[t].top = Pool.workers[t].bottom = 0;
+	}
+	Pool_push(&Pool.workers[0], lower_limit, upper_limit);
+	atomic_store(&Pool.remaining, upper_limit - lower_limit);
+
+	pthread_mutex_lock(&Pool.mutex);
+	Pool.generation++;
+	Pool.running = Pool.nof_threads - 1;
+	pthread_cond_broadcast(&Pool.start);
+	pthread_mutex_unlock(&Pool.mutex);
+
+	Pool_work(0);
+
+	pthread_mutex_lock(&Pool.mutex);
+	while (Pool.running > 0)
+		pthread_cond_wait(&Pool.done, &Pool.mutex);
+	pthread_mutex_unlock(&Pool.mutex);
+
+	for (int t = 0; t < Pool.nof_threads; t++)
+		Sum_acc_add(acc, &Pool.workers[t].acc);
+	Pool.jobs++;
+}
+
+/* Add the sum of the series' terms lower_limit <= i < upper_limit to acc, on the pool */
+static inline void Pool_sum(int64_t lower_limit, int64_t upper_limit, struct sum_acc* acc) {
+	Pool_run(lower_limit, upper_limit, Sum_kernel_acc, acc);
+}
+
+/* Each thread's terms, leaf tasks, steals and busy time since Pool_start */
+static inline void Pool_report(FILE* out, const char* title) {
+	double total = 0;
+
+	if (Pool.workers == NULL || Pool.nof_threads == 1)
+		return;
+	for (int t = 0; t < Pool.nof_threads; t++)
+		total += Pool.workers[t].terms;
+	fprintf(out, "\n%s: %d threads, %.0f jobs, grain %" PRId64 " terms\n", title, Pool.nof_threads, Pool.jobs,
+			Pool.grain);
+	fprintf(out, "%6s %16s %7s %10s %10s %12s\n", "thread", "terms", "share", "tasks", "steals", "busy (s)");
+	for (int t = 0; t < Pool.nof_threads; t++) {
+		const struct pool_worker* w = &Pool.workers[t];
+
+		fprintf(out, "%6d %16.0f %6.1f%% %10.0f %10.0f %12.4e\n", t, w->terms,
+				total > 0 ? 100 * w->terms / total : 0, w->tasks, w->steals, w->busy);
+	}
+	fflush(out);
+}
+
+#endif
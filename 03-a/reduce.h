@@ -0,0 +1,251 @@
+/* File:     reduce.h
+ *
+ * Purpose:  Reductions for the summation programs, chosen at run time:
+ *              linear     each rank sends to the root, which combines in
+ *                         rank order: p - 1 messages in a row
+ *              tree       binomial tree towards the root: log2 p steps
+ *              butterfly  recursive doubling (an all-reduce): log2 p
+ *                         exchanges, every rank ends with the result
+ *              reduce     MPI_Reduce
+ *              allreduce  MPI_Allreduce
+ *              ireduce    MPI_Ireduce; Reduce_start returns at once, so
+ *                         the caller can compute its next batch of terms
+ *                         while the reduction is in flight
+ *           The hand-written strategies combine with MPI_Reduce_local,
+ *           so any datatype / op pair works, including the exact
+ *           accumulator of sum_kernels.h (Sum_acc_mpi).  The op must be
+ *           commutative.
+ *
+ * Note:     --reduce <name> (Reduce_select) or $SUM_REDUCE choose the
+ *           strategy; each program has its own default.  Only available
+ *           when mpi.h is included before this file.
+ *
+ * Example:
+ *    Reduce_select(argc, argv);
+ *    . . .
+ *    Reduce_start(&local, &total, 1, MPI_DOUBLE, MPI_SUM, 0, comm,
+ *          Reduce_strategy(REDUCE_MPI), &request);
+ *    . . .   (work that does not need total)
+ *    MPI_Wait(&request, MPI_STATUS_IGNORE);
+ */
+#ifndef _REDUCE_H_
+#define _REDUCE_H_
+#ifdef MPI_VERSION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REDUCE_TAG 7301
+#define REDUCE_BATCHES 8	/* batches a rank's terms are cut into with ireduce */
+
+enum reduce_strategy {
+	REDUCE_LINEAR, REDUCE_TREE, REDUCE_BUTTERFLY, REDUCE_MPI, REDUCE_ALLREDUCE, REDUCE_IREDUCE,
+	REDUCE_NOF_STRATEGIES
+};
+
+static const char* const Reduce_names[REDUCE_NOF_STRATEGIES] = {
+	"linear", "tree", "butterfly", "reduce", "allreduce", "ireduce"
+};
+
+static int Reduce_forced = -1;
+
+/* The strategy called name, or -1 */
+static inline int Reduce_parse(const char* name) {
+	for (int s = 0; name != NULL && s < REDUCE_NOF_STRATEGIES; s++)
+		if (strcmp(name, Reduce_names[s]) == 0)
+			return s;
+	return -1;
+}
+
+/* Pick the strategy from --reduce <name>; 0, or -1 for an unknown name */
+static inline int Reduce_select(int argc, char* argv[]) {
+	for (int a = 1; a + 1 < argc; a++) {
+		if (strcmp(argv[a], "--reduce") == 0) {
+			int s = Reduce_parse(argv[a + 1]);
+			if (s < 0) {
+				fprintf(stderr, "--reduce %s: expected linear, tree, butterfly, reduce, allreduce or ireduce\n",
+						argv[a + 1]);
+				return -1;
+			}
+			Reduce_forced = s;
+		}
+	}
+	return 0;
+}
+
+/* --reduce's strategy, else $SUM_REDUCE, else the program's default */
+static inline enum reduce_strategy Reduce_strategy(enum reduce_strategy fallback) {
+	static int from_env = -2;
+
+	if (Reduce_forced >= 0)
+		return (enum reduce_strategy)Reduce_forced;
+	if (from_env == -2) {
+		const char* name = getenv("SUM_REDUCE");
+		from_env = Reduce_parse(name);
+		if (name != NULL && from_env < 0)
+			fprintf(stderr, "SUM_REDUCE=%s is not a reduction strategy, using %s\n", name,
+					Reduce_names[fallback]);
+	}
+	return from_env >= 0 ? (enum reduce_strategy)from_env : fallback;
+}
+
+/* Bytes of count elements of type, for copies and scratch buffers */
+static inline size_t Reduce_bytes(int count, MPI_Datatype type) {
+	MPI_Aint lb, extent;
+
+	MPI_Type_get_extent(type, &lb, &extent);
+	return (size_t)extent * count;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Reduce_linear
+ * Purpose:		The root receives from every other rank in rank order
+ * 				and combines as each message arrives
+ */
+static inline void Reduce_linear(const void* in, void* out, int count, MPI_Datatype type, MPI_Op op,
+		int root, MPI_Comm comm) {
+	int my_rank, comm_sz;
+	void* tmp;
+
+	MPI_Comm_rank(comm, &my_rank);
+	MPI_Comm_size(comm, &comm_sz);
+	if (my_rank != root) {
+		MPI_Send(in, count, type, root, REDUCE_TAG, comm);
+		return;
+	}
+	tmp = malloc(Reduce_bytes(count, type));
+	memcpy(out, in, Reduce_bytes(count, type));
+	for (int source = 0; source < comm_sz; source++) {
+		if (source == root)
+			continue;
+		MPI_Recv(tmp, count, type, source, REDUCE_TAG, comm, MPI_STATUS_IGNORE);
+		MPI_Reduce_local(tmp, out, count, type, op);
+	}
+	free(tmp);
+}
+
+/*------------------------------------------------------------------
+ * Function:	Reduce_tree
+ * Purpose:		Binomial tree: in step k, ranks (relative to the root)
+ * 				with bit k set send their partial result to the rank
+ * 				without it and drop out
+ * Output args:	out:	the result on root; scratch on the other ranks
+ */
+static inline void Reduce_tree(const void* in, void* out, int count, MPI_Datatype type, MPI_Op op,
+		int root, MPI_Comm comm) {
+	int my_rank, comm_sz, relative;
+	void* tmp;
+
+	MPI_Comm_rank(comm, &my_rank);
+	MPI_Comm_size(comm, &comm_sz);
+	relative = (my_rank - root + comm_sz) % comm_sz;
+	tmp = malloc(Reduce_bytes(count, type));
+	memcpy(out, in, Reduce_bytes(count, type));
+
+	for (int mask = 1; mask < comm_sz; mask <<= 1) {
+		if (relative & mask) {
+			MPI_Send(out, count, type, (relative - mask + root) % comm_sz, REDUCE_TAG, comm);
+			break;
+		}
+		if (relative + mask < comm_sz) {
+			MPI_Recv(tmp, count, type, (relative + mask + root) % comm_sz, REDUCE_TAG, comm,
+					MPI_STATUS_IGNORE);
+			MPI_Reduce_local(tmp, out, count, type, op);
+		}
+	}
+	free(tmp);
+}
+
+/*------------------------------------------------------------------
+ * Function:	Reduce_butterfly
+ * Purpose:		Recursive doubling: in step k each rank exchanges its
+ * 				partial result with rank ^ 2^k and combines.  With p not
+ * 				a power of two, the ranks past the largest power of two
+ * 				fold into a partner first and get the result back at
+ * 				the end.
+ * Output args:	out:	the result, on every rank
+ * Note:		Both partners combine the same two values, so with a
+ * 				commutative op every rank gets the same bits.
+ */
+static inline void Reduce_butterfly(const void* in, void* out, int count, MPI_Datatype type, MPI_Op op,
+		MPI_Comm comm) {
+	int my_rank, comm_sz, pow2 = 1;
+	void* tmp;
+
+	MPI_Comm_rank(comm, &my_rank);
+	MPI_Comm_size(comm, &comm_sz);
+	while (2 * pow2 <= comm_sz)
+		pow2 *= 2;
+	memcpy(out, in, Reduce_bytes(count, type));
+
+	if (my_rank >= pow2) {
+		MPI_Send(out, count, type, my_rank - pow2, REDUCE_TAG, comm);
+		MPI_Recv(out, count, type, my_rank - pow2, REDUCE_TAG, comm, MPI_STATUS_IGNORE);
+		return;
+	}
+
+	tmp = malloc(Reduce_bytes(count, type));
+	if (my_rank + pow2 < comm_sz) {
+		MPI_Recv(tmp, count, type, my_rank + pow2, REDUCE_TAG, comm, MPI_STATUS_IGNORE);
+		MPI_Reduce_local(tmp, out, count, type, op);
+	}
+	for (int mask = 1; mask < pow2; mask <<= 1) {
+		int partner = my_rank ^ mask;
+
+		MPI_Sendrecv(out, count, type, partner, REDUCE_TAG, tmp, count, type, partner, REDUCE_TAG,
+				comm, MPI_STATUS_IGNORE);
+		MPI_Reduce_local(tmp, out, count, type, op);
+	}
+	if (my_rank + pow2 < comm_sz)
+		MPI_Send(out, count, type, my_rank + pow2, REDUCE_TAG, comm);
+	free(tmp);
+}
+
+/*------------------------------------------------------------------
+ * Function:	Reduce_start
+ * Purpose:		Reduce count elements of in over comm with strategy
+ * Input args:	in, count, type, op:	this rank's contribution
+ * 				root:					the rank that needs the result
+ * Output args:	out:		the result on root (every rank for butterfly
+ * 							and allreduce).  Must hold count elements on
+ * 							every rank: the other ranks use it as scratch.
+ * 				request:	MPI_REQUEST_NULL, or for ireduce the request
+ * 							to wait on before reading out
+ */
+static inline void Reduce_start(const void* in, void* out, int count, MPI_Datatype type, MPI_Op op,
+		int root, MPI_Comm comm, enum reduce_strategy strategy, MPI_Request* request) {
+	*request = MPI_REQUEST_NULL;
+	switch (strategy) {
+	case REDUCE_LINEAR:
+		Reduce_linear(in, out, count, type, op, root, comm);
+		break;
+	case REDUCE_TREE:
+		Reduce_tree(in, out, count, type, op, root, comm);
+		break;
+	case REDUCE_BUTTERFLY:
+		Reduce_butterfly(in, out, count, type, op, comm);
+		break;
+	case REDUCE_ALLREDUCE:
+		MPI_Allreduce(in, out, count, type, op, comm);
+		break;
+	case REDUCE_IREDUCE:
+		MPI_Ireduce(in, out, count, type, op, root, comm, request);
+		break;
+	default:
+		MPI_Reduce(in, out, count, type, op, root, comm);
+		break;
+	}
+}
+
+/* Reduce_start and wait */
+static inline void Reduce_run(const void* in, void* out, int count, MPI_Datatype type, MPI_Op op,
+		int root, MPI_Comm comm, enum reduce_strategy strategy) {
+	MPI_Request request;
+
+	Reduce_start(in, out, count, type, op, root, comm, strategy, &request);
+	MPI_Wait(&request, MPI_STATUS_IGNORE);
+}
+
+#endif
+#endif
@@ -0,0 +1,334 @@
+/* File:     schedule.h
+ *
+ * Purpose:  Dynamic scheduling of the summation terms over the ranks, for
+ *           clusters whose nodes run at different speeds.  Instead of one
+ *           static block per rank, the range is cut into chunks that get
+ *           smaller towards the end, and each rank takes the next chunk
+ *           when it is done with the last one:
+ *              static     one balanced block per rank (Sum_split)
+ *              guided     each chunk is 1/(2p) of the terms left, at
+ *                         least SCHED_MIN_CHUNK
+ *              trapezoid  chunk sizes fall linearly from n/(2p) to
+ *                         SCHED_MIN_CHUNK (trapezoid self-scheduling)
+ *           The chunk table is the same on every rank, so only the index
+ *           of the next chunk has to be shared.  It comes from
+ *              rma          an MPI_Fetch_and_op counter in a window on
+ *                           rank 0 (no coordinator to wait for), or
+ *              coordinator  rank 0, which answers requests between the
+ *                           slices of its own chunks
+ *
+ * Note:     --schedule static|guided|trapezoid and --dispatch rma|coordinator
+ *           (or $SUM_SCHEDULE, $SUM_DISPATCH).  Sched_run is collective;
+ *           Sched_report prints each rank's terms, chunks, busy and idle
+ *           time.  Idle time is the time spent getting chunks plus the
+ *           time between a rank's last chunk and the slowest rank's.
+ *           The ranks should enter Sched_run together (after a barrier).
+ *           Only available when mpi.h and sum_kernels.h are included
+ *           before this file.
+ */
+#ifndef _SCHEDULE_H_
+#define _SCHEDULE_H_
+#ifdef MPI_VERSION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#define SCHED_MIN_CHUNK 100000		/* terms: ~0.1 ms, well above a chunk request */
+#define SCHED_POLL_TERMS 50000		/* rank 0 serves requests this often */
+#define SCHED_TAG_REQUEST 7311
+#define SCHED_TAG_CHUNK 7312
+
+enum sched_kind { SCHED_STATIC, SCHED_GUIDED, SCHED_TRAPEZOID, SCHED_NOF_KINDS };
+enum sched_dispatch { SCHED_RMA, SCHED_COORDINATOR, SCHED_NOF_DISPATCHES };
+
+static const char* const Sched_kind_names[SCHED_NOF_KINDS] = {"static", "guided", "trapezoid"};
+static const char* const Sched_dispatch_names[SCHED_NOF_DISPATCHES] = {"rma", "coordinator"};
+
+/* What one rank did in Sched_run */
+struct sched_stats {
+	double terms, chunks;
+	double busy;		/* seconds in work */
+	double wait;		/* seconds getting chunks */
+	double done;		/* seconds from entering Sched_run to the last chunk's end */
+	double idle;		/* wait + time after done until the slowest rank */
+};
+
+/* The work of a chunk [first, last) */
+typedef void (*sched_work)(int64_t first, int64_t last, void* arg);
+
+static int Sched_kind_forced = -1, Sched_dispatch_forced = -1;
+
+static inline int Sched_parse(const char* name, const char* const* names, int count) {
+	for (int k = 0; name != NULL && k < count; k++)
+		if (strcmp(name, names[k]) == 0)
+			return k;
+	return -1;
+}
+
+/* Pick the schedule from --schedule and --dispatch; 0, or -1 for an unknown name */
+static inline int Sched_select(int argc, char* argv[]) {
+	for (int a = 1; a + 1 < argc; a++) {
+		if (strcmp(argv[a], "--schedule") == 0) {
+			Sched_kind_forced = Sched_parse(argv[a + 1], Sched_kind_names, SCHED_NOF_KINDS);
+			if (Sched_kind_forced < 0) {
+				fprintf(stderr, "--schedule %s: expected static, guided or trapezoid\n", argv[a + 1]);
+				return -1;
+			}
+		} else if (strcmp(argv[a], "--dispatch") == 0) {
+			Sched_dispatch_forced = Sched_parse(argv[a + 1], Sched_dispatch_names, SCHED_NOF_DISPATCHES);
+			if (Sched_dispatch_forced < 0) {
+				fprintf(stderr, "--dispatch %s: expected rma or coordinator\n", argv[a + 1]);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* --schedule's kind, else $SUM_SCHEDULE, else static */
+static inline enum sched_kind Sched_kind(void) {
+	static int from_env = -2;
+
+	if (Sched_kind_forced >= 0)
+		return (enum sched_kind)Sched_kind_forced;
+	if (from_env == -2) {
+		const char* name = getenv("SUM_SCHEDULE");
+		from_env = Sched_parse(name, Sched_kind_names, SCHED_NOF_KINDS);
+		if (name != NULL && from_env < 0)
+			fprintf(stderr, "SUM_SCHEDULE=%s is not static, guided or trapezoid, using static\n", name);
+	}
+	return from_env >= 0 ? (enum sched_kind)from_env : SCHED_STATIC;
+}
+
+/* --dispatch's way, else $SUM_DISPATCH, else rma */
+static inline enum sched_dispatch Sched_dispatch(void) {
+	static int from_env = -2;
+
+	if (Sched_dispatch_forced >= 0)
+		return (enum sched_dispatch)Sched_dispatch_forced;
+	if (from_env == -2) {
+		const char* name = getenv("SUM_DISPATCH");
+		from_env = Sched_parse(name, Sched_dispatch_names, SCHED_NOF_DISPATCHES);
+		if (name != NULL && from_env < 0)
+			fprintf(stderr, "SUM_DISPATCH=%s is not rma or coordinator, using rma\n", name);
+	}
+	return from_env >= 0 ? (enum sched_dispatch)from_env : SCHED_RMA;
+}
+
+/* "guided/rma": the schedule Sched_run uses */
+static inline const char* Sched_name(void) {
+	static char name[32];
+
+	if (Sched_kind() == SCHED_STATIC)
+		return Sched_kind_names[SCHED_STATIC];
+	snprintf(name, sizeof(name), "%s/%s", Sched_kind_names[Sched_kind()], Sched_dispatch_names[Sched_dispatch()]);
+	return name;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Sched_chunks
+ * Purpose:		Cut [lower, upper) into the chunks of kind for procs
+ * 				ranks: chunk k is [bounds[k], bounds[k + 1])
+ * Return:		the number of chunks; bounds is malloc'ed
+ */
+static inline int64_t Sched_chunks(int64_t lower, int64_t upper, int procs, enum sched_kind kind,
+		int64_t** bounds) {
+	int64_t n = upper - lower, first = n / (2 * procs), min = SCHED_MIN_CHUNK, max, count = 0, at = lower;
+	double size, delta = 0;
+
+	if (first < min)
+		first = min;
+	if (kind == SCHED_TRAPEZOID) {
+		/* about 2n / (first + min) chunks, falling by delta each */
+		max = 2 * n / (first + min) + 2;
+		delta = max > 2 ? (double)(first - min) / (max - 2) : 0;
+	} else {
+		/* each chunk leaves (1 - 1/2p) of the rest: about 2p ln(n / 2p min) chunks */
+		max = 64;
+		for (double rest = n; rest > min; rest -= rest / (2 * procs))
+			max++;
+	}
+	*bounds = malloc((max + 1) * sizeof(int64_t));
+
+	size = first;
+	(*bounds)[count++] = at;
+	while (at < upper) {
+		int64_t chunk = kind == SCHED_TRAPEZOID ? (int64_t)size : (upper - at) / (2 * procs);
+
+		if (chunk < min)
+			chunk = min;
+		if (chunk > upper - at || count == max)
+			chunk = upper - at;
+		at += chunk;
+		(*bounds)[count++] = at;
+		size -= delta;
+	}
+	return count - 1;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Sched_next_rma
+ * Purpose:		The next chunk index, from the counter in win
+ */
+static inline int64_t Sched_next_rma(MPI_Win win) {
+	int64_t one = 1, index;
+
+	MPI_Fetch_and_op(&one, &index, MPI_INT64_T, 0, 0, MPI_SUM, win);
+	MPI_Win_flush(0, win);
+	return index;
+}
+
+/* Rank 0 with the coordinator: answer the pending requests, or wait for one */
+static inline void Sched_serve(int64_t* next, int64_t nof_chunks, int* finished, MPI_Comm comm, int block) {
+	int pending = 1;
+	int64_t index;
+	MPI_Status status;
+
+	for (;;) {
+		if (!block)
+			MPI_Iprobe(MPI_ANY_SOURCE, SCHED_TAG_REQUEST, comm, &pending, &status);
+		if (!pending)
+			return;
+		MPI_Recv(NULL, 0, MPI_BYTE, MPI_ANY_SOURCE, SCHED_TAG_REQUEST, comm, &status);
+		index = *next < nof_chunks ? (*next)++ : -1;
+		MPI_Send(&index, 1, MPI_INT64_T, status.MPI_SOURCE, SCHED_TAG_CHUNK, comm);
+		if (index < 0)
+			(*finished)++;
+		if (block)
+			return;
+	}
+}
+
+/*------------------------------------------------------------------
+ * Function:	Sched_run
+ * Purpose:		Do [lower, upper) over all ranks of comm with the
+ * 				schedule picked by Sched_select: work is called for
+ * 				each chunk this rank takes
+ * Output args:	stats:	what this rank did (idle from Sched_report)
+ * Note:		Collective.  With the coordinator, rank 0 works on its
+ * 				chunks in slices of SCHED_POLL_TERMS and answers
+ * 				requests in between, so the work must be splittable.
+ */
+static inline void Sched_run(int64_t lower, int64_t upper, sched_work work, void* arg, MPI_Comm comm,
+		struct sched_stats* stats) {
+	enum sched_kind kind = Sched_kind();
+	enum sched_dispatch dispatch = Sched_dispatch();
+	int my_rank, comm_sz, finished = 0;
+	int64_t* bounds, nof_chunks, index, next = 0, * counter;
+	double entry = MPI_Wtime(), start;
+	MPI_Win win = MPI_WIN_NULL;
+
+	MPI_Comm_rank(comm, &my_rank);
+	MPI_Comm_size(comm, &comm_sz);
+	memset(stats, 0, sizeof(*stats));
+
+	if (kind == SCHED_STATIC || comm_sz == 1) {
+		int64_t first, last;
+
+		Sum_split(lower, upper, my_rank, comm_sz, &first, &last);
+		start = MPI_Wtime();
+		if (first < last)
+			work(first, last, arg);
+		stats->busy = MPI_Wtime() - start;
+		stats->terms = last - first;
+		stats->chunks = 1;
+		stats->done = MPI_Wtime() - entry;
+		return;
+	}
+
+	nof_chunks = Sched_chunks(lower, upper, comm_sz, kind, &bounds);
+	if (dispatch == SCHED_RMA) {
+		MPI_Win_allocate(my_rank == 0 ? sizeof(int64_t) : 0, sizeof(int64_t), MPI_INFO_NULL, comm,
+				&counter, &win);
+		if (my_rank == 0)
+			*counter = 0;
+		MPI_Barrier(comm);
+		MPI_Win_lock_all(0, win);
+	}
+
+	for (;;) {
+		start = MPI_Wtime();
+		if (dispatch == SCHED_RMA) {
+			index = Sched_next_rma(win);
+		} else if (my_rank == 0) {
+			Sched_serve(&next, nof_chunks, &finished, comm, 0);
+			index = next < nof_chunks ? next++ : -1;
+		} else {
+			MPI_Send(NULL, 0, MPI_BYTE, 0, SCHED_TAG_REQUEST, comm);
+			MPI_Recv(&index, 1, MPI_INT64_T, 0, SCHED_TAG_CHUNK, comm, MPI_STATUS_IGNORE);
+		}
+		stats->wait += MPI_Wtime() - start;
+		if (index < 0 || index >= nof_chunks)
+			break;
+
+		start = MPI_Wtime();
+		if (dispatch == SCHED_COORDINATOR && my_rank == 0) {
+			for (int64_t at = bounds[index]; at < bounds[index + 1]; at += SCHED_POLL_TERMS) {
+				int64_t end = bounds[index + 1] - at > SCHED_POLL_TERMS ? at + SCHED_POLL_TERMS : bounds[index + 1];
+
+				work(at, end, arg);
+				Sched_serve(&next, nof_chunks, &finished, comm, 0);
+			}
+		} else {
+			work(bounds[index], bounds[index + 1], arg);
+		}
+		stats->busy += MPI_Wtime() - start;
+		stats->terms += bounds[index + 1] - bounds[index];
+		stats->chunks++;
+	}
+	stats->done = MPI_Wtime() - entry;
+
+	/* the coordinator answers until every other rank has been told to stop */
+	if (dispatch == SCHED_COORDINATOR && my_rank == 0)
+		while (finished < comm_sz - 1)
+			Sched_serve(&next, nof_chunks, &finished, comm, 1);
+	if (dispatch == SCHED_RMA) {
+		MPI_Win_unlock_all(win);
+		MPI_Win_free(&win);
+	}
+	free(bounds);
+}
+
+/*------------------------------------------------------------------
+ * Function:	Sched_report
+ * Purpose:		Gather every rank's stats and print a row each on
+ * 				rank 0 of comm, with the idle time after its last
+ * 				chunk (until the slowest rank's) added in
+ * Note:		Collective.  out is only used on rank 0.
+ */
+static inline void Sched_report(FILE* out, const struct sched_stats* stats, MPI_Comm comm) {
+	int my_rank, comm_sz;
+	struct sched_stats* all = NULL;
+	double last = 0, idle = 0, busy = 0;
+
+	MPI_Comm_rank(comm, &my_rank);
+	MPI_Comm_size(comm, &comm_sz);
+	if (my_rank == 0)
+		all = malloc(comm_sz * sizeof(struct sched_stats));
+	MPI_Gather(stats, sizeof(struct sched_stats) / sizeof(double), MPI_DOUBLE, all,
+			sizeof(struct sched_stats) / sizeof(double), MPI_DOUBLE, 0, comm);
+	if (my_rank != 0)
+		return;
+
+	/* durations, not clock readings: the clocks of different nodes need not agree */
+	for (int r = 0; r < comm_sz; r++)
+		if (all[r].done > last)
+			last = all[r].done;
+	fprintf(out, "\nschedule: %s\n%5s %14s %8s %12s %12s %12s\n", Sched_name(), "rank", "terms", "chunks",
+			"busy (s)", "wait (s)", "idle (s)");
+	for (int r = 0; r < comm_sz; r++) {
+		all[r].idle = all[r].wait + (last - all[r].done);
+		idle += all[r].idle;
+		busy += all[r].busy;
+		fprintf(out, "%5d %14.0f %8.0f %12.4e %12.4e %12.4e\n", r, all[r].terms, all[r].chunks,
+				all[r].busy, all[r].wait, all[r].idle);
+	}
+	fprintf(out, "idle / (busy + idle): %.1f%%\n", busy + idle > 0 ? 100 * idle / (busy + idle) : 0);
+	free(all);
+}
+
+#endif
+#endif
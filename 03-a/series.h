@@ -0,0 +1,216 @@
+/* File:     series.h
+ *
+ * Purpose:  Sum any series with the machinery of the Sum_* programs.  A
+ *           series is a term function, double term(int64_t i), and an
+ *           accumulator kind; SERIES_DEFINE turns them into a leaf, the
+ *           loop over a range of i with the term inlined, and the generic
+ *           drivers run a leaf
+ *              Series_serial    on the calling thread
+ *              Series_threads   on the work-stealing pool of pool.h
+ *              Series_mpi       split over the ranks of a communicator
+ *                               (each rank on its pool), merged exactly
+ *                               on rank 0
+ *           with the decomposition, the exact merge of the partial sums
+ *           and the timing built in.
+ *
+ *           Accumulators (the third argument of SERIES_DEFINE):
+ *              plain   one double, added in index order: in one leaf
+ *                      (Series_serial) the same bits as the hand-written
+ *                      loop
+ *              kahan   Neumaier's compensated sum: error O(eps), not
+ *                      O(n eps)
+ *              exact   every term into a struct sum_acc: the sum
+ *                      rounded once, the same bits for any split
+ *           A leaf's result is added to the caller's struct sum_acc
+ *           exactly (the sum and, for kahan, the compensation).
+ *
+ * Note:     The term is a macro argument, so the compiler specializes
+ *           the loop for it as it would a hand-written one: the only
+ *           indirect call is per leaf, thousands of terms at a time.
+ *           The including file must define _GNU_SOURCE (see pool.h);
+ *           Series_mpi is only available when mpi.h is included first.
+ *
+ * Example:
+ *    static inline double Basel_term(int64_t i) {
+ *       double k = i + 1.0;
+ *       return 1.0 / (k * k);
+ *    }
+ *    SERIES_DEFINE(Basel, Basel_term, kahan)
+ *    . . .
+ *    sum = Series_threads(Basel_leaf, 0, n, &seconds);   // pi^2 / 6
+ */
+#ifndef _SERIES_H_
+#define _SERIES_H_
+
+#include <stdint.h>
+#include "instrument.h"
+#include "sum_kernels.h"
+#include "pool.h"
+
+#define SERIES_EXACT_FLUSH ((int64_t)1 << 20)	/* deposits between carry propagations */
+
+/*---------------------------------------------------------------- accumulators */
+
+struct series_plain {
+	double sum;
+};
+
+static inline void Series_plain_init(struct series_plain* a) {
+	a->sum = 0;
+}
+
+static inline __attribute__((always_inline)) void Series_plain_add(struct series_plain* a, double x) {
+	a->sum += x;
+}
+
+static inline void Series_plain_deposit(const struct series_plain* a, struct sum_acc* acc) {
+	Sum_acc_deposit(acc, a->sum);
+	Sum_acc_normalize(acc);
+}
+
+struct series_kahan {
+	double sum, compensation;
+};
+
+static inline void Series_kahan_init(struct series_kahan* a) {
+	a->sum = a->compensation = 0;
+}
+
+/* Neumaier: the low-order bits lost by each add go to the compensation */
+static inline __attribute__((always_inline)) void Series_kahan_add(struct series_kahan* a, double x) {
+	double t = a->sum + x;
+
+	if (fabs(a->sum) >= fabs(x))
+		a->compensation += (a->sum - t) + x;
+	else
+		a->compensation += (x - t) + a->sum;
+	a->sum = t;
+}
+
+static inline void Series_kahan_deposit(const struct series_kahan* a, struct sum_acc* acc) {
+	Sum_acc_deposit(acc, a->sum);
+	Sum_acc_deposit(acc, a->compensation);
+	Sum_acc_normalize(acc);
+}
+
+struct series_exact {
+	struct sum_acc acc;
+	int64_t pending;	/* deposits since the last normalization */
+};
+
+static inline void Series_exact_init(struct series_exact* a) {
+	Sum_acc_init(&a->acc);
+	a->pending = 0;
+}
+
+static inline __attribute__((always_inline)) void Series_exact_add(struct series_exact* a, double x) {
+	Sum_acc_deposit(&a->acc, x);
+	if (++a->pending == SERIES_EXACT_FLUSH) {
+		Sum_acc_normalize(&a->acc);
+		a->pending = 0;
+	}
+}
+
+static inline void Series_exact_deposit(const struct series_exact* a, struct sum_acc* acc) {
+	struct sum_acc part = a->acc;
+
+	Sum_acc_normalize(&part);
+	Sum_acc_add(acc, &part);
+}
+
+/*------------------------------------------------------------------
+ * Macro:		SERIES_DEFINE
+ * Purpose:		Define name##_leaf, a pool_leaf (see pool.h) that adds
+ * 				term(i) for first <= i < last to an accumulator of kind
+ * 				acc (plain, kahan or exact) and that to the caller's
+ * 				struct sum_acc
+ */
+#define SERIES_DEFINE(name, term, acc)											\
+	static void name##_leaf(int64_t first, int64_t last, struct sum_acc* total) {	\
+		struct series_##acc a;													\
+																				\
+		Series_##acc##_init(&a);												\
+		for (int64_t i = first; i < last; i++)									\
+			Series_##acc##_add(&a, term(i));									\
+		Series_##acc##_deposit(&a, total);										\
+	}
+
+/*---------------------------------------------------------------- drivers */
+
+/*------------------------------------------------------------------
+ * Function:	Series_serial
+ * Purpose:		Sum leaf over [lower_limit, upper_limit) on this thread
+ * Output args:	seconds:	the time it took
+ * Return:		the sum
+ */
+static inline double Series_serial(pool_leaf leaf, int64_t lower_limit, int64_t upper_limit, double* seconds) {
+	struct sum_acc acc;
+	double start = Instr_now();
+
+	Sum_acc_init(&acc);
+	Instr_begin(INSTR_COMPUTE);
+	leaf(lower_limit, upper_limit, &acc);
+	Instr_end(INSTR_COMPUTE);
+	*seconds = Instr_now() - start;
+	return Sum_acc_value(&acc);
+}
+
+/*------------------------------------------------------------------
+ * Function:	Series_threads
+ * Purpose:		Sum leaf over [lower_limit, upper_limit) on the pool's
+ * 				threads (Pool_start first; without a pool this is
+ * 				Series_serial)
+ * Output args:	seconds:	the time it took
+ * Return:		the sum
+ */
+static inline double Series_threads(pool_leaf leaf, int64_t lower_limit, int64_t upper_limit, double* seconds) {
+	struct sum_acc acc;
+	double start = Instr_now();
+
+	Sum_acc_init(&acc);
+	Instr_begin(INSTR_COMPUTE);
+	Pool_run(lower_limit, upper_limit, leaf, &acc);
+	Instr_end(INSTR_COMPUTE);
+	*seconds = Instr_now() - start;
+	return Sum_acc_value(&acc);
+}
+
+#ifdef MPI_VERSION
+/*------------------------------------------------------------------
+ * Function:	Series_mpi
+ * Purpose:		Sum leaf over [lower_limit, upper_limit) on every rank of
+ * 				comm: rank r takes part r of Sum_split, sums it on its
+ * 				pool, and the partial sums are merged exactly on rank 0
+ * Output args:	seconds:	the slowest rank's time, from a barrier to
+ * 							the end of the reduction (rank 0)
+ * Return:		the sum, on rank 0
+ * Note:		Collective over comm.
+ */
+static inline double Series_mpi(pool_leaf leaf, int64_t lower_limit, int64_t upper_limit, double* seconds,
+		MPI_Comm comm) {
+	struct sum_acc local, total;
+	int my_rank, comm_sz;
+	int64_t first, last;
+	double start, elapsed;
+
+	MPI_Comm_rank(comm, &my_rank);
+	MPI_Comm_size(comm, &comm_sz);
+	Sum_split(lower_limit, upper_limit, my_rank, comm_sz, &first, &last);
+	Sum_acc_init(&local);
+
+	MPI_Barrier(comm);
+	start = MPI_Wtime();
+	Instr_begin(INSTR_COMPUTE);
+	Pool_run(first, last, leaf, &local);
+	Instr_end(INSTR_COMPUTE);
+	Instr_begin(INSTR_REDUCE);
+	Sum_acc_reduce(&local, &total, 0, comm);
+	Instr_end(INSTR_REDUCE);
+	elapsed = MPI_Wtime() - start;
+	MPI_Reduce(&elapsed, seconds, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+
+	return my_rank == 0 ? Sum_acc_value(&total) : 0;
+}
+#endif
+
+#endif
@@ -0,0 +1,266 @@
+/* File:     server.h
+ *
+ * Purpose:  Serve many small jobs from one MPI launch.  With --serve
+ *           <socket> a program's ranks stay up; rank 0 listens on a local
+ *           UNIX socket, reads one request line per connection, and the
+ *           ranks run the job and rank 0 writes one reply line back.
+ *           mpiexec, MPI_Init and the program's setup are paid once
+ *           instead of per job.
+ *
+ *           The same binary is the client, without MPI:
+ *              ./prog --request <socket> "<request>" [--repeat R] [--cold "<command>"]
+ *           sends the request R times (default 10) and prints the reply
+ *           and the round-trip latency (min / median / max).  With
+ *           --cold it also times the command, a cold launch doing the
+ *           same job (e.g. "mpiexec -n 4 ./prog ..."), a few times, and
+ *           prints how many times slower that is.
+ *
+ *           The request "quit" stops the server.
+ *
+ * Note:     Server_client must be called before MPI_Init: it returns -1
+ *           when the program was not started as a client.  Requests and
+ *           replies are single lines of at most SERVER_LINE bytes.  A client
+ *           that sends no line within SERVER_TIMEOUT seconds, or that goes
+ *           away before its reply, is dropped: the ranks never wait on it.
+ *
+ * Example:
+ *    int status = Server_client(argc, argv);
+ *    if (status >= 0)
+ *       return status;
+ *    MPI_Init(NULL, NULL);
+ *    . . .
+ *    if (my_rank == 0)
+ *       listen_fd = Server_listen(path);
+ *    for (;;) {
+ *       if (my_rank == 0)
+ *          fd = Server_next(listen_fd, line, sizeof(line));
+ *       . . . broadcast the job, run it . . .
+ *       if (my_rank == 0)
+ *          Server_reply(fd, reply);
+ *    }
+ */
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "bench.h"
+
+#define SERVER_LINE 1024
+#define SERVER_COLD_RUNS 3
+#define SERVER_TIMEOUT 5		/* seconds a client has to send its request */
+
+/* argv's --serve <socket>, or NULL */
+static inline const char * Server_path(int argc, char * argv[]) {
+	for (int a = 1; a + 1 < argc; a++)
+		if (strcmp(argv[a], "--serve") == 0)
+			return argv[a + 1];
+	return NULL;
+}
+
+static inline int Server_address(const char * path, struct sockaddr_un * address) {
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address->sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return -1;
+	}
+	strcpy(address->sun_path, path);
+	return 0;
+}
+
+/* A listening socket at path (replacing a stale one); -1 on an error */
+static inline int Server_listen(const char * path) {
+	struct sockaddr_un address;
+	int fd;
+
+	if (Server_address(path, &address) != 0)
+		return -1;
+	unlink(path);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0
+			|| listen(fd, 16) != 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Read one line (without the newline) from fd; its length, or -1 on a timeout, an error or an empty connection */
+static inline int Server_read_line(int fd, char * line, int size) {
+	int len = 0;
+
+	while (len < size - 1) {
+		ssize_t got = read(fd, line + len, 1);
+
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0 || (got == 0 && len == 0)) {
+			line[0] = '\0';
+			return -1;
+		}
+		if (got == 0 || line[len] == '\n')
+			break;
+		len++;
+	}
+	line[len] = '\0';
+	return len;
+}
+
+/* Write len bytes to fd without raising SIGPIPE; 0, or -1 (EPIPE: the peer went away) */
+static inline int Server_send(int fd, const char * data, size_t len) {
+	size_t sent = 0;
+
+	while (sent < len) {
+		ssize_t n = send(fd, data + sent, len - sent, MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		sent += n;
+	}
+	return 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Server_next
+ * Purpose:		Wait for the next connection and read its request line,
+ * 				dropping connections that send none within SERVER_TIMEOUT
+ * 				seconds
+ * Output args:	line:	the request
+ * Return:		the connection, to pass to Server_reply
+ */
+static inline int Server_next(int listen_fd, char * line, int size) {
+	struct timeval timeout = {SERVER_TIMEOUT, 0};
+
+	for (;;) {
+		int fd = accept(listen_fd, NULL, NULL);
+
+		if (fd < 0) {
+			if (errno != EINTR)
+				perror("server: accept");
+			continue;
+		}
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		errno = 0;
+		if (Server_read_line(fd, line, size) >= 0)
+			return fd;
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			fprintf(stderr, "server: no request within %d s, client dropped\n", SERVER_TIMEOUT);
+		close(fd);
+	}
+}
+
+/* Send reply (one line) and close the connection; a client that went away is dropped */
+static inline void Server_reply(int fd, const char * reply) {
+	if (Server_send(fd, reply, strlen(reply)) != 0 || Server_send(fd, "\n", 1) != 0)
+		fprintf(stderr, "server: reply not delivered (%s), client dropped\n", strerror(errno));
+	close(fd);
+}
+
+/*------------------------------------------------------------------
+ * Function:	Server_request
+ * Purpose:		Send one request to the server at path and read its reply
+ * Output args:	reply:	the reply line
+ * Return:		0, or -1 if the server could not be reached
+ */
+static inline int Server_request(const char * path, const char * request, char * reply, int size) {
+	struct sockaddr_un address;
+	int fd;
+
+	if (Server_address(path, &address) != 0)
+		return -1;
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	if (Server_send(fd, request, strlen(request)) != 0 || Server_send(fd, "\n", 1) != 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	if (Server_read_line(fd, reply, size) < 0) {
+		fprintf(stderr, "%s: no reply\n", path);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Server_client
+ * Purpose:		Run as the client if argv has --request <socket> "<request>"
+ * 				[--repeat R] [--cold "<command>"], printing the reply and
+ * 				the latency of the warm server against the cold command
+ * Return:		-1 without --request, else the exit status
+ */
+static inline int Server_client(int argc, char * argv[]) {
+	const char * path = NULL, * request = NULL, * cold = NULL;
+	char reply[SERVER_LINE];
+	double samples[BENCH_MAX_TRIALS];
+	struct bench_stats warm, launch;
+	int repeat = 10;
+
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "--request") == 0 && a + 2 < argc) {
+			path = argv[++a];
+			request = argv[++a];
+		} else if (strcmp(argv[a], "--repeat") == 0 && a + 1 < argc) {
+			repeat = atoi(argv[++a]);
+		} else if (strcmp(argv[a], "--cold") == 0 && a + 1 < argc) {
+			cold = argv[++a];
+		}
+	}
+	if (path == NULL)
+		return -1;
+	if (repeat < 1 || repeat > BENCH_MAX_TRIALS) {
+		fprintf(stderr, "--repeat %d: expected 1..%d\n", repeat, BENCH_MAX_TRIALS);
+		return 1;
+	}
+
+	for (int r = 0; r < repeat; r++) {
+		double start = Bench_now();
+
+		if (Server_request(path, request, reply, sizeof(reply)) != 0)
+			return 1;
+		samples[r] = Bench_now() - start;
+		if (strcmp(request, "quit") == 0) {
+			repeat = r + 1;
+			break;
+		}
+	}
+	Bench_summarize(samples, repeat, 1, &warm);
+	printf("%s\n", reply);
+	printf("server: %d requests, latency min %.3e  median %.3e  max %.3e s\n", repeat, warm.min, warm.median,
+			warm.max);
+
+	if (cold != NULL) {
+		int runs = repeat < SERVER_COLD_RUNS ? repeat : SERVER_COLD_RUNS;
+
+		for (int r = 0; r < runs; r++) {
+			double start = Bench_now();
+
+			if (system(cold) != 0)
+				fprintf(stderr, "cold launch: %s failed\n", cold);
+			samples[r] = Bench_now() - start;
+		}
+		Bench_summarize(samples, runs, 1, &launch);
+		printf("cold launch: %d runs, min %.3e  median %.3e s  (%.1fx the server's median)\n", runs, launch.min,
+				launch.median, launch.median / warm.median);
+	}
+	return strncmp(reply, "error", 5) == 0;
+}
+
+#endif
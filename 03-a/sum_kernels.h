@@ -0,0 +1,876 @@
+/* File:     sum_kernels.h
+ *
+ * Purpose:  SSE2, AVX2 and AVX-512 versions of Summation_term, the sum of
+ *           (-1)^i / (2i+1) for lower_limit <= i < upper_limit, selected at
+ *           run time by dispatch.h, in three modes
+ *           (SUM_KERNEL=ordered|paired|repro or Sum_set_mode).
+ *
+ *           ordered (the default): the variants return exactly the value of
+ *           the original loop.
+ *           pow(-1.0, i) is always +1 or -1, so the sign is taken from the
+ *           parity of i instead; the 2, 4 or 8 divisions of a step are done
+ *           in one vector instruction, and the quotients are then added to
+ *           the single accumulator in the original order.  That add
+ *           chain limits every variant to about one term per add latency,
+ *           and 512-bit divides are slower than two 256-bit ones on current
+ *           Intel parts, so AVX2 is the default even on AVX-512 hosts;
+ *           KERNEL_ISA=avx512 still selects the AVX-512 variant.
+ *
+ *           paired: consecutive terms i (even) and i+1 are combined into
+ *           2 / ((2i+1)(2i+3)), so there is one reciprocal per two terms and
+ *           every addend is positive.  Four independent vector accumulators
+ *           hide the add latency, and the pairs are added from the last to
+ *           the first, smallest first, which makes the result closer to the
+ *           exact sum than the original loop's (usually correctly rounded).
+ *           AVX-512 replaces the divide with rcp14 and two Newton-Raphson
+ *           steps; on AVX2 the divide is still faster than a float rcp and
+ *           three steps.  The result is not bit-identical to the original
+ *           loop.
+ *
+ *           repro: every term is added exactly (binned, then into a
+ *           superaccumulator, struct sum_acc), so the sum is the exact sum
+ *           of the terms rounded once.  Partial sums are kept as
+ *           accumulators and merged exactly, by Sum_acc_add and, under MPI,
+ *           by Sum_acc_reduce's MPI_Op, so the result has the same bits for
+ *           any number of ranks or threads, any split and any variant.  It
+ *           runs at about the speed of the ordered kernel.
+ *
+ *           Indices are 64-bit throughout: 2i+1 stays exact in a double up to
+ *           i = 2^52, far past any run that finishes, so the same kernels
+ *           serve 10^12-10^13 term runs.  Sum_split divides [lower, upper)
+ *           among ranks or threads without overflow.
+ *
+ *           Sum_to_tolerance replaces n by a tolerance: the fewest terms
+ *           plus a closed-form tail correction, timed against brute force.
+ *
+ * Note:     Sum_kernels_benchmark times the original pow() loop and every
+ *           variant of both modes the host supports, and reports how far
+ *           each result is from the pow() loop (ulps) and from the exact sum.
+ */
+#ifndef _SUM_KERNELS_H_
+#define _SUM_KERNELS_H_
+
+#include <math.h>
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include "dispatch.h"
+#include "instrument.h"
+
+typedef double (*sum_kernel)(int64_t lower_limit, int64_t upper_limit);
+
+enum sum_mode { SUM_ORDERED, SUM_PAIRED, SUM_REPRO, SUM_NOF_MODES };
+
+static const char * const Sum_mode_names[SUM_NOF_MODES] = {"ordered", "paired", "repro"};
+
+/* The loop the kernels replace, kept as the reference */
+static double Sum_reference(int64_t lower_limit, int64_t upper_limit) {
+	double result = 0;
+
+	for (int64_t i = lower_limit; i < upper_limit; i++) {
+		result += pow(-1.0,(double)i) / ((2.0*i)+1);
+	}
+	return result;
+}
+
+/* Scalar remainder of a vector loop */
+static inline __attribute__((always_inline))
+double Sum_tail(double result, int64_t i, int64_t upper_limit) {
+	for (; i < upper_limit; i++)
+		result += ((i & 1) ? -1.0 : 1.0) / ((2.0*i)+1);
+	return result;
+}
+
+#if DISPATCH_X86
+static double Sum_sse2(int64_t lower_limit, int64_t upper_limit) {
+	double terms[2];
+	int64_t i = lower_limit;
+	__m128d denom = _mm_setr_pd(2.0*i+1, 2.0*i+3);
+	__m128d sign = (i & 1) ? _mm_setr_pd(-1.0, 1.0) : _mm_setr_pd(1.0, -1.0);
+	const __m128d step = _mm_set1_pd(4.0);
+	double result = 0;
+
+	for (; i + 2 <= upper_limit; i += 2) {
+		_mm_storeu_pd(terms, _mm_div_pd(sign, denom));
+		result += terms[0];
+		result += terms[1];
+		denom = _mm_add_pd(denom, step);
+	}
+	return Sum_tail(result, i, upper_limit);
+}
+
+__attribute__((target("avx2")))
+static double Sum_avx2(int64_t lower_limit, int64_t upper_limit) {
+	double terms[4];
+	int64_t i = lower_limit;
+	__m256d denom = _mm256_setr_pd(2.0*i+1, 2.0*i+3, 2.0*i+5, 2.0*i+7);
+	__m256d sign = (i & 1) ? _mm256_setr_pd(-1.0, 1.0, -1.0, 1.0) : _mm256_setr_pd(1.0, -1.0, 1.0, -1.0);
+	const __m256d step = _mm256_set1_pd(8.0);
+	double result = 0;
+
+	for (; i + 4 <= upper_limit; i += 4) {
+		_mm256_storeu_pd(terms, _mm256_div_pd(sign, denom));
+		for (int j = 0; j < 4; j++)
+			result += terms[j];
+		denom = _mm256_add_pd(denom, step);
+	}
+	return Sum_tail(result, i, upper_limit);
+}
+
+__attribute__((target("avx512f")))
+static double Sum_avx512(int64_t lower_limit, int64_t upper_limit) {
+	double terms[8];
+	int64_t i = lower_limit;
+	__m512d denom = _mm512_add_pd(_mm512_set1_pd(2.0*i+1), _mm512_setr_pd(0, 2, 4, 6, 8, 10, 12, 14));
+	__m512d sign = (i & 1) ? _mm512_setr_pd(-1, 1, -1, 1, -1, 1, -1, 1) : _mm512_setr_pd(1, -1, 1, -1, 1, -1, 1, -1);
+	const __m512d step = _mm512_set1_pd(16.0);
+	double result = 0;
+
+	for (; i + 8 <= upper_limit; i += 8) {
+		_mm512_storeu_pd(terms, _mm512_div_pd(sign, denom));
+		for (int j = 0; j < 8; j++)
+			result += terms[j];
+		denom = _mm512_add_pd(denom, step);
+	}
+	return Sum_tail(result, i, upper_limit);
+}
+#else
+static double Sum_sse2(int64_t lower_limit, int64_t upper_limit) {
+	return Sum_tail(0.0, lower_limit, upper_limit);
+}
+#define Sum_avx2 Sum_sse2
+#define Sum_avx512 Sum_sse2
+#endif
+
+/*---------------------------------------------------------------- paired */
+
+/*
+ * Take a leading odd term and a trailing even term off [lower, upper) so that
+ * what is left is whole (even, odd) pairs; return those edge terms' sum
+ */
+static inline __attribute__((always_inline))
+double Sum_pair_edges(int64_t* lower_limit, int64_t* upper_limit) {
+	double edges = 0;
+
+	if (*lower_limit >= *upper_limit) {
+		*upper_limit = *lower_limit;
+		return 0;
+	}
+	if (*lower_limit & 1) {
+		edges -= 1.0 / (2.0 * *lower_limit + 1);
+		(*lower_limit)++;
+	}
+	if ((*upper_limit - *lower_limit) & 1) {
+		(*upper_limit)--;
+		edges += 1.0 / (2.0 * *upper_limit + 1);
+	}
+	return edges;
+}
+
+/* Add 1/(d(d+2)) for the first `pairs` pairs, d = d0, d0+4, ..., last first */
+static inline __attribute__((always_inline))
+double Sum_pair_tail(double sum, double d0, int64_t pairs) {
+	for (int64_t k = pairs - 1; k >= 0; k--) {
+		double d = d0 + 4.0 * k;
+		sum += 1.0 / (d * (d + 2));
+	}
+	return sum;
+}
+
+#if DISPATCH_X86
+static double Sum_paired_sse2(int64_t lower_limit, int64_t upper_limit) {
+	double edges = Sum_pair_edges(&lower_limit, &upper_limit), d0 = 2.0 * lower_limit + 1, lanes[2];
+	int64_t k = (upper_limit - lower_limit) / 2;
+	const __m128d one = _mm_set1_pd(1.0), two = _mm_set1_pd(2.0), step = _mm_set1_pd(-8.0);
+	__m128d acc0 = _mm_setzero_pd(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+	__m128d d = _mm_setr_pd(d0 + 4.0 * (k - 2), d0 + 4.0 * (k - 1));
+
+	for (; k >= 8; k -= 8) {
+		__m128d d1 = _mm_add_pd(d, step), d2 = _mm_add_pd(d1, step), d3 = _mm_add_pd(d2, step);
+		acc0 = _mm_add_pd(acc0, _mm_div_pd(one, _mm_mul_pd(d, _mm_add_pd(d, two))));
+		acc1 = _mm_add_pd(acc1, _mm_div_pd(one, _mm_mul_pd(d1, _mm_add_pd(d1, two))));
+		acc2 = _mm_add_pd(acc2, _mm_div_pd(one, _mm_mul_pd(d2, _mm_add_pd(d2, two))));
+		acc3 = _mm_add_pd(acc3, _mm_div_pd(one, _mm_mul_pd(d3, _mm_add_pd(d3, two))));
+		d = _mm_add_pd(d3, step);
+	}
+	_mm_storeu_pd(lanes, _mm_add_pd(_mm_add_pd(acc0, acc1), _mm_add_pd(acc2, acc3)));
+	return 2 * Sum_pair_tail(lanes[0] + lanes[1], d0, k) + edges;
+}
+
+__attribute__((target("avx2")))
+static double Sum_paired_avx2(int64_t lower_limit, int64_t upper_limit) {
+	double edges = Sum_pair_edges(&lower_limit, &upper_limit), d0 = 2.0 * lower_limit + 1, lanes[4];
+	int64_t k = (upper_limit - lower_limit) / 2;
+	const __m256d one = _mm256_set1_pd(1.0), two = _mm256_set1_pd(2.0), step = _mm256_set1_pd(-16.0);
+	__m256d acc0 = _mm256_setzero_pd(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+	__m256d d = _mm256_add_pd(_mm256_set1_pd(d0 + 4.0 * (k - 4)), _mm256_setr_pd(0, 4, 8, 12));
+
+	for (; k >= 16; k -= 16) {
+		__m256d d1 = _mm256_add_pd(d, step), d2 = _mm256_add_pd(d1, step), d3 = _mm256_add_pd(d2, step);
+		acc0 = _mm256_add_pd(acc0, _mm256_div_pd(one, _mm256_mul_pd(d, _mm256_add_pd(d, two))));
+		acc1 = _mm256_add_pd(acc1, _mm256_div_pd(one, _mm256_mul_pd(d1, _mm256_add_pd(d1, two))));
+		acc2 = _mm256_add_pd(acc2, _mm256_div_pd(one, _mm256_mul_pd(d2, _mm256_add_pd(d2, two))));
+		acc3 = _mm256_add_pd(acc3, _mm256_div_pd(one, _mm256_mul_pd(d3, _mm256_add_pd(d3, two))));
+		d = _mm256_add_pd(d3, step);
+	}
+	_mm256_storeu_pd(lanes, _mm256_add_pd(_mm256_add_pd(acc0, acc1), _mm256_add_pd(acc2, acc3)));
+	return 2 * Sum_pair_tail((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]), d0, k) + edges;
+}
+
+/* 1/p from rcp14 (14 bits) and two Newton-Raphson steps (28, then 53 bits) */
+__attribute__((target("avx512f")))
+static inline __m512d Sum_reciprocal_avx512(__m512d p) {
+	const __m512d one = _mm512_set1_pd(1.0);
+	__m512d r = _mm512_rcp14_pd(p);
+
+	r = _mm512_fmadd_pd(r, _mm512_fnmadd_pd(p, r, one), r);
+	return _mm512_fmadd_pd(r, _mm512_fnmadd_pd(p, r, one), r);
+}
+
+__attribute__((target("avx512f")))
+static double Sum_paired_avx512(int64_t lower_limit, int64_t upper_limit) {
+	double edges = Sum_pair_edges(&lower_limit, &upper_limit), d0 = 2.0 * lower_limit + 1;
+	int64_t k = (upper_limit - lower_limit) / 2;
+	const __m512d two = _mm512_set1_pd(2.0), step = _mm512_set1_pd(-32.0);
+	__m512d acc0 = _mm512_setzero_pd(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+	__m512d d = _mm512_add_pd(_mm512_set1_pd(d0 + 4.0 * (k - 8)), _mm512_setr_pd(0, 4, 8, 12, 16, 20, 24, 28));
+
+	for (; k >= 32; k -= 32) {
+		__m512d d1 = _mm512_add_pd(d, step), d2 = _mm512_add_pd(d1, step), d3 = _mm512_add_pd(d2, step);
+		acc0 = _mm512_add_pd(acc0, Sum_reciprocal_avx512(_mm512_mul_pd(d, _mm512_add_pd(d, two))));
+		acc1 = _mm512_add_pd(acc1, Sum_reciprocal_avx512(_mm512_mul_pd(d1, _mm512_add_pd(d1, two))));
+		acc2 = _mm512_add_pd(acc2, Sum_reciprocal_avx512(_mm512_mul_pd(d2, _mm512_add_pd(d2, two))));
+		acc3 = _mm512_add_pd(acc3, Sum_reciprocal_avx512(_mm512_mul_pd(d3, _mm512_add_pd(d3, two))));
+		d = _mm512_add_pd(d3, step);
+	}
+	acc0 = _mm512_add_pd(_mm512_add_pd(acc0, acc1), _mm512_add_pd(acc2, acc3));
+	return 2 * Sum_pair_tail(_mm512_reduce_add_pd(acc0), d0, k) + edges;
+}
+#else
+static double Sum_paired_sse2(int64_t lower_limit, int64_t upper_limit) {
+	double edges = Sum_pair_edges(&lower_limit, &upper_limit);
+	return 2 * Sum_pair_tail(0.0, 2.0 * lower_limit + 1, (upper_limit - lower_limit) / 2) + edges;
+}
+#define Sum_paired_avx2 Sum_paired_sse2
+#define Sum_paired_avx512 Sum_paired_sse2
+#endif
+
+/*---------------------------------------------------------------- repro */
+
+/*
+ * Superaccumulator: a fixed-point number covering every double, bit 0 =
+ * 2^-1074, held as 32-bit digits in 64-bit words so that deposits can add
+ * to a digit many times before the carries have to be propagated.  Adding
+ * doubles to it is exact, so the total does not depend on the order of the
+ * additions or on how the terms were split among ranks and threads.
+ */
+#define SUM_ACC_CHUNKS 67
+
+struct sum_acc {
+	int64_t chunk[SUM_ACC_CHUNKS];
+};
+
+static inline void Sum_acc_init(struct sum_acc* acc) {
+	memset(acc, 0, sizeof(*acc));
+}
+
+/* Add x exactly (x finite) */
+static inline void Sum_acc_deposit(struct sum_acc* acc, double x) {
+	uint64_t bits, mantissa;
+	int exponent;
+	unsigned __int128 value;
+
+	memcpy(&bits, &x, sizeof(bits));
+	exponent = (int)((bits >> 52) & 0x7ff);
+	mantissa = bits & ((1ULL << 52) - 1);
+	if (exponent == 0 && mantissa == 0)
+		return;
+	if (exponent != 0)
+		mantissa |= 1ULL << 52;
+	else
+		exponent = 1;
+
+	/* x = mantissa * 2^(exponent - 1075): bit exponent - 1 of the accumulator */
+	value = (unsigned __int128)mantissa << ((exponent - 1) & 31);
+	int64_t* chunk = &acc->chunk[(exponent - 1) >> 5];
+	if (bits >> 63) {
+		chunk[0] -= (int64_t)(uint32_t)value;
+		chunk[1] -= (int64_t)(uint32_t)(value >> 32);
+		chunk[2] -= (int64_t)(value >> 64);
+	} else {
+		chunk[0] += (int64_t)(uint32_t)value;
+		chunk[1] += (int64_t)(uint32_t)(value >> 32);
+		chunk[2] += (int64_t)(value >> 64);
+	}
+}
+
+/* Propagate carries: every digit but the top one ends in [0, 2^32) */
+static inline void Sum_acc_normalize(struct sum_acc* acc) {
+	for (int c = 0; c < SUM_ACC_CHUNKS - 1; c++) {
+		int64_t low = acc->chunk[c] & 0xffffffff;
+		acc->chunk[c + 1] += (acc->chunk[c] - low) / ((int64_t)1 << 32);
+		acc->chunk[c] = low;
+	}
+}
+
+/* acc += other (both normalized) */
+static inline void Sum_acc_add(struct sum_acc* acc, const struct sum_acc* other) {
+	for (int c = 0; c < SUM_ACC_CHUNKS; c++)
+		acc->chunk[c] += other->chunk[c];
+	Sum_acc_normalize(acc);
+}
+
+/* The accumulator rounded to the nearest double */
+static inline double Sum_acc_value(const struct sum_acc* acc) {
+	struct sum_acc a = *acc;
+	unsigned __int128 top = 0;
+	double sign = 1;
+	int h;
+
+	Sum_acc_normalize(&a);
+	if (a.chunk[SUM_ACC_CHUNKS - 1] < 0) {
+		for (int c = 0; c < SUM_ACC_CHUNKS; c++)
+			a.chunk[c] = -a.chunk[c];
+		Sum_acc_normalize(&a);
+		sign = -1;
+	}
+	for (h = SUM_ACC_CHUNKS - 1; h >= 0 && a.chunk[h] == 0; h--)
+		;
+	if (h < 0)
+		return 0;
+
+	/* the top three digits, and a sticky bit for the rest: 65+ bits, rounded once */
+	for (int c = h; c > h - 3; c--)
+		top = (top << 32) | (uint64_t)(c >= 0 ? a.chunk[c] : 0);
+	for (int c = h - 3; c >= 0; c--)
+		top |= a.chunk[c] != 0;
+	return sign * ldexp((double)top, 32 * (h - 2) - 1074);
+}
+
+/*
+ * The repro kernels split every term x = (-1)^i / (2i+1), |x| <= 1, into
+ * q0 + q1 + q2, q0 a multiple of 2^-41, q1 of 2^-83 and q2 of 2^-125
+ * ((x + M) - M rounds x to a multiple of the ulp of M), and add each part to
+ * its own bin.  2048 parts of a bin sum exactly, so a bin only needs to go
+ * to the superaccumulator every SUM_BIN_FLUSH terms per lane.  Terms with
+ * 2i+1 < 2^53 end above 2^-125, so the sum of the bins is the exact sum of
+ * the terms and Sum_acc_value rounds it once.  The terms are divisions, as
+ * in the ordered kernels, so every variant gives the same bits.
+ */
+#define SUM_BIN_FLUSH 2048
+#define SUM_BIN_M0 0x1.8p11
+#define SUM_BIN_M1 0x1.8p-31
+#define SUM_BIN_M2 0x1.8p-73
+
+typedef void (*sum_acc_kernel)(int64_t lower_limit, int64_t upper_limit, struct sum_acc* acc);
+
+/* Scalar repro kernel, for the remainder of the vector loops */
+static inline void Sum_repro_tail(int64_t lower_limit, int64_t upper_limit, struct sum_acc* acc) {
+	for (int64_t i = lower_limit; i < upper_limit; ) {
+		double s0 = 0, s1 = 0, s2 = 0;
+
+		for (int k = 0; k < SUM_BIN_FLUSH && i < upper_limit; k++, i++) {
+			double x = ((i & 1) ? -1.0 : 1.0) / ((2.0*i)+1), q;
+			q = (x + SUM_BIN_M0) - SUM_BIN_M0; s0 += q; x -= q;
+			q = (x + SUM_BIN_M1) - SUM_BIN_M1; s1 += q; x -= q;
+			q = (x + SUM_BIN_M2) - SUM_BIN_M2; s2 += q;
+		}
+		Sum_acc_deposit(acc, s0);
+		Sum_acc_deposit(acc, s1);
+		Sum_acc_deposit(acc, s2);
+	}
+	Sum_acc_normalize(acc);
+}
+
+#if DISPATCH_X86
+static void Sum_repro_sse2(int64_t lower_limit, int64_t upper_limit, struct sum_acc* acc) {
+	int64_t i = lower_limit;
+	__m128d denom = _mm_setr_pd(2.0*i+1, 2.0*i+3);
+	const __m128d sign = (i & 1) ? _mm_setr_pd(-1.0, 1.0) : _mm_setr_pd(1.0, -1.0), step = _mm_set1_pd(4.0);
+	const __m128d m0 = _mm_set1_pd(SUM_BIN_M0), m1 = _mm_set1_pd(SUM_BIN_M1), m2 = _mm_set1_pd(SUM_BIN_M2);
+	double bins[3][2];
+
+	while (i + 2 <= upper_limit) {
+		__m128d s0 = _mm_setzero_pd(), s1 = s0, s2 = s0;
+
+		for (int k = 0; k < SUM_BIN_FLUSH && i + 2 <= upper_limit; k++, i += 2) {
+			__m128d x = _mm_div_pd(sign, denom), q;
+			q = _mm_sub_pd(_mm_add_pd(x, m0), m0); s0 = _mm_add_pd(s0, q); x = _mm_sub_pd(x, q);
+			q = _mm_sub_pd(_mm_add_pd(x, m1), m1); s1 = _mm_add_pd(s1, q); x = _mm_sub_pd(x, q);
+			q = _mm_sub_pd(_mm_add_pd(x, m2), m2); s2 = _mm_add_pd(s2, q);
+			denom = _mm_add_pd(denom, step);
+		}
+		_mm_storeu_pd(bins[0], s0);
+		_mm_storeu_pd(bins[1], s1);
+		_mm_storeu_pd(bins[2], s2);
+		for (int b = 0; b < 3 * 2; b++)
+			Sum_acc_deposit(acc, bins[b / 2][b % 2]);
+	}
+	Sum_repro_tail(i, upper_limit, acc);
+}
+
+__attribute__((target("avx2")))
+static void Sum_repro_avx2(int64_t lower_limit, int64_t upper_limit, struct sum_acc* acc) {
+	int64_t i = lower_limit;
+	__m256d denom = _mm256_setr_pd(2.0*i+1, 2.0*i+3, 2.0*i+5, 2.0*i+7);
+	const __m256d sign = (i & 1) ? _mm256_setr_pd(-1.0, 1.0, -1.0, 1.0) : _mm256_setr_pd(1.0, -1.0, 1.0, -1.0);
+	const __m256d step = _mm256_set1_pd(8.0);
+	const __m256d m0 = _mm256_set1_pd(SUM_BIN_M0), m1 = _mm256_set1_pd(SUM_BIN_M1), m2 = _mm256_set1_pd(SUM_BIN_M2);
+	double bins[3][4];
+
+	while (i + 4 <= upper_limit) {
+		__m256d s0 = _mm256_setzero_pd(), s1 = s0, s2 = s0;
+
+		for (int k = 0; k < SUM_BIN_FLUSH && i + 4 <= upper_limit; k++, i += 4) {
+			__m256d x = _mm256_div_pd(sign, denom), q;
+			q = _mm256_sub_pd(_mm256_add_pd(x, m0), m0); s0 = _mm256_add_pd(s0, q); x = _mm256_sub_pd(x, q);
+			q = _mm256_sub_pd(_mm256_add_pd(x, m1), m1); s1 = _mm256_add_pd(s1, q); x = _mm256_sub_pd(x, q);
+			q = _mm256_sub_pd(_mm256_add_pd(x, m2), m2); s2 = _mm256_add_pd(s2, q);
+			denom = _mm256_add_pd(denom, step);
+		}
+		_mm256_storeu_pd(bins[0], s0);
+		_mm256_storeu_pd(bins[1], s1);
+		_mm256_storeu_pd(bins[2], s2);
+		for (int b = 0; b < 3 * 4; b++)
+			Sum_acc_deposit(acc, bins[b / 4][b % 4]);
+	}
+	Sum_repro_tail(i, upper_limit, acc);
+}
+
+__attribute__((target("avx512f")))
+static void Sum_repro_avx512(int64_t lower_limit, int64_t upper_limit, struct sum_acc* acc) {
+	int64_t i = lower_limit;
+	__m512d denom = _mm512_add_pd(_mm512_set1_pd(2.0*i+1), _mm512_setr_pd(0, 2, 4, 6, 8, 10, 12, 14));
+	const __m512d sign = (i & 1) ? _mm512_setr_pd(-1, 1, -1, 1, -1, 1, -1, 1) : _mm512_setr_pd(1, -1, 1, -1, 1, -1, 1, -1);
+	const __m512d step = _mm512_set1_pd(16.0);
+	const __m512d m0 = _mm512_set1_pd(SUM_BIN_M0), m1 = _mm512_set1_pd(SUM_BIN_M1), m2 = _mm512_set1_pd(SUM_BIN_M2);
+	double bins[3][8];
+
+	while (i + 8 <= upper_limit) {
+		__m512d s0 = _mm512_setzero_pd(), s1 = s0, s2 = s0;
+
+		for (int k = 0; k < SUM_BIN_FLUSH && i + 8 <= upper_limit; k++, i += 8) {
+			__m512d x = _mm512_div_pd(sign, denom), q;
+			q = _mm512_sub_pd(_mm512_add_pd(x, m0), m0); s0 = _mm512_add_pd(s0, q); x = _mm512_sub_pd(x, q);
+			q = _mm512_sub_pd(_mm512_add_pd(x, m1), m1); s1 = _mm512_add_pd(s1, q); x = _mm512_sub_pd(x, q);
+			q = _mm512_sub_pd(_mm512_add_pd(x, m2), m2); s2 = _mm512_add_pd(s2, q);
+			denom = _mm512_add_pd(denom, step);
+		}
+		_mm512_storeu_pd(bins[0], s0);
+		_mm512_storeu_pd(bins[1], s1);
+		_mm512_storeu_pd(bins[2], s2);
+		for (int b = 0; b < 3 * 8; b++)
+			Sum_acc_deposit(acc, bins[b / 8][b % 8]);
+	}
+	Sum_repro_tail(i, upper_limit, acc);
+}
+#else
+#define Sum_repro_sse2 Sum_repro_tail
+#define Sum_repro_avx2 Sum_repro_tail
+#define Sum_repro_avx512 Sum_repro_tail
+#endif
+
+static const sum_acc_kernel Sum_repro_variants[ISA_COUNT] = {Sum_repro_sse2, Sum_repro_avx2, Sum_repro_avx512};
+
+/* The repro kernels as plain sums, for Sum_variants */
+static double Sum_repro_value_sse2(int64_t lower_limit, int64_t upper_limit) {
+	struct sum_acc acc;
+
+	Sum_acc_init(&acc);
+	Sum_repro_sse2(lower_limit, upper_limit, &acc);
+	return Sum_acc_value(&acc);
+}
+
+static double Sum_repro_value_avx2(int64_t lower_limit, int64_t upper_limit) {
+	struct sum_acc acc;
+
+	Sum_acc_init(&acc);
+	Sum_repro_avx2(lower_limit, upper_limit, &acc);
+	return Sum_acc_value(&acc);
+}
+
+static double Sum_repro_value_avx512(int64_t lower_limit, int64_t upper_limit) {
+	struct sum_acc acc;
+
+	Sum_acc_init(&acc);
+	Sum_repro_avx512(lower_limit, upper_limit, &acc);
+	return Sum_acc_value(&acc);
+}
+
+static const sum_kernel Sum_variants[SUM_NOF_MODES][ISA_COUNT] = {
+	{Sum_sse2, Sum_avx2, Sum_avx512},
+	{Sum_paired_sse2, Sum_paired_avx2, Sum_paired_avx512},
+	{Sum_repro_value_sse2, Sum_repro_value_avx2, Sum_repro_value_avx512}
+};
+
+/*---------------------------------------------------------------- splitting */
+
+/*
+ * Part `part` of `parts` of [lower_limit, upper_limit): the first n % parts
+ * parts get one term more than the others, so the counts add up to exactly
+ * n and differ by at most one; nothing is multiplied past n, so any 64-bit
+ * range and any number of parts are safe
+ */
+static inline void Sum_split(int64_t lower_limit, int64_t upper_limit, int part, int parts,
+		int64_t* first, int64_t* last) {
+	int64_t n = upper_limit > lower_limit ? upper_limit - lower_limit : 0;
+	int64_t base = n / parts, extra = n % parts;
+
+	*first = lower_limit + base * part + (part < extra ? part : extra);
+	*last = *first + base + (part < extra);
+}
+
+/*---------------------------------------------------------------- selection */
+
+static int Sum_mode_forced = -1;
+
+/* SUM_ORDERED / SUM_PAIRED for "ordered" / "paired", -1 otherwise */
+static inline int Sum_parse_mode(const char* name) {
+	for (int m = 0; name != NULL && m < SUM_NOF_MODES; m++) {
+		if (strcmp(name, Sum_mode_names[m]) == 0)
+			return m;
+	}
+	return -1;
+}
+
+/* Use mode from now on, whatever SUM_KERNEL says */
+static inline void Sum_set_mode(enum sum_mode mode) {
+	Sum_mode_forced = mode;
+}
+
+/* Apply a "--kernel ordered|paired|repro" argument; -1 if the name is unknown */
+static inline int Sum_select_mode(int argc, char* argv[]) {
+	for (int a = 1; a + 1 < argc; a++) {
+		if (strcmp(argv[a], "--kernel") == 0) {
+			int mode = Sum_parse_mode(argv[a + 1]);
+			if (mode < 0) {
+				fprintf(stderr, "--kernel %s: expected ordered, paired or repro\n", argv[a + 1]);
+				return -1;
+			}
+			Sum_set_mode((enum sum_mode)mode);
+		}
+	}
+	return 0;
+}
+
+/* The mode Sum_kernel runs: Sum_set_mode's, else $SUM_KERNEL, else ordered */
+static inline enum sum_mode Sum_mode(void) {
+	static int from_env = -2;
+
+	if (Sum_mode_forced >= 0)
+		return (enum sum_mode)Sum_mode_forced;
+	if (from_env == -2) {
+		const char* name = getenv("SUM_KERNEL");
+		from_env = Sum_parse_mode(name);
+		if (name != NULL && from_env < 0)
+			fprintf(stderr, "SUM_KERNEL=%s is not ordered, paired or repro, using ordered\n", name);
+	}
+	return from_env >= 0 ? (enum sum_mode)from_env : SUM_ORDERED;
+}
+
+/* The variant Sum_kernel runs: AVX2 at most for the divide-bound modes (see above) */
+static inline enum isa Sum_kernel_isa(void) {
+	return Sum_mode() == SUM_PAIRED ? Isa_selected() : Isa_preferred(ISA_AVX2);
+}
+
+/* Sum of (-1)^i / (2i+1) for lower_limit <= i < upper_limit */
+static inline double Sum_kernel(int64_t lower_limit, int64_t upper_limit) {
+	return Sum_variants[Sum_mode()][Sum_kernel_isa()](lower_limit, upper_limit);
+}
+
+/*
+ * Add the sum of lower_limit <= i < upper_limit to acc: exactly, term by
+ * term, in repro mode; the other modes add their rounded sum
+ */
+static inline void Sum_kernel_acc(int64_t lower_limit, int64_t upper_limit, struct sum_acc* acc) {
+	if (Sum_mode() == SUM_REPRO) {
+		Sum_repro_variants[Sum_kernel_isa()](lower_limit, upper_limit, acc);
+	} else {
+		Sum_acc_deposit(acc, Sum_kernel(lower_limit, upper_limit));
+		Sum_acc_normalize(acc);
+	}
+}
+
+#ifdef MPI_VERSION
+/* MPI_Op for struct sum_acc: exact, so any reduction order gives the same bits */
+static void Sum_acc_merge(void* in, void* inout, int* len, MPI_Datatype* type) {
+	struct sum_acc* a = in, * b = inout;
+
+	(void)type;
+	for (int k = 0; k < *len; k++)
+		Sum_acc_add(&b[k], &a[k]);
+}
+
+/* The MPI datatype of struct sum_acc and its sum, created on first use */
+static inline void Sum_acc_mpi(MPI_Datatype* type, MPI_Op* op) {
+	static MPI_Datatype acc_type = MPI_DATATYPE_NULL;
+	static MPI_Op acc_op = MPI_OP_NULL;
+
+	if (acc_type == MPI_DATATYPE_NULL) {
+		MPI_Type_contiguous(SUM_ACC_CHUNKS, MPI_INT64_T, &acc_type);
+		MPI_Type_commit(&acc_type);
+		MPI_Op_create(Sum_acc_merge, 1, &acc_op);
+	}
+	*type = acc_type;
+	*op = acc_op;
+}
+
+/* MPI_Reduce of the ranks' accumulators into total on root */
+static inline void Sum_acc_reduce(const struct sum_acc* local, struct sum_acc* total, int root, MPI_Comm comm) {
+	MPI_Datatype type;
+	MPI_Op op;
+
+	Sum_acc_mpi(&type, &op);
+	MPI_Reduce(local, total, 1, type, op, root, comm);
+}
+#endif
+
+/* "paired/avx512": the mode and variant Sum_kernel runs */
+static inline const char* Sum_kernel_name(void) {
+	static char name[32];
+
+	snprintf(name, sizeof(name), "%s/%s", Sum_mode_names[Sum_mode()], Isa_names[Sum_kernel_isa()]);
+	return name;
+}
+
+/*---------------------------------------------------------------- accuracy */
+
+/*
+ * The sum in long double with Kahan compensation, pairs last to first: the
+ * exact sum to well under a double ulp, for judging the kernels
+ */
+static inline double Sum_exact(int64_t lower_limit, int64_t upper_limit) {
+	long double edges = Sum_pair_edges(&lower_limit, &upper_limit), sum = 0, carry = 0;
+
+	for (int64_t k = (upper_limit - lower_limit) / 2 - 1; k >= 0; k--) {
+		long double d = 2.0L * lower_limit + 1 + 4.0L * k;
+		long double y = 2.0L / (d * (d + 2)) - carry, t = sum + y;
+		carry = (t - sum) - y;
+		sum = t;
+	}
+	return (double)(sum + edges);
+}
+
+/* Distance between two doubles in units in the last place */
+static inline long long Sum_ulps(double a, double b) {
+	long long x, y;
+
+	memcpy(&x, &a, sizeof(x));
+	memcpy(&y, &b, sizeof(y));
+	if (x < 0)
+		x = (long long)0x8000000000000000ULL - x;
+	if (y < 0)
+		y = (long long)0x8000000000000000ULL - y;
+	return x > y ? x - y : y - x;
+}
+
+/*---------------------------------------------------------------- tolerance */
+
+/*
+ * Accuracy-driven runs (--eps): instead of n terms, the fewest terms that
+ * give pi to within eps once the tail is added back.  For n terms
+ *
+ *     pi/4 - S_n = (-1)^n sum_k E_2k / (2 (2n)^(2k+1))
+ *
+ * (E: Euler numbers; the series is asymptotic, so only a few terms help
+ * for small n).  The first omitted term bounds the truncation error well;
+ * about sqrt(n) + 1 ulps of pi are added for rounding.  The brute-force
+ * path needs n = 1/eps terms for the same error, since 4 |pi/4 - S_n| is
+ * about 1/n.
+ */
+#define SUM_EULER_TERMS 12
+#define SUM_BRUTE_MAX_TERMS 4000000000LL	/* brute force runs beyond this are estimated */
+#define SUM_BRUTE_SAMPLE_TERMS 100000000LL	/* ... from the time of this many terms */
+
+static const double Sum_euler_numbers[SUM_EULER_TERMS] = {
+	1, -1, 5, -61, 1385, -50521, 2702765, -199360981, 19391512145.0, -2404879675441.0,
+	370371188237525.0, -69348874393137901.0
+};
+
+/* pi/4 minus the sum of the first n terms, to `order` terms of the expansion */
+static inline double Sum_tail_correction(int64_t n, int order) {
+	double x = 1.0 / (2.0 * n), tail = 0;
+
+	/* smallest first */
+	for (int k = order - 1; k >= 0; k--)
+		tail += Sum_euler_numbers[k] / 2 * pow(x, 2 * k + 1);
+	return (n & 1) ? -tail : tail;
+}
+
+/*
+ * The fewest terms n, and then the fewest corrections `order`, whose error
+ * estimate for pi is at most eps; returns the estimate, or -1 if eps is
+ * below what a double can deliver
+ */
+static inline double Sum_tail_plan(double eps, int64_t* n, int* order) {
+	for (int64_t m = 1; m <= (1 << 20); m++) {
+		double x = 1.0 / (2.0 * m), rounding = (sqrt((double) m) + 1) * DBL_EPSILON * M_PI;
+
+		for (int k = 1; k < SUM_EULER_TERMS; k++) {
+			double truncation = 2 * fabs(Sum_euler_numbers[k]) * pow(x, 2 * k + 1);
+
+			if (truncation + rounding <= eps) {
+				*n = m;
+				*order = k;
+				return truncation + rounding;
+			}
+		}
+	}
+	return -1;
+}
+
+/* Apply a "--eps <tolerance>" argument: 0 if there is none, -1 if it is not a positive number */
+static inline double Sum_select_eps(int argc, char* argv[]) {
+	for (int a = 1; a + 1 < argc; a++) {
+		if (strcmp(argv[a], "--eps") == 0) {
+			double eps = atof(argv[a + 1]);
+			if (!(eps > 0)) {
+				fprintf(stderr, "--eps %s: expected a positive tolerance\n", argv[a + 1]);
+				return -1;
+			}
+			return eps;
+		}
+	}
+	return 0;
+}
+
+/* A program's own summation of [lower_limit, upper_limit), serial or over its ranks */
+typedef double (*sum_driver)(int64_t lower_limit, int64_t upper_limit, double* seconds, void* arg);
+
+/*------------------------------------------------------------------
+ * Function:	Sum_to_tolerance
+ * Purpose:		Compute pi to within eps with the fewest terms plus the
+ * 				tail correction, then time the brute-force path to the
+ * 				same eps (1/eps terms; estimated from a sample when that
+ * 				is more than SUM_BRUTE_MAX_TERMS) and compare
+ * Input args:	eps:	the tolerance
+ * 				sum:	the program's summation, called collectively
+ * 				arg:	passed to sum
+ * 				out:	where to print (NULL on MPI ranks other than 0;
+ * 					sum's results are only used where out is set)
+ * Return:		0, or 1 if eps is out of reach of a double
+ */
+static inline int Sum_to_tolerance(double eps, sum_driver sum, void* arg, FILE* out) {
+	int64_t n, brute_n, run_n;
+	int order;
+	double estimate = Sum_tail_plan(eps, &n, &order), start, seconds, plan_seconds, pi, brute_seconds, brute_pi;
+
+	if (estimate < 0) {
+		if (out != NULL)
+			fprintf(out, "--eps %g is below what double precision can deliver (about %.0e)\n", eps,
+					4 * DBL_EPSILON * M_PI);
+		return 1;
+	}
+	/* eps is in reach now, so 1 / eps fits an int64_t; clamped all the same */
+	brute_n = 1 / eps < 9e18 ? (int64_t)ceil(1 / eps) : INT64_MAX;
+
+	/* first calls (kernel choice, counters, lazy binding) are setup, not the method's cost */
+	sum(0, 1, &seconds, arg);
+	start = Instr_now();
+	Sum_tail_plan(eps, &n, &order);
+	plan_seconds = Instr_now() - start;
+	pi = sum(0, n, &seconds, arg);
+	start = Instr_now();
+	pi = 4 * (pi + Sum_tail_correction(n, order));
+	seconds += plan_seconds + (Instr_now() - start);
+
+	run_n = brute_n <= SUM_BRUTE_MAX_TERMS ? brute_n : SUM_BRUTE_SAMPLE_TERMS;
+	brute_pi = 4 * sum(0, run_n, &brute_seconds, arg);
+	brute_seconds *= (double) brute_n / run_n;
+
+	if (out != NULL) {
+		fprintf(out, "tolerance %g: %" PRId64 " terms + %d tail corrections\n", eps, n, order);
+		fprintf(out, "%.17g\n", pi);
+		fprintf(out, "error estimate %.3e, error vs M_PI %.3e\n", estimate, fabs(pi - M_PI));
+		fprintf(out, "time to tolerance: %.3e s\n", seconds);
+		if (run_n == brute_n)
+			fprintf(out, "brute force: %" PRId64 " terms, %.3e s, error vs M_PI %.3e (speedup %.3g)\n",
+					brute_n, brute_seconds, fabs(brute_pi - M_PI), brute_seconds / seconds);
+		else
+			fprintf(out, "brute force: %" PRId64 " terms, %.3e s estimated from %" PRId64 " terms "
+					"(speedup %.3g)\n", brute_n, brute_seconds, run_n, brute_seconds / seconds);
+	}
+	return 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Sum_kernels_benchmark
+ * Purpose:		Time the reference loop and every supported variant of
+ * 				both modes on n terms, and print terms/sec, the speedup
+ * 				and each result's distance from the pow() loop (ulps)
+ * 				and from the exact sum
+ * Input args:	n:	number of terms
+ * Return:		0 if every ordered variant matches the reference bit for
+ * 				bit, no other variant is further from the exact sum than
+ * 				the reference, and every repro variant gives the same
+ * 				bits when the terms are split into uneven parts
+ */
+static inline int Sum_kernels_benchmark(int64_t n) {
+	double start, finish, reference, reference_time, exact = Sum_exact(0, n), reference_error;
+	int status = 0;
+
+	start = Instr_now();
+	reference = Sum_reference(0, n);
+	finish = Instr_now();
+	reference_time = finish - start;
+	reference_error = fabs(reference - exact);
+
+	printf("summation benchmark: %" PRId64 " terms, selected kernel %s\n", n, Sum_kernel_name());
+	printf("%-16s %14s %8s %10s %12s  %s\n", "kernel", "Mterms/s", "speedup", "ulps/pow", "|error|", "check");
+	printf("%-16s %14.1f %8.2f %10d %12.3e  %.17g\n", "pow() loop", n / reference_time / 1e6, 1.0, 0,
+			reference_error, 4 * reference);
+
+	for (int m = 0; m < SUM_NOF_MODES; m++) {
+		for (int v = 0; v < ISA_COUNT; v++) {
+			char name[32];
+			double result, error;
+			int ok;
+
+			snprintf(name, sizeof(name), "%s/%s", Sum_mode_names[m], Isa_names[v]);
+			if (!Isa_supported((enum isa)v)) {
+				printf("%-16s %14s %8s %10s %12s  not supported by this cpu\n", name, "-", "-", "-", "-");
+				continue;
+			}
+			start = Instr_now();
+			result = Sum_variants[m][v](0, n);
+			finish = Instr_now();
+			error = fabs(result - exact);
+
+			if (m == SUM_ORDERED)
+				ok = memcmp(&result, &reference, sizeof(double)) == 0;
+			else
+				ok = error <= reference_error || Sum_ulps(result, exact) <= 1;
+			if (m == SUM_REPRO) {
+				/* the same bits from 14 uneven parts, merged in reverse */
+				struct sum_acc total, part;
+				int64_t first, last, middle;
+				double merged;
+
+				Sum_acc_init(&total);
+				for (int p = 6; p >= 0; p--) {
+					Sum_split(0, n, p, 7, &first, &last);
+					middle = first + (last - first) / 3 + p;
+					if (middle > last)
+						middle = last;
+					Sum_acc_init(&part);
+					Sum_repro_variants[v](middle, last, &part);
+					Sum_repro_variants[v](first, middle, &part);
+					Sum_acc_add(&total, &part);
+				}
+				merged = Sum_acc_value(&total);
+				ok = ok && memcmp(&merged, &result, sizeof(double)) == 0;
+			}
+			status |= !ok;
+			printf("%-16s %14.1f %8.2f %10lld %12.3e  %s\n", name, n / (finish - start) / 1e6,
+					reference_time / (finish - start), Sum_ulps(result, reference), error,
+					ok ? (m == SUM_ORDERED ? "bit-identical" : (m == SUM_REPRO ? "split-identical" : "ok"))
+							: "MISMATCH");
+		}
+	}
+	return status;
+}
+
+#endif
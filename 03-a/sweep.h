@@ -0,0 +1,243 @@
+/* File:     sweep.h
+ *
+ * Purpose:  Parameter sweeps for the summation programs: instead of
+ *           reading one n from stdin, a program runs a list of
+ *           configurations in one launch and prints one row per
+ *           configuration, so small runs are not swamped by mpiexec and
+ *           MPI_Init startup.
+ *
+ *           The configurations come from argv,
+ *              --n 1000,1e6:1e9:x10 --repeat 5
+ *           (a list of n, lo:hi:xk a geometric range, lo:hi:+k or lo:hi:k
+ *           an arithmetic one), and/or from a job file, --jobs <file>,
+ *           with one line per group of configurations:
+ *              # n            repeat   kernel
+ *              1e6:1e9:x10    5        paired
+ *              100000007      3
+ *           (repeat and kernel are optional; '#' starts a comment).
+ *           --format text|csv|json picks the row format (see bench.h).
+ *
+ * Note:     The MPI programs read the configurations on process 0 and
+ *           send them in one message of a derived datatype (Build_mpi_type),
+ *           so the job file only has to exist there.
+ */
+#ifndef _SWEEP_H_
+#define _SWEEP_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+#include "bench.h"
+#include "sum_kernels.h"
+
+#define SWEEP_MAX_CONFIGS 4096
+#define SWEEP_MAX_REPEAT 1000	/* at most BENCH_MAX_TRIALS */
+
+/* One configuration: sum [lower_limit, upper_limit) repeat times */
+struct sum_config {
+	int64_t lower_limit, upper_limit;
+	int64_t repeat;
+	int64_t mode;		/* enum sum_mode, or -1 for the program's kernel */
+};
+
+/* A count like 1000000 or 1e6; -1 if it is not a whole number >= 0 */
+static inline int64_t Sweep_count(const char* text, char** end) {
+	double value = strtod(text, end);
+
+	if (*end == text || value < 0 || value > 9e18 || value != floor(value))
+		return -1;
+	return (int64_t)value;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Sweep_parse_list
+ * Purpose:		Expand "1000,1e6:1e9:x10,5:20:+5" into values
+ * Return:		the number of values, or -1 for a malformed list or
+ * 				more than max values
+ */
+static inline int Sweep_parse_list(const char* list, int64_t* values, int max) {
+	int n = 0;
+	char* end;
+
+	while (*list != '\0') {
+		int64_t lo = Sweep_count(list, &end), hi = lo, step = 1;
+		int geometric = 0;
+
+		if (lo < 0)
+			return -1;
+		if (*end == ':') {
+			hi = Sweep_count(end + 1, &end);
+			if (hi < lo || *end != ':')
+				return -1;
+			list = end + 1;
+			geometric = (*list == 'x');
+			if (*list == 'x' || *list == '+')
+				list++;
+			step = Sweep_count(list, &end);
+			if (step < (geometric ? 2 : 1))
+				return -1;
+		}
+		for (int64_t v = lo; v <= hi; v = geometric ? v * step : v + step) {
+			if (n == max || (geometric && v == 0))
+				return -1;
+			values[n++] = v;
+			if (hi - v < (geometric ? v * (step - 1) : step))
+				break;	/* the next value would pass hi (or overflow) */
+		}
+		if (*end != ',' && *end != '\0')
+			return -1;
+		list = (*end == ',') ? end + 1 : end;
+	}
+	return n;
+}
+
+/* Append [0, n) for each n of list; the new count, or -1 */
+static inline int Sweep_add(struct sum_config* configs, int nof_configs, int max, const char* list,
+		int64_t repeat, int64_t mode) {
+	int64_t values[SWEEP_MAX_CONFIGS];
+	int count = Sweep_parse_list(list, values, SWEEP_MAX_CONFIGS);
+
+	if (count < 0 || nof_configs + count > max || repeat < 1 || repeat > SWEEP_MAX_REPEAT)
+		return -1;
+	for (int k = 0; k < count; k++) {
+		struct sum_config* c = &configs[nof_configs++];
+		c->lower_limit = 0;
+		c->upper_limit = values[k];
+		c->repeat = repeat;
+		c->mode = mode;
+	}
+	return nof_configs;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Sweep_read_jobs
+ * Purpose:		Append the configurations of a job file
+ * Return:		the new count, or -1 (with a message) on an error
+ */
+static inline int Sweep_read_jobs(const char* path, struct sum_config* configs, int nof_configs, int max) {
+	char line[512], list[256], repeat[32], kernel[32];
+	FILE* in = fopen(path, "r");
+	int line_no = 0;
+
+	if (in == NULL) {
+		perror(path);
+		return -1;
+	}
+	while (nof_configs >= 0 && fgets(line, sizeof(line), in) != NULL) {
+		char* comment = strchr(line, '#');
+		int fields, mode = -1;
+
+		line_no++;
+		if (comment != NULL)
+			*comment = '\0';
+		fields = sscanf(line, "%255s %31s %31s", list, repeat, kernel);
+		if (fields <= 0)
+			continue;
+		if (fields == 3 && (mode = Sum_parse_mode(kernel)) < 0) {
+			fprintf(stderr, "%s:%d: kernel %s: expected ordered, paired or repro\n", path, line_no, kernel);
+			nof_configs = -1;
+			break;
+		}
+		nof_configs = Sweep_add(configs, nof_configs, max, list, fields >= 2 ? atoll(repeat) : 1, mode);
+		if (nof_configs < 0)
+			fprintf(stderr, "%s:%d: expected <n list> [repeat 1..%d] [kernel]\n", path, line_no,
+					SWEEP_MAX_REPEAT);
+	}
+	fclose(in);
+	return nof_configs;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Sweep_configs
+ * Purpose:		The configurations given by --n / --repeat and --jobs
+ * Output args:	format:	from --format
+ * Return:		the number of configurations, 0 if neither --n nor
+ * 				--jobs was given (read n interactively), -1 on an error
+ */
+static inline int Sweep_configs(int argc, char* argv[], struct sum_config* configs, int max,
+		enum bench_format* format) {
+	int64_t repeat = 1;
+	int nof_configs = 0;
+
+	*format = BENCH_TEXT;
+	for (int a = 1; a + 1 < argc; a++) {
+		if (strcmp(argv[a], "--repeat") == 0)
+			repeat = atoll(argv[a + 1]);
+		else if (strcmp(argv[a], "--format") == 0)
+			*format = Bench_parse_format(argv[a + 1]);
+	}
+	for (int a = 1; a + 1 < argc && nof_configs >= 0; a++) {
+		if (strcmp(argv[a], "--n") == 0) {
+			nof_configs = Sweep_add(configs, nof_configs, max, argv[a + 1], repeat, -1);
+			if (nof_configs < 0)
+				fprintf(stderr, "--n %s --repeat %" PRId64 ": expected a list of n, lo:hi:xk or lo:hi:+k, "
+						"and 1..%d repeats\n", argv[a + 1], repeat, SWEEP_MAX_REPEAT);
+		} else if (strcmp(argv[a], "--jobs") == 0) {
+			nof_configs = Sweep_read_jobs(argv[a + 1], configs, nof_configs, max);
+		}
+	}
+	return nof_configs;
+}
+
+/*---------------------------------------------------------------- rows */
+
+static inline void Sweep_begin(struct bench_report* report, FILE* out, enum bench_format format) {
+	report->out = out;
+	report->format = format;
+	report->records = 0;
+
+	if (format == BENCH_CSV)
+		fprintf(out, "n,first,repeat,procs,kernel,reduce,min_s,median_s,max_s,terms_per_s,pi,error\n");
+	else if (format == BENCH_JSON)
+		fprintf(out, "[");
+	else
+		fprintf(out, "%12s %6s %5s %-14s %-9s %12s %12s %12s %20s %10s\n", "n", "repeat", "procs",
+				"kernel", "reduce", "min (s)", "median (s)", "terms/s", "pi", "error");
+}
+
+/*------------------------------------------------------------------
+ * Function:	Sweep_row
+ * Purpose:		Print the row of one configuration
+ * Input args:	config:		the configuration
+ * 				procs:		processes that ran it
+ * 				kernel:		Sum_kernel_name()
+ * 				reduce:		the reduction strategy, or "-"
+ * 				seconds:	the time of each repetition (sorted in place)
+ * 				sum:		the sum of the last repetition, times 4
+ */
+static inline void Sweep_row(struct bench_report* report, const struct sum_config* config, int procs,
+		const char* kernel, const char* reduce, double* seconds, double sum) {
+	struct bench_stats stats;
+	int64_t terms = config->upper_limit - config->lower_limit;
+	double rate, error = fabs(sum - M_PI);
+
+	Bench_summarize(seconds, (int)config->repeat, 1, &stats);
+	rate = stats.median > 0 ? terms / stats.median : 0;
+
+	if (report->format == BENCH_CSV) {
+		fprintf(report->out, "%" PRId64 ",%" PRId64 ",%" PRId64 ",%d,%s,%s,%.9e,%.9e,%.9e,%.6e,%.17g,%.3e\n",
+				config->upper_limit, config->lower_limit, config->repeat, procs, kernel, reduce,
+				stats.min, stats.median, stats.max, rate, sum, error);
+	} else if (report->format == BENCH_JSON) {
+		fprintf(report->out, "%s\n  {\"n\": %" PRId64 ", \"first\": %" PRId64 ", \"repeat\": %" PRId64
+				", \"procs\": %d, \"kernel\": \"%s\", \"reduce\": \"%s\", \"min_s\": %.9e, \"median_s\": %.9e, "
+				"\"max_s\": %.9e, \"terms_per_s\": %.6e, \"pi\": %.17g, \"error\": %.3e}",
+				report->records ? "," : "", config->upper_limit, config->lower_limit, config->repeat, procs,
+				kernel, reduce, stats.min, stats.median, stats.max, rate, sum, error);
+	} else {
+		fprintf(report->out, "%12" PRId64 " %6" PRId64 " %5d %-14s %-9s %12.4e %12.4e %12.4e %20.17f %10.3e\n",
+				config->upper_limit, config->repeat, procs, kernel, reduce, stats.min, stats.median,
+				rate, sum, error);
+	}
+	report->records++;
+	fflush(report->out);
+}
+
+static inline void Sweep_end(struct bench_report* report) {
+	Bench_end(report);
+}
+
+#endif
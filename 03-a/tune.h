@@ -0,0 +1,189 @@
+/* File:     tune.h
+ *
+ * Purpose:  Per-host profiles of tuned settings.  A tuner (tune.c for the
+ *           equalizers, Sum_tune.c for the summations) runs short timed
+ *           trials of the settings that matter on this host and saves the
+ *           best ones as a profile of NAME=value lines.  The names are the
+ *           environment variables the programs already read (KERNEL_ISA,
+ *           HISTOGRAM_WAYS, SUM_THREADS, ...), so Tune_load, called first
+ *           thing in main, only has to put the profile in the environment.
+ *           A variable that is already set wins over the profile.
+ *
+ *           The profile of a program family is $TUNE_PROFILE, else
+ *              $HOME/.cache/par-tune/<family>-<host>-<cpu>.profile
+ *           where <cpu> is a hash of the cpu model and the number of
+ *           cpus: a profile only applies to the machine it was tuned on.
+ *           TUNE_PROFILE=none loads nothing.
+ *
+ * Note:     Lines starting with '#' are comments; the tuners write their
+ *           measurements there.  Under MPI every process loads the
+ *           profile of its own host.
+ *
+ * Example:
+ *    Tune_load("equalize");               // before MPI_Init and any getenv
+ *    . . .
+ *    Tune_report(stdout);                 // "profile: <path> (KERNEL_ISA=avx2 ...)"
+ *    Tune_expect(stdout, "SUM_RANKS", comm_sz, "processes");   // a note if they differ
+ *    . . .
+ *    struct tune_setting best[] = {{"KERNEL_ISA", "avx2"}, {"HISTOGRAM_WAYS", "8"}};
+ *    Tune_save("equalize", best, 2, "# histogram 2.1 GB/s\n");
+ */
+#ifndef _TUNE_H_
+#define _TUNE_H_
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TUNE_LINE 256
+
+struct tune_setting {
+	char name[32];
+	char value[32];
+};
+
+/* What Tune_load did, for Tune_report */
+static struct {
+	char path[512];
+	char applied[TUNE_LINE];
+} Tune_state;
+
+/* <host>-<hash of the cpu model and count> */
+static inline void Tune_host_key(char * key, size_t size) {
+	char host[64] = "localhost", line[TUNE_LINE];
+	unsigned hash = 2166136261u;	/* FNV-1a */
+	FILE * f = fopen("/proc/cpuinfo", "r");
+
+	if (f != NULL) {
+		while (fgets(line, sizeof(line), f) != NULL)
+			if (strncmp(line, "model name", 10) == 0) {
+				for (const char * c = line; *c != '\0'; c++)
+					hash = (hash ^ (unsigned char)*c) * 16777619u;
+				break;
+			}
+		fclose(f);
+	}
+	hash = (hash ^ (unsigned)sysconf(_SC_NPROCESSORS_ONLN)) * 16777619u;
+	gethostname(host, sizeof(host) - 1);
+	host[sizeof(host) - 1] = '\0';
+	snprintf(key, size, "%s-%08x", host, hash);
+}
+
+/* The profile of family on this host; -1 if profiles are off (TUNE_PROFILE=none) */
+static inline int Tune_profile_path(const char * family, char * path, size_t size) {
+	const char * forced = getenv("TUNE_PROFILE"), * home = getenv("HOME");
+	char key[128];
+
+	if (forced != NULL && *forced != '\0') {
+		if (strcmp(forced, "none") == 0)
+			return -1;
+		snprintf(path, size, "%s", forced);
+		return 0;
+	}
+	Tune_host_key(key, sizeof(key));
+	snprintf(path, size, "%s/.cache/par-tune/%s-%s.profile", home != NULL ? home : ".", family, key);
+	return 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Tune_load
+ * Purpose:		Put the settings of family's profile for this host in
+ * 				the environment, except those already set
+ * Return:		the number of settings applied (0 without a profile)
+ */
+static inline int Tune_load(const char * family) {
+	char line[TUNE_LINE];
+	int applied = 0;
+	FILE * f;
+
+	Tune_state.path[0] = Tune_state.applied[0] = '\0';
+	if (Tune_profile_path(family, Tune_state.path, sizeof(Tune_state.path)) != 0
+			|| (f = fopen(Tune_state.path, "r")) == NULL) {
+		Tune_state.path[0] = '\0';
+		return 0;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char * value = strchr(line, '='), item[80];
+
+		if (line[0] == '#' || value == NULL)
+			continue;
+		*value++ = '\0';
+		value[strcspn(value, "\r\n")] = '\0';
+		if (getenv(line) != NULL || setenv(line, value, 0) != 0)
+			continue;
+		snprintf(item, sizeof(item), "%s%.32s=%.32s", applied ? " " : "", line, value);
+		strncat(Tune_state.applied, item, sizeof(Tune_state.applied) - strlen(Tune_state.applied) - 1);
+		applied++;
+	}
+	fclose(f);
+	return applied;
+}
+
+/* One line on what the profile set, if one was loaded */
+static inline void Tune_report(FILE * out) {
+	if (Tune_state.path[0] != '\0')
+		fprintf(out, "profile: %s (%s)\n", Tune_state.path, Tune_state.applied[0] ? Tune_state.applied
+				: "nothing applied, all set in the environment");
+}
+
+/* A note if setting name (from the profile or the environment) asks for another value than this run's */
+static inline void Tune_expect(FILE * out, const char * name, long actual, const char * what) {
+	const char * wanted = getenv(name);
+
+	if (wanted != NULL && *wanted != '\0' && atol(wanted) != actual)
+		fprintf(out, "note: %s=%s was tuned for this host, this run has %ld %s\n", name, wanted, actual, what);
+}
+
+/* mkdir -p of the directory part of path */
+static inline int Tune_make_dirs(const char * path) {
+	char dir[512];
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	for (char * slash = strchr(dir + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+			return -1;
+		*slash = '/';
+	}
+	return 0;
+}
+
+/*------------------------------------------------------------------
+ * Function:	Tune_save
+ * Purpose:		Write family's profile for this host
+ * Input args:	settings:	the NAME=value lines
+ * 				notes:		comment lines ('#' first) to keep with them
+ * Return:		0, or -1 on an error
+ */
+static inline int Tune_save(const char * family, const struct tune_setting * settings, int nof_settings,
+		const char * notes) {
+	char path[512], key[128], date[32];
+	time_t now = time(NULL);
+	FILE * f;
+
+	if (Tune_profile_path(family, path, sizeof(path)) != 0) {
+		fprintf(stderr, "tune: TUNE_PROFILE=none, profile not saved\n");
+		return -1;
+	}
+	if (Tune_make_dirs(path) != 0 || (f = fopen(path, "w")) == NULL) {
+		perror(path);
+		return -1;
+	}
+	Tune_host_key(key, sizeof(key));
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime(&now));
+	fprintf(f, "# %s profile of %s, tuned %s\n%s", family, key, date, notes != NULL ? notes : "");
+	for (int s = 0; s < nof_settings; s++)
+		fprintf(f, "%s=%s\n", settings[s].name, settings[s].value);
+	if (fclose(f) != 0) {
+		perror(path);
+		return -1;
+	}
+	printf("profile saved to %s\n", path);
+	return 0;
+}
+
+#endif